@@ -1,15 +1,679 @@
+#include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <fstream>
+#include <sstream>
 
 #include "nbtpp/tag.hpp"
 #include "nbtpp/nbt.hpp"
+#include "nbtpp/archive.hpp"
+#include "nbtpp/backup.hpp"
+#include "nbtpp/region.hpp"
+#include "nbtpp/regionscan.hpp"
+#include "nbtpp/blockdata.hpp"
+#include "nbtpp/canonical.hpp"
+#include "nbtpp/chunkcache.hpp"
+#include "nbtpp/columnar.hpp"
+#include "nbtpp/compact.hpp"
 #include "nbtpp/nbtexception.hpp"
+#include "nbtpp/codec.hpp"
+#include "nbtpp/deflate.hpp"
+#include "nbtpp/json.hpp"
+#include "nbtpp/pushparser.hpp"
+#include "nbtpp/section.hpp"
+#include "nbtpp/snbt.hpp"
+#include "nbtpp/validate.hpp"
+#include "nbtpp/writer.hpp"
 #include "stde/streams/gzip.hpp"
 
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#endif
+
 using namespace nbtpp;
 using namespace stde;
 
+/**
+ * Moving a tag hands over its payload instead of copying it.
+ */
+static void test_move_tags() {
+    tags::tag_string s("s", std::string(1000, 'x'));
+    const char* chars = s.value().data();
+    tags::tag_string moved(std::move(s));
+    assert(moved.value().data() == chars && moved.value().size() == 1000 && s.value().empty());
+
+    tags::tag_longarray a("a", std::vector<int64_t>(1000, 7));
+    const int64_t* longs = a.value().data();
+    tags::tag_longarray assigned("b");
+    assigned = std::move(a);
+    assert(assigned.value().data() == longs && assigned.name() == "a" && a.value().empty());
+
+    tags::tag_compound c("c");
+    tags::tag_int* i = new tags::tag_int("i", 1);
+    c.insert(i);
+    assert(c.remove(i) && c.get("i") == nullptr && i->value() == 1);
+    c.insert(i);
+    assert(c.erase(i) && c.value().empty());
+}
+
+/**
+ * Documents fed a byte at a time parse like whole ones, and a header declaring a huge array allocates nothing.
+ */
+static void test_push_parser() {
+    const uint8_t document[] = { 10, 0, 0, 12, 0, 1, 'l', 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0 };
+    push_parser p;
+    for (size_t i = 0; i < sizeof(document) - 1; i++)
+        assert(p.feed(document + i, 1) == push_parser::need_more);
+    assert(p.feed(document + sizeof(document) - 1, 1) == push_parser::complete);
+    std::unique_ptr<tag> root(p.take());
+    const tags::tag_longarray* l = static_cast<tags::tag_compound*>(root.get())->get<tags::tag_longarray>("l");
+    assert(l != nullptr && l->value().size() == 2 && l->value()[0] == 1 && l->value()[1] == 256);
+
+    const uint8_t hostile[] = { 12, 0, 0, 0x7f, 0xff, 0xff, 0xff, 1, 2, 3 };
+    assert(p.feed(hostile, sizeof(hostile)) == push_parser::need_more && p.position() == sizeof(hostile));
+    p.reset();
+}
+
+/**
+ * Volumes survive both block formats, and sizes or palette indices that don't match the data are rejected before
+ * allocating anything.
+ */
+static void test_block_volumes() {
+    blockdata::block_volume v;
+    v.width = 3;
+    v.height = 2;
+    v.length = 4;
+    v.palette = { "minecraft:air", "minecraft:oak_stairs[facing=north,half=bottom]" };
+    for (size_t i = 0; i < v.volume(); i++)
+        v.blocks.push_back(i % 3 == 0);
+
+    tags::tag_compound schematic("");
+    blockdata::encode_schematic(v, &schematic);
+    blockdata::block_volume s;
+    blockdata::decode_schematic(&schematic, s);
+    assert(s.palette == v.palette && s.blocks == v.blocks);
+
+    tags::tag_compound structure("");
+    blockdata::encode_structure(v, &structure, 0);
+    blockdata::block_volume t;
+    blockdata::decode_structure(&structure, t, 0);
+    assert(t.palette == v.palette && t.blocks == v.blocks && t.width == 3 && t.length == 4);
+
+    tags::tag_compound* palette = schematic.get<tags::tag_compound>("Palette");
+    tags::tag_int* stone = new tags::tag_int("minecraft:stone", 0x7fffffff);
+    palette->insert(stone);
+    try {
+        blockdata::decode_schematic(&schematic, s);
+        assert(false);
+    } catch (nbt_exception& e) {
+    }
+    palette->erase(stone);
+    schematic.insert(new tags::tag_short("Width", 0x7fff));
+    try {
+        blockdata::decode_schematic(&schematic, s);
+        assert(false);
+    } catch (nbt_exception& e) {
+    }
+
+    tags::tag_list* size = new tags::tag_list("size", tag_type::TAG_Int);
+    for (int i = 0; i < 3; i++)
+        size->append(new tags::tag_int("", 0x7fffffff));
+    structure.insert(size);
+    try {
+        blockdata::decode_structure(&structure, t);
+        assert(false);
+    } catch (nbt_exception& e) {
+    }
+}
+
+/**
+ * JSON holds standard UTF-8 whichever path writes it, NBT strings being in Java's modified UTF-8.
+ */
+static void test_json_strings() {
+    // NUL, U+1F600 as a surrogate pair, then a lone high surrogate.
+    std::string modified("a\xc0\x80" "b\xed\xa0\xbd\xed\xb8\x80" "c\xed\xa0\xbd");
+    tags::tag_string s("", modified);
+    std::string tree;
+    json::write(&s, tree);
+    assert(tree == "\"a\\u0000b\xf0\x9f\x98\x80" "c\\ud83d\"");
+
+    std::string encoded("\x08\x00\x00\x00", 4);
+    encoded += (char) modified.size();
+    encoded += modified;
+    std::string streamed;
+    json::write_encoded(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), streamed);
+    assert(streamed == tree);
+}
+
+/**
+ * Streams compressed on several threads inflate to their input with a valid checksum, and streams abandoned on an
+ * exception or by abort() don't inflate at all.
+ */
+static void test_parallel_deflate() {
+    std::string data(1 << 20, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = "nbtpp"[(i * 7 + i / 1000) % 5];
+
+    for (nbt::compression c : { nbt::gzip, nbt::zlib }) {
+        std::ostringstream o;
+        {
+            parallel_deflate_ostream p(o, c, 4, 64 << 10);
+            p.write(data.data(), data.size());
+            p.finish();
+        }
+        std::string z = o.str();
+        std::vector<uint8_t> out;
+        decompress(reinterpret_cast<const uint8_t*>(z.data()), z.size(), c, out);
+        assert(out.size() == data.size() && std::equal(out.begin(), out.end(), data.begin()));
+
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(z.data() + z.size());
+        if (c == nbt::gzip) {
+            uLong crc = crc32(0, reinterpret_cast<const Bytef*>(data.data()), data.size());
+            assert((end[-8] | end[-7] << 8 | end[-6] << 16 | (uLong) end[-5] << 24) == crc);
+        } else {
+            uLong adler = adler32(1, reinterpret_cast<const Bytef*>(data.data()), data.size());
+            assert(codec::load_be<uint32_t>(end - 4) == adler);
+        }
+    }
+
+    std::ostringstream unwound;
+    try {
+        parallel_deflate_ostream p(unwound, nbt::gzip, 4, 64 << 10);
+        p.write(data.data(), data.size() / 2);
+        throw nbt_exception("failed while writing");
+    } catch (nbt_exception& e) {
+    }
+    std::string z = unwound.str();
+    std::vector<uint8_t> out;
+    try {
+        decompress(reinterpret_cast<const uint8_t*>(z.data()), z.size(), nbt::gzip, out);
+        assert(false);
+    } catch (nbt_exception& e) {
+    }
+
+    std::ostringstream aborted;
+    parallel_deflate_ostream p(aborted, nbt::zlib, 2);
+    p.write(data.data(), 100);
+    p.abort();
+    p.finish();
+    assert(aborted.str().size() == 2);
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+/**
+ * A base snapshot and a delta restore the world as it was at the delta: changed and removed chunks, removed regions
+ * and chunks stored outside their region in .mcc files.
+ */
+static void test_backup() {
+    const std::string root = "backup_test";
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/world").c_str(), 0755);
+    mkdir((root + "/restored").c_str(), 0755);
+    const std::string world = root + "/world/";
+
+    region_file::create(world + "r.0.0.mca");
+    {
+        region_file r(world + "r.0.0.mca");
+        for (int i = 0; i < 10; i++)
+            r.store(i, 0, nbt(snbt::parse("{x:" + std::to_string(i) + "}")));
+        r.save();
+    }
+    region_file::create(world + "r.1.0.mca");
+    {
+        region_file r(world + "r.1.0.mca");
+        r.store(0, 0, nbt(snbt::parse("{gone:1b}")));
+        r.save();
+    }
+    // Chunk 1,1 of region 2,0 is too large for its region and lives in c.65.1.mcc.
+    {
+        std::string region(3 * region_file::sector_size, 0);
+        uint8_t* b = reinterpret_cast<uint8_t*>(&region[0]);
+        codec::store_be<uint32_t>(b + 33 * 4, (2u << 8) | 1);
+        codec::store_be<uint32_t>(b + region_file::sector_size + 33 * 4, 1234);
+        codec::store_be<uint32_t>(b + 2 * region_file::sector_size, 1);
+        b[2 * region_file::sector_size + 4] = region_file::external_flag | nbt::zlib;
+        std::ofstream(world + "r.2.0.mca", std::ios::binary) << region;
+        std::ofstream(world + "c.65.1.mcc", std::ios::binary) << "external chunk";
+    }
+
+    backup::manifest empty, base, later;
+    {
+        std::ofstream delta(root + "/base.delta", std::ios::binary);
+        backup::snapshot_stats s = backup::snapshot(root + "/world", empty, delta, base);
+        assert(s.regions == 3 && s.chunks == 12 && s.copied == 12);
+    }
+
+    {
+        region_file r(world + "r.0.0.mca");
+        r.store(3, 0, nbt(snbt::parse("{x:\"changed\"}")));
+        r.save();
+        std::fstream f(world + "r.0.0.mca", std::ios::binary | std::ios::in | std::ios::out);
+        for (size_t at : { (size_t) 5 * 4, region_file::sector_size + 5 * 4 }) {
+            f.seekp(at);
+            f.write("\0\0\0\0", 4);
+        }
+    }
+    std::remove((world + "r.1.0.mca").c_str());
+    {
+        std::ofstream delta(root + "/later.delta", std::ios::binary);
+        backup::snapshot_stats s = backup::snapshot(root + "/world", base, delta, later);
+        assert(s.regions == 2 && s.chunks == 10 && s.removed == 2);
+    }
+
+    assert(backup::restore({ root + "/base.delta", root + "/later.delta" }, root + "/restored") == 2);
+    for (const char* name : { "r.0.0.mca", "r.2.0.mca" }) {
+        region_file a(world + name), b(root + "/restored/" + name);
+        for (int i = 0; i < 1024; i++) {
+            std::vector<uint8_t> x, y;
+            assert(a.read_record(i % 32, i / 32, x) == b.read_record(i % 32, i / 32, y) && x == y);
+            assert(a.timestamp(i % 32, i / 32) == b.timestamp(i % 32, i / 32));
+        }
+    }
+    std::ifstream removed(root + "/restored/r.1.0.mca");
+    assert(!removed);
+    assert(read_file(root + "/restored/c.65.1.mcc") == "external chunk");
+}
+
+/**
+ * Documents put, replaced and erased read back the same from the index and from the records after it, with documents
+ * on their own or in blocks, and an index left by another archive at the same path is ignored.
+ */
+static void test_archive() {
+    const std::string path = "archive_test.nbta";
+    std::remove(path.c_str());
+    std::remove((path + ".idx").c_str());
+    auto document = [](int i) {
+        return nbt(snbt::parse("{id:" + std::to_string(i) + ",name:\"player " + std::to_string(i) + "\"}"));
+    };
+    auto check = [&document](const archive& a, int i) {
+        nbt d;
+        assert(a.load("k" + std::to_string(i), d) && *d.content() == *document(i).content());
+    };
+
+    {
+        archive_writer w(path, nbt::zlib);
+        for (int i = 0; i < 100; i++) {
+            nbt d = document(i);
+            w.put("k" + std::to_string(i), d);
+        }
+        w.close();
+    }
+    assert(archive::build_index(path) == 100);
+    {
+        archive_writer w(path, nbt::gzip, 1024);
+        for (int i = 100; i < 200; i++) {
+            nbt d = document(i);
+            w.put("k" + std::to_string(i), d);
+        }
+        nbt replaced = document(-1);
+        w.put("k5", replaced);
+        w.erase("k7");
+        w.erase("k150");
+        w.close();
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        archive a(path);
+        assert(pass == 0 ? a.indexed() == 100 && a.unindexed() == 102 : a.indexed() == 198 && a.unindexed() == 0);
+        for (int i = 0; i < 200; i++) {
+            if (i == 7 || i == 150) {
+                nbt d;
+                assert(!a.load("k" + std::to_string(i), d));
+            } else if (i != 5) {
+                check(a, i);
+            }
+        }
+        nbt d;
+        assert(a.load("k5", d) && *d.content() == *document(-1).content());
+        size_t visited = 0;
+        a.for_each([&visited](const std::string&, const archive::span&) {
+            visited++;
+        });
+        assert(visited == 198);
+        if (pass == 0)
+            assert(archive::build_index(path) == 198);
+    }
+
+    // A new archive at the same path, longer than the data the old index covers.
+    std::remove(path.c_str());
+    {
+        archive_writer w(path, nbt::uncompressed);
+        for (int i = 1000; i < 1400; i++) {
+            nbt d = document(i);
+            w.put("k" + std::to_string(i), d);
+        }
+    }
+    archive a(path);
+    nbt d;
+    assert(a.indexed() == 0 && a.unindexed() == 400 && !a.load("k1", d));
+    check(a, 1300);
+}
+
+/**
+ * A truncated stream declaring a huge array must fail at its end rather than allocating the declared length.
+ */
+static void test_truncated_array() {
+    const char data[] = { 10, 0, 0, 12, 0, 1, 'a', 0x7f, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 1 };
+    std::istringstream in(std::string(data, sizeof(data)));
+    nbtpp::nbt n;
+    try {
+        n.load(in);
+        assert(false);
+    } catch (nbt_exception& e) {
+    }
+}
+
+/**
+ * Sections below and above the world in 1.13-1.17 chunks only hold light, without a palette.
+ */
+static void test_section_without_palette() {
+    std::string light = "[B;";
+    for (int i = 0; i < 2048; i++)
+        light += i == 0 ? "-1b" : ",-1b";
+    nbtpp::nbt section(snbt::parse("{Y:-1b,SkyLight:" + light + "]}"));
+    palette_registry states;
+    section_view v(static_cast<const tags::tag_compound*>(section.content()), states);
+    assert(!v.has_blocks());
+    assert(v.block(1, 2, 3) == palette_registry::npos);
+    assert(v.count(0) == 0);
+    assert(v.has_sky_light() && v.sky_light(1, 2, 3) == 15);
+}
+
+/**
+ * Scans read external chunks from their .mcc file and report corrupt chunks without stopping.
+ */
+static void test_region_scan() {
+    const std::string root = "scan_test";
+    mkdir(root.c_str(), 0755);
+    const std::string path = root + "/r.1.0.mca";
+
+    // Chunk 0,0 is stored uncompressed, 1,0 in c.33.0.mcc and 2,0 is not zlib at all.
+    std::vector<uint8_t> raw, external;
+    nbt(snbt::parse("{x:0}")).save(raw);
+    {
+        std::vector<uint8_t> chunk;
+        nbt(snbt::parse("{x:1}")).save(chunk);
+        compress(chunk.data(), chunk.size(), nbt::zlib, external);
+    }
+    std::string region(5 * region_file::sector_size, 0);
+    uint8_t* b = reinterpret_cast<uint8_t*>(&region[0]);
+    for (uint32_t i = 0; i < 3; i++)
+        codec::store_be<uint32_t>(b + i * 4, ((2 + i) << 8) | 1);
+    uint8_t* c = b + 2 * region_file::sector_size;
+    codec::store_be<uint32_t>(c, (uint32_t) raw.size() + 1);
+    c[4] = nbt::uncompressed;
+    std::copy(raw.begin(), raw.end(), c + 5);
+    c += region_file::sector_size;
+    codec::store_be<uint32_t>(c, 1);
+    c[4] = region_file::external_flag | nbt::zlib;
+    c += region_file::sector_size;
+    codec::store_be<uint32_t>(c, 5);
+    c[4] = nbt::zlib;
+    std::copy_n("junk", 4, c + 5);
+    std::ofstream(path, std::ios::binary) << region;
+    std::ofstream(root + "/c.33.0.mcc", std::ios::binary).write(reinterpret_cast<const char*>(external.data()),
+        external.size());
+
+    for (region_scanner::backend use : { region_scanner::backend::automatic, region_scanner::backend::thread_pool }) {
+        region_scanner scanner(4, 2, use);
+        std::mutex lock;
+        int32_t seen = 0, failed = -1;
+        scanner.scan({ path, root + "/missing.mca" }, [&](const std::string&, int32_t x, int32_t, nbt& chunk) {
+            std::lock_guard<std::mutex> hold(lock);
+            assert(chunk.content<tags::tag_compound>()->get<tags::tag_int>("x")->value() == x);
+            seen |= 1 << x;
+        }, nullptr, [&](const std::string& p, int32_t x, int32_t, const nbt_exception&) {
+            std::lock_guard<std::mutex> hold(lock);
+            if (p == path)
+                failed = x;
+        });
+        assert(seen == 3 && failed == 2 && scanner.chunks() == 2 && scanner.errors() == 2);
+
+        bool thrown = false;
+        try {
+            scanner.scan({ path }, [](const std::string&, int32_t, int32_t, nbt&) {});
+        } catch (nbt_exception&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+/**
+ * Region validation checks external chunks in their .mcc file instead of rejecting their compression.
+ */
+static void test_validate_external() {
+    const std::string root = "validate_test";
+    mkdir(root.c_str(), 0755);
+    const std::string path = root + "/r.0.0.mca";
+
+    // Chunks 0,0 and 1,0 are both external.
+    std::string region(4 * region_file::sector_size, 0);
+    uint8_t* b = reinterpret_cast<uint8_t*>(&region[0]);
+    for (uint32_t i = 0; i < 2; i++) {
+        codec::store_be<uint32_t>(b + i * 4, ((2 + i) << 8) | 1);
+        uint8_t* c = b + (2 + i) * region_file::sector_size;
+        codec::store_be<uint32_t>(c, 1);
+        c[4] = region_file::external_flag | nbt::zlib;
+    }
+    std::ofstream(path, std::ios::binary) << region;
+    std::vector<uint8_t> raw, chunk;
+    nbt(snbt::parse("{x:0}")).save(raw);
+    compress(raw.data(), raw.size(), nbt::zlib, chunk);
+    std::ofstream(root + "/c.0.0.mcc", std::ios::binary).write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    std::remove((root + "/c.1.0.mcc").c_str());
+
+    region_validation v = validate_region(path);
+    assert(v.chunks == 2 && v.problems.size() == 1 && v.problems[0].x == 1);
+    assert(v.problems[0].error.offset == 3 * region_file::sector_size + 4);
+
+    std::ofstream(root + "/c.1.0.mcc", std::ios::binary) << "not zlib";
+    v = validate_region(path);
+    assert(v.problems.size() == 1 && v.problems[0].x == 1);
+
+    std::ofstream(root + "/c.1.0.mcc", std::ios::binary).write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    assert(validate_region(path).valid());
+}
+
+/**
+ * The chunk cache reads external chunks, and reopens region files rewritten since they were opened.
+ */
+static void test_chunk_cache() {
+    const std::string root = "cache_test";
+    mkdir(root.c_str(), 0755);
+    const std::string path = root + "/r.0.0.mca";
+
+    // Chunk 0,0 lives in c.0.0.mcc.
+    std::string region(3 * region_file::sector_size, 0);
+    uint8_t* b = reinterpret_cast<uint8_t*>(&region[0]);
+    codec::store_be<uint32_t>(b, (2u << 8) | 1);
+    codec::store_be<uint32_t>(b + 2 * region_file::sector_size, 1);
+    b[2 * region_file::sector_size + 4] = region_file::external_flag | nbt::zlib;
+    std::ofstream(path, std::ios::binary) << region;
+    std::vector<uint8_t> raw, external;
+    nbt(snbt::parse("{x:0}")).save(raw);
+    compress(raw.data(), raw.size(), nbt::zlib, external);
+    std::ofstream(root + "/c.0.0.mcc", std::ios::binary).write(reinterpret_cast<const char*>(external.data()),
+        external.size());
+    {
+        region_file r(path);
+        r.store(1, 0, nbt(snbt::parse("{x:1}")));
+        r.save();
+    }
+
+    chunk_cache cache(64 << 20);
+    auto x = [&cache, &path](int32_t cx) {
+        chunk_cache::handle h = cache.get(path, cx, 0);
+        return h->content<tags::tag_compound>()->get<tags::tag_int>("x")->value();
+    };
+    assert(x(0) == 0 && x(1) == 1 && cache.get(path, 2, 0) == nullptr);
+    assert(cache.get(root + "/r.5.5.mca", 0, 0) == nullptr);
+
+    {
+        region_file r(path);
+        r.store(1, 0, nbt(snbt::parse("{x:2}")));
+        r.save();
+    }
+    cache.invalidate(path, 1, 0);
+    assert(x(1) == 2 && x(0) == 0);
+}
+
+/**
+ * Columnar tables give null string rows as empty strings, and reject files declaring more data than they hold.
+ */
+static void test_columnar() {
+    std::vector<columnar::field> fields(3);
+    fields[0].name = fields[0].path = "id";
+    fields[0].type = columnar::column_type::string;
+    fields[1].name = "x";
+    fields[1].path = "Pos[0]";
+    fields[1].type = columnar::column_type::real;
+    fields[2].name = "b";
+    fields[2].path = "b[1]";
+    fields[2].type = columnar::column_type::int64;
+    fields[2].method = columnar::compression::none;
+    columnar::extractor e("Entities", fields);
+    std::unique_ptr<tag> first(snbt::parse("{Entities:[{Pos:[1.5d],b:[I;1,2]}]}"));
+    std::unique_ptr<tag> second(snbt::parse("{Entities:[{id:\"a\",Pos:[2.5d]},{b:[L;3L,4L]}]}"));
+    columnar::table t = e.make_table();
+    // The first row is null with nothing in the dictionary yet.
+    e.extract(first.get(), t);
+    const columnar::column& id = t.columns[0];
+    assert(id.null(0) && id.string(0).empty());
+    e.extract(second.get(), t);
+    assert(t.rows() == 3 && id.string(1) == "a" && id.string(2).empty());
+    assert(t.columns[1].reals()[1] == 2.5 && t.columns[1].null(2));
+    assert(t.columns[2].ints()[0] == 2 && t.columns[2].null(1) && t.columns[2].ints()[2] == 4);
+
+    std::ostringstream out;
+    columnar::write_table(out, t);
+    std::string file = out.str();
+    {
+        std::istringstream in(file);
+        columnar::table back;
+        columnar::read_table(in, back);
+        assert(back.rows() == 3 && back.columns.size() == 3);
+        for (size_t i = 0; i < 3; i++)
+            assert(back.columns[0].string(i) == id.string(i) && back.columns[0].null(i) == id.null(i));
+        assert(back.columns[1].reals() == t.columns[1].reals() && back.columns[2].ints() == t.columns[2].ints());
+    }
+
+    // A row count, then the size and stored size of column b, far beyond the file.
+    size_t b = file.find(std::string("\0\1b\1\0", 5)) + 5;
+    for (int i = 0; i < 2; i++) {
+        std::string bad = file;
+        for (size_t at : i == 0 ? std::vector<size_t> { 5 } : std::vector<size_t> { b, b + 8 })
+            codec::store_be<uint64_t>(reinterpret_cast<uint8_t*>(&bad[at]), (uint64_t) 1 << 60);
+        std::istringstream in(bad);
+        columnar::table back;
+        bool thrown = false;
+        try {
+            columnar::read_table(in, back);
+        } catch (nbt_exception&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+/**
+ * A chunk-shaped tree takes several times less memory as a compact_tree than as tags, and converts back unchanged.
+ */
+static void test_compact_memory() {
+    std::string sections, entities;
+    for (int y = 0; y < 16; y++) {
+        std::string palette, states;
+        for (int i = 0; i < 8; i++)
+            palette += std::string(i ? "," : "") + "{Name:\"minecraft:block_" + std::to_string(i) +
+                "\",Properties:{facing:\"north\",half:\"top\",waterlogged:\"false\"}}";
+        for (int i = 0; i < 256; i++)
+            states += std::string(i ? "," : "") + std::to_string(i * 7919 + y) + "L";
+        sections += std::string(y ? "," : "") + "{Y:" + std::to_string(y) + "b,Palette:[" + palette +
+            "],BlockStates:[L;" + states + "],BlockLight:[B;1b,2b,3b],SkyLight:[B;4b,5b,6b]}";
+    }
+    for (int i = 0; i < 100; i++)
+        entities += std::string(i ? "," : "") + "{id:\"minecraft:zombie\",Pos:[" + std::to_string(i) +
+            "d,64d,0d],Motion:[0d,0d,0d],Rotation:[0f,0f],Health:20f,Air:300s,OnGround:1b,Fire:-1s,UUID:[I;1,2,3," +
+            std::to_string(i) + "]}";
+    std::unique_ptr<tag> chunk(snbt::parse("{DataVersion:2586,Level:{xPos:1,zPos:2,Status:\"full\",Sections:[" +
+        sections + "],Entities:[" + entities + "]}}"));
+
+    compact_tree compact(chunk.get());
+    size_t tags_size = chunk->memory_usage();
+    size_t compact_size = compact.memory_usage();
+    // The block states are as large either way, everything else shrinks.
+    assert(compact_size >= 16 * 256 * sizeof(int64_t) && compact_size * 2 < tags_size);
+
+    std::unique_ptr<tag> back(compact.to_tag());
+    assert(*back == *chunk);
+}
+
+/**
+ * The streaming writer produces the same bytes as saving the tree, and rejects an end() with nothing open.
+ */
+static void test_writer() {
+    std::vector<uint8_t> written;
+    nbt_buffer_writer w(written);
+    w.begin_compound("root");
+    w.write_int("i", 7);
+    w.write_string("s", "text");
+    w.begin_list("l", tag_type::TAG_Compound, 2);
+    for (int i = 0; i < 2; i++) {
+        w.begin_compound();
+        w.write_short("n", (int16_t) i);
+        w.end();
+    }
+    w.end();
+    const int64_t longs[] = { 1, -1 };
+    w.write_long_array("a", longs, 2);
+    w.end();
+    assert(w.complete());
+
+    bool thrown = false;
+    try {
+        w.end();
+    } catch (nbt_exception&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    std::unique_ptr<tag> expected(snbt::parse("{i:7,s:\"text\",l:[{n:0s},{n:1s}],a:[L;1L,-1L]}"));
+    expected->name("root");
+    std::vector<uint8_t> saved;
+    nbt(expected.release()).save(saved);
+    assert(written == saved);
+}
+
 int main(int argc, char** argv) {
+    test_move_tags();
+    test_push_parser();
+    test_block_volumes();
+    test_json_strings();
+    test_parallel_deflate();
+    test_backup();
+    test_archive();
+    test_region_scan();
+    test_validate_external();
+    test_chunk_cache();
+    test_columnar();
+    test_compact_memory();
+    test_writer();
+    test_truncated_array();
+    test_section_without_palette();
+
     // std::ifstream f("tests/hell.mcr");
     // f.seekg(0x2005);
 
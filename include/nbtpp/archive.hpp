@@ -0,0 +1,267 @@
+#ifndef NBTPP_ARCHIVE_HPP_
+#define NBTPP_ARCHIVE_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "nbt.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Many small documents in one file, looked up by key.
+     *
+     * The data file is append-only: documents are added, replaced and erased by appending records, each document
+     * compressed on its own or gathered with the next ones into blocks compressed together, which compresses small
+     * similar documents far better. Keys of a block are stored uncompressed before it, so no block is inflated to index
+     * the file.
+     *
+     * The index, path + ".idx", holds the keys sorted with the place of their latest document, and is used straight
+     * from a memory mapping: opening an archive of millions of documents maps two files and only reads the last 64 KB
+     * the index covers, whose checksum tells an index left behind by another archive written at the same path. Records
+     * appended after the index was written are read when opening, so the index only needs to be rebuilt from time to
+     * time with build_index(), e.g. after each batch of writes.
+     *
+     *     archive_writer w("players.nbta", nbt::zlib, 64 << 10);
+     *     w.put(uuid, player);
+     *     w.close();
+     *     archive::build_index("players.nbta");
+     *
+     *     archive a("players.nbta");
+     *     std::vector<uint8_t> buffer;
+     *     archive::span s;
+     *     if (a.find(uuid, s, buffer))
+     *         player.load(s.data, s.size);
+     */
+    class archive {
+    public:
+        /**
+         * Uncompressed bytes of a document.
+         */
+        struct span {
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+        };
+
+        /**
+         * Where the latest document of a key is stored.
+         */
+        struct location {
+            /**
+             * Offset in the data file of the stored document, or of the block holding it
+             */
+            uint64_t offset = 0;
+
+            /**
+             * Stored size of the document or block
+             */
+            uint32_t stored = 0;
+
+            /**
+             * Offset of the document in the uncompressed block, 0 for documents stored on their own
+             */
+            uint32_t position = 0;
+
+            /**
+             * Uncompressed size of the document
+             */
+            uint32_t size = 0;
+
+            nbt::compression compression = nbt::uncompressed;
+
+            /**
+             * Whether the document is part of a block
+             */
+            bool block = false;
+
+            /**
+             * Whether the key was erased
+             */
+            bool erased = false;
+        };
+
+        /**
+         * Called for each document in file order, with a span only valid during the call.
+         */
+        typedef std::function<void(const std::string& key, const span& document)> visitor;
+
+        /**
+         * Map an archive and its index, and read the records appended after the index. Records appended later are not
+         * seen until the archive is opened again.
+         *
+         * @throws nbt_exception if the file can't be opened or is not an archive
+         */
+        explicit archive(const std::string& path);
+
+        archive(const archive&) = delete;
+        archive& operator=(const archive&) = delete;
+
+        ~archive();
+
+        /**
+         * Write the index of an archive, through a temporary file renamed over the previous one.
+         *
+         * @return  Number of keys indexed
+         */
+        static size_t build_index(const std::string& path);
+
+        /**
+         * Find the latest document of a key.
+         *
+         * Documents stored uncompressed are not copied, out then points into the mapped file. Others are decompressed
+         * into buffer, a whole block for documents of a block.
+         *
+         * @param key       Key of the document
+         * @param out       Set to the document
+         * @param buffer    Room for decompressing
+         * @return          false if there is no such key
+         * @throws nbt_exception if the document is damaged
+         */
+        bool find(const std::string& key, span& out, std::vector<uint8_t>& buffer) const;
+
+        /**
+         * Load the latest document of a key.
+         *
+         * @return  false, leaving out unchanged, if there is no such key
+         */
+        bool load(const std::string& key, nbt& out) const;
+
+        /**
+         * Place of the latest document of a key, without reading it.
+         */
+        bool locate(const std::string& key, location& out) const;
+
+        /**
+         * Visit the latest document of every key, reading the data file once from start to end and inflating each
+         * block once.
+         */
+        void for_each(const visitor& visit) const;
+
+        /**
+         * Number of keys in the index, before the records appended after it.
+         */
+        size_t indexed() const;
+
+        /**
+         * Number of keys added, replaced or erased by records appended after the index.
+         */
+        inline size_t unindexed() const {
+            return m_tail.size();
+        }
+
+        inline const std::string& path() const {
+            return m_path;
+        }
+    private:
+        friend class archive_writer;
+
+        struct mapping {
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+        };
+
+        static mapping map(const std::string& path, bool sequential);
+        static void unmap(mapping& m);
+
+        /**
+         * Read the records from offset to the end of the data.
+         *
+         * @param each  Called with the key and location of each document or erasure of a record, in order
+         * @return      Offset of the end of the last whole record
+         */
+        static uint64_t replay(const uint8_t* data, uint64_t size, uint64_t offset,
+            const std::function<void(const std::string& key, const location& l)>& each);
+
+        bool find_indexed(const std::string& key, location& out) const;
+
+        /**
+         * @param cached    Offset of the block held by buffer, 0 if none, updated when another block is inflated
+         */
+        void read(const location& l, span& out, std::vector<uint8_t>& buffer, uint64_t& cached) const;
+
+        std::string m_path;
+        mapping m_data;
+        mapping m_index;
+        size_t m_index_count;
+        const uint8_t* m_index_entries;
+        const uint8_t* m_index_keys;
+        size_t m_index_keys_size;
+
+        /**
+         * End of the last whole record of the data
+         */
+        uint64_t m_end;
+
+        /**
+         * Keys of the records appended after the index
+         */
+        std::map<std::string, location> m_tail;
+    };
+
+    /**
+     * Appends documents to an archive, creating it if needed.
+     *
+     * With a block size, documents are gathered until their uncompressed size reaches it and written as one compressed
+     * block, else each is compressed on its own. Writes are buffered, call close() to write the last block and detect
+     * errors. The destructor closes too but ignores errors.
+     */
+    class archive_writer {
+    public:
+        /**
+         * @param path          Path of the data file
+         * @param compression   Compression of the documents or blocks
+         * @param block_size    Uncompressed size of the blocks, 0 to compress each document on its own
+         * @throws nbt_exception if the file can't be opened or is not an archive
+         */
+        explicit archive_writer(const std::string& path, nbt::compression compression = nbt::zlib, size_t block_size = 0);
+
+        archive_writer(const archive_writer&) = delete;
+        archive_writer& operator=(const archive_writer&) = delete;
+
+        ~archive_writer();
+
+        /**
+         * Add a document, or replace the document of the key.
+         *
+         * @param data  Uncompressed NBT
+         */
+        void put(const std::string& key, const uint8_t* data, size_t size);
+
+        void put(const std::string& key, nbt& document);
+
+        /**
+         * Erase the document of a key.
+         */
+        void erase(const std::string& key);
+
+        /**
+         * Write the pending block and push the writes to the file.
+         */
+        void flush();
+
+        void close();
+    private:
+        void write_block();
+
+        std::string m_path;
+        std::ofstream m_out;
+        nbt::compression m_compression;
+        size_t m_block_size;
+
+        /**
+         * Keys, positions and sizes of the documents of the pending block
+         */
+        std::vector<uint8_t> m_block_keys;
+        std::vector<uint8_t> m_block;
+        uint32_t m_block_count;
+
+        std::vector<uint8_t> m_buffer;
+        std::vector<uint8_t> m_scratch;
+    };
+}
+
+#endif
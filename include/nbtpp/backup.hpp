@@ -0,0 +1,131 @@
+#ifndef NBTPP_BACKUP_HPP_
+#define NBTPP_BACKUP_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace nbtpp {
+
+    /**
+     * Incremental backups of the region files of a world directory.
+     *
+     * A snapshot compares the header of every region file, the location and timestamp of each chunk, with the
+     * manifest of the previous snapshot, and writes the chunks that changed to a delta file exactly as they are stored,
+     * still compressed, with the .mcc file of chunks stored outside their region. The first snapshot, taken against an empty manifest, holds every chunk. Restoring replays a
+     * base and its later deltas in order:
+     *
+     *     backup::manifest previous, current;
+     *     std::ifstream m("world.manifest");
+     *     if (m)
+     *         previous.load(m);
+     *     std::ofstream delta("world-2024-05-01.delta", std::ios::binary);
+     *     backup::snapshot("world/region", previous, delta, current);
+     *     std::ofstream out("world.manifest", std::ios::binary);
+     *     current.save(out);
+     *
+     *     backup::restore({ "world-base.delta", "world-2024-05-01.delta" }, "restored/region");
+     *
+     * A chunk counts as changed when its location or timestamp differs, which is the case whenever the game or
+     * region_file::save() writes it. Timestamps are in seconds, so chunks stamped in the second of the previous snapshot
+     * or later are copied anyway, as they may have been written again after it read their header.
+     */
+    namespace backup {
+
+        /**
+         * Header of a region file at the time of a snapshot.
+         */
+        struct region_state {
+            /**
+             * File name within the directory, e.g. "r.0.-1.mca"
+             */
+            std::string name;
+
+            uint32_t locations[1024];
+            uint32_t timestamps[1024];
+        };
+
+        class manifest {
+        public:
+            /**
+             * Regions sorted by name.
+             */
+            std::vector<region_state> regions;
+
+            /**
+             * Time the snapshot started, in seconds since the epoch
+             */
+            uint32_t time = 0;
+
+            /**
+             * Region called name, or nullptr.
+             */
+            const region_state* find(const std::string& name) const;
+
+            void save(std::ostream& out) const;
+
+            /**
+             * Replace the regions with a manifest written by save().
+             *
+             * @throws nbt_exception if the data is not a manifest
+             */
+            void load(std::istream& in);
+        };
+
+        struct snapshot_stats {
+            size_t regions = 0;
+
+            /**
+             * Number of chunks in the regions
+             */
+            size_t chunks = 0;
+
+            /**
+             * Number of chunks copied to the delta
+             */
+            size_t copied = 0;
+
+            /**
+             * Number of chunks gone since the previous snapshot
+             */
+            size_t removed = 0;
+
+            /**
+             * Bytes of chunk data copied
+             */
+            uint64_t bytes = 0;
+        };
+
+        /**
+         * Write the changes of the region files of a directory since a previous snapshot.
+         *
+         * @param directory Directory holding the .mca files
+         * @param previous  Manifest of the previous snapshot, empty for a full one
+         * @param delta     Stream to write the delta to
+         * @param current   Set to the manifest of this snapshot
+         * @throws nbt_exception if a region file can't be read or the delta can't be written
+         */
+        snapshot_stats snapshot(const std::string& directory, const manifest& previous, std::ostream& delta, manifest& current);
+
+        /**
+         * Rebuild one region file from a full snapshot and the deltas taken after it.
+         *
+         * @param deltas    Paths of the delta files, oldest first
+         * @param name      File name of the region, e.g. "r.0.-1.mca"
+         * @param path      Path of the region file to write, .mcc files of external chunks are written next to it
+         * @return          false, writing nothing, if the region has no chunk in the last snapshot
+         * @throws nbt_exception if a delta can't be read, or a chunk is unchanged in a delta but absent before it
+         */
+        bool restore_region(const std::vector<std::string>& deltas, const std::string& name, const std::string& path);
+
+        /**
+         * Rebuild every region of a full snapshot and the deltas taken after it into a directory.
+         *
+         * @return  Number of region files written
+         */
+        size_t restore(const std::vector<std::string>& deltas, const std::string& directory);
+    }
+}
+
+#endif
@@ -0,0 +1,476 @@
+#ifndef NBTPP_BINDING_HPP_
+#define NBTPP_BINDING_HPP_
+
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "nbt.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+namespace nbtpp {
+
+    /**
+     * One bound member of T: its key, its tag type and the functions decoding and encoding it.
+     *
+     * Instances are created with NBTPP_FIELD inside NBTPP_BINDING.
+     */
+    template<class T>
+    struct field {
+        const char* name;
+        size_t name_length;
+        tag_type type;
+        void (*read_buffer)(codec::buffer_reader&, T&);
+        void (*read_stream)(codec::stream_reader&, T&);
+        void (*write_buffer)(codec::buffer_writer&, const T&);
+        void (*write_stream)(codec::stream_writer&, const T&);
+
+        void read(codec::buffer_reader& in, T& obj) const {
+            read_buffer(in, obj);
+        }
+
+        void read(codec::stream_reader& in, T& obj) const {
+            read_stream(in, obj);
+        }
+
+        void write(codec::buffer_writer& out, const T& obj) const {
+            write_buffer(out, obj);
+        }
+
+        void write(codec::stream_writer& out, const T& obj) const {
+            write_stream(out, obj);
+        }
+    };
+
+    /**
+     * Fields bound to T, in encoding order.
+     */
+    template<class T>
+    struct field_list {
+        const field<T>* first;
+        size_t count;
+
+        const field<T>* begin() const {
+            return first;
+        }
+
+        const field<T>* end() const {
+            return first + count;
+        }
+    };
+
+    /**
+     * Binding of a struct to a compound, specialized with NBTPP_BINDING.
+     */
+    template<class T>
+    struct binding {
+    };
+
+    namespace detail {
+        template<class T>
+        struct void_of {
+            typedef void type;
+        };
+
+        template<class T, class = void>
+        struct has_binding: std::false_type {
+        };
+
+        template<class T>
+        struct has_binding<T, typename void_of<decltype(binding<T>::fields())>::type> : std::true_type {
+        };
+
+        template<class P>
+        struct member_traits;
+
+        template<class T, class M>
+        struct member_traits<M T::*> {
+            typedef T class_type;
+            typedef M member_type;
+        };
+    }
+
+    /**
+     * Decodes and encodes a member of type M, specialized for every supported member type.
+     *
+     * Supported are the integer and floating point types of the scalar tags, bool (as TAG_Byte), std::string,
+     * std::vector of int8_t, int32_t and int64_t (as the matching array tags), other std::vector and std::array (as
+     * TAG_List) and structs that have their own NBTPP_BINDING (as TAG_Compound).
+     */
+    template<class M, class Enable = void>
+    struct value_codec {
+        static_assert(sizeof(M) == 0, "unsupported member type, see nbtpp::value_codec");
+    };
+
+    template<class T, class Reader>
+    void decode_compound(Reader& in, T& obj);
+
+    template<class T, class Writer>
+    void encode_compound(Writer& out, const T& obj);
+
+#define NBTPP_SCALAR_CODEC(Type, Tag, Read, Write) \
+    template<> \
+    struct value_codec<Type> { \
+        static constexpr tag_type type = tag_type::Tag; \
+        template<class Reader> \
+        static void read(Reader& in, Type& v) { \
+            v = (Type) in.Read(); \
+        } \
+        template<class Writer> \
+        static void write(Writer& out, const Type& v) { \
+            out.Write(v); \
+        } \
+    };
+
+    NBTPP_SCALAR_CODEC(int8_t, TAG_Byte, read_byte, write_byte)
+    NBTPP_SCALAR_CODEC(int16_t, TAG_Short, read_short, write_short)
+    NBTPP_SCALAR_CODEC(int32_t, TAG_Int, read_int, write_int)
+    NBTPP_SCALAR_CODEC(int64_t, TAG_Long, read_long, write_long)
+    NBTPP_SCALAR_CODEC(float, TAG_Float, read_float, write_float)
+    NBTPP_SCALAR_CODEC(double, TAG_Double, read_double, write_double)
+
+#undef NBTPP_SCALAR_CODEC
+
+    template<>
+    struct value_codec<bool> {
+        static constexpr tag_type type = tag_type::TAG_Byte;
+
+        template<class Reader>
+        static void read(Reader& in, bool& v) {
+            v = in.read_byte() != 0;
+        }
+
+        template<class Writer>
+        static void write(Writer& out, const bool& v) {
+            out.write_byte(v ? 1 : 0);
+        }
+    };
+
+    template<>
+    struct value_codec<std::string> {
+        static constexpr tag_type type = tag_type::TAG_String;
+
+        template<class Reader>
+        static void read(Reader& in, std::string& v) {
+            in.read_string(v);
+        }
+
+        template<class Writer>
+        static void write(Writer& out, const std::string& v) {
+            out.write_string(v);
+        }
+    };
+
+    /**
+     * Codec of the array tags.
+     */
+    template<class E, tag_type Tag>
+    struct array_codec {
+        static constexpr tag_type type = Tag;
+
+        template<class Reader>
+        static void read(Reader& in, std::vector<E>& v) {
+            int32_t length = in.read_int();
+            v.clear();
+            if (length > 0)
+                in.read_vector(v, length);
+        }
+
+        template<class Writer>
+        static void write(Writer& out, const std::vector<E>& v) {
+            out.write_int((int32_t) v.size());
+            out.write_array(v.data(), v.size());
+        }
+    };
+
+    template<>
+    struct value_codec<std::vector<int8_t>> : array_codec<int8_t, tag_type::TAG_Byte_Array> {
+    };
+
+    template<>
+    struct value_codec<std::vector<int32_t>> : array_codec<int32_t, tag_type::TAG_Int_Array> {
+    };
+
+    template<>
+    struct value_codec<std::vector<int64_t>> : array_codec<int64_t, tag_type::TAG_Long_Array> {
+    };
+
+    namespace detail {
+        /**
+         * Read a list header, checking the element type.
+         *
+         * @return  Number of elements, 0 for an empty list of any type
+         */
+        template<class Reader>
+        int32_t read_list_header(Reader& in, tag_type expected) {
+            tag_type type = (tag_type) in.read_ubyte();
+            int32_t length = in.read_int();
+            if (length <= 0)
+                return 0;
+            if (type != expected)
+                throw nbt_exception("can't read list of " + name_for_type(type) + " as list of " + name_for_type(expected));
+            return length;
+        }
+    }
+
+    template<class U>
+    struct value_codec<std::vector<U>> {
+        static constexpr tag_type type = tag_type::TAG_List;
+
+        template<class Reader>
+        static void read(Reader& in, std::vector<U>& v) {
+            size_t length = (size_t) detail::read_list_header(in, value_codec<U>::type);
+            // Grown as elements are read so a bogus length fails at the end of the data, reusing the elements there.
+            if (v.size() > length)
+                v.resize(length);
+            for (size_t i = 0; i < length; i++) {
+                if (i == v.size())
+                    v.emplace_back();
+                value_codec<U>::read(in, v[i]);
+            }
+        }
+
+        template<class Writer>
+        static void write(Writer& out, const std::vector<U>& v) {
+            out.write_ubyte(value_codec<U>::type);
+            out.write_int((int32_t) v.size());
+            for (const U& e : v) {
+                value_codec<U>::write(out, e);
+            }
+        }
+    };
+
+    /**
+     * Fixed-size lists, such as Pos or Motion. Missing elements are left untouched, extra elements are skipped.
+     */
+    template<class U, size_t N>
+    struct value_codec<std::array<U, N>> {
+        static constexpr tag_type type = tag_type::TAG_List;
+
+        template<class Reader>
+        static void read(Reader& in, std::array<U, N>& v) {
+            size_t length = detail::read_list_header(in, value_codec<U>::type);
+            for (size_t i = 0; i < length; i++) {
+                if (i < N)
+                    value_codec<U>::read(in, v[i]);
+                else
+                    codec::skip_payload(in, value_codec<U>::type);
+            }
+        }
+
+        template<class Writer>
+        static void write(Writer& out, const std::array<U, N>& v) {
+            out.write_ubyte(value_codec<U>::type);
+            out.write_int((int32_t) N);
+            for (const U& e : v) {
+                value_codec<U>::write(out, e);
+            }
+        }
+    };
+
+    template<class M>
+    struct value_codec<M, typename std::enable_if<detail::has_binding<M>::value>::type> {
+        static constexpr tag_type type = tag_type::TAG_Compound;
+
+        template<class Reader>
+        static void read(Reader& in, M& v) {
+            decode_compound(in, v);
+        }
+
+        template<class Writer>
+        static void write(Writer& out, const M& v) {
+            encode_compound(out, v);
+        }
+    };
+
+    namespace detail {
+        template<class P, P Member>
+        struct member_codec {
+            typedef typename member_traits<P>::class_type class_type;
+            typedef typename member_traits<P>::member_type member_type;
+
+            template<class Reader>
+            static void read(Reader& in, class_type& obj) {
+                value_codec<member_type>::read(in, obj.*Member);
+            }
+
+            template<class Writer>
+            static void write(Writer& out, const class_type& obj) {
+                value_codec<member_type>::write(out, obj.*Member);
+            }
+        };
+
+        template<class P, P Member>
+        field<typename member_traits<P>::class_type> make_field(const char* name) {
+            typedef member_codec<P, Member> mc;
+            return field<typename member_traits<P>::class_type> { name, std::strlen(name), value_codec<typename mc::member_type>::type,
+                &mc::template read<codec::buffer_reader>, &mc::template read<codec::stream_reader>,
+                &mc::template write<codec::buffer_writer>, &mc::template write<codec::stream_writer> };
+        }
+
+        /**
+         * Find the field named name, starting at the one after the last match since keys usually come in order.
+         */
+        template<class T>
+        const field<T>* find_field(const field_list<T>& fields, const char* name, size_t length, size_t& next) {
+            for (size_t n = 0; n < fields.count; n++) {
+                size_t i = next + n < fields.count ? next + n : next + n - fields.count;
+                const field<T>& f = fields.first[i];
+                if (f.name_length == length && std::memcmp(f.name, name, length) == 0) {
+                    next = i + 1;
+                    return &f;
+                }
+            }
+            return nullptr;
+        }
+
+        template<class T, class Reader>
+        void decode_root(Reader& in, T& obj) {
+            tag_type type = (tag_type) in.read_ubyte();
+            if (type != tag_type::TAG_Compound)
+                throw nbt_exception("can't decode " + name_for_type(type) + " into a struct");
+            in.skip(in.read_ushort());
+            decode_compound(in, obj);
+        }
+
+        template<class T, class Writer>
+        void encode_root(Writer& out, const T& obj, const std::string& name) {
+            out.write_ubyte(tag_type::TAG_Compound);
+            out.write_string(name);
+            encode_compound(out, obj);
+        }
+    }
+
+    /**
+     * Decode the payload of a compound into obj.
+     *
+     * Keys without a bound member are skipped, members without a key are left untouched.
+     *
+     * @param in    Reader positioned on the first entry of the compound
+     * @param obj   Object to fill
+     */
+    template<class T, class Reader>
+    void decode_compound(Reader& in, T& obj) {
+        static_assert(detail::has_binding<T>::value, "T has no NBTPP_BINDING");
+        field_list<T> fields = binding<T>::fields();
+        size_t next = 0;
+
+        while (1) {
+            tag_type type = (tag_type) in.read_ubyte();
+            if (type == tag_type::TAG_End)
+                break;
+
+            size_t length;
+            const char* name = in.read_string_data(length);
+            const field<T>* f = detail::find_field(fields, name, length, next);
+            if (f == nullptr) {
+                codec::skip_payload(in, type);
+                continue;
+            }
+            if (f->type != type)
+                throw nbt_exception("field '" + std::string(f->name) + "' is " + name_for_type(type) + ", expected " + name_for_type(f->type));
+            f->read(in, obj);
+        }
+    }
+
+    /**
+     * Encode obj as the payload of a compound, terminating TAG_End included.
+     *
+     * @param out   Writer to write to
+     * @param obj   Object to encode
+     */
+    template<class T, class Writer>
+    void encode_compound(Writer& out, const T& obj) {
+        static_assert(detail::has_binding<T>::value, "T has no NBTPP_BINDING");
+        for (const field<T>& f : binding<T>::fields()) {
+            out.write_ubyte(f.type);
+            out.write_string(f.name, f.name_length);
+            f.write(out, obj);
+        }
+        out.write_ubyte(tag_type::TAG_End);
+    }
+
+    /**
+     * Decode an uncompressed document whose root is a compound into obj, without building tags.
+     */
+    template<class T>
+    void decode(codec::buffer_reader& in, T& obj) {
+        detail::decode_root(in, obj);
+    }
+
+    template<class T>
+    void decode(codec::stream_reader& in, T& obj) {
+        detail::decode_root(in, obj);
+    }
+
+    template<class T>
+    void decode(const uint8_t* data, size_t size, T& obj) {
+        codec::buffer_reader in(data, size);
+        detail::decode_root(in, obj);
+    }
+
+    template<class T>
+    void decode(std::istream& in, T& obj) {
+        codec::stream_reader reader(in.rdbuf());
+        detail::decode_root(reader, obj);
+    }
+
+    /**
+     * Encode obj as an uncompressed document whose root is a compound named name.
+     */
+    template<class T>
+    void encode(codec::buffer_writer& out, const T& obj, const std::string& name = "") {
+        detail::encode_root(out, obj, name);
+    }
+
+    template<class T>
+    void encode(codec::stream_writer& out, const T& obj, const std::string& name = "") {
+        detail::encode_root(out, obj, name);
+    }
+
+    template<class T>
+    void encode(std::vector<uint8_t>& out, const T& obj, const std::string& name = "") {
+        codec::buffer_writer writer(out);
+        detail::encode_root(writer, obj, name);
+    }
+
+    template<class T>
+    void encode(std::ostream& out, const T& obj, const std::string& name = "") {
+        codec::stream_writer writer(out.rdbuf());
+        detail::encode_root(writer, obj, name);
+        writer.flush();
+    }
+}
+
+/**
+ * Bind a member to a key, for use inside NBTPP_BINDING.
+ *
+ * @param name      Key of the member in the compound
+ * @param member    Pointer to member, e.g. &player::health
+ */
+#define NBTPP_FIELD(name, member) ::nbtpp::detail::make_field<decltype(member), member>(name)
+
+/**
+ * Declare the binding of a struct to a compound. Must be used at global scope, after the bindings of any struct used
+ * as a member.
+ *
+ * NBTPP_BINDING(player,
+ *     NBTPP_FIELD("Health", &player::health),
+ *     NBTPP_FIELD("Pos", &player::pos))
+ */
+#define NBTPP_BINDING(Type, ...) \
+    namespace nbtpp { \
+        template<> \
+        struct binding<Type> { \
+            static field_list<Type> fields() { \
+                static const field<Type> list[] = { __VA_ARGS__ }; \
+                return field_list<Type> { list, sizeof(list) / sizeof(list[0]) }; \
+            } \
+        }; \
+    }
+
+#endif
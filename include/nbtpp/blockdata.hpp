@@ -0,0 +1,213 @@
+#ifndef NBTPP_BLOCKDATA_HPP_
+#define NBTPP_BLOCKDATA_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tag.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+namespace nbtpp {
+    namespace tags {
+        class tag_compound;
+    }
+
+    /**
+     * Conversion between the block storage of structure files and flat arrays of palette indices.
+     *
+     * Sponge schematics store blocks as LEB128 varints in a TAG_Byte_Array, vanilla structures as a list of small
+     * compounds. Both are turned into a block_volume, whose blocks are indexed like Sponge's BlockData:
+     * x + z * width + y * width * length.
+     */
+    namespace blockdata {
+
+        /**
+         * Streaming LEB128 varint decoder, keeping a partially read value between calls so the input may be split
+         * anywhere.
+         *
+         * Runs of bytes below 0x80, which is every block of a palette of at most 128 states, are decoded 8 at a time.
+         */
+        class varint_decoder {
+        public:
+            varint_decoder() : m_value(0), m_shift(0) {
+            }
+
+            /**
+             * Decode as many values as fit in out.
+             *
+             * @param data      Encoded bytes
+             * @param size      Number of bytes
+             * @param out       Decoded values
+             * @param capacity  Room in out
+             * @param consumed  Set to the number of bytes used, less than size if out is full
+             * @return          Number of values written to out
+             */
+            size_t decode(const uint8_t* data, size_t size, uint32_t* out, size_t capacity, size_t& consumed);
+
+            /**
+             * Whether a value is partially decoded, i.e. the input stopped in the middle of a varint.
+             */
+            inline bool partial() const {
+                return m_shift != 0;
+            }
+
+            /**
+             * Check that the input did not end in the middle of a varint.
+             */
+            void finish() const {
+                if (partial())
+                    throw nbt_exception("truncated varint");
+            }
+        private:
+            uint32_t m_value;
+            uint32_t m_shift;
+        };
+
+        /**
+         * Decode a whole varint array.
+         *
+         * @param data  Encoded bytes
+         * @param size  Number of bytes
+         * @param out   Vector to append the values to
+         */
+        void decode_varints(const uint8_t* data, size_t size, std::vector<uint32_t>& out);
+
+        inline void decode_varints(const std::vector<int8_t>& data, std::vector<uint32_t>& out) {
+            decode_varints(reinterpret_cast<const uint8_t*>(data.data()), data.size(), out);
+        }
+
+        /**
+         * Decode size encoded bytes from a reader without holding them all in memory.
+         *
+         * @param in    Reader positioned on the encoded bytes, e.g. after the length of a TAG_Byte_Array
+         * @param size  Number of encoded bytes
+         * @param sink  Called as sink(const uint32_t* values, size_t count) for each decoded chunk
+         */
+        template<class Reader, class Sink>
+        void decode_varints(Reader& in, size_t size, Sink&& sink) {
+            uint8_t chunk[16384];
+            uint32_t values[16384];
+            varint_decoder d;
+            while (size > 0) {
+                size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+                in.read_raw(chunk, n);
+                size -= n;
+                size_t offset = 0;
+                while (offset < n) {
+                    size_t consumed;
+                    size_t count = d.decode(chunk + offset, n - offset, values, sizeof(values) / sizeof(uint32_t), consumed);
+                    offset += consumed;
+                    sink(static_cast<const uint32_t*>(values), count);
+                }
+            }
+            d.finish();
+        }
+
+        /**
+         * Number of bytes needed to encode values.
+         */
+        size_t varint_size(const uint32_t* values, size_t count);
+
+        /**
+         * Encode values as varints.
+         *
+         * @param values    Values to encode
+         * @param count     Number of values
+         * @param out       Buffer to append to
+         */
+        void encode_varints(const uint32_t* values, size_t count, std::vector<int8_t>& out);
+
+        /**
+         * Encode values as varints straight to a writer, e.g. after writing varint_size() as the length of a
+         * TAG_Byte_Array.
+         */
+        template<class Writer>
+        void write_varints(Writer& out, const uint32_t* values, size_t count) {
+            std::vector<int8_t> chunk;
+            const size_t per_chunk = 16384;
+            chunk.reserve(per_chunk * 5);
+            while (count > 0) {
+                size_t n = count < per_chunk ? count : per_chunk;
+                chunk.clear();
+                encode_varints(values, n, chunk);
+                out.write_raw(chunk.data(), chunk.size());
+                values += n;
+                count -= n;
+            }
+        }
+
+        /**
+         * Block state string of a palette entry of a structure or chunk section, a compound with a Name and optional
+         * Properties, e.g. "minecraft:oak_stairs[facing=north,half=bottom]".
+         */
+        std::string state_string(const tags::tag_compound* entry);
+
+        /**
+         * A box of blocks, as palette indices.
+         */
+        struct block_volume {
+            uint32_t width = 0;
+            uint32_t height = 0;
+            uint32_t length = 0;
+
+            /**
+             * Block states, e.g. "minecraft:oak_stairs[facing=north,half=bottom]".
+             */
+            std::vector<std::string> palette;
+
+            /**
+             * Palette index of every block, width * height * length entries.
+             */
+            std::vector<uint32_t> blocks;
+
+            inline size_t index(uint32_t x, uint32_t y, uint32_t z) const {
+                return x + (size_t) z * width + (size_t) y * width * length;
+            }
+
+            inline size_t volume() const {
+                return (size_t) width * height * length;
+            }
+        };
+
+        /**
+         * Read the blocks of a Sponge schematic (version 2, or version 3 with its Blocks compound).
+         *
+         * @param root  Schematic compound
+         * @param out   Volume to fill
+         */
+        void decode_schematic(const tags::tag_compound* root, block_volume& out);
+
+        /**
+         * Write the Version, Width, Height, Length, Palette, PaletteMax and BlockData entries of a version 2 Sponge
+         * schematic.
+         *
+         * @param in    Volume to store
+         * @param root  Schematic compound, existing entries are replaced
+         */
+        void encode_schematic(const block_volume& in, tags::tag_compound* root);
+
+        /**
+         * Read the blocks of a vanilla structure file.
+         *
+         * @param root  Structure compound
+         * @param out   Volume to fill
+         * @param empty Index given to positions without a block (structure voids)
+         * @throws nbt_exception if the structure is invalid, or its size is out of proportion with its blocks: more than
+         *                       48x48x48 plus 64 positions per block
+         */
+        void decode_structure(const tags::tag_compound* root, block_volume& out, uint32_t empty = UINT32_MAX);
+
+        /**
+         * Write the size, palette and blocks entries of a vanilla structure file.
+         *
+         * @param in    Volume to store
+         * @param root  Structure compound, existing entries are replaced
+         * @param empty Index of positions to leave out
+         */
+        void encode_structure(const block_volume& in, tags::tag_compound* root, uint32_t empty = UINT32_MAX);
+    }
+}
+
+#endif
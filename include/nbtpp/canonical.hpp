@@ -0,0 +1,282 @@
+#ifndef NBTPP_CANONICAL_HPP_
+#define NBTPP_CANONICAL_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "tag.hpp"
+#include "codec.hpp"
+
+namespace nbtpp {
+    namespace canonical {
+
+        namespace detail {
+            const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+            const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+            inline uint64_t rotl(uint64_t x, int r) {
+                return (x << r) | (x >> (64 - r));
+            }
+
+            inline uint64_t fmix(uint64_t h) {
+                h ^= h >> 33;
+                h *= 0xff51afd7ed558ccdULL;
+                h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ULL;
+                h ^= h >> 33;
+                return h;
+            }
+
+            inline uint64_t combine(uint64_t seed, uint64_t v) {
+                return fmix(rotl(seed ^ (v * prime1), 27) * prime2 + prime1);
+            }
+
+            inline uint32_t float_bits(float v) {
+                if (v != v)
+                    return 0x7fc00000u;
+                uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                return bits;
+            }
+
+            inline uint64_t double_bits(double v) {
+                if (v != v)
+                    return 0x7ff8000000000000ULL;
+                uint64_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                return bits;
+            }
+        }
+
+        /**
+         * Incremental 64-bit hash of a byte sequence, fed in any number of pieces.
+         */
+        class byte_hasher {
+        public:
+            byte_hasher(uint64_t seed = 0) : m_hash(seed ^ detail::prime2), m_length(0), m_tail_size(0) {
+            }
+
+            void update(const uint8_t* data, size_t size) {
+                m_length += size;
+                if (m_tail_size > 0) {
+                    while (m_tail_size < 8 && size > 0) {
+                        m_tail[m_tail_size++] = *data++;
+                        size--;
+                    }
+                    if (m_tail_size < 8)
+                        return;
+                    word(load_le(m_tail));
+                    m_tail_size = 0;
+                }
+                while (size >= 8) {
+                    word(load_le(data));
+                    data += 8;
+                    size -= 8;
+                }
+                while (size > 0) {
+                    m_tail[m_tail_size++] = *data++;
+                    size--;
+                }
+            }
+
+            uint64_t digest() const {
+                uint64_t h = m_hash;
+                if (m_tail_size > 0) {
+                    uint8_t last[8] = { };
+                    std::memcpy(last, m_tail, m_tail_size);
+                    h = detail::rotl(h ^ (load_le(last) * detail::prime1), 31) * detail::prime2;
+                }
+                return detail::fmix(h ^ m_length);
+            }
+        private:
+            static uint64_t load_le(const uint8_t* p) {
+                uint64_t v = 0;
+                for (int i = 7; i >= 0; i--) {
+                    v = (v << 8) | p[i];
+                }
+                return v;
+            }
+
+            void word(uint64_t w) {
+                m_hash = detail::rotl(m_hash ^ (w * detail::prime1), 31) * detail::prime2;
+            }
+
+            uint64_t m_hash;
+            uint64_t m_length;
+            uint8_t m_tail[8];
+            size_t m_tail_size;
+        };
+
+        /**
+         * Hash of a tag name.
+         */
+        inline uint64_t hash_name(const char* name, size_t length) {
+            byte_hasher h(0x6e616d65);
+            h.update(reinterpret_cast<const uint8_t*>(name), length);
+            return h.digest();
+        }
+
+        /**
+         * Structural hash of a tag, its name included.
+         *
+         * The hash does not depend on the order of compound entries, treats every NaN as the same value and ignores the
+         * element type of empty lists, so two trees that are equal() have the same hash. It is the same as hash_encoded()
+         * of any encoding of the tree.
+         */
+        uint64_t hash(const tag* t);
+
+        /**
+         * Structural hash of the payload of a tag, without its name.
+         */
+        uint64_t hash_value(const tag* t);
+
+        /**
+         * Structural equality, ignoring the order of compound entries and the element type of empty lists, and treating
+         * every NaN as the same value. Returns as soon as a difference is found.
+         *
+         * @param a First tag, may be nullptr
+         * @param b Second tag, may be nullptr
+         */
+        bool equal(const tag* a, const tag* b);
+
+        /**
+         * Equality with precomputed hashes, exiting early when they differ.
+         */
+        inline bool equal(const tag* a, uint64_t hash_a, const tag* b, uint64_t hash_b) {
+            return hash_a == hash_b && equal(a, b);
+        }
+
+        /**
+         * Write a tag in canonical form: compound entries sorted by name, NaNs normalized and empty lists typed TAG_End.
+         * Equal trees have byte-identical canonical encodings.
+         *
+         * @param t     Root tag
+         * @param out   Buffer to append to
+         */
+        void encode(const tag* t, std::vector<uint8_t>& out);
+
+        /**
+         * Write a tag in canonical form to a stream.
+         */
+        void encode(const tag* t, std::ostream& out);
+
+        namespace detail {
+            template<class Reader>
+            inline void hash_raw(Reader& in, size_t size, byte_hasher& h) {
+                uint8_t chunk[4096];
+                while (size > 0) {
+                    size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+                    in.read_raw(chunk, n);
+                    h.update(chunk, n);
+                    size -= n;
+                }
+            }
+
+            inline void hash_raw(codec::buffer_reader& in, size_t size, byte_hasher& h) {
+                in.expect(size);
+                h.update(in.current(), size);
+                in.skip(size);
+            }
+
+            template<class Reader>
+            uint64_t hash_payload(Reader& in, tag_type type) {
+                switch (type) {
+                    case tag_type::TAG_Byte:
+                        return combine(type, (uint64_t) (int64_t) in.read_byte());
+                    case tag_type::TAG_Short:
+                        return combine(type, (uint64_t) (int64_t) in.read_short());
+                    case tag_type::TAG_Int:
+                        return combine(type, (uint64_t) (int64_t) in.read_int());
+                    case tag_type::TAG_Long:
+                        return combine(type, (uint64_t) in.read_long());
+                    case tag_type::TAG_Float:
+                        return combine(type, float_bits(in.read_float()));
+                    case tag_type::TAG_Double:
+                        return combine(type, double_bits(in.read_double()));
+                    case tag_type::TAG_String: {
+                        byte_hasher h;
+                        hash_raw(in, in.read_ushort(), h);
+                        return combine(type, h.digest());
+                    }
+                    case tag_type::TAG_Byte_Array:
+                    case tag_type::TAG_Int_Array:
+                    case tag_type::TAG_Long_Array: {
+                        int32_t length = in.read_int();
+                        size_t element_size = type == tag_type::TAG_Byte_Array ? 1 : type == tag_type::TAG_Int_Array ? 4 : 8;
+                        byte_hasher h;
+                        hash_raw(in, length > 0 ? (size_t) length * element_size : 0, h);
+                        return combine(type, h.digest());
+                    }
+                    case tag_type::TAG_List: {
+                        tag_type content_type = (tag_type) in.read_ubyte();
+                        int32_t length = in.read_int();
+                        uint64_t h = combine(type, length > 0 ? length : 0);
+                        if (length > 0)
+                            h = combine(h, content_type);
+                        for (int32_t i = 0; i < length; i++) {
+                            h = combine(h, hash_payload(in, content_type));
+                        }
+                        return h;
+                    }
+                    case tag_type::TAG_Compound: {
+                        uint64_t sum = 0;
+                        uint64_t count = 0;
+                        while (1) {
+                            tag_type t = (tag_type) in.read_ubyte();
+                            if (t == tag_type::TAG_End)
+                                break;
+                            size_t length;
+                            const char* name = in.read_string_data(length);
+                            uint64_t name_hash = hash_name(name, length);
+                            sum += fmix(combine(name_hash, hash_payload(in, t)));
+                            count++;
+                        }
+                        return combine(combine(type, count), sum);
+                    }
+                    default:
+                        throw nbt_exception("invalid tag type " + std::to_string((int) type));
+                }
+            }
+        }
+
+        /**
+         * Structural hash computed directly over an encoded document, without building tags.
+         *
+         * @param in    Reader positioned on the root tag
+         * @return      The same value as hash() of the decoded tree
+         */
+        template<class Reader>
+        uint64_t hash_encoded(Reader& in) {
+            tag_type type = (tag_type) in.read_ubyte();
+            if (type == tag_type::TAG_End)
+                return detail::combine(hash_name("", 0), detail::combine(type, 0));
+            size_t length;
+            const char* name = in.read_string_data(length);
+            uint64_t name_hash = hash_name(name, length);
+            return detail::combine(name_hash, detail::hash_payload(in, type));
+        }
+
+        /**
+         * Structural hash of an uncompressed document in memory.
+         */
+        inline uint64_t hash_encoded(const uint8_t* data, size_t size) {
+            codec::buffer_reader in(data, size);
+            return hash_encoded(in);
+        }
+    }
+
+    /**
+     * Structural equality, see canonical::equal().
+     */
+    inline bool operator==(const tag& a, const tag& b) {
+        return canonical::equal(&a, &b);
+    }
+
+    inline bool operator!=(const tag& a, const tag& b) {
+        return !canonical::equal(&a, &b);
+    }
+}
+
+#endif
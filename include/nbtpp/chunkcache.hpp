@@ -0,0 +1,162 @@
+#ifndef NBTPP_CHUNKCACHE_HPP_
+#define NBTPP_CHUNKCACHE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "nbt.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Thread-safe cache of decoded chunks, keyed by region file and chunk coordinates.
+     *
+     * Decoded trees are kept up to a byte budget measured with nbt::memory_usage(). Least recently used trees are
+     * then dropped to a second tier holding only the stored (compressed) bytes of the chunk, which is decoded again
+     * on the next hit without reading the file, and finally discarded when that tier is over its own budget.
+     *
+     * Keys are spread over shards, each with its own lock and an equal part of the budgets. Concurrent misses of the
+     * same chunk are loaded once, the other callers wait for the result. Trees are shared: a handle stays valid after
+     * its entry is evicted.
+     */
+    class chunk_cache {
+    public:
+        /**
+         * Smallest part of the budget given to a shard, enough for the largest decoded chunks. Small budgets use fewer
+         * shards rather than shards too small to keep such a chunk.
+         */
+        static const size_t min_shard_budget = 4 << 20;
+
+        struct key {
+            std::string region;
+            int32_t x;
+            int32_t z;
+
+            bool operator==(const key& other) const {
+                return x == other.x && z == other.z && region == other.region;
+            }
+        };
+
+        struct key_hash {
+            size_t operator()(const key& k) const {
+                uint64_t h = std::hash<std::string>()(k.region);
+                h ^= ((uint64_t) (uint32_t) k.x << 32 | (uint32_t) k.z) * 0x9E3779B97F4A7C15ULL;
+                return (size_t) (h ^ (h >> 29));
+            }
+        };
+
+        typedef std::shared_ptr<const nbt> handle;
+
+        /**
+         * Reads the stored bytes of a chunk, returning false if it does not exist.
+         */
+        typedef std::function<bool(const key& k, std::vector<uint8_t>& data, nbt::compression& compression)> fetcher;
+
+        struct statistics {
+            uint64_t hits;
+            uint64_t compressed_hits;
+            uint64_t misses;
+            uint64_t evictions;
+            uint64_t discards;
+        };
+
+        /**
+         * Fetcher reading chunks from the region file named by the key.
+         *
+         * The last open_regions region files read stay open with their header loaded, so misses in the same region
+         * only read the chunk. A region file replaced or changed since it was opened is opened again.
+         */
+        static fetcher region_fetcher(size_t open_regions = 16);
+
+        /**
+         * Create a cache.
+         *
+         * @param budget            Bytes of decoded trees to keep
+         * @param compressed_budget Bytes of stored chunks to keep once their tree is evicted
+         * @param shards            Maximum number of independently locked shards, lowered so each gets at least
+         *                          min_shard_budget
+         * @param fetch             Source of chunks, reading region files by default
+         */
+        chunk_cache(size_t budget, size_t compressed_budget = 0, size_t shards = 16, fetcher fetch = region_fetcher());
+
+        chunk_cache(const chunk_cache&) = delete;
+        chunk_cache& operator=(const chunk_cache&) = delete;
+
+        /**
+         * Get a chunk, loading it on a miss.
+         *
+         * @return  The decoded chunk, or nullptr if it does not exist
+         * @throws nbt_exception if the chunk can't be loaded
+         */
+        handle get(const std::string& region, int32_t x, int32_t z);
+
+        /**
+         * Drop a chunk from both tiers, e.g. after it was written.
+         */
+        void invalidate(const std::string& region, int32_t x, int32_t z);
+
+        /**
+         * Drop every chunk.
+         */
+        void clear();
+
+        /**
+         * Bytes of decoded trees held.
+         */
+        size_t size() const;
+
+        /**
+         * Bytes of stored chunks held in the second tier.
+         */
+        size_t compressed_size() const;
+
+        statistics stats() const;
+    private:
+        struct entry {
+            handle tree;
+            std::vector<uint8_t> data;
+            nbt::compression compression;
+            size_t cost;
+            std::list<key>::iterator position;
+        };
+
+        struct shard {
+            std::mutex mutex;
+            std::unordered_map<key, entry, key_hash> hot;
+            std::unordered_map<key, entry, key_hash> cold;
+            std::unordered_map<key, std::pair<uint64_t, std::shared_future<handle>>, key_hash> loading;
+            std::list<key> hot_order;
+            std::list<key> cold_order;
+            size_t hot_bytes = 0;
+            size_t cold_bytes = 0;
+        };
+
+        shard& shard_for(const key& k) {
+            return *m_shards[key_hash()(k) % m_shards.size()];
+        }
+
+        void insert(shard& s, const key& k, entry e);
+        void demote(shard& s);
+
+        size_t m_budget;
+        size_t m_compressed_budget;
+        fetcher m_fetch;
+        std::vector<std::unique_ptr<shard>> m_shards;
+        std::atomic<uint64_t> m_next_load;
+        std::atomic<uint64_t> m_hits;
+        std::atomic<uint64_t> m_compressed_hits;
+        std::atomic<uint64_t> m_misses;
+        std::atomic<uint64_t> m_evictions;
+        std::atomic<uint64_t> m_discards;
+    };
+}
+
+#endif
@@ -0,0 +1,611 @@
+#ifndef NBTPP_CODEC_HPP_
+#define NBTPP_CODEC_HPP_
+
+#include <cstdint>
+#include <cstring>
+#include <streambuf>
+#include <type_traits>
+#include <string>
+#include <vector>
+
+#include "tag.hpp"
+#include "nbtexception.hpp"
+
+namespace nbtpp {
+    namespace codec {
+
+        /**
+         * Read a big-endian unsigned integer from p.
+         */
+        template<class U>
+        inline U load_be(const uint8_t* p) {
+            U v = 0;
+            for (size_t i = 0; i < sizeof(U); i++) {
+                v = (U) ((v << 8) | p[i]);
+            }
+            return v;
+        }
+
+        /**
+         * Write a big-endian unsigned integer to p.
+         */
+        template<class U>
+        inline void store_be(uint8_t* p, U v) {
+            for (size_t i = sizeof(U); i > 0; i--) {
+                p[i - 1] = (uint8_t) v;
+                v = (U) (v >> 8);
+            }
+        }
+
+        /**
+         * Unsigned integer of the same size as T.
+         */
+        template<class T>
+        struct unsigned_of {
+            typedef typename std::conditional<sizeof(T) == 1, uint8_t,
+                typename std::conditional<sizeof(T) == 2, uint16_t,
+                    typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type>::type>::type type;
+        };
+
+        /**
+         * Convert count big-endian values of type T from src to native values in dst.
+         */
+        template<class T>
+        inline void from_be(T* dst, const uint8_t* src, size_t count) {
+            typedef typename unsigned_of<T>::type U;
+            for (size_t i = 0; i < count; i++) {
+                U v = load_be<U>(src + i * sizeof(T));
+                std::memcpy(dst + i, &v, sizeof(T));
+            }
+        }
+
+        /**
+         * Convert count native values of type T from src to big-endian values in dst.
+         */
+        template<class T>
+        inline void to_be(uint8_t* dst, const T* src, size_t count) {
+            typedef typename unsigned_of<T>::type U;
+            for (size_t i = 0; i < count; i++) {
+                U v;
+                std::memcpy(&v, src + i, sizeof(T));
+                store_be<U>(dst + i * sizeof(T), v);
+            }
+        }
+
+        /**
+         * Exception thrown when the input ends in the middle of a document.
+         */
+        class eof_exception: public nbt_exception {
+        public:
+            eof_exception() : nbt_exception("unexpected end of data") {
+            }
+        };
+
+        /**
+         * CRTP base providing the typed reads of every reader from its read_raw().
+         *
+         * Readers all share this interface so the parser, the skipper and the binding decoder can be written once as
+         * templates over the reader type.
+         */
+        template<class Derived>
+        class reader_base {
+        public:
+            uint8_t read_ubyte() {
+                uint8_t v;
+                self().read_raw(&v, 1);
+                return v;
+            }
+
+            int8_t read_byte() {
+                return (int8_t) read_ubyte();
+            }
+
+            uint16_t read_ushort() {
+                return read_be<uint16_t>();
+            }
+
+            int16_t read_short() {
+                return (int16_t) read_be<uint16_t>();
+            }
+
+            int32_t read_int() {
+                return (int32_t) read_be<uint32_t>();
+            }
+
+            int64_t read_long() {
+                return (int64_t) read_be<uint64_t>();
+            }
+
+            float read_float() {
+                uint32_t bits = read_be<uint32_t>();
+                float v;
+                std::memcpy(&v, &bits, sizeof(v));
+                return v;
+            }
+
+            double read_double() {
+                uint64_t bits = read_be<uint64_t>();
+                double v;
+                std::memcpy(&v, &bits, sizeof(v));
+                return v;
+            }
+
+            /**
+             * Read a length-prefixed string into out, reusing its capacity.
+             */
+            void read_string(std::string& out) {
+                size_t length = read_ushort();
+                out.resize(length);
+                if (length > 0)
+                    self().read_raw(&out[0], length);
+            }
+
+            std::string read_string() {
+                std::string s;
+                read_string(s);
+                return s;
+            }
+
+            /**
+             * Read count big-endian values into out.
+             */
+            template<class T>
+            void read_array(T* out, size_t count) {
+                if (sizeof(T) == 1) {
+                    self().read_raw(out, count);
+                    return;
+                }
+                uint8_t chunk[4096];
+                const size_t per_chunk = sizeof(chunk) / sizeof(T);
+                while (count > 0) {
+                    size_t n = count < per_chunk ? count : per_chunk;
+                    self().read_raw(chunk, n * sizeof(T));
+                    from_be(out, chunk, n);
+                    out += n;
+                    count -= n;
+                }
+            }
+
+            /**
+             * Read count big-endian values and append them to out.
+             *
+             * The count usually comes from the data, so readers that don't know their size grow out 64 KB at a time,
+             * reading each part before growing: a truncated stream declaring a huge length fails with an
+             * eof_exception instead of allocating that length first.
+             */
+            template<class T>
+            void read_vector(std::vector<T>& out, size_t count) {
+                const size_t per_step = (64 << 10) / sizeof(T);
+                while (count > 0) {
+                    size_t n = count < per_step ? count : per_step;
+                    size_t at = out.size();
+                    out.resize(at + n);
+                    self().read_array(out.data() + at, n);
+                    count -= n;
+                }
+            }
+
+            /**
+             * Hint that size bytes are about to be read, so readers that know their size can fail before allocating.
+             */
+            void expect(size_t) {
+            }
+        private:
+            Derived& self() {
+                return static_cast<Derived&>(*this);
+            }
+
+            template<class U>
+            U read_be() {
+                uint8_t b[sizeof(U)];
+                self().read_raw(b, sizeof(U));
+                return load_be<U>(b);
+            }
+        };
+
+        /**
+         * Reader over an in-memory buffer.
+         */
+        class buffer_reader: public reader_base<buffer_reader> {
+        public:
+            buffer_reader(const uint8_t* data, size_t size) : m_begin(data), m_pos(data), m_end(data + size) {
+            }
+
+            void read_raw(void* out, size_t size) {
+                require(size);
+                std::memcpy(out, m_pos, size);
+                m_pos += size;
+            }
+
+            uint8_t read_ubyte() {
+                require(1);
+                return *m_pos++;
+            }
+
+            int8_t read_byte() {
+                return (int8_t) read_ubyte();
+            }
+
+            /**
+             * Read a length-prefixed string without copying it.
+             *
+             * @param length    Set to the length of the string
+             * @return          Pointer to the string bytes, valid as long as the buffer
+             */
+            const char* read_string_data(size_t& length) {
+                length = read_ushort();
+                require(length);
+                const char* s = reinterpret_cast<const char*>(m_pos);
+                m_pos += length;
+                return s;
+            }
+
+            template<class T>
+            void read_array(T* out, size_t count) {
+                require(count * sizeof(T));
+                from_be(out, m_pos, count);
+                m_pos += count * sizeof(T);
+            }
+
+            template<class T>
+            void read_vector(std::vector<T>& out, size_t count) {
+                require(count * sizeof(T));
+                size_t at = out.size();
+                out.resize(at + count);
+                read_array(out.data() + at, count);
+            }
+
+            void skip(size_t size) {
+                require(size);
+                m_pos += size;
+            }
+
+            void expect(size_t size) {
+                require(size);
+            }
+
+            /**
+             * Number of bytes consumed so far.
+             */
+            size_t position() const {
+                return m_pos - m_begin;
+            }
+
+            /**
+             * Number of bytes left.
+             */
+            size_t remaining() const {
+                return m_end - m_pos;
+            }
+
+            /**
+             * Pointer to the next unread byte.
+             */
+            const uint8_t* current() const {
+                return m_pos;
+            }
+        private:
+            void require(size_t size) const {
+                if ((size_t) (m_end - m_pos) < size)
+                    throw eof_exception();
+            }
+
+            const uint8_t* m_begin;
+            const uint8_t* m_pos;
+            const uint8_t* m_end;
+        };
+
+        /**
+         * Reader over a stream buffer.
+         */
+        class stream_reader: public reader_base<stream_reader> {
+        public:
+            stream_reader(std::streambuf* buf) : m_buf(buf) {
+            }
+
+            void read_raw(void* out, size_t size) {
+                if ((size_t) m_buf->sgetn(static_cast<char*>(out), size) != size)
+                    throw eof_exception();
+            }
+
+            /**
+             * Read a length-prefixed string into a scratch buffer owned by the reader.
+             *
+             * @param length    Set to the length of the string
+             * @return          Pointer to the string bytes, valid until the next call
+             */
+            const char* read_string_data(size_t& length) {
+                read_string(m_scratch);
+                length = m_scratch.size();
+                return m_scratch.data();
+            }
+
+            void skip(size_t size) {
+                char chunk[4096];
+                while (size > 0) {
+                    size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+                    read_raw(chunk, n);
+                    size -= n;
+                }
+            }
+        private:
+            std::streambuf* m_buf;
+            std::string m_scratch;
+        };
+
+        /**
+         * CRTP base providing the typed writes of every writer from its write_raw().
+         */
+        template<class Derived>
+        class writer_base {
+        public:
+            void write_ubyte(uint8_t v) {
+                self().write_raw(&v, 1);
+            }
+
+            void write_byte(int8_t v) {
+                write_ubyte((uint8_t) v);
+            }
+
+            void write_ushort(uint16_t v) {
+                write_be<uint16_t>(v);
+            }
+
+            void write_short(int16_t v) {
+                write_be<uint16_t>((uint16_t) v);
+            }
+
+            void write_int(int32_t v) {
+                write_be<uint32_t>((uint32_t) v);
+            }
+
+            void write_long(int64_t v) {
+                write_be<uint64_t>((uint64_t) v);
+            }
+
+            void write_float(float v) {
+                uint32_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                write_be<uint32_t>(bits);
+            }
+
+            void write_double(double v) {
+                uint64_t bits;
+                std::memcpy(&bits, &v, sizeof(bits));
+                write_be<uint64_t>(bits);
+            }
+
+            void write_string(const char* s, size_t length) {
+                if (length > 0xffff)
+                    throw nbt_exception("string too long (" + std::to_string(length) + " bytes)");
+                write_ushort((uint16_t) length);
+                self().write_raw(s, length);
+            }
+
+            void write_string(const std::string& s) {
+                write_string(s.data(), s.size());
+            }
+
+            /**
+             * Write count values as big-endian.
+             */
+            template<class T>
+            void write_array(const T* values, size_t count) {
+                if (sizeof(T) == 1) {
+                    self().write_raw(values, count);
+                    return;
+                }
+                uint8_t chunk[4096];
+                const size_t per_chunk = sizeof(chunk) / sizeof(T);
+                while (count > 0) {
+                    size_t n = count < per_chunk ? count : per_chunk;
+                    to_be(chunk, values, n);
+                    self().write_raw(chunk, n * sizeof(T));
+                    values += n;
+                    count -= n;
+                }
+            }
+        private:
+            Derived& self() {
+                return static_cast<Derived&>(*this);
+            }
+
+            template<class U>
+            void write_be(U v) {
+                uint8_t b[sizeof(U)];
+                store_be<U>(b, v);
+                self().write_raw(b, sizeof(U));
+            }
+        };
+
+        /**
+         * Writer appending to an in-memory buffer.
+         */
+        class buffer_writer: public writer_base<buffer_writer> {
+        public:
+            buffer_writer(std::vector<uint8_t>& out) : m_out(out) {
+            }
+
+            void write_raw(const void* data, size_t size) {
+                const uint8_t* p = static_cast<const uint8_t*>(data);
+                m_out.insert(m_out.end(), p, p + size);
+            }
+
+            template<class T>
+            void write_array(const T* values, size_t count) {
+                size_t offset = m_out.size();
+                m_out.resize(offset + count * sizeof(T));
+                to_be(&m_out[offset], values, count);
+            }
+        private:
+            std::vector<uint8_t>& m_out;
+        };
+
+        /**
+         * Writer over a stream buffer.
+         *
+         * Small writes are gathered in an internal buffer, call flush() once done to push them to the stream buffer and
+         * detect errors. The destructor flushes too but ignores errors.
+         */
+        class stream_writer: public writer_base<stream_writer> {
+        public:
+            stream_writer(std::streambuf* buf) : m_buf(buf), m_size(0) {
+            }
+
+            stream_writer(const stream_writer&) = delete;
+            stream_writer& operator=(const stream_writer&) = delete;
+
+            ~stream_writer() {
+                try {
+                    flush();
+                } catch (nbt_exception&) {
+                }
+            }
+
+            void write_raw(const void* data, size_t size) {
+                if (m_size + size > sizeof(m_buffer)) {
+                    flush();
+                    if (size > sizeof(m_buffer)) {
+                        put(data, size);
+                        return;
+                    }
+                }
+                std::memcpy(m_buffer + m_size, data, size);
+                m_size += size;
+            }
+
+            /**
+             * Push buffered bytes to the stream buffer.
+             */
+            void flush() {
+                size_t size = m_size;
+                m_size = 0;
+                put(m_buffer, size);
+            }
+        private:
+            void put(const void* data, size_t size) {
+                if (size > 0 && (size_t) m_buf->sputn(static_cast<const char*>(data), size) != size)
+                    throw nbt_exception("write error");
+            }
+
+            std::streambuf* m_buf;
+            size_t m_size;
+            char m_buffer[8192];
+        };
+
+        /**
+         * Non-owning reference to a string, built implicitly from C strings and std::string.
+         */
+        struct string_ref {
+            string_ref(const char* s) : data(s), size(std::strlen(s)) {
+            }
+
+            string_ref(const char* s, size_t length) : data(s), size(length) {
+            }
+
+            string_ref(const std::string& s) : data(s.data()), size(s.size()) {
+            }
+
+            std::string str() const {
+                return std::string(data, size);
+            }
+
+            const char* data;
+            size_t size;
+        };
+
+        /**
+         * Size of the payload of a fixed-size tag type.
+         *
+         * @param type  Tag type
+         * @return      Payload size in bytes, or 0 for variable-size types
+         */
+        inline size_t fixed_payload_size(tag_type type) {
+            switch (type) {
+                case tag_type::TAG_Byte:
+                    return 1;
+                case tag_type::TAG_Short:
+                    return 2;
+                case tag_type::TAG_Int:
+                case tag_type::TAG_Float:
+                    return 4;
+                case tag_type::TAG_Long:
+                case tag_type::TAG_Double:
+                    return 8;
+                default:
+                    return 0;
+            }
+        }
+
+        /**
+         * Skip the payload of a tag of the given type without building it.
+         *
+         * @param in    Reader positioned on the payload
+         * @param type  Type of the tag
+         */
+        template<class Reader>
+        void skip_payload(Reader& in, tag_type type) {
+            switch (type) {
+                case tag_type::TAG_Byte:
+                    in.skip(1);
+                    break;
+                case tag_type::TAG_Short:
+                    in.skip(2);
+                    break;
+                case tag_type::TAG_Int:
+                case tag_type::TAG_Float:
+                    in.skip(4);
+                    break;
+                case tag_type::TAG_Long:
+                case tag_type::TAG_Double:
+                    in.skip(8);
+                    break;
+                case tag_type::TAG_Byte_Array: {
+                    int32_t length = in.read_int();
+                    in.skip(length > 0 ? length : 0);
+                    break;
+                }
+                case tag_type::TAG_String:
+                    in.skip(in.read_ushort());
+                    break;
+                case tag_type::TAG_List: {
+                    tag_type list_type = (tag_type) in.read_ubyte();
+                    int32_t length = in.read_int();
+                    size_t element_size = fixed_payload_size(list_type);
+                    if (element_size != 0) {
+                        in.skip(length > 0 ? (size_t) length * element_size : 0);
+                        break;
+                    }
+                    for (int32_t i = 0; i < length; i++) {
+                        skip_payload(in, list_type);
+                    }
+                    break;
+                }
+                case tag_type::TAG_Compound: {
+                    while (1) {
+                        tag_type t = (tag_type) in.read_ubyte();
+                        if (t == tag_type::TAG_End)
+                            break;
+                        in.skip(in.read_ushort());
+                        skip_payload(in, t);
+                    }
+                    break;
+                }
+                case tag_type::TAG_Int_Array: {
+                    int32_t length = in.read_int();
+                    in.skip(length > 0 ? (size_t) length * 4 : 0);
+                    break;
+                }
+                case tag_type::TAG_Long_Array: {
+                    int32_t length = in.read_int();
+                    in.skip(length > 0 ? (size_t) length * 8 : 0);
+                    break;
+                }
+                default:
+                    throw nbt_exception("invalid tag type " + std::to_string((int) type));
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef NBTPP_COLUMNAR_HPP_
+#define NBTPP_COLUMNAR_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Extraction of fields from many NBT documents into typed columns, e.g. one row per entity of a world with its
+     * chunk position, id, position and health:
+     *
+     *     columnar::extractor e("Level.Entities", {
+     *         { "x", "/Level.xPos", columnar::column_type::int64 },
+     *         { "z", "/Level.zPos", columnar::column_type::int64 },
+     *         { "id", "id", columnar::column_type::string },
+     *         { "pos_x", "Pos[0]", columnar::column_type::real },
+     *         { "health", "Health", columnar::column_type::real }
+     *     });
+     *     columnar::table t = e.make_table();
+     *     e.extract(chunks, t);
+     *     columnar::write_table(out, t);
+     */
+    namespace columnar {
+
+        enum class column_type : uint8_t {
+            int64 = 1, real = 2, string = 3
+        };
+
+        enum class compression : uint8_t {
+            none = 0, zlib = 1
+        };
+
+        /**
+         * Description of a column to extract.
+         */
+        struct field {
+            /**
+             * Column name
+             */
+            std::string name;
+
+            /**
+             * Names separated by dots, each optionally followed by list or array indices, e.g. "Pos[0]" or
+             * "Item.tag.display.Name". Relative to the row, or to the document when starting with '/'.
+             */
+            std::string path;
+
+            column_type type;
+
+            /**
+             * How the column is compressed by write_table()
+             */
+            compression method = compression::zlib;
+        };
+
+        /**
+         * Values of a column, with a slot for every row whether it is null or not.
+         *
+         * Integer tags are stored in int64 and real columns, float and double tags in real columns and string tags in
+         * string columns, through a dictionary. Any other value is null.
+         */
+        class column {
+        public:
+            column(std::string name, column_type type, compression method = compression::zlib);
+
+            inline const std::string& name() const {
+                return m_name;
+            }
+
+            inline column_type type() const {
+                return m_type;
+            }
+
+            inline compression method() const {
+                return m_method;
+            }
+
+            inline size_t size() const {
+                return m_size;
+            }
+
+            inline bool null(size_t row) const {
+                return !(m_valid[row >> 3] & (1 << (row & 7)));
+            }
+
+            /**
+             * Values of an int64 column.
+             */
+            inline const std::vector<int64_t>& ints() const {
+                return m_ints;
+            }
+
+            /**
+             * Values of a real column.
+             */
+            inline const std::vector<double>& reals() const {
+                return m_reals;
+            }
+
+            /**
+             * Dictionary indices of a string column.
+             */
+            inline const std::vector<uint32_t>& codes() const {
+                return m_codes;
+            }
+
+            /**
+             * Distinct strings of a string column, in order of appearance.
+             */
+            inline const std::vector<std::string>& dictionary() const {
+                return m_dictionary;
+            }
+
+            /**
+             * Validity bitmap, bit (row & 7) of byte (row >> 3) is set for non-null values.
+             */
+            inline const std::vector<uint8_t>& validity() const {
+                return m_valid;
+            }
+
+            /**
+             * String of a row of a string column, empty for a null row.
+             */
+            inline const std::string& string(size_t row) const {
+                static const std::string empty;
+                return null(row) ? empty : m_dictionary[m_codes[row]];
+            }
+
+            void append_null();
+            void append(int64_t v);
+            void append(double v);
+            void append(const std::string& v);
+
+            /**
+             * Append every row of other, which must have the same type.
+             */
+            void append(const column& other);
+
+            /**
+             * Replace the content, used when reading a table.
+             */
+            void assign(size_t size, std::vector<uint8_t> valid, std::vector<int64_t> ints, std::vector<double> reals,
+                std::vector<uint32_t> codes, std::vector<std::string> dictionary);
+        private:
+            void next_row(bool valid);
+
+            std::string m_name;
+            column_type m_type;
+            compression m_method;
+            size_t m_size;
+            std::vector<uint8_t> m_valid;
+            std::vector<int64_t> m_ints;
+            std::vector<double> m_reals;
+            std::vector<uint32_t> m_codes;
+            std::vector<std::string> m_dictionary;
+            std::unordered_map<std::string, uint32_t> m_lookup;
+        };
+
+        /**
+         * Columns of the same number of rows.
+         */
+        struct table {
+            std::vector<column> columns;
+
+            inline size_t rows() const {
+                return columns.empty() ? 0 : columns[0].size();
+            }
+
+            /**
+             * Append the rows of a table with the same columns.
+             */
+            void append(const table& other);
+
+            /**
+             * Column called name, or nullptr.
+             */
+            const column* find(const std::string& name) const;
+        };
+
+        class extractor {
+        public:
+            /**
+             * Create an extractor.
+             *
+             * @param rows      Path of a list whose elements are the rows, or "" for one row per document
+             * @param fields    Columns to extract
+             */
+            extractor(const std::string& rows, std::vector<field> fields);
+
+            /**
+             * Empty table with the columns of this extractor.
+             */
+            table make_table() const;
+
+            /**
+             * Append the rows of a document.
+             */
+            void extract(const tag* document, table& out) const;
+
+            /**
+             * Append the rows of many documents, in order, using several threads.
+             *
+             * @param documents Documents to read, not modified
+             * @param out       Table to append to
+             * @param threads   Number of threads, 0 for the hardware concurrency
+             */
+            void extract(const std::vector<const tag*>& documents, table& out, unsigned threads = 0) const;
+
+            struct step {
+                std::string name;
+                int32_t index;
+            };
+
+            struct path {
+                bool absolute;
+                std::vector<step> steps;
+            };
+        private:
+            path m_rows;
+            std::vector<field> m_fields;
+            std::vector<path> m_paths;
+        };
+
+        /**
+         * Write a table as a columnar file, each column compressed on its own.
+         */
+        void write_table(std::ostream& out, const table& t);
+
+        /**
+         * Read a table written by write_table().
+         */
+        void read_table(std::istream& in, table& t);
+    }
+}
+
+#endif
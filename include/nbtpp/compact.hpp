@@ -0,0 +1,213 @@
+#ifndef NBTPP_COMPACT_HPP_
+#define NBTPP_COMPACT_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tag.hpp"
+#include "codec.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Node of a compact_tree, 16 bytes.
+     *
+     * Scalars are stored inline. Strings, arrays and containers hold a range in one of the pools of the tree, the
+     * children of a compound or list being contiguous nodes.
+     */
+    struct compact_node {
+        struct range {
+            uint32_t first;
+            uint32_t count;
+        };
+
+        tag_type type;
+
+        /**
+         * Element type of a list
+         */
+        tag_type element;
+
+        uint16_t reserved;
+
+        /**
+         * Index in the name table of the tree, compact_tree::no_name for list elements
+         */
+        uint32_t name;
+
+        union {
+            int64_t integer;
+            float float_value;
+            double double_value;
+            range children;
+        } value;
+    };
+
+    /**
+     * Read-only tag tree stored as a few flat arrays instead of one heap object per tag.
+     *
+     * Nodes are compact_node values in one vector, children of a container being contiguous so walking them reads
+     * memory in order. Names are interned in a table, so the keys repeated in every section or entity of a chunk are
+     * stored once. String bytes and array values live in pools indexed by the nodes. A loaded chunk takes several times
+     * less memory than as tags::tag_* objects, and is built with a handful of allocations.
+     *
+     * Nodes are addressed by index, the root is root(). Trees convert to and from tags with the constructor and
+     * to_tag(), and load and save the binary format directly.
+     */
+    class compact_tree {
+    public:
+        static const uint32_t no_name = UINT32_MAX;
+        static const uint32_t npos = UINT32_MAX;
+
+        compact_tree() : m_root(npos) {
+        }
+
+        /**
+         * Build the compact form of a tag tree.
+         */
+        explicit compact_tree(const tag* t);
+
+        /**
+         * Load uncompressed NBT from memory, replacing the tree.
+         *
+         * @throws nbt_exception if the data is not valid NBT
+         */
+        void load(const uint8_t* data, size_t size);
+
+        /**
+         * Load uncompressed NBT from a stream, replacing the tree.
+         */
+        void load(std::istream& in);
+
+        /**
+         * Append the uncompressed NBT form of the tree to out.
+         */
+        void save(std::vector<uint8_t>& out) const;
+
+        /**
+         * Build tags::tag_* objects for a node and its children.
+         *
+         * @return  The tag, owned by the caller
+         */
+        tag* to_tag(uint32_t node) const;
+
+        inline tag* to_tag() const {
+            return empty() ? nullptr : to_tag(m_root);
+        }
+
+        inline bool empty() const {
+            return m_root == npos;
+        }
+
+        /**
+         * Delete the tree.
+         */
+        void clear();
+
+        inline uint32_t root() const {
+            return m_root;
+        }
+
+        inline const compact_node& node(uint32_t i) const {
+            return m_nodes[i];
+        }
+
+        inline tag_type type(uint32_t i) const {
+            return m_nodes[i].type;
+        }
+
+        /**
+         * Name of a node, empty for list elements.
+         */
+        inline codec::string_ref name(uint32_t i) const {
+            if (m_nodes[i].name == no_name)
+                return codec::string_ref("", 0);
+            const compact_node::range& r = m_names[m_nodes[i].name];
+            return codec::string_ref(m_name_pool.data() + r.first, r.count);
+        }
+
+        /**
+         * Number of children of a compound or list, elements of an array, or bytes of a string.
+         */
+        inline uint32_t size(uint32_t i) const {
+            return m_nodes[i].value.children.count;
+        }
+
+        /**
+         * Index of the k-th child of a compound or list.
+         */
+        inline uint32_t child(uint32_t i, uint32_t k) const {
+            return m_nodes[i].value.children.first + k;
+        }
+
+        /**
+         * Child of a compound with the given name, or npos.
+         */
+        uint32_t find(uint32_t i, codec::string_ref name) const;
+
+        /**
+         * Value of a byte, short, int or long.
+         */
+        inline int64_t integer(uint32_t i) const {
+            return m_nodes[i].value.integer;
+        }
+
+        /**
+         * Value of a float or double.
+         */
+        inline double real(uint32_t i) const {
+            return m_nodes[i].type == tag_type::TAG_Float ? m_nodes[i].value.float_value : m_nodes[i].value.double_value;
+        }
+
+        inline codec::string_ref string(uint32_t i) const {
+            return codec::string_ref(m_strings.data() + m_nodes[i].value.children.first, m_nodes[i].value.children.count);
+        }
+
+        inline const int8_t* bytes(uint32_t i) const {
+            return m_bytes.data() + m_nodes[i].value.children.first;
+        }
+
+        inline const int32_t* ints(uint32_t i) const {
+            return m_ints.data() + m_nodes[i].value.children.first;
+        }
+
+        inline const int64_t* longs(uint32_t i) const {
+            return m_longs.data() + m_nodes[i].value.children.first;
+        }
+
+        /**
+         * Number of nodes in the tree.
+         */
+        inline size_t node_count() const {
+            return m_nodes.size();
+        }
+
+        /**
+         * Approximate number of bytes used by the tree, to compare with tag::memory_usage().
+         */
+        size_t memory_usage() const;
+    private:
+        class builder;
+
+        /**
+         * Give back the room left by growing the arrays while building.
+         */
+        void shrink_to_fit();
+
+        template<class Reader>
+        void load_from(Reader& in);
+
+        std::vector<compact_node> m_nodes;
+        std::vector<compact_node::range> m_names;
+        std::vector<char> m_name_pool;
+        std::vector<char> m_strings;
+        std::vector<int8_t> m_bytes;
+        std::vector<int32_t> m_ints;
+        std::vector<int64_t> m_longs;
+        uint32_t m_root;
+    };
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef NBTPP_DEFLATE_HPP_
+#define NBTPP_DEFLATE_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "nbt.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Compress a buffer in one go on the calling thread.
+     *
+     * @param data          Bytes to compress
+     * @param size          Number of bytes
+     * @param compression   nbt::gzip or nbt::zlib, nbt::uncompressed copies the bytes
+     * @param out           Set to the compressed bytes
+     * @param level         zlib compression level, -1 for the default
+     */
+    void compress(const uint8_t* data, size_t size, nbt::compression compression, std::vector<uint8_t>& out, int level = -1);
+
+    /**
+     * Decompress a buffer in one go on the calling thread.
+     *
+     * @param data          Compressed bytes
+     * @param size          Number of bytes
+     * @param compression   nbt::gzip or nbt::zlib, nbt::uncompressed copies the bytes
+     * @param out           Set to the decompressed bytes
+     * @throws nbt_exception if the data is not a valid stream
+     */
+    void decompress(const uint8_t* data, size_t size, nbt::compression compression, std::vector<uint8_t>& out);
+
+    /**
+     * Stream buffer compressing to gzip or zlib on several threads, in the way of pigz.
+     *
+     * Written bytes are cut into blocks, each deflated on a worker with the last 32 KB of the previous block as its
+     * dictionary so the ratio stays close to a single stream. Blocks end on a byte boundary with an empty stored block,
+     * and their checksums are combined, so the output is one standard stream any inflater reads.
+     *
+     * The stream is finished by finish() or the destructor, errors of the workers are thrown from the next write or
+     * from finish(). After an error, or when destroyed while an exception unwinds, the stream is abandoned without its
+     * trailer so a partial output never reads back as a whole one.
+     */
+    class parallel_deflate_streambuf: public std::streambuf {
+    public:
+        static const size_t default_block_size = 128 * 1024;
+
+        /**
+         * @param sink          Stream buffer receiving the compressed stream
+         * @param compression   nbt::gzip or nbt::zlib
+         * @param threads       Number of workers, 0 for the hardware concurrency
+         * @param block_size    Uncompressed bytes per block, at least 32 KB
+         * @param level         zlib compression level, -1 for the default
+         */
+        parallel_deflate_streambuf(std::streambuf* sink, nbt::compression compression, unsigned threads = 0,
+            size_t block_size = default_block_size, int level = -1);
+
+        parallel_deflate_streambuf(const parallel_deflate_streambuf&) = delete;
+        parallel_deflate_streambuf& operator=(const parallel_deflate_streambuf&) = delete;
+
+        ~parallel_deflate_streambuf();
+
+        /**
+         * Compress what is left, write the trailer and stop the workers. Nothing can be written afterwards.
+         *
+         * @throws nbt_exception if compressing or writing failed
+         */
+        void finish();
+
+        /**
+         * Stop the workers without writing what is left or the trailer, leaving the output unfinished. Nothing can be
+         * written afterwards.
+         */
+        void abort();
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+        int sync() override;
+    private:
+        struct block;
+
+        void submit(bool last);
+        void write_oldest();
+        void work();
+        void put(const void* data, size_t size);
+        void stop_workers(bool discard);
+
+        std::streambuf* m_sink;
+        nbt::compression m_compression;
+        size_t m_block_size;
+        int m_level;
+        bool m_finished;
+
+        /**
+         * Whether a block failed to compress or be written, the stream can't be finished then
+         */
+        bool m_failed;
+
+        /**
+         * Block being filled, it is the put area
+         */
+        std::unique_ptr<block> m_current;
+
+        /**
+         * Last 32 KB given to the previous block, dictionary of the next one
+         */
+        std::vector<uint8_t> m_dictionary;
+
+        /**
+         * Submitted blocks in stream order, written once compressed
+         */
+        std::deque<std::shared_ptr<block>> m_pending;
+        std::deque<std::shared_ptr<block>> m_queue;
+        size_t m_max_pending;
+
+        uint32_t m_check;
+        uint64_t m_total;
+
+        std::mutex m_mutex;
+        std::condition_variable m_work;
+        std::condition_variable m_done;
+        bool m_stop;
+        std::vector<std::thread> m_workers;
+    };
+
+    /**
+     * Output stream over a parallel_deflate_streambuf.
+     */
+    class parallel_deflate_ostream: public std::ostream {
+    public:
+        parallel_deflate_ostream(std::ostream& sink, nbt::compression compression, unsigned threads = 0,
+            size_t block_size = parallel_deflate_streambuf::default_block_size, int level = -1) :
+            std::ostream(nullptr), m_buf(sink.rdbuf(), compression, threads, block_size, level) {
+            rdbuf(&m_buf);
+        }
+
+        /**
+         * @see parallel_deflate_streambuf::finish()
+         */
+        inline void finish() {
+            m_buf.finish();
+        }
+
+        /**
+         * @see parallel_deflate_streambuf::abort()
+         */
+        inline void abort() {
+            m_buf.abort();
+        }
+    private:
+        parallel_deflate_streambuf m_buf;
+    };
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef NBTPP_FILTER_HPP_
+#define NBTPP_FILTER_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Condition on an NBT document, tested on its uncompressed bytes without building any tag.
+     *
+     * Only the entries on the paths of the expression are read, everything else being skipped over, and evaluation
+     * stops as soon as the result is known. Documents that match can then be loaded in full. Expressions look like:
+     *
+     *     Level.InhabitedTime > 10000
+     *     any(Level.Entities, id == "minecraft:villager" && Health < 10.0)
+     *     DataVersion >= 2860 || !(Level.Status == "full")
+     *     all(Level.Sections[0].Palette, Name != "minecraft:air")
+     *     any(Tags, . == "boss")
+     *
+     * Grammar:
+     *
+     *     expression := and ("||" and)*
+     *     and        := unary ("&&" unary)*
+     *     unary      := "!" unary | "(" expression ")" | ("any" | "all") "(" path "," expression ")" | path [op literal]
+     *     path       := "." | name ("." name | "[" index "]")*
+     *     op         := "==" | "!=" | "<" | "<=" | ">" | ">="
+     *     literal    := number with an optional SNBT suffix | "string" | true | false
+     *
+     * Names are unquoted letters, digits, '_', '-' and '+', or quoted strings. A path alone is true if it exists.
+     * Paths are relative to the root compound, and inside any() and all() to the list element, "." being the element
+     * itself. any() and all() go over lists and arrays, and are false when the path doesn't exist; all() of an empty
+     * list is true.
+     *
+     * Numbers compare with byte to double tags, as integers if both are integers; strings compare bytewise with string
+     * tags. Comparing a missing value or one of another type is false, whatever the operator.
+     */
+    class filter {
+    public:
+        /**
+         * Compile an expression.
+         *
+         * @throws nbt_exception if the expression is not valid
+         */
+        explicit filter(const std::string& expression);
+
+        /**
+         * Test an uncompressed document.
+         *
+         * @throws nbt_exception if the document is truncated or malformed in the parts read
+         */
+        bool matches(const uint8_t* data, size_t size) const;
+
+        inline bool matches(const std::vector<uint8_t>& data) const {
+            return matches(data.data(), data.size());
+        }
+
+        inline const std::string& expression() const {
+            return m_expression;
+        }
+
+        enum class kind : uint8_t {
+            all_of, any_of, negate, exists, compare, any, all
+        };
+
+        enum class comparison : uint8_t {
+            eq, ne, lt, le, gt, ge
+        };
+
+        struct step {
+            std::string name;
+
+            /**
+             * List or array index, -1 for a name
+             */
+            int32_t index;
+        };
+
+        struct node {
+            kind type;
+            comparison op;
+
+            /**
+             * Value compared to, by type
+             */
+            bool is_string;
+            bool is_integer;
+            int64_t integer;
+            double real;
+            std::string string;
+
+            std::vector<step> path;
+
+            /**
+             * Operands of all_of and any_of, the condition of negate, any and all
+             */
+            std::vector<uint32_t> children;
+        };
+    private:
+        class parser;
+
+        /**
+         * Value found by following a path: its type and the offset of its payload.
+         */
+        struct value {
+            tag_type type;
+            size_t offset;
+        };
+
+        bool eval(uint32_t n, const uint8_t* data, size_t size, value v) const;
+        bool resolve(const std::vector<step>& path, const uint8_t* data, size_t size, value& v) const;
+        bool compare(const node& n, const uint8_t* data, size_t size, value v) const;
+
+        std::string m_expression;
+        std::vector<node> m_nodes;
+        uint32_t m_root;
+    };
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef NBTPP_FORMAT_HPP_
+#define NBTPP_FORMAT_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace nbtpp {
+
+    /**
+     * Number formatting shared by the text outputs, appending to a std::string without going through streams.
+     */
+    namespace format {
+
+        inline void append_integer(std::string& out, int64_t v) {
+            char buf[24];
+            char* p = buf + sizeof(buf);
+            uint64_t u = v < 0 ? 0 - (uint64_t) v : (uint64_t) v;
+            do {
+                *--p = (char) ('0' + u % 10);
+                u /= 10;
+            } while (u != 0);
+            if (v < 0)
+                *--p = '-';
+            out.append(p, buf + sizeof(buf));
+        }
+
+        namespace detail {
+            template<class T>
+            inline void append_real(std::string& out, T v, int min_precision, int max_precision) {
+                if (v == std::floor(v) && std::fabs(v) < 1e15) {
+                    if (v == 0 && std::signbit(v))
+                        out += '-';
+                    append_integer(out, (int64_t) v);
+                    out += ".0";
+                    return;
+                }
+
+                char buf[32];
+                int n = 0;
+                for (int precision = min_precision; precision <= max_precision; precision++) {
+                    n = std::snprintf(buf, sizeof(buf), "%.*g", precision, (double) v);
+                    if (sizeof(T) == sizeof(float) ? std::strtof(buf, nullptr) == (float) v : std::strtod(buf, nullptr) == (double) v)
+                        break;
+                }
+                out.append(buf, n);
+            }
+        }
+
+        /**
+         * Append the shortest decimal form that parses back to v, which must be finite. Integral values get a ".0".
+         */
+        inline void append_float(std::string& out, float v) {
+            detail::append_real(out, v, 6, 9);
+        }
+
+        /**
+         * Append the shortest decimal form that parses back to v, which must be finite. Integral values get a ".0".
+         */
+        inline void append_double(std::string& out, double v) {
+            detail::append_real(out, v, 15, 17);
+        }
+    }
+}
+
+#endif
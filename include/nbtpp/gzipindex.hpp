@@ -0,0 +1,195 @@
+#ifndef NBTPP_GZIPINDEX_HPP_
+#define NBTPP_GZIPINDEX_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "nbt.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Seek index of a large gzip or zlib compressed NBT file, to decode one subtree without inflating everything
+     * before it.
+     *
+     * Building the index inflates the whole file once, taking a checkpoint at a deflate block boundary every span
+     * bytes of output: the compressed offset, the bit offset in that byte and the last 32 KB of output, which is all
+     * inflate needs to resume there. The same pass records where each top-level child of the root starts and ends in
+     * the uncompressed data. Reading a child then only inflates from the checkpoint before it.
+     *
+     * The index can be saved to a sidecar file next to the data, see open(). Each checkpoint costs 32 KB, a 4 MB span
+     * keeps the index under 1% of the uncompressed size. Only the first gzip member of a file is indexed.
+     */
+    class gzip_index {
+    public:
+        static const uint64_t default_span = 4 << 20;
+        static const size_t window_size = 32768;
+
+        /**
+         * Where inflate can resume.
+         */
+        struct checkpoint {
+            /**
+             * Offset in the uncompressed data
+             */
+            uint64_t out;
+
+            /**
+             * Offset in the compressed file of the first byte holding bits of the next block
+             */
+            uint64_t in;
+
+            /**
+             * Number of bits of that byte belonging to the previous block, 0 if the block starts on a byte
+             */
+            uint8_t bits;
+
+            /**
+             * Last 32 KB of output before out, or all of it near the start
+             */
+            std::vector<uint8_t> window;
+        };
+
+        /**
+         * A top-level child of the root, or an element if the root is a list.
+         */
+        struct child {
+            tag_type type;
+
+            /**
+             * Name of the child, empty for list elements
+             */
+            std::string name;
+
+            /**
+             * Offset of the encoded tag in the uncompressed data, at its type byte for compound children and at its
+             * payload for list elements
+             */
+            uint64_t offset;
+
+            /**
+             * Size of the encoded tag
+             */
+            uint64_t size;
+        };
+
+        gzip_index() : m_span(default_span), m_compressed_size(0), m_trailer(0), m_uncompressed_size(0),
+            m_root_type(tag_type::TAG_End) {
+        }
+
+        /**
+         * Build the index of a compressed file by inflating it once.
+         *
+         * @param in    File positioned at its start, offsets in the index are relative to it
+         * @param span  Uncompressed bytes between checkpoints
+         * @throws nbt_exception if the file is not valid compressed NBT
+         */
+        static gzip_index build(std::istream& in, uint64_t span = default_span);
+
+        /**
+         * Load the index of path from its sidecar file, path + ".idx", or build it and write the sidecar if there is
+         * none or it belongs to another file: one of another size, or whose last 8 bytes, the gzip CRC32 and length,
+         * differ.
+         */
+        static gzip_index open(const std::string& path, uint64_t span = default_span);
+
+        /**
+         * Write the index in its sidecar format.
+         */
+        void save(std::ostream& out) const;
+
+        /**
+         * Read an index written by save().
+         *
+         * @throws nbt_exception if the data is not an index
+         */
+        static gzip_index load(std::istream& in);
+
+        /**
+         * Inflate a range of the uncompressed data, starting from the checkpoint before it.
+         *
+         * @param in        The indexed file
+         * @param offset    Offset of the range in the uncompressed data
+         * @param size      Size of the range
+         * @param out       Set to the bytes of the range
+         */
+        void extract(std::istream& in, uint64_t offset, uint64_t size, std::vector<uint8_t>& out) const;
+
+        /**
+         * First child of the root with the given name, or nullptr.
+         */
+        const child* find(const std::string& name) const;
+
+        /**
+         * Decode one child of the root of the indexed file.
+         *
+         * @param in    The indexed file
+         * @param c     A child of this index
+         * @param out   Set to the child, with its name
+         */
+        void load(std::istream& in, const child& c, nbt& out) const;
+
+        /**
+         * Decode the child of the root with the given name.
+         *
+         * @return  Whether the root has such a child
+         */
+        bool load(std::istream& in, const std::string& name, nbt& out) const;
+
+        inline const std::vector<checkpoint>& checkpoints() const {
+            return m_checkpoints;
+        }
+
+        inline const std::vector<child>& children() const {
+            return m_children;
+        }
+
+        inline tag_type root_type() const {
+            return m_root_type;
+        }
+
+        inline const std::string& root_name() const {
+            return m_root_name;
+        }
+
+        /**
+         * Element type of the root if it is a list.
+         */
+        inline tag_type element_type() const {
+            return m_element_type;
+        }
+
+        inline uint64_t span() const {
+            return m_span;
+        }
+
+        inline uint64_t compressed_size() const {
+            return m_compressed_size;
+        }
+
+        /**
+         * Last 8 bytes of the indexed file, the CRC32 and length of a gzip trailer.
+         */
+        inline uint64_t trailer() const {
+            return m_trailer;
+        }
+
+        inline uint64_t uncompressed_size() const {
+            return m_uncompressed_size;
+        }
+    private:
+        uint64_t m_span;
+        uint64_t m_compressed_size;
+        uint64_t m_trailer;
+        uint64_t m_uncompressed_size;
+        std::vector<checkpoint> m_checkpoints;
+        tag_type m_root_type;
+        tag_type m_element_type = tag_type::TAG_End;
+        std::string m_root_name;
+        std::vector<child> m_children;
+    };
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef NBTPP_INSTRUMENTATION_HPP_
+#define NBTPP_INSTRUMENTATION_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+    namespace instrumentation {
+
+        /**
+         * Whether the library was built with NBTPP_INSTRUMENTATION.
+         *
+         * When it is not, every hook compiles to nothing and the counters stay at zero.
+         */
+#ifdef NBTPP_INSTRUMENTATION
+        constexpr bool enabled = true;
+#else
+        constexpr bool enabled = false;
+#endif
+
+        /**
+         * Load and save counters, accumulated per thread.
+         */
+        struct counters {
+            /**
+             * Number of tags decoded, indexed by tag_type (TAG_End markers included).
+             */
+            uint64_t tags[TAG_Long_Array + 1] = { };
+
+            /**
+             * Uncompressed bytes consumed by the parser.
+             */
+            uint64_t bytes_decoded = 0;
+
+            /**
+             * Uncompressed bytes produced by the serializer.
+             */
+            uint64_t bytes_encoded = 0;
+
+            /**
+             * Time spent inflating compressed input, in nanoseconds.
+             */
+            uint64_t decompression_ns = 0;
+
+            /**
+             * Time spent parsing, excluding decompression and allocation, in nanoseconds.
+             */
+            uint64_t load_ns = 0;
+
+            /**
+             * Time spent constructing tag objects while parsing, in nanoseconds.
+             */
+            uint64_t allocation_ns = 0;
+
+            /**
+             * Time spent serializing, in nanoseconds.
+             */
+            uint64_t save_ns = 0;
+
+            /**
+             * Largest element counts seen for each array-like tag.
+             */
+            uint64_t largest_byte_array = 0;
+            uint64_t largest_int_array = 0;
+            uint64_t largest_long_array = 0;
+            uint64_t largest_list = 0;
+
+            /**
+             * Merge counters from another thread into this one.
+             */
+            counters& operator+=(const counters& other);
+        };
+
+        /**
+         * Counters of the calling thread.
+         */
+        counters& thread_counters();
+
+        /**
+         * Reset the counters of the calling thread.
+         */
+        void reset();
+
+        /**
+         * Export every counter as a (name, value) pair, for feeding a metrics pipeline.
+         *
+         * Per-type tag counts are named "tags.<type name>", e.g. "tags.TAG_Compound".
+         *
+         * @param c     Counters to export
+         * @param sink  Called once per counter
+         */
+        void export_counters(const counters& c, const std::function<void(const std::string&, uint64_t)>& sink);
+
+        /**
+         * Write every counter to out, one "name value" pair per line.
+         *
+         * @param out   Stream to write to
+         * @param c     Counters to write
+         */
+        void write_counters(std::ostream& out, const counters& c);
+    }
+}
+
+/**
+ * Internal hook, runs stmt only when built with NBTPP_INSTRUMENTATION.
+ */
+#ifdef NBTPP_INSTRUMENTATION
+#define NBTPP_INSTRUMENT(stmt) do { stmt; } while (0)
+#else
+#define NBTPP_INSTRUMENT(stmt) do { } while (0)
+#endif
+
+#endif
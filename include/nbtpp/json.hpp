@@ -0,0 +1,58 @@
+#ifndef NBTPP_JSON_HPP_
+#define NBTPP_JSON_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+
+    /**
+     * JSON export of tag trees, or of encoded NBT without building tags.
+     *
+     * Output is appended to a std::string, or written to a stream in 64 KB pieces so exporting a large file does not
+     * hold the whole text in memory. Strings are converted from the modified UTF-8 of NBT to standard UTF-8, escaping
+     * only what JSON requires and NUL, so strict parsers accept the output.
+     */
+    namespace json {
+
+        enum class mode : uint8_t {
+            /**
+             * Compounds as objects, lists and arrays as JSON arrays, numbers as JSON numbers. NaN and infinities
+             * become null and the tag types are lost.
+             */
+            plain = 0,
+
+            /**
+             * Every tag as {"type":"int","value":1}, lists with an extra "element" type and the root with its "name".
+             * Longs are written as strings and NaN and infinities as "NaN", "Infinity" and "-Infinity", so the tree can
+             * be rebuilt exactly.
+             */
+            typed = 1
+        };
+
+        /**
+         * Append the JSON form of a tag to out.
+         */
+        void write(const tag* t, std::string& out, mode m = mode::plain);
+
+        /**
+         * Write the JSON form of a tag to a stream.
+         */
+        void write(const tag* t, std::ostream& out, mode m = mode::plain);
+
+        /**
+         * Append the JSON form of an uncompressed NBT document in memory to out, without building its tags.
+         */
+        void write_encoded(const uint8_t* data, size_t size, std::string& out, mode m = mode::plain);
+
+        /**
+         * Write the JSON form of an uncompressed NBT document read from in, without building its tags.
+         */
+        void write_encoded(std::istream& in, std::ostream& out, mode m = mode::plain);
+    }
+}
+
+#endif
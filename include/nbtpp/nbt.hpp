@@ -2,7 +2,10 @@
 #define NBT_HPP_
 
 #include <iostream>
+#include <memory>
+#include <vector>
 #include "tag.hpp"
+#include "recycler.hpp"
 
 namespace nbtpp {
 
@@ -28,6 +31,26 @@ namespace nbtpp {
         nbt(tag* t) : m_tag(t) {
         }
 
+        nbt(const nbt&) = delete;
+        nbt& operator=(const nbt&) = delete;
+
+        /**
+         * Take the tree of other, leaving it blank.
+         */
+        nbt(nbt&& other) : m_tag(other.m_tag), m_compression(other.m_compression), m_recycler(std::move(other.m_recycler)) {
+            other.m_tag = nullptr;
+        }
+
+        nbt& operator=(nbt&& other) {
+            if (this != &other) {
+                content(other.m_tag);
+                m_compression = other.m_compression;
+                m_recycler = std::move(other.m_recycler);
+                other.m_tag = nullptr;
+            }
+            return *this;
+        }
+
         /**
          * Loads NBT data from a file, detecting its compression (gzip'd or uncompressed) and setting the compressed flag accordingly.
          * @param in    File to load from
@@ -57,18 +80,84 @@ namespace nbtpp {
          */
         void load(std::istream& in);
 
+        /**
+         * Loads uncompressed data from memory
+         * @param data  Start of the data
+         * @param size  Size of the data in bytes
+         */
+        void load(const uint8_t* data, size_t size);
+
+        /**
+         * Loads uncompressed data from memory on several threads.
+         *
+         * The element boundaries of the root list or compound are found first by skipping over the encoded tags, a
+         * child holding most of the data being split in turn. Ranges of elements are then parsed on each thread and
+         * stitched into the tree in order. Documents under 1 MB or with a scalar root are loaded on the calling thread.
+         *
+         * @param data      Start of the data
+         * @param size      Size of the data in bytes
+         * @param threads   Number of threads, 0 for the hardware concurrency
+         */
+        void load_parallel(const uint8_t* data, size_t size, unsigned threads = 0);
+
+        /**
+         * Reads uncompressed data from a stream into memory and loads it on several threads.
+         *
+         * @see load_parallel(const uint8_t*, size_t, unsigned)
+         */
+        void load_parallel(std::istream& in, unsigned threads = 0);
+
+        /**
+         * Loads uncompressed data from a stream, decoding into the current tree instead of deleting it.
+         *
+         * Nodes, names, strings and arrays are reused where the new data has the same shape, leftover nodes are kept
+         * for later reloads. Meant for loading many similar documents, e.g. chunks, through one nbt.
+         *
+         * @param in    Stream to load from
+         * @see tree_recycler
+         */
+        void reload(std::istream& in);
+
+        /**
+         * Loads uncompressed data from memory, decoding into the current tree instead of deleting it.
+         *
+         * @param data  Start of the data
+         * @param size  Size of the data in bytes
+         * @see reload(std::istream&)
+         */
+        void reload(const uint8_t* data, size_t size);
+
+        /**
+         * Recycler used by reload(), e.g. to release detached subtrees to it.
+         */
+        tree_recycler& recycler();
+
         /**
          * Saves NBT to a file, using compression
          * @param out   File to save to
          */
         void save_file(std::ofstream& out);
 
+        /**
+         * Saves NBT to a file, compressing blocks of it on several threads if the compression is gzip or zlib
+         * @param out       File to save to
+         * @param threads   Number of compression threads, 0 for the hardware concurrency
+         * @see parallel_deflate_streambuf
+         */
+        void save_file(std::ofstream& out, unsigned threads);
+
         /**
          * Saves uncompressed data to a stream
          * @param out   Stream to save to
          */
         void save(std::ostream& out);
 
+        /**
+         * Appends uncompressed data to a buffer
+         * @param out   Buffer to append to
+         */
+        void save(std::vector<uint8_t>& out);
+
         /**
          * Retrieve the tag
          * @return
@@ -84,7 +173,7 @@ namespace nbtpp {
         template <class T>
         inline T* content() const {
             static_assert(std::is_base_of<nbtpp::tag, T>::value, "T must be child class of nbtpp::tag");
-            return dynamic_cast<T*>(content());
+            return tag_cast<T>(content());
         }
 
         /**
@@ -98,6 +187,32 @@ namespace nbtpp {
             m_tag = t;
         }
 
+        /**
+         * Set a new tag, delete the old one.
+         */
+        void content(std::unique_ptr<tag> t) {
+            content(t.release());
+        }
+
+        /**
+         * Remove the tag without deleting it, giving its ownership to the caller and leaving this NBT blank.
+         */
+        std::unique_ptr<tag> take() {
+            tag* t = m_tag;
+            m_tag = nullptr;
+            return std::unique_ptr<tag>(t);
+        }
+
+        /**
+         * Estimate the memory used by this NBT and its whole tag tree.
+         *
+         * @return  Number of bytes used
+         * @see tag::memory_usage()
+         */
+        size_t memory_usage() const {
+            return sizeof(nbt) + (m_tag != nullptr ? m_tag->memory_usage() : 0);
+        }
+
         /**
          * Pretty prints a NBT tag to out
          */
@@ -122,6 +237,7 @@ namespace nbtpp {
     private:
         tag *m_tag;
         compression m_compression = uncompressed;
+        std::unique_ptr<tree_recycler> m_recycler;
     };
 
     /**
@@ -0,0 +1,135 @@
+#ifndef NBTPP_PUSHPARSER_HPP_
+#define NBTPP_PUSHPARSER_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Incremental parser for uncompressed NBT arriving in chunks, e.g. from the network.
+     *
+     * Bytes are pushed with feed() as they arrive; the parse state is kept between calls so a document may be split
+     * anywhere. Parsing stops right after the end of a document, leaving the following bytes unconsumed so several
+     * back-to-back documents can be read from one stream without copying the input:
+     *
+     *     size_t used;
+     *     while (size > 0 && p.feed(data, size, used) == push_parser::complete) {
+     *         handle(p.take());
+     *         data += used;
+     *         size -= used;
+     *     }
+     *
+     * The parser never throws on malformed input, it reports push_parser::error instead.
+     */
+    class push_parser {
+    public:
+        enum status : uint8_t {
+            need_more = 0, complete = 1, error = 2
+        };
+
+        /**
+         * Create a parser.
+         *
+         * @param max_size  Maximum size of a document in bytes, checked before allocating arrays and strings. 0 means
+         *                  unlimited.
+         */
+        push_parser(size_t max_size = 0);
+
+        push_parser(const push_parser&) = delete;
+        push_parser& operator=(const push_parser&) = delete;
+
+        virtual ~push_parser();
+
+        /**
+         * Push bytes to the parser.
+         *
+         * @param data      Bytes to parse
+         * @param size      Number of bytes
+         * @param consumed  Set to the number of bytes used, less than size if a document ended before
+         * @return          The parser status
+         */
+        status feed(const uint8_t* data, size_t size, size_t& consumed);
+
+        /**
+         * Push bytes to the parser, ignoring how many were consumed.
+         */
+        status feed(const uint8_t* data, size_t size) {
+            size_t consumed;
+            return feed(data, size, consumed);
+        }
+
+        /**
+         * Current status.
+         */
+        inline status state() const {
+            return m_status;
+        }
+
+        /**
+         * Take the parsed tree once complete, and get ready for the next document.
+         *
+         * @return  Root tag, owned by the caller, or nullptr if the document is not complete
+         */
+        tag* take();
+
+        /**
+         * Drop any partially parsed document and error.
+         */
+        void reset();
+
+        /**
+         * Description of the error, when state() is error.
+         */
+        inline const std::string& error_message() const {
+            return m_error;
+        }
+
+        /**
+         * Number of bytes consumed in the current document.
+         */
+        inline size_t position() const {
+            return m_position;
+        }
+    private:
+        enum phase : uint8_t {
+            read_type, read_name_length, read_name, read_header, read_body
+        };
+
+        struct frame {
+            tag* container;
+            tag_type content_type;
+            int32_t remaining;
+        };
+
+        bool gather(const uint8_t*& in, const uint8_t* end, size_t size);
+        void attach(tag* t);
+        void begin_header(tag_type type);
+        void header_done();
+        void body_done();
+        void value_done();
+        void fail(const std::string& message);
+        bool reserve(size_t size);
+
+        size_t m_max_size;
+        status m_status;
+        phase m_phase;
+        tag_type m_type;
+        tag* m_root;
+        tag* m_current;
+        std::vector<frame> m_stack;
+        std::string m_name;
+        std::string m_string;
+        uint8_t m_scratch[8];
+        size_t m_have;
+        size_t m_body_size;
+        size_t m_body_have;
+        size_t m_position;
+        std::string m_error;
+    };
+}
+
+#endif
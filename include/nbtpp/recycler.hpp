@@ -0,0 +1,75 @@
+#ifndef NBTPP_RECYCLER_HPP_
+#define NBTPP_RECYCLER_HPP_
+
+#include <cstddef>
+#include <vector>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Decodes NBT into an existing tree, reusing its nodes and their string and vector capacity wherever the shape of
+     * the new data matches, and keeping nodes left over in per-type free lists for later loads.
+     *
+     * Used by nbt::reload(). Once successive documents have a similar shape, loading one allocates next to nothing.
+     */
+    class tree_recycler {
+    public:
+        /**
+         * @param max_free  Maximum number of free nodes kept, further released nodes are deleted
+         */
+        tree_recycler(size_t max_free = 65536) : m_max_free(max_free), m_free_count(0) {
+        }
+
+        tree_recycler(const tree_recycler&) = delete;
+        tree_recycler& operator=(const tree_recycler&) = delete;
+
+        ~tree_recycler() {
+            clear();
+        }
+
+        /**
+         * Decode a tag, reusing old.
+         *
+         * @param in    Reader positioned on the tag, a codec::buffer_reader or codec::stream_reader
+         * @param old   Tree to reuse, owned by the recycler from now on, or nullptr
+         * @return      The decoded tag, owned by the caller
+         */
+        template<class Reader>
+        tag* reload(Reader& in, tag* old);
+
+        /**
+         * Give a tree to the free lists.
+         */
+        void release(tag* t);
+
+        /**
+         * Number of nodes in the free lists.
+         */
+        inline size_t free_count() const {
+            return m_free_count;
+        }
+
+        /**
+         * Delete every free node.
+         */
+        void clear();
+    private:
+        template<class Reader>
+        tag* reload(Reader& in, tag* old, tag_type type);
+
+        template<class T>
+        T* acquire(tag* old, tag_type type);
+
+        size_t m_max_free;
+        size_t m_free_count;
+        std::vector<tag*> m_free[tag_type::TAG_Long_Array + 1];
+        /**
+         * Name being read, its buffer is swapped with the name of the node it goes to
+         */
+        std::string m_name;
+    };
+}
+
+#endif
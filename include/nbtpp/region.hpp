@@ -0,0 +1,159 @@
+#ifndef NBTPP_REGION_HPP_
+#define NBTPP_REGION_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "nbt.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Reader and writer of Anvil region files (.mca), each holding 32x32 chunks.
+     *
+     * Chunks are addressed by their coordinates within the region, only the lower 5 bits of x and z are used so world
+     * chunk coordinates work too. Stored chunks are kept as dirty until save(), which compresses them all concurrently
+     * and rewrites the file.
+     */
+    class region_file {
+    public:
+        static const size_t sector_size = 4096;
+
+        /**
+         * Flag of the compression byte of chunks too large for the region, stored in c.<x>.<z>.mcc next to it with
+         * x and z the world chunk coordinates.
+         */
+        static const uint8_t external_flag = 0x80;
+
+        /**
+         * Open a region file and read its header.
+         *
+         * @throws nbt_exception if the file can't be read
+         */
+        region_file(const std::string& path);
+
+        /**
+         * Create an empty region file, replacing any file at path.
+         *
+         * @throws nbt_exception if the file can't be written
+         */
+        static void create(const std::string& path);
+
+        /**
+         * Path of the .mcc file of an external chunk, next to the region and named after the world coordinates of
+         * the chunk, from the region coordinates in the name of the region file.
+         *
+         * @param region_path   Path of the region file, named r.<x>.<z>.mca
+         * @throws nbt_exception if the region file is not named that way
+         */
+        static std::string external_path(const std::string& region_path, int32_t x, int32_t z);
+
+        /**
+         * Read the .mcc file of an external chunk, its data compressed as the compression byte of its record says.
+         *
+         * @throws nbt_exception if the file can't be read
+         */
+        static void read_external(const std::string& region_path, int32_t x, int32_t z, std::vector<uint8_t>& data);
+
+        inline const std::string& path() const {
+            return m_path;
+        }
+
+        /**
+         * Whether the chunk is stored in the file.
+         */
+        inline bool exists(int32_t x, int32_t z) const {
+            return m_locations[index(x, z)] != 0;
+        }
+
+        /**
+         * Location of the chunk as stored in the header: first sector << 8 | sector count, 0 if not stored.
+         */
+        inline uint32_t location(int32_t x, int32_t z) const {
+            return m_locations[index(x, z)];
+        }
+
+        /**
+         * Last modification time of the chunk, in seconds since the epoch.
+         */
+        inline uint32_t timestamp(int32_t x, int32_t z) const {
+            return m_timestamps[index(x, z)];
+        }
+
+        /**
+         * Read the stored bytes of a chunk, still compressed, from its .mcc file for an external chunk.
+         *
+         * @param data          Set to the chunk bytes
+         * @param compression   Set to the compression of the bytes
+         * @return              false if the chunk is not stored
+         */
+        bool read(int32_t x, int32_t z, std::vector<uint8_t>& data, nbt::compression& compression);
+
+        /**
+         * Read the record of a chunk exactly as stored: its length, compression byte and data, whatever the
+         * compression, to copy it without decoding it.
+         *
+         * @param record    Set to the record, 4 + length bytes
+         * @return          false if the chunk is not stored
+         */
+        bool read_record(int32_t x, int32_t z, std::vector<uint8_t>& record);
+
+        /**
+         * Load a chunk, reusing the tree already in out.
+         *
+         * @return  false if the chunk is not stored
+         */
+        bool load(int32_t x, int32_t z, nbt& out);
+
+        /**
+         * Decode stored chunk bytes with nbt::reload().
+         */
+        static void decode(const uint8_t* data, size_t size, nbt::compression compression, nbt& out);
+
+        /**
+         * Replace a chunk on the next save(). Reads keep returning the stored chunk until then.
+         *
+         * @param chunk         Chunk to store, its compression is not used
+         * @param compression   Compression of the stored bytes
+         */
+        void store(int32_t x, int32_t z, nbt chunk, nbt::compression compression = nbt::zlib);
+
+        /**
+         * Number of chunks waiting for save().
+         */
+        inline size_t dirty() const {
+            return m_dirty.size();
+        }
+
+        /**
+         * Serialize and compress every dirty chunk concurrently, then rewrite the file with the other chunks copied
+         * as they are stored. The file is written next to the region and renamed over it.
+         *
+         * @param threads   Number of threads, 0 for the hardware concurrency
+         * @throws nbt_exception if a chunk is larger than 1 MB compressed or the file can't be written
+         */
+        void save(unsigned threads = 0);
+    private:
+        struct dirty_chunk {
+            size_t index;
+            nbt chunk;
+            nbt::compression compression;
+        };
+
+        void read_header();
+
+        static inline size_t index(int32_t x, int32_t z) {
+            return (x & 31) + (z & 31) * 32;
+        }
+
+        std::string m_path;
+        std::ifstream m_file;
+        uint32_t m_locations[1024];
+        uint32_t m_timestamps[1024];
+        std::vector<dirty_chunk> m_dirty;
+    };
+}
+
+#endif
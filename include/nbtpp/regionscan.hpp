@@ -0,0 +1,115 @@
+#ifndef NBTPP_REGIONSCAN_HPP_
+#define NBTPP_REGIONSCAN_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "nbt.hpp"
+#include "nbtexception.hpp"
+
+namespace nbtpp {
+    class filter;
+
+    /**
+     * Reads every chunk of many region files with a deep queue of asynchronous reads, for whole-world scans.
+     *
+     * Chunk sectors are read in file order with up to queue_depth reads in flight, through io_uring on Linux or else
+     * a pool of threads calling pread(), or reading streams where there is no pread(). Each completed read goes
+     * straight to a decoding thread, which decompresses and parses it into a tree reused for the chunks of that thread,
+     * then hands it to the visitor.
+     */
+    class region_scanner {
+    public:
+        enum class backend : uint8_t {
+            /**
+             * io_uring if the kernel allows it, else the thread pool
+             */
+            automatic = 0,
+            io_uring = 1,
+            thread_pool = 2
+        };
+
+        /**
+         * Called for each chunk from a decoding thread, with the region path and the chunk coordinates within the
+         * region. Calls happen concurrently and the tree is only valid during the call.
+         */
+        typedef std::function<void(const std::string& path, int32_t x, int32_t z, nbt& chunk)> visitor;
+
+        /**
+         * Called for each chunk that can't be read or decoded, with the region path and the chunk coordinates within
+         * the region, or -1, -1 for a region file that can't be read at all. Calls happen concurrently, and the scan
+         * goes on with the other chunks.
+         */
+        typedef std::function<void(const std::string& path, int32_t x, int32_t z, const nbt_exception& error)> error_handler;
+
+        /**
+         * @param queue_depth   Maximum number of chunks read or waiting for decoding at once
+         * @param threads       Number of decoding threads, 0 for the hardware concurrency
+         * @param use           Backend to read with, io_uring falls back to the thread pool if the kernel refuses it
+         */
+        region_scanner(unsigned queue_depth = 128, unsigned threads = 0, backend use = backend::automatic);
+
+        /**
+         * Read, decode and visit every chunk of the region files. Chunks stored outside their region are read from
+         * their .mcc file.
+         *
+         * @param where     Filter tested on the decompressed bytes of each chunk, only matching chunks being parsed and
+         *                  visited, or nullptr to visit every chunk
+         * @param errors    Called for each chunk or file that can't be read or decoded, or empty to stop the scan at
+         *                  the first one
+         * @throws nbt_exception without an error handler, on the first file that can't be read or chunk that can't be
+         *         decoded, after the reads in flight are done. Exceptions of the visitor and the error handler are
+         *         rethrown the same way.
+         */
+        void scan(const std::vector<std::string>& paths, const visitor& visit, const filter* where = nullptr,
+            const error_handler& errors = error_handler());
+
+        /**
+         * Backend used by the last scan.
+         */
+        inline backend used() const {
+            return m_used;
+        }
+
+        /**
+         * Number of chunks visited by the last scan.
+         */
+        inline uint64_t chunks() const {
+            return m_chunks;
+        }
+
+        /**
+         * Number of chunks left out by the filter of the last scan.
+         */
+        inline uint64_t filtered() const {
+            return m_filtered;
+        }
+
+        /**
+         * Number of chunks and files given to the error handler by the last scan.
+         */
+        inline uint64_t errors() const {
+            return m_errors;
+        }
+
+        /**
+         * Number of chunk bytes read by the last scan.
+         */
+        inline uint64_t bytes_read() const {
+            return m_bytes_read;
+        }
+    private:
+        unsigned m_queue_depth;
+        unsigned m_threads;
+        backend m_backend;
+        backend m_used;
+        uint64_t m_chunks;
+        uint64_t m_filtered;
+        uint64_t m_errors;
+        uint64_t m_bytes_read;
+    };
+}
+
+#endif
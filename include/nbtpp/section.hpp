@@ -0,0 +1,196 @@
+#ifndef NBTPP_SECTION_HPP_
+#define NBTPP_SECTION_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+    namespace tags {
+        class tag_compound;
+        class tag_bytearray;
+        class tag_longarray;
+    }
+
+    /**
+     * Numbers block states or biomes by their name, so palettes of different sections can be compared as integers.
+     *
+     * Block states are named as blockdata::state_string() does, e.g. "minecraft:oak_stairs[facing=north,half=bottom]".
+     * Names keep their id for the lifetime of the registry. Interning and lookups may happen from several threads.
+     */
+    class palette_registry {
+    public:
+        static const uint32_t npos = UINT32_MAX;
+
+        /**
+         * Id of a name, adding it if needed.
+         */
+        uint32_t intern(const std::string& name);
+
+        /**
+         * Id of a block state palette entry, a compound with a Name and optional Properties.
+         */
+        uint32_t intern(const tags::tag_compound* entry);
+
+        /**
+         * Id of a name, or npos if it was never interned.
+         */
+        uint32_t find(const std::string& name) const;
+
+        /**
+         * Name of an id, valid as long as the registry.
+         */
+        const std::string& name(uint32_t id) const;
+
+        size_t size() const;
+    private:
+        mutable std::mutex m_mutex;
+        std::unordered_map<std::string, uint32_t> m_ids;
+
+        /**
+         * Names by id, a deque so references stay valid as it grows
+         */
+        std::deque<std::string> m_names;
+    };
+
+    /**
+     * Typed access to a 16x16x16 chunk section compound.
+     *
+     * Both the 1.18+ layout (block_states and biomes compounds) and the 1.13-1.17 one (Palette and BlockStates) are
+     * read, with either packing of the indices in the longs. Palette entries are resolved to registry ids when the view
+     * is built; block indices are unpacked from the longs on first use. Light and block positions are indexed
+     * y * 256 + z * 16 + x.
+     *
+     * The view points into the section, which must outlive it and not change. A view is cheap and meant to be used by
+     * a single thread.
+     */
+    class section_view {
+    public:
+        static const size_t volume = 4096;
+
+        /**
+         * @param section   Section compound
+         * @param states    Registry to resolve the block palette with
+         * @param biomes    Registry to resolve the biome palette with, or nullptr to ignore biomes
+         * @throws nbt_exception if an array has the wrong size for its palette
+         */
+        section_view(const tags::tag_compound* section, palette_registry& states, palette_registry* biomes = nullptr);
+
+        /**
+         * Section height in chunk sections, e.g. -4 for the blocks from y = -64 to -49.
+         */
+        inline int32_t y() const {
+            return m_y;
+        }
+
+        /**
+         * Whether the section has a block palette. Sections without one are all air in practice.
+         */
+        inline bool has_blocks() const {
+            return !m_palette.empty();
+        }
+
+        /**
+         * Registry ids of the block palette entries.
+         */
+        inline const std::vector<uint32_t>& palette() const {
+            return m_palette;
+        }
+
+        /**
+         * Palette index of every block, unpacked on the first call.
+         *
+         * @throws nbt_exception if an index is outside of the palette
+         */
+        const uint16_t* indices() const;
+
+        /**
+         * Registry id of a block, with x, y and z in 0-15, or palette_registry::npos if the section has no blocks.
+         */
+        inline uint32_t block(uint32_t x, uint32_t y, uint32_t z) const {
+            if (m_palette.size() <= 1)
+                return m_palette.empty() ? palette_registry::npos : m_palette[0];
+            return m_palette[indices()[(y << 8) | (z << 4) | x]];
+        }
+
+        /**
+         * Write the registry id of every block to out, which has room for volume ids.
+         */
+        void blocks(uint32_t* out) const;
+
+        /**
+         * Number of blocks with a state, by registry id.
+         */
+        size_t count(uint32_t state) const;
+
+        /**
+         * Add the number of blocks of each state to counts, indexed by registry id and grown as needed.
+         */
+        void histogram(std::vector<uint32_t>& counts) const;
+
+        /**
+         * Registry id of the biome around a block, with x, y and z in 0-15, or palette_registry::npos if the section
+         * has no biomes or they were not resolved.
+         */
+        uint32_t biome(uint32_t x, uint32_t y, uint32_t z) const;
+
+        inline bool has_block_light() const {
+            return m_block_light != nullptr;
+        }
+
+        inline bool has_sky_light() const {
+            return m_sky_light != nullptr;
+        }
+
+        /**
+         * Unpack the BlockLight nibbles, one byte per block, into out of volume bytes. Zeros if the section has none.
+         */
+        void block_light(uint8_t* out) const;
+
+        /**
+         * Unpack the SkyLight nibbles, one byte per block, into out of volume bytes. Zeros if the section has none.
+         */
+        void sky_light(uint8_t* out) const;
+
+        uint8_t block_light(uint32_t x, uint32_t y, uint32_t z) const;
+
+        uint8_t sky_light(uint32_t x, uint32_t y, uint32_t z) const;
+
+        /**
+         * Highest BlockLight level in the section, 0 if it has none.
+         */
+        uint8_t max_block_light() const;
+
+        /**
+         * Highest SkyLight level in the section, 0 if it has none.
+         */
+        uint8_t max_sky_light() const;
+    private:
+        int32_t m_y;
+        std::vector<uint32_t> m_palette;
+        const tags::tag_longarray* m_data;
+        uint32_t m_bits;
+
+        /**
+         * Indices span two longs, as before 1.16
+         */
+        bool m_spanning;
+
+        std::vector<uint32_t> m_biome_palette;
+        const tags::tag_longarray* m_biome_data;
+        uint32_t m_biome_bits;
+
+        const int8_t* m_block_light;
+        const int8_t* m_sky_light;
+
+        mutable bool m_unpacked;
+        mutable uint16_t m_indices[volume];
+    };
+}
+
+#endif
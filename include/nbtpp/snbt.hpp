@@ -0,0 +1,56 @@
+#ifndef NBTPP_SNBT_HPP_
+#define NBTPP_SNBT_HPP_
+
+#include <iostream>
+#include <string>
+
+#include "tag.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Stringified NBT, the text form used by commands and datapacks, e.g. {Count:1b,id:"minecraft:stone"}.
+     *
+     * Numbers carry a type suffix (b, s, L, f, d, none for ints and doubles with a decimal point), typed arrays are
+     * written [B;...], [I;...] and [L;...], and keys are only quoted when needed. Floats and doubles are written with
+     * the fewest digits that parse back to the same value, so a tree survives a round trip unchanged.
+     */
+    namespace snbt {
+
+        /**
+         * Parse SNBT in a single pass.
+         *
+         * @param data  Text to parse
+         * @param size  Length of the text
+         * @param name  Name given to the root tag, SNBT has none
+         * @return      The root tag, owned by the caller
+         * @throws nbt_exception with the position of the error if the text is not valid SNBT
+         */
+        tag* parse(const char* data, size_t size, std::string name = "");
+
+        inline tag* parse(const std::string& text, std::string name = "") {
+            return parse(text.data(), text.size(), std::move(name));
+        }
+
+        /**
+         * Append the SNBT form of a tag's value to out, without its name.
+         */
+        void write(const tag* t, std::string& out);
+
+        /**
+         * Write the SNBT form of a tag's value to a stream.
+         */
+        void write(const tag* t, std::ostream& out);
+
+        /**
+         * SNBT form of a tag's value.
+         */
+        inline std::string to_string(const tag* t) {
+            std::string out;
+            write(t, out);
+            return out;
+        }
+    }
+}
+
+#endif
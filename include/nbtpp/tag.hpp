@@ -4,9 +4,12 @@
 #include <cstdint>
 #include <string>
 #include <iostream>
+#include <type_traits>
+#include <utility>
 
 namespace nbtpp {
     class nbt;
+    class tree_recycler;
 
     enum tag_type : uint8_t {
         TAG_End = 0,
@@ -32,29 +35,104 @@ namespace nbtpp {
      */
     class tag {
         friend class nbt;
+        friend class tree_recycler;
     public:
         virtual ~tag() {
         }
 
-        std::string name() const {
+        const std::string& name() const {
             return m_name;
         }
 
-        void name(const std::string& name) {
-            m_name = name;
+        void name(std::string name) {
+            m_name = std::move(name);
         }
 
         tag_type type() const {
             return m_type;
         }
+
+        /**
+         * Estimate the memory used by this tag and all of its children.
+         *
+         * Counts the node objects themselves, heap-allocated name and value strings, vector capacities and array
+         * payloads. Allocator bookkeeping overhead is not included.
+         *
+         * @return  Number of bytes used
+         */
+        virtual size_t memory_usage() const = 0;
     protected:
-        tag(const std::string& name, tag_type type) : m_name(name), m_type(type) {
+        tag(std::string name, tag_type type) : m_name(std::move(name)), m_type(type) {
+        }
+
+        tag(const tag&) = default;
+        tag(tag&&) = default;
+        tag& operator=(const tag&) = default;
+        tag& operator=(tag&&) = default;
+
+        /**
+         * Heap memory owned by the name of this tag.
+         */
+        size_t name_memory_usage() const {
+            return string_memory_usage(m_name);
+        }
+
+        /**
+         * Heap memory owned by a string, zero when it fits in the small string buffer.
+         *
+         * @param s String to measure
+         * @return  Number of heap bytes used by s
+         */
+        static size_t string_memory_usage(const std::string& s) {
+            const char* data = s.data();
+            const char* self = reinterpret_cast<const char*>(&s);
+            if (data >= self && data < self + sizeof(std::string))
+                return 0;
+            return s.capacity() + 1;
         }
     private:
         std::string m_name;
         tag_type m_type;
     };
 
+    /**
+     * Maps a tag class to its tag_type, specialized next to every tag_* class.
+     *
+     * The specialization for the tag base class uses TAG_Undef, meaning any type.
+     */
+    template<class T>
+    struct tag_traits;
+
+    template<>
+    struct tag_traits<tag> {
+        static constexpr tag_type type = tag_type::TAG_Undef;
+    };
+
+    /**
+     * Checked downcast, comparing the stored tag_type instead of using RTTI.
+     *
+     * @param t Tag to cast, may be nullptr
+     * @return  t as a T, or nullptr if t is nullptr or of another type
+     */
+    template<class T>
+    inline T* tag_cast(tag* t) {
+        static_assert(std::is_base_of<nbtpp::tag, T>::value, "T must be child class of nbtpp::tag");
+        if (t == nullptr || (tag_traits<T>::type != tag_type::TAG_Undef && t->type() != tag_traits<T>::type))
+            return nullptr;
+        return static_cast<T*>(t);
+    }
+
+    /**
+     * Checked downcast, comparing the stored tag_type instead of using RTTI.
+     *
+     * @param t Tag to cast, may be nullptr
+     * @return  t as a T, or nullptr if t is nullptr or of another type
+     */
+    template<class T>
+    inline const T* tag_cast(const tag* t) {
+        return tag_cast<T>(const_cast<tag*>(t));
+    }
+
 }
 
 #include "tags/tagend.hpp"
@@ -71,4 +149,6 @@ namespace nbtpp {
 #include "tags/tagintarray.hpp"
 #include "tags/taglongarray.hpp"
 
+#include "visit.hpp"
+
 #endif
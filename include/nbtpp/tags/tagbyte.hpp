@@ -8,13 +8,22 @@ namespace nbtpp {
 
         class tag_byte: public tag {
         public:
-            tag_byte(std::string name, int8_t value) : tag(name, tag_type::TAG_Byte), m_value(value) {
+            tag_byte(std::string name, int8_t value) : tag(std::move(name), tag_type::TAG_Byte), m_value(value) {
 
             }
             virtual ~tag_byte() {
 
             }
 
+            tag_byte(const tag_byte&) = default;
+            tag_byte(tag_byte&&) noexcept = default;
+            tag_byte& operator=(const tag_byte&) = default;
+            tag_byte& operator=(tag_byte&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_byte) + name_memory_usage();
+            }
+
             inline const int8_t value() const {
                 return m_value;
             }
@@ -26,6 +35,11 @@ namespace nbtpp {
             int8_t m_value;
         };
     }
+
+    template<>
+    struct tag_traits<tags::tag_byte> {
+        static constexpr tag_type type = tag_type::TAG_Byte;
+    };
 }
 
 #endif
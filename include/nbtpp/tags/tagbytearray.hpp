@@ -9,11 +9,11 @@ namespace nbtpp {
 
         class tag_bytearray: public tag {
         public:
-            tag_bytearray(std::string name) : tag(name, tag_type::TAG_Byte_Array), m_value() {
+            tag_bytearray(std::string name) : tag(std::move(name), tag_type::TAG_Byte_Array), m_value() {
 
             }
 
-            tag_bytearray(std::string name, const std::vector<int8_t>& data) : tag(name, tag_type::TAG_Byte_Array), m_value(data) {
+            tag_bytearray(std::string name, std::vector<int8_t> data) : tag(std::move(name), tag_type::TAG_Byte_Array), m_value(std::move(data)) {
 
             }
 
@@ -21,6 +21,15 @@ namespace nbtpp {
 
             }
 
+            tag_bytearray(const tag_bytearray&) = default;
+            tag_bytearray(tag_bytearray&&) noexcept = default;
+            tag_bytearray& operator=(const tag_bytearray&) = default;
+            tag_bytearray& operator=(tag_bytearray&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_bytearray) + name_memory_usage() + m_value.capacity() * sizeof(int8_t);
+            }
+
             void append(int8_t val) {
                 m_value.push_back(val);
             }
@@ -29,6 +38,10 @@ namespace nbtpp {
                 return m_value;
             }
 
+            inline std::vector<int8_t>& value() {
+                return m_value;
+            }
+
             inline void assign(int8_t* array, size_t count) {
                 m_value.assign(array, array + count);
             }
@@ -36,6 +49,11 @@ namespace nbtpp {
             std::vector<int8_t> m_value;
         };
     }
+
+    template<>
+    struct tag_traits<tags::tag_bytearray> {
+        static constexpr tag_type type = tag_type::TAG_Byte_Array;
+    };
 }
 
 #endif
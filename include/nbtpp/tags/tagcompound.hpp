@@ -1,6 +1,9 @@
 #ifndef TAGS_COMPOUND_HPP_
 #define TAGS_COMPOUND_HPP_
 
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "../tag.hpp"
@@ -8,20 +11,52 @@
 namespace nbtpp {
     namespace tags {
         class tag_compound: public tag {
+            friend class nbtpp::tree_recycler;
         public:
-            tag_compound(std::string name) : tag(name, tag_type::TAG_Compound) {
+            tag_compound(std::string name) : tag(std::move(name), tag_type::TAG_Compound) {
 
             }
 
+            tag_compound(const tag_compound&) = delete;
+            tag_compound& operator=(const tag_compound&) = delete;
+
+            /**
+             * Steal the content of other, leaving it empty. No child is copied.
+             */
+            tag_compound(tag_compound&& other) noexcept : tag(std::move(other)), m_content(std::move(other.m_content)) {
+                other.m_content.clear();
+            }
+
+            tag_compound& operator=(tag_compound&& other) noexcept {
+                if (this != &other) {
+                    clear();
+                    tag::operator=(std::move(other));
+                    m_content = std::move(other.m_content);
+                    other.m_content.clear();
+                }
+                return *this;
+            }
+
             virtual ~tag_compound() {
-                for (tag *t : m_content) {
-                    delete t;
+                clear();
+            }
+
+            virtual size_t memory_usage() const {
+                size_t total = sizeof(tag_compound) + name_memory_usage() + m_content.capacity() * sizeof(tag*);
+                for (const tag *t : m_content) {
+                    total += t->memory_usage();
                 }
+                return total;
             }
 
+            /**
+             * Insert a tag, taking ownership of it. A tag with the same name is deleted.
+             */
             void insert(tag* t) {
                 for (auto i = m_content.begin(); i < m_content.end(); i++) {
                     if ((*i)->name() == t->name()) {
+                        if (*i != t)
+                            delete *i;
                         m_content.erase(i);
                         break;
                     }
@@ -30,24 +65,113 @@ namespace nbtpp {
                 m_content.push_back(t);
             }
 
+            void insert(std::unique_ptr<tag> t) {
+                insert(t.get());
+                t.release();
+            }
+
+            /**
+             * Insert many tags in order, taking ownership of them and leaving tags empty. Same-named tags are replaced
+             * as with insert(), but names are looked up in a hash table instead of the whole compound for each tag.
+             */
+            void insert_all(std::vector<tag*>& tags) {
+                std::unordered_map<std::string, size_t> index;
+                index.reserve(m_content.size() + tags.size());
+                for (size_t i = 0; i < m_content.size(); i++) {
+                    index[m_content[i]->name()] = i;
+                }
+
+                bool replaced = false;
+                for (tag *t : tags) {
+                    auto found = index.find(t->name());
+                    if (found == index.end()) {
+                        index.emplace(t->name(), m_content.size());
+                    } else {
+                        if (m_content[found->second] != t)
+                            delete m_content[found->second];
+                        m_content[found->second] = nullptr;
+                        found->second = m_content.size();
+                        replaced = true;
+                    }
+                    m_content.push_back(t);
+                }
+                tags.clear();
+
+                if (replaced)
+                    m_content.erase(std::remove(m_content.begin(), m_content.end(), nullptr), m_content.end());
+            }
+
+            /**
+             * Remove a tag without deleting it, the caller becomes its owner. detach() returns it as a std::unique_ptr
+             * instead.
+             *
+             * @return  false if t is not in this compound
+             */
             bool remove(tag* t) {
+                return detach(t).release() != nullptr;
+            }
+
+            /**
+             * Remove and delete a tag.
+             *
+             * @return  false if t is not in this compound
+             */
+            bool erase(tag* t) {
+                return detach(t) != nullptr;
+            }
+
+            /**
+             * Remove a tag without deleting it, giving its ownership to the caller.
+             *
+             * @return  t, or nullptr if t is not in this compound
+             */
+            std::unique_ptr<tag> detach(tag* t) {
                 for (auto i = m_content.begin(); i < m_content.end(); i++) {
                     if ((*i) == t) {
                         m_content.erase(i);
-                        return true;
+                        return std::unique_ptr<tag>(t);
                     }
                 }
 
-                return false;
+                return std::unique_ptr<tag>();
+            }
+
+            /**
+             * Remove the tag called name without deleting it, giving its ownership to the caller.
+             *
+             * Moving a subtree to another tree with other->insert(take(name)) copies no node.
+             *
+             * @return  The tag, or nullptr if there is none with this name
+             */
+            std::unique_ptr<tag> take(const std::string& name) {
+                for (auto i = m_content.begin(); i < m_content.end(); i++) {
+                    if ((*i)->name() == name) {
+                        tag* t = *i;
+                        m_content.erase(i);
+                        return std::unique_ptr<tag>(t);
+                    }
+                }
+
+                return std::unique_ptr<tag>();
+            }
+
+            /**
+             * Delete every tag.
+             */
+            void clear() {
+                for (tag *t : m_content) {
+                    delete t;
+                }
+                m_content.clear();
             }
 
             template<class T>
-            T* get(std::string name) const {
+            T* get(const std::string& name) const {
                 static_assert(std::is_base_of<nbtpp::tag, T>::value, "T must be child class of nbtpp::tag");
-                return dynamic_cast<T*>(get(name));
+                return tag_cast<T>(get(name));
             }
 
-            tag* get(std::string name) const {
+            tag* get(const std::string& name) const {
                 for (auto i = m_content.begin(); i < m_content.end(); i++) {
                     if ((*i)->name() == name) {
                         return *i;
@@ -57,7 +181,7 @@ namespace nbtpp {
                 return nullptr;
             }
 
-            bool exists(std::string name) const {
+            bool exists(const std::string& name) const {
                 for (auto i = m_content.begin(); i < m_content.end(); i++) {
                     if ((*i)->name() == name) {
                         return true;
@@ -78,6 +202,11 @@ namespace nbtpp {
             std::vector<tag*> m_content;
         };
     }
+
+    template<>
+    struct tag_traits<tags::tag_compound> {
+        static constexpr tag_type type = tag_type::TAG_Compound;
+    };
 }
 
 #endif
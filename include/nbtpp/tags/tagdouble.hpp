@@ -8,13 +8,22 @@ namespace nbtpp {
 
         class tag_double: public tag {
         public:
-            tag_double(std::string name, double value) : tag(name, tag_type::TAG_Double), m_value(value) {
+            tag_double(std::string name, double value) : tag(std::move(name), tag_type::TAG_Double), m_value(value) {
 
             }
             virtual ~tag_double() {
 
             }
 
+            tag_double(const tag_double&) = default;
+            tag_double(tag_double&&) noexcept = default;
+            tag_double& operator=(const tag_double&) = default;
+            tag_double& operator=(tag_double&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_double) + name_memory_usage();
+            }
+
             inline const double value() const {
                 return m_value;
             }
@@ -26,6 +35,11 @@ namespace nbtpp {
             double m_value;
         };
     }
+
+    template<>
+    struct tag_traits<tags::tag_double> {
+        static constexpr tag_type type = tag_type::TAG_Double;
+    };
 }
 
 #endif
@@ -11,8 +11,22 @@ namespace nbtpp {
             }
             virtual ~tag_end() {
             }
+
+            tag_end(const tag_end&) = default;
+            tag_end(tag_end&&) noexcept = default;
+            tag_end& operator=(const tag_end&) = default;
+            tag_end& operator=(tag_end&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_end) + name_memory_usage();
+            }
         };
     }
+
+    template<>
+    struct tag_traits<tags::tag_end> {
+        static constexpr tag_type type = tag_type::TAG_End;
+    };
 }
 
 #endif
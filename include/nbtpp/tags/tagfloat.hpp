@@ -8,13 +8,22 @@ namespace nbtpp {
 
         class tag_float: public tag {
         public:
-            tag_float(std::string name, float value) : tag(name, tag_type::TAG_Float), m_value(value) {
+            tag_float(std::string name, float value) : tag(std::move(name), tag_type::TAG_Float), m_value(value) {
 
             }
             virtual ~tag_float() {
 
             }
 
+            tag_float(const tag_float&) = default;
+            tag_float(tag_float&&) noexcept = default;
+            tag_float& operator=(const tag_float&) = default;
+            tag_float& operator=(tag_float&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_float) + name_memory_usage();
+            }
+
             inline const float value() const {
                 return m_value;
             }
@@ -27,6 +36,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_float> {
+        static constexpr tag_type type = tag_type::TAG_Float;
+    };
 }
 
 #endif
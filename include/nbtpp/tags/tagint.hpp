@@ -8,13 +8,22 @@ namespace nbtpp {
 
         class tag_int: public tag {
         public:
-            tag_int(std::string name, int32_t value) : tag(name, tag_type::TAG_Int), m_value(value) {
+            tag_int(std::string name, int32_t value) : tag(std::move(name), tag_type::TAG_Int), m_value(value) {
 
             }
             virtual ~tag_int() {
 
             }
 
+            tag_int(const tag_int&) = default;
+            tag_int(tag_int&&) noexcept = default;
+            tag_int& operator=(const tag_int&) = default;
+            tag_int& operator=(tag_int&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_int) + name_memory_usage();
+            }
+
             inline const int32_t value() const {
                 return m_value;
             }
@@ -27,6 +36,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_int> {
+        static constexpr tag_type type = tag_type::TAG_Int;
+    };
 }
 
 #endif
@@ -9,11 +9,11 @@ namespace nbtpp {
 
         class tag_intarray: public tag {
         public:
-            tag_intarray(std::string name) : tag(name, tag_type::TAG_Int_Array), m_value() {
+            tag_intarray(std::string name) : tag(std::move(name), tag_type::TAG_Int_Array), m_value() {
 
             }
 
-            tag_intarray(std::string name, const std::vector<int32_t>& data) : tag(name, tag_type::TAG_Byte_Array), m_value(data) {
+            tag_intarray(std::string name, std::vector<int32_t> data) : tag(std::move(name), tag_type::TAG_Int_Array), m_value(std::move(data)) {
 
             }
 
@@ -21,6 +21,15 @@ namespace nbtpp {
 
             }
 
+            tag_intarray(const tag_intarray&) = default;
+            tag_intarray(tag_intarray&&) noexcept = default;
+            tag_intarray& operator=(const tag_intarray&) = default;
+            tag_intarray& operator=(tag_intarray&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_intarray) + name_memory_usage() + m_value.capacity() * sizeof(int32_t);
+            }
+
             void append(int32_t val) {
                 m_value.push_back(val);
             }
@@ -29,6 +38,10 @@ namespace nbtpp {
                 return m_value;
             }
 
+            inline std::vector<int32_t>& value() {
+                return m_value;
+            }
+
             inline void assign(int32_t* array, size_t count) {
                 m_value.assign(array, array + count);
             }
@@ -37,6 +50,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_intarray> {
+        static constexpr tag_type type = tag_type::TAG_Int_Array;
+    };
 }
 
 #endif
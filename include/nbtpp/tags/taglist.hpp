@@ -1,6 +1,7 @@
 #ifndef NBTPP_TAGS_TAGLIST_HPP_
 #define NBTPP_TAGS_TAGLIST_HPP_
 
+#include <memory>
 #include <vector>
 
 #include "../nbt.hpp"
@@ -15,36 +16,124 @@ namespace nbtpp {
     namespace tags {
 
         class tag_list: public tag {
+            friend class nbtpp::tree_recycler;
         public:
-            tag_list(std::string name, tag_type type) : tag(name, tag_type::TAG_List), m_content_type(type) {
+            tag_list(std::string name, tag_type type) : tag(std::move(name), tag_type::TAG_List), m_content_type(type) {
 
             }
 
+            tag_list(const tag_list&) = delete;
+            tag_list& operator=(const tag_list&) = delete;
+
+            /**
+             * Steal the content of other, leaving it empty. No element is copied.
+             */
+            tag_list(tag_list&& other) noexcept : tag(std::move(other)), m_content_type(other.m_content_type), m_content(std::move(other.m_content)) {
+                other.m_content.clear();
+            }
+
+            tag_list& operator=(tag_list&& other) noexcept {
+                if (this != &other) {
+                    clear();
+                    tag::operator=(std::move(other));
+                    m_content_type = other.m_content_type;
+                    m_content = std::move(other.m_content);
+                    other.m_content.clear();
+                }
+                return *this;
+            }
+
             virtual ~tag_list() {
-                for (tag *t : m_content) {
-                    delete t;
+                clear();
+            }
+
+            virtual size_t memory_usage() const {
+                size_t total = sizeof(tag_list) + name_memory_usage() + m_content.capacity() * sizeof(tag*);
+                for (const tag *t : m_content) {
+                    total += t->memory_usage();
                 }
+                return total;
             }
 
             inline tag_type content_type() const {
                 return m_content_type;
             }
 
+            /**
+             * Remove an element without deleting it, the caller becomes its owner. detach() returns it as a
+             * std::unique_ptr instead.
+             *
+             * @return  false if t is not in this list
+             */
             bool remove(tag* t) {
+                return detach(t).release() != nullptr;
+            }
+
+            /**
+             * Remove and delete an element.
+             *
+             * @return  false if t is not in this list
+             */
+            bool erase(tag* t) {
+                return detach(t) != nullptr;
+            }
+
+            /**
+             * Remove an element without deleting it, giving its ownership to the caller.
+             *
+             * @return  t, or nullptr if t is not in this list
+             */
+            std::unique_ptr<tag> detach(tag* t) {
                 for (auto i = m_content.begin(); i < m_content.end(); i++) {
                     if ((*i) == t) {
                         m_content.erase(i);
-                        return true;
+                        return std::unique_ptr<tag>(t);
                     }
                 }
 
-                return false;
+                return std::unique_ptr<tag>();
+            }
+
+            /**
+             * Remove the element at position without deleting it, giving its ownership to the caller.
+             */
+            std::unique_ptr<tag> take(size_t position) {
+                tag* t = m_content.at(position);
+                m_content.erase(m_content.begin() + position);
+                return std::unique_ptr<tag>(t);
+            }
+
+            /**
+             * Move every element of other to the end of this list, leaving other empty. No element is copied.
+             */
+            void splice(tag_list& other) {
+                if (&other == this || other.m_content.empty())
+                    return;
+                if (other.m_content_type != m_content_type) {
+                    throw nbt_exception("can't put type " + nbtpp::name_for_type(other.m_content_type) + " in list of " + nbtpp::name_for_type(m_content_type));
+                }
+                if (m_content.empty()) {
+                    m_content.swap(other.m_content);
+                } else {
+                    m_content.insert(m_content.end(), other.m_content.begin(), other.m_content.end());
+                    other.m_content.clear();
+                }
+            }
+
+            /**
+             * Delete every element.
+             */
+            void clear() {
+                for (tag *t : m_content) {
+                    delete t;
+                }
+                m_content.clear();
             }
 
             template<class T>
             T* get(int position) const {
                 static_assert(std::is_base_of<nbtpp::tag, T>::value, "T must be child class of nbtpp::tag");
-                return dynamic_cast<T*>(get(position));
+                return tag_cast<T>(get(position));
             }
 
             tag* get(int position) const {
@@ -58,6 +147,11 @@ namespace nbtpp {
                 m_content.push_back(t);
             }
 
+            void append(std::unique_ptr<tag> t) {
+                append(t.get());
+                t.release();
+            }
+
             inline const std::vector<tag*>& value() const {
                 return m_content;
             }
@@ -68,6 +162,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_list> {
+        static constexpr tag_type type = tag_type::TAG_List;
+    };
 }
 
 #endif
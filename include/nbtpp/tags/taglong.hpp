@@ -8,13 +8,22 @@ namespace nbtpp {
 
         class tag_long: public tag {
         public:
-            tag_long(std::string name, int64_t value) : tag(name, tag_type::TAG_Long), m_value(value) {
+            tag_long(std::string name, int64_t value) : tag(std::move(name), tag_type::TAG_Long), m_value(value) {
 
             }
             virtual ~tag_long() {
 
             }
 
+            tag_long(const tag_long&) = default;
+            tag_long(tag_long&&) noexcept = default;
+            tag_long& operator=(const tag_long&) = default;
+            tag_long& operator=(tag_long&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_long) + name_memory_usage();
+            }
+
             inline const int64_t value() const {
                 return m_value;
             }
@@ -27,6 +36,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_long> {
+        static constexpr tag_type type = tag_type::TAG_Long;
+    };
 }
 
 #endif
@@ -9,11 +9,11 @@ namespace nbtpp {
 
         class tag_longarray: public tag {
         public:
-            tag_longarray(std::string name) : tag(name, tag_type::TAG_Long_Array), m_value() {
+            tag_longarray(std::string name) : tag(std::move(name), tag_type::TAG_Long_Array), m_value() {
 
             }
 
-            tag_longarray(std::string name, const std::vector<int64_t>& data) : tag(name, tag_type::TAG_Byte_Array), m_value(data) {
+            tag_longarray(std::string name, std::vector<int64_t> data) : tag(std::move(name), tag_type::TAG_Long_Array), m_value(std::move(data)) {
 
             }
 
@@ -21,6 +21,15 @@ namespace nbtpp {
 
             }
 
+            tag_longarray(const tag_longarray&) = default;
+            tag_longarray(tag_longarray&&) noexcept = default;
+            tag_longarray& operator=(const tag_longarray&) = default;
+            tag_longarray& operator=(tag_longarray&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_longarray) + name_memory_usage() + m_value.capacity() * sizeof(int64_t);
+            }
+
             void append(int64_t val) {
                 m_value.push_back(val);
             }
@@ -29,6 +38,10 @@ namespace nbtpp {
                 return m_value;
             }
 
+            inline std::vector<int64_t>& value() {
+                return m_value;
+            }
+
             inline void assign(int64_t* array, size_t count) {
                 m_value.assign(array, array + count);
             }
@@ -37,6 +50,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_longarray> {
+        static constexpr tag_type type = tag_type::TAG_Long_Array;
+    };
 }
 
 #endif
@@ -8,13 +8,22 @@ namespace nbtpp {
 
         class tag_short: public tag {
         public:
-            tag_short(std::string name, int16_t value) : tag(name, tag_type::TAG_Short), m_value(value) {
+            tag_short(std::string name, int16_t value) : tag(std::move(name), tag_type::TAG_Short), m_value(value) {
 
             }
             virtual ~tag_short() {
 
             }
 
+            tag_short(const tag_short&) = default;
+            tag_short(tag_short&&) noexcept = default;
+            tag_short& operator=(const tag_short&) = default;
+            tag_short& operator=(tag_short&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_short) + name_memory_usage();
+            }
+
             inline const int16_t value() const {
                 return m_value;
             }
@@ -27,6 +36,11 @@ namespace nbtpp {
         };
 
     }
+
+    template<>
+    struct tag_traits<tags::tag_short> {
+        static constexpr tag_type type = tag_type::TAG_Short;
+    };
 }
 
 #endif
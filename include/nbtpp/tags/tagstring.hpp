@@ -6,25 +6,40 @@
 namespace nbtpp {
     namespace tags {
         class tag_string: public tag {
+            friend class nbtpp::tree_recycler;
         public:
-            tag_string(std::string name, std::string value) : tag(name, tag_type::TAG_String), m_value(value) {
+            tag_string(std::string name, std::string value) : tag(std::move(name), tag_type::TAG_String), m_value(std::move(value)) {
             }
 
             virtual ~tag_string() {
             }
 
+            tag_string(const tag_string&) = default;
+            tag_string(tag_string&&) noexcept = default;
+            tag_string& operator=(const tag_string&) = default;
+            tag_string& operator=(tag_string&&) noexcept = default;
+
+            virtual size_t memory_usage() const {
+                return sizeof(tag_string) + name_memory_usage() + string_memory_usage(m_value);
+            }
+
             inline const std::string& value() const {
                 return m_value;
             }
 
-            void value(const std::string& mValue) {
-                m_value = mValue;
+            void value(std::string mValue) {
+                m_value = std::move(mValue);
             }
 
         private:
             std::string m_value;
         };
     }
+
+    template<>
+    struct tag_traits<tags::tag_string> {
+        static constexpr tag_type type = tag_type::TAG_String;
+    };
 }
 
 #endif
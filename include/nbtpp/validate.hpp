@@ -0,0 +1,85 @@
+#ifndef NBTPP_VALIDATE_HPP_
+#define NBTPP_VALIDATE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nbtpp {
+
+    /**
+     * Outcome of a validation, with where the data went wrong if it did.
+     */
+    struct validation_result {
+        bool valid = true;
+
+        /**
+         * Byte offset of the first invalid byte, in the uncompressed data
+         */
+        size_t offset = 0;
+
+        /**
+         * Path of the tag holding it, e.g. "Level.Sections[3].Palette[0].Name", empty for the root
+         */
+        std::string path;
+
+        std::string message;
+
+        /**
+         * Message, offset and path in one line.
+         */
+        std::string what() const;
+    };
+
+    /**
+     * Check that uncompressed data is one well-formed tag and nothing more, without building it.
+     *
+     * Tag types, array and list lengths, list element types, nesting depth and the modified UTF-8 of names and
+     * strings are checked as the game's reader does, and every length against the end of the data. Nothing is allocated
+     * unless the data is invalid: scalars and arrays are skipped by their size and ASCII text is checked 8 bytes at a
+     * time, so valid data is checked at close to memory speed.
+     */
+    validation_result validate(const uint8_t* data, size_t size);
+
+    inline validation_result validate(const std::vector<uint8_t>& data) {
+        return validate(data.data(), data.size());
+    }
+
+    /**
+     * A problem with a chunk of a region file, or with the file itself when x and z are -1.
+     */
+    struct region_problem {
+        int32_t x;
+        int32_t z;
+
+        /**
+         * Offset in the region file for problems of the header and chunk framing, else in the uncompressed chunk
+         */
+        validation_result error;
+    };
+
+    struct region_validation {
+        /**
+         * Number of chunks in the header
+         */
+        uint32_t chunks = 0;
+
+        std::vector<region_problem> problems;
+
+        inline bool valid() const {
+            return problems.empty();
+        }
+    };
+
+    /**
+     * Check a whole region file: the header locations against the file size and each other, then the length and
+     * compression of each chunk, then its decompressed data with validate(). Chunks stored outside the region are
+     * checked from their .mcc file, a missing one being a problem of the chunk. Problems of every chunk are collected
+     * rather than stopping at the first one.
+     *
+     * @throws nbt_exception if the file can't be read
+     */
+    region_validation validate_region(const std::string& path);
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef NBTPP_VISIT_HPP_
+#define NBTPP_VISIT_HPP_
+
+#include <type_traits>
+#include <utility>
+
+#include "tag.hpp"
+#include "nbtexception.hpp"
+
+namespace nbtpp {
+    namespace detail {
+        /**
+         * To, with the same constness as From.
+         */
+        template<class From, class To>
+        struct same_const {
+            typedef To type;
+        };
+
+        template<class From, class To>
+        struct same_const<const From, To> {
+            typedef const To type;
+        };
+    }
+
+    /**
+     * Call the overload of visitor matching the stored type of t.
+     *
+     * Dispatch is a switch on tag::type() followed by a static_cast, no RTTI is involved. The visitor must be callable
+     * with a reference to every tag_* class (a generic fallback overload taking a const tag& is enough for the types it
+     * does not care about), and all overloads must return the same type.
+     *
+     * @param t         Tag to visit
+     * @param visitor   Callable object
+     * @return          What the selected overload returned
+     */
+    template<class Tag, class Visitor>
+    inline auto visit(Tag& t, Visitor&& visitor)
+        -> decltype(std::forward<Visitor>(visitor)(std::declval<typename detail::same_const<Tag, tags::tag_end>::type&>())) {
+        static_assert(std::is_base_of<nbtpp::tag, typename std::remove_const<Tag>::type>::value, "Tag must be nbtpp::tag or a child class");
+
+        typename detail::same_const<Tag, tag>::type& base = t;
+
+        switch (base.type()) {
+            case tag_type::TAG_End:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_end>::type&>(base));
+            case tag_type::TAG_Byte:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_byte>::type&>(base));
+            case tag_type::TAG_Short:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_short>::type&>(base));
+            case tag_type::TAG_Int:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_int>::type&>(base));
+            case tag_type::TAG_Long:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_long>::type&>(base));
+            case tag_type::TAG_Float:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_float>::type&>(base));
+            case tag_type::TAG_Double:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_double>::type&>(base));
+            case tag_type::TAG_Byte_Array:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_bytearray>::type&>(base));
+            case tag_type::TAG_String:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_string>::type&>(base));
+            case tag_type::TAG_List:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_list>::type&>(base));
+            case tag_type::TAG_Compound:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_compound>::type&>(base));
+            case tag_type::TAG_Int_Array:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_intarray>::type&>(base));
+            case tag_type::TAG_Long_Array:
+                return std::forward<Visitor>(visitor)(static_cast<typename detail::same_const<Tag, tags::tag_longarray>::type&>(base));
+            default:
+                throw nbt_exception("invalid tag type " + std::to_string((int) base.type()));
+        }
+    }
+}
+
+#endif
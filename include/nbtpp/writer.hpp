@@ -0,0 +1,250 @@
+#ifndef NBTPP_WRITER_HPP_
+#define NBTPP_WRITER_HPP_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "nbt.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+namespace nbtpp {
+
+    /**
+     * Streaming NBT writer, producing uncompressed NBT without building a tag tree.
+     *
+     * Named calls write entries of the enclosing compound (or the root tag), unnamed calls write elements of the
+     * enclosing list. Every begin_compound() and begin_list() must be matched by an end().
+     *
+     * Unless NDEBUG is defined, misuse (unnamed tags in compounds, wrong element types or counts in lists) throws
+     * nbt_exception. Release builds only track whether each open container is a list or a compound, an end() without
+     * an open container throws in both.
+     *
+     * @tparam Output   codec::buffer_writer or codec::stream_writer
+     */
+    template<class Output>
+    class basic_writer {
+    public:
+        /**
+         * Create a writer, forwarding args to the Output constructor.
+         */
+        template<class ... Args>
+        explicit basic_writer(Args&&... args) : m_out(std::forward<Args>(args)...) {
+        }
+
+        void begin_compound(codec::string_ref name) {
+            begin_named(tag_type::TAG_Compound, name);
+            push(tag_type::TAG_Compound, tag_type::TAG_End, 0);
+        }
+
+        void begin_compound() {
+            begin_element(tag_type::TAG_Compound);
+            push(tag_type::TAG_Compound, tag_type::TAG_End, 0);
+        }
+
+        void begin_list(codec::string_ref name, tag_type type, int32_t count) {
+            begin_named(tag_type::TAG_List, name);
+            list_header(type, count);
+        }
+
+        void begin_list(tag_type type, int32_t count) {
+            begin_element(tag_type::TAG_List);
+            list_header(type, count);
+        }
+
+        /**
+         * Close the innermost compound or list.
+         *
+         * @throws nbt_exception if no compound or list is open
+         */
+        void end() {
+            if (m_stack.empty())
+                throw nbt_exception("end() without matching begin");
+#ifndef NDEBUG
+            if (m_stack.back().type == tag_type::TAG_List && m_stack.back().remaining != 0)
+                throw nbt_exception("list closed with " + std::to_string(m_stack.back().remaining) + " missing elements");
+#endif
+            if (m_stack.back().type == tag_type::TAG_Compound)
+                m_out.write_ubyte(tag_type::TAG_End);
+            m_stack.pop_back();
+        }
+
+        void write_byte(codec::string_ref name, int8_t v) {
+            begin_named(tag_type::TAG_Byte, name);
+            m_out.write_byte(v);
+        }
+
+        void write_byte(int8_t v) {
+            begin_element(tag_type::TAG_Byte);
+            m_out.write_byte(v);
+        }
+
+        void write_short(codec::string_ref name, int16_t v) {
+            begin_named(tag_type::TAG_Short, name);
+            m_out.write_short(v);
+        }
+
+        void write_short(int16_t v) {
+            begin_element(tag_type::TAG_Short);
+            m_out.write_short(v);
+        }
+
+        void write_int(codec::string_ref name, int32_t v) {
+            begin_named(tag_type::TAG_Int, name);
+            m_out.write_int(v);
+        }
+
+        void write_int(int32_t v) {
+            begin_element(tag_type::TAG_Int);
+            m_out.write_int(v);
+        }
+
+        void write_long(codec::string_ref name, int64_t v) {
+            begin_named(tag_type::TAG_Long, name);
+            m_out.write_long(v);
+        }
+
+        void write_long(int64_t v) {
+            begin_element(tag_type::TAG_Long);
+            m_out.write_long(v);
+        }
+
+        void write_float(codec::string_ref name, float v) {
+            begin_named(tag_type::TAG_Float, name);
+            m_out.write_float(v);
+        }
+
+        void write_float(float v) {
+            begin_element(tag_type::TAG_Float);
+            m_out.write_float(v);
+        }
+
+        void write_double(codec::string_ref name, double v) {
+            begin_named(tag_type::TAG_Double, name);
+            m_out.write_double(v);
+        }
+
+        void write_double(double v) {
+            begin_element(tag_type::TAG_Double);
+            m_out.write_double(v);
+        }
+
+        void write_string(codec::string_ref name, codec::string_ref v) {
+            begin_named(tag_type::TAG_String, name);
+            m_out.write_string(v.data, v.size);
+        }
+
+        void write_string(codec::string_ref v) {
+            begin_element(tag_type::TAG_String);
+            m_out.write_string(v.data, v.size);
+        }
+
+        void write_byte_array(codec::string_ref name, const int8_t* values, size_t count) {
+            begin_named(tag_type::TAG_Byte_Array, name);
+            array(values, count);
+        }
+
+        void write_byte_array(const int8_t* values, size_t count) {
+            begin_element(tag_type::TAG_Byte_Array);
+            array(values, count);
+        }
+
+        void write_int_array(codec::string_ref name, const int32_t* values, size_t count) {
+            begin_named(tag_type::TAG_Int_Array, name);
+            array(values, count);
+        }
+
+        void write_int_array(const int32_t* values, size_t count) {
+            begin_element(tag_type::TAG_Int_Array);
+            array(values, count);
+        }
+
+        void write_long_array(codec::string_ref name, const int64_t* values, size_t count) {
+            begin_named(tag_type::TAG_Long_Array, name);
+            array(values, count);
+        }
+
+        void write_long_array(const int64_t* values, size_t count) {
+            begin_element(tag_type::TAG_Long_Array);
+            array(values, count);
+        }
+
+        /**
+         * Whether every container has been closed.
+         */
+        bool complete() const {
+            return m_stack.empty();
+        }
+
+        /**
+         * The underlying output, e.g. to flush a codec::stream_writer.
+         */
+        Output& output() {
+            return m_out;
+        }
+    private:
+        struct frame {
+            tag_type type;
+            tag_type content_type;
+            int32_t remaining;
+        };
+
+        void push(tag_type type, tag_type content_type, int32_t count) {
+            frame f = { type, content_type, count };
+            m_stack.push_back(f);
+        }
+
+        void begin_named(tag_type type, const codec::string_ref& name) {
+#ifndef NDEBUG
+            if (!m_stack.empty() && m_stack.back().type != tag_type::TAG_Compound)
+                throw nbt_exception("named " + name_for_type(type) + " '" + name.str() + "' written in a list");
+#endif
+            m_out.write_ubyte(type);
+            m_out.write_string(name.data, name.size);
+        }
+
+        void begin_element(tag_type type) {
+#ifndef NDEBUG
+            if (m_stack.empty() || m_stack.back().type != tag_type::TAG_List)
+                throw nbt_exception("unnamed " + name_for_type(type) + " written outside of a list");
+            frame& f = m_stack.back();
+            if (f.content_type != type)
+                throw nbt_exception("can't put type " + name_for_type(type) + " in list of " + name_for_type(f.content_type));
+            if (f.remaining <= 0)
+                throw nbt_exception("too many elements in list of " + name_for_type(f.content_type));
+            f.remaining--;
+#else
+            (void) type;
+#endif
+        }
+
+        void list_header(tag_type type, int32_t count) {
+            m_out.write_ubyte(type);
+            m_out.write_int(count);
+            push(tag_type::TAG_List, type, count);
+        }
+
+        template<class T>
+        void array(const T* values, size_t count) {
+            m_out.write_int((int32_t) count);
+            m_out.write_array(values, count);
+        }
+
+        Output m_out;
+        std::vector<frame> m_stack;
+    };
+
+    /**
+     * Streaming writer appending to a std::vector<uint8_t>.
+     */
+    typedef basic_writer<codec::buffer_writer> nbt_buffer_writer;
+
+    /**
+     * Streaming writer over a stream buffer, call output().flush() once done.
+     */
+    typedef basic_writer<codec::stream_writer> nbt_stream_writer;
+}
+
+#endif
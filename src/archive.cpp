@@ -0,0 +1,610 @@
+#include "archive.hpp"
+#include "codec.hpp"
+#include "deflate.hpp"
+#include "nbtexception.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <zlib.h>
+
+#ifdef NBTPP_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace nbtpp;
+
+static const char archive_magic[4] = { 'N', 'B', 'T', 'A' };
+static const char index_magic[4] = { 'N', 'B', 'T', 'X' };
+static const uint8_t archive_version = 1;
+static const uint8_t index_version = 2;
+
+static const size_t archive_header_size = sizeof(archive_magic) + 1;
+static const size_t index_header_size = 40;
+static const size_t index_entry_size = 32;
+
+/**
+ * Bytes at the end of the data covered by an index whose checksum it keeps
+ */
+static const uint64_t index_check_size = 64 * 1024;
+
+/**
+ * Kinds of records of the data file.
+ *
+ * A document is its key, compression, uncompressed and stored sizes, then the stored bytes. An erasure is a key. A
+ * block is its compression, uncompressed and stored sizes and document count, then the key, position and size of each
+ * document, then the stored bytes. Numbers are big-endian and keys are prefixed by their 16 bit length.
+ */
+enum record_kind : uint8_t {
+    document_record = 1, erase_record = 2, block_record = 3
+};
+
+/**
+ * Header of an index: magic, version, size of the data it covers, number of entries, size of the keys and CRC32 of the
+ * last 64 KB of the data it covers. The entries follow sorted by key, each the offset, stored size, position and size
+ * of the document, the offset and length of its key, its compression and flags. The keys come last.
+ */
+struct index_header {
+    uint64_t covered;
+    uint64_t count;
+    uint64_t keys;
+};
+
+/**
+ * Checksum of the end of the data covered by an index, telling the data it was built from apart from another archive
+ * written at the same path since.
+ */
+static uint32_t covered_check(const uint8_t* data, uint64_t covered) {
+    uint64_t size = std::min(covered, index_check_size);
+    return (uint32_t) crc32(0, data + covered - size, (uInt) size);
+}
+
+static bool read_index_header(const uint8_t* p, size_t size, const uint8_t* data, uint64_t data_size, index_header& out) {
+    if (size < index_header_size || std::memcmp(p, index_magic, sizeof(index_magic)) != 0 || p[4] != index_version)
+        return false;
+    out.covered = codec::load_be<uint64_t>(p + 8);
+    out.count = codec::load_be<uint64_t>(p + 16);
+    out.keys = codec::load_be<uint64_t>(p + 24);
+    return out.covered >= archive_header_size && out.covered <= data_size && out.count <= size / index_entry_size &&
+        index_header_size + out.count * index_entry_size + out.keys == size &&
+        codec::load_be<uint32_t>(p + 32) == covered_check(data, out.covered);
+}
+
+static bool valid_compression(uint8_t c) {
+    return c >= nbt::gzip && c <= nbt::uncompressed;
+}
+
+/**
+ * Tell the system how a mapping is about to be read.
+ */
+static void advise(const uint8_t* data, size_t size, bool sequential) {
+#ifdef NBTPP_POSIX
+    if (data != nullptr)
+        ::madvise(const_cast<uint8_t*>(data), size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#endif
+}
+
+archive::mapping archive::map(const std::string& path, bool sequential) {
+    mapping m;
+#ifdef NBTPP_POSIX
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return m;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = ::mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            m.data = static_cast<const uint8_t*>(p);
+            m.size = (size_t) st.st_size;
+            advise(m.data, m.size, sequential);
+        }
+    }
+    ::close(fd);
+#else
+    // Without mmap the file is read whole.
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    std::streamoff size = in ? (std::streamoff) in.tellg() : 0;
+    if (size > 0) {
+        uint8_t* data = new uint8_t[(size_t) size];
+        if (in.seekg(0) && in.read(reinterpret_cast<char*>(data), size)) {
+            m.data = data;
+            m.size = (size_t) size;
+        } else {
+            delete[] data;
+        }
+    }
+#endif
+    return m;
+}
+
+void archive::unmap(mapping& m) {
+    if (m.data != nullptr) {
+#ifdef NBTPP_POSIX
+        ::munmap(const_cast<uint8_t*>(m.data), m.size);
+#else
+        delete[] m.data;
+#endif
+    }
+    m.data = nullptr;
+    m.size = 0;
+}
+
+uint64_t archive::replay(const uint8_t* data, uint64_t size, uint64_t offset,
+    const std::function<void(const std::string& key, const location& l)>& each) {
+    std::vector<std::pair<std::string, location>> block;
+    while (offset < size) {
+        const uint8_t* p = data + offset;
+        uint64_t left = size - offset;
+        uint64_t used = 1;
+
+        auto key = [&](std::string& out) {
+            if (left < used + 2)
+                return false;
+            uint16_t length = codec::load_be<uint16_t>(p + used);
+            if (left < used + 2 + length)
+                return false;
+            out.assign(reinterpret_cast<const char*>(p + used + 2), length);
+            used += 2 + length;
+            return true;
+        };
+
+        std::string k;
+        location l;
+        switch (p[0]) {
+            case document_record: {
+                if (!key(k) || left < used + 9 || !valid_compression(p[used]))
+                    return offset;
+                l.compression = (nbt::compression) p[used];
+                l.size = codec::load_be<uint32_t>(p + used + 1);
+                l.stored = codec::load_be<uint32_t>(p + used + 5);
+                used += 9;
+                if (left < used + l.stored)
+                    return offset;
+                l.offset = offset + used;
+                used += l.stored;
+                each(k, l);
+                break;
+            }
+            case erase_record:
+                if (!key(k))
+                    return offset;
+                l.erased = true;
+                each(k, l);
+                break;
+            case block_record: {
+                if (left < used + 13 || !valid_compression(p[used]))
+                    return offset;
+                l.compression = (nbt::compression) p[used];
+                l.block = true;
+                uint32_t raw = codec::load_be<uint32_t>(p + used + 1);
+                l.stored = codec::load_be<uint32_t>(p + used + 5);
+                uint32_t count = codec::load_be<uint32_t>(p + used + 9);
+                used += 13;
+                block.clear();
+                for (uint32_t i = 0; i < count; i++) {
+                    if (!key(k) || left < used + 8)
+                        return offset;
+                    l.position = codec::load_be<uint32_t>(p + used);
+                    l.size = codec::load_be<uint32_t>(p + used + 4);
+                    used += 8;
+                    if ((uint64_t) l.position + l.size > raw)
+                        return offset;
+                    block.emplace_back(std::move(k), l);
+                }
+                if (left < used + l.stored)
+                    return offset;
+                for (auto& d : block) {
+                    d.second.offset = offset + used;
+                    each(d.first, d.second);
+                }
+                used += l.stored;
+                break;
+            }
+            default:
+                return offset;
+        }
+        offset += used;
+    }
+    return offset;
+}
+
+archive::archive(const std::string& path) : m_path(path), m_index_count(0), m_index_entries(nullptr),
+    m_index_keys(nullptr), m_index_keys_size(0), m_end(archive_header_size) {
+    m_data = map(path, false);
+    if (m_data.size < archive_header_size || std::memcmp(m_data.data, archive_magic, sizeof(archive_magic)) != 0 ||
+        m_data.data[4] != archive_version) {
+        unmap(m_data);
+        throw nbt_exception("not an archive: " + path);
+    }
+
+    // An index that doesn't fit the data belongs to another file, the records are then all read.
+    uint64_t covered = archive_header_size;
+    m_index = map(path + ".idx", false);
+    index_header h;
+    if (read_index_header(m_index.data, m_index.size, m_data.data, m_data.size, h)) {
+        covered = h.covered;
+        m_index_count = (size_t) h.count;
+        m_index_entries = m_index.data + index_header_size;
+        m_index_keys = m_index_entries + m_index_count * index_entry_size;
+        m_index_keys_size = (size_t) h.keys;
+    } else {
+        unmap(m_index);
+    }
+
+    m_end = replay(m_data.data, m_data.size, covered, [this](const std::string& key, const location& l) {
+        m_tail[key] = l;
+    });
+}
+
+archive::~archive() {
+    unmap(m_data);
+    unmap(m_index);
+}
+
+size_t archive::indexed() const {
+    return m_index_count;
+}
+
+/**
+ * Key of an index entry, empty if it lies outside the keys.
+ */
+static std::pair<const char*, size_t> index_key(const uint8_t* entry, const uint8_t* keys, size_t keys_size) {
+    uint32_t offset = codec::load_be<uint32_t>(entry + 20);
+    uint16_t length = codec::load_be<uint16_t>(entry + 24);
+    if ((uint64_t) offset + length > keys_size)
+        return std::make_pair((const char*) nullptr, (size_t) 0);
+    return std::make_pair(reinterpret_cast<const char*>(keys + offset), (size_t) length);
+}
+
+static int compare_key(const std::string& key, const std::pair<const char*, size_t>& other) {
+    size_t n = std::min(key.size(), other.second);
+    int c = n == 0 ? 0 : std::memcmp(key.data(), other.first, n);
+    if (c != 0)
+        return c;
+    return key.size() < other.second ? -1 : key.size() > other.second ? 1 : 0;
+}
+
+static archive::location index_location(const uint8_t* entry) {
+    archive::location l;
+    l.offset = codec::load_be<uint64_t>(entry);
+    l.stored = codec::load_be<uint32_t>(entry + 8);
+    l.position = codec::load_be<uint32_t>(entry + 12);
+    l.size = codec::load_be<uint32_t>(entry + 16);
+    l.compression = (nbt::compression) entry[26];
+    l.block = (entry[27] & 1) != 0;
+    return l;
+}
+
+bool archive::find_indexed(const std::string& key, location& out) const {
+    size_t low = 0;
+    size_t high = m_index_count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const uint8_t* entry = m_index_entries + middle * index_entry_size;
+        int c = compare_key(key, index_key(entry, m_index_keys, m_index_keys_size));
+        if (c == 0) {
+            out = index_location(entry);
+            return true;
+        }
+        if (c < 0)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return false;
+}
+
+bool archive::locate(const std::string& key, location& out) const {
+    auto i = m_tail.find(key);
+    if (i != m_tail.end()) {
+        if (i->second.erased)
+            return false;
+        out = i->second;
+        return true;
+    }
+    return find_indexed(key, out);
+}
+
+void archive::read(const location& l, span& out, std::vector<uint8_t>& buffer, uint64_t& cached) const {
+    if (l.offset + l.stored > m_data.size || !valid_compression(l.compression))
+        throw nbt_exception("damaged document in archive " + m_path);
+    const uint8_t* stored = m_data.data + l.offset;
+
+    const uint8_t* base;
+    size_t size;
+    if (l.compression == nbt::uncompressed) {
+        base = stored;
+        size = l.stored;
+    } else {
+        if (cached != l.offset) {
+            cached = 0;
+            decompress(stored, l.stored, l.compression, buffer);
+            cached = l.offset;
+        }
+        base = buffer.data();
+        size = buffer.size();
+    }
+
+    if (l.block ? (uint64_t) l.position + l.size > size : l.size != size)
+        throw nbt_exception("damaged document in archive " + m_path);
+    out.data = base + l.position;
+    out.size = l.size;
+}
+
+bool archive::find(const std::string& key, span& out, std::vector<uint8_t>& buffer) const {
+    location l;
+    if (!locate(key, l))
+        return false;
+    uint64_t cached = 0;
+    read(l, out, buffer, cached);
+    return true;
+}
+
+bool archive::load(const std::string& key, nbt& out) const {
+    std::vector<uint8_t> buffer;
+    span s;
+    if (!find(key, s, buffer))
+        return false;
+    out.load(s.data, s.size);
+    return true;
+}
+
+void archive::for_each(const visitor& visit) const {
+    advise(m_data.data, m_data.size, true);
+
+    std::vector<uint8_t> buffer;
+    uint64_t cached = 0;
+    try {
+        replay(m_data.data, m_end, archive_header_size, [&](const std::string& key, const location& l) {
+            // Only the latest record of a key is visited.
+            location latest;
+            if (l.erased || !locate(key, latest) || latest.offset != l.offset || latest.position != l.position)
+                return;
+            span s;
+            read(l, s, buffer, cached);
+            visit(key, s);
+        });
+    } catch (...) {
+        advise(m_data.data, m_data.size, false);
+        throw;
+    }
+    advise(m_data.data, m_data.size, false);
+}
+
+size_t archive::build_index(const std::string& path) {
+    archive a(path);
+
+    // Merge the sorted index with the sorted tail, the tail winning.
+    std::vector<uint8_t> entries;
+    std::vector<uint8_t> keys;
+    uint64_t count = 0;
+    auto add = [&](const char* key, size_t length, const location& l) {
+        if (l.erased)
+            return;
+        size_t at = entries.size();
+        entries.resize(at + index_entry_size);
+        uint8_t* e = entries.data() + at;
+        codec::store_be<uint64_t>(e, l.offset);
+        codec::store_be<uint32_t>(e + 8, l.stored);
+        codec::store_be<uint32_t>(e + 12, l.position);
+        codec::store_be<uint32_t>(e + 16, l.size);
+        codec::store_be<uint32_t>(e + 20, (uint32_t) keys.size());
+        codec::store_be<uint16_t>(e + 24, (uint16_t) length);
+        e[26] = l.compression;
+        e[27] = l.block ? 1 : 0;
+        keys.insert(keys.end(), key, key + length);
+        count++;
+    };
+
+    auto tail = a.m_tail.begin();
+    for (size_t i = 0; i < a.m_index_count; i++) {
+        const uint8_t* entry = a.m_index_entries + i * index_entry_size;
+        std::pair<const char*, size_t> key = index_key(entry, a.m_index_keys, a.m_index_keys_size);
+        if (key.first == nullptr)
+            throw nbt_exception("damaged index of archive " + path);
+        int c = 1;
+        while (tail != a.m_tail.end() && (c = compare_key(tail->first, key)) < 0) {
+            add(tail->first.data(), tail->first.size(), tail->second);
+            ++tail;
+        }
+        if (tail != a.m_tail.end() && c == 0) {
+            add(tail->first.data(), tail->first.size(), tail->second);
+            ++tail;
+        } else {
+            add(key.first, key.second, index_location(entry));
+        }
+    }
+    for (; tail != a.m_tail.end(); ++tail) {
+        add(tail->first.data(), tail->first.size(), tail->second);
+    }
+
+    uint8_t header[index_header_size] = { 0 };
+    std::memcpy(header, index_magic, sizeof(index_magic));
+    header[4] = index_version;
+    codec::store_be<uint64_t>(header + 8, a.m_end);
+    codec::store_be<uint64_t>(header + 16, count);
+    codec::store_be<uint64_t>(header + 24, keys.size());
+    codec::store_be<uint32_t>(header + 32, covered_check(a.m_data.data, a.m_end));
+
+    std::string index = path + ".idx";
+    std::string temp = index + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size());
+        out.write(reinterpret_cast<const char*>(keys.data()), keys.size());
+        if (!out.flush()) {
+            std::remove(temp.c_str());
+            throw nbt_exception("can't write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), index.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw nbt_exception("can't replace " + index);
+    }
+    return (size_t) count;
+}
+
+/**
+ * Cut a file to its first size bytes.
+ */
+static void truncate_file(const std::string& path, uint64_t size) {
+#ifdef NBTPP_POSIX
+    if (::truncate(path.c_str(), (off_t) size) != 0)
+        throw nbt_exception("can't truncate " + path);
+#else
+    std::vector<char> kept((size_t) size);
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(kept.data(), kept.size()))
+        throw nbt_exception("can't truncate " + path);
+    in.close();
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.write(kept.data(), kept.size()) || !out.flush())
+        throw nbt_exception("can't truncate " + path);
+#endif
+}
+
+archive_writer::archive_writer(const std::string& path, nbt::compression compression, size_t block_size) : m_path(path),
+    m_compression(compression), m_block_size(block_size), m_block_count(0) {
+    if (!valid_compression(compression))
+        throw nbt_exception("invalid archive compression");
+
+    archive::mapping data = archive::map(path, true);
+    if (data.size == 0) {
+        m_out.open(path, std::ios::binary | std::ios::trunc);
+        m_out.write(archive_magic, sizeof(archive_magic));
+        m_out.put((char) archive_version);
+    } else {
+        if (data.size < archive_header_size || std::memcmp(data.data, archive_magic, sizeof(archive_magic)) != 0 ||
+            data.data[4] != archive_version) {
+            archive::unmap(data);
+            throw nbt_exception("not an archive: " + path);
+        }
+
+        // Drop a record cut short by a crash, reading only the records after the index.
+        uint64_t covered = archive_header_size;
+        std::ifstream idx(path + ".idx", std::ios::binary | std::ios::ate);
+        std::streamoff idx_size = idx ? (std::streamoff) idx.tellg() : 0;
+        uint8_t header[index_header_size];
+        index_header h;
+        if (idx_size > 0 && idx.seekg(0) && idx.read(reinterpret_cast<char*>(header), sizeof(header)) &&
+            read_index_header(header, (size_t) idx_size, data.data, data.size, h))
+            covered = h.covered;
+        uint64_t end = archive::replay(data.data, data.size, covered, [](const std::string&, const archive::location&) {
+        });
+        size_t size = data.size;
+        archive::unmap(data);
+        if (end < size)
+            truncate_file(path, end);
+        m_out.open(path, std::ios::binary | std::ios::app);
+    }
+    if (!m_out)
+        throw nbt_exception("can't open archive " + path);
+}
+
+archive_writer::~archive_writer() {
+    try {
+        close();
+    } catch (nbt_exception&) {
+    }
+}
+
+static void write_key(codec::buffer_writer& w, const std::string& key) {
+    if (key.size() > UINT16_MAX)
+        throw nbt_exception("archive key longer than 65535 bytes");
+    w.write_string(key);
+}
+
+void archive_writer::put(const std::string& key, const uint8_t* data, size_t size) {
+    if (size > UINT32_MAX)
+        throw nbt_exception("archive document larger than 4 GB");
+
+    if (m_block_size > 0) {
+        if (m_block.size() + size > UINT32_MAX)
+            write_block();
+        codec::buffer_writer w(m_block_keys);
+        write_key(w, key);
+        w.write_int((int32_t) m_block.size());
+        w.write_int((int32_t) size);
+        m_block.insert(m_block.end(), data, data + size);
+        m_block_count++;
+        if (m_block.size() >= m_block_size)
+            write_block();
+        return;
+    }
+
+    const uint8_t* stored = data;
+    size_t stored_size = size;
+    if (m_compression != nbt::uncompressed) {
+        compress(data, size, m_compression, m_scratch);
+        stored = m_scratch.data();
+        stored_size = m_scratch.size();
+    }
+    m_buffer.clear();
+    codec::buffer_writer w(m_buffer);
+    w.write_ubyte(document_record);
+    write_key(w, key);
+    w.write_ubyte(m_compression);
+    w.write_int((int32_t) size);
+    w.write_int((int32_t) stored_size);
+    m_out.write(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size());
+    m_out.write(reinterpret_cast<const char*>(stored), stored_size);
+}
+
+void archive_writer::put(const std::string& key, nbt& document) {
+    std::vector<uint8_t> data;
+    document.save(data);
+    put(key, data.data(), data.size());
+}
+
+void archive_writer::erase(const std::string& key) {
+    write_block();
+    m_buffer.clear();
+    codec::buffer_writer w(m_buffer);
+    w.write_ubyte(erase_record);
+    write_key(w, key);
+    m_out.write(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size());
+}
+
+void archive_writer::write_block() {
+    if (m_block_count == 0)
+        return;
+    const uint8_t* stored = m_block.data();
+    size_t stored_size = m_block.size();
+    if (m_compression != nbt::uncompressed) {
+        compress(m_block.data(), m_block.size(), m_compression, m_scratch);
+        stored = m_scratch.data();
+        stored_size = m_scratch.size();
+    }
+    m_buffer.clear();
+    codec::buffer_writer w(m_buffer);
+    w.write_ubyte(block_record);
+    w.write_ubyte(m_compression);
+    w.write_int((int32_t) m_block.size());
+    w.write_int((int32_t) stored_size);
+    w.write_int((int32_t) m_block_count);
+    m_out.write(reinterpret_cast<const char*>(m_buffer.data()), m_buffer.size());
+    m_out.write(reinterpret_cast<const char*>(m_block_keys.data()), m_block_keys.size());
+    m_out.write(reinterpret_cast<const char*>(stored), stored_size);
+
+    m_block.clear();
+    m_block_keys.clear();
+    m_block_count = 0;
+}
+
+void archive_writer::flush() {
+    write_block();
+    if (m_out.is_open() && !m_out.flush())
+        throw nbt_exception("can't write archive " + m_path);
+}
+
+void archive_writer::close() {
+    if (!m_out.is_open())
+        return;
+    flush();
+    m_out.close();
+}
@@ -0,0 +1,440 @@
+#include "backup.hpp"
+#include "region.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <dirent.h>
+#endif
+
+using namespace nbtpp;
+using namespace nbtpp::backup;
+
+static const char manifest_magic[4] = { 'N', 'B', 'T', 'M' };
+static const char delta_magic[4] = { 'N', 'B', 'T', 'D' };
+static const uint8_t backup_version = 1;
+
+/**
+ * State of a chunk in a delta record.
+ */
+enum chunk_change : uint8_t {
+    absent = 0, unchanged = 1, stored = 2
+};
+
+static const size_t sector_size = region_file::sector_size;
+
+/**
+ * Largest chunk record a region can hold: 255 sectors, less the length field.
+ */
+static const uint32_t max_chunk_length = 255 * sector_size - 4;
+
+const region_state* manifest::find(const std::string& name) const {
+    auto i = std::lower_bound(regions.begin(), regions.end(), name, [](const region_state& r, const std::string& n) {
+        return r.name < n;
+    });
+    return i != regions.end() && i->name == name ? &*i : nullptr;
+}
+
+void manifest::save(std::ostream& out) const {
+    codec::stream_writer w(out.rdbuf());
+    w.write_raw(manifest_magic, sizeof(manifest_magic));
+    w.write_ubyte(backup_version);
+    w.write_int((int32_t) time);
+    w.write_int((int32_t) regions.size());
+    for (const region_state& r : regions) {
+        w.write_string(r.name);
+        w.write_array(r.locations, 1024);
+        w.write_array(r.timestamps, 1024);
+    }
+    w.flush();
+    if (!out)
+        throw nbt_exception("can't write backup manifest");
+}
+
+void manifest::load(std::istream& in) {
+    codec::stream_reader r(in.rdbuf());
+    char magic[sizeof(manifest_magic)];
+    r.read_raw(magic, sizeof(magic));
+    if (std::memcmp(magic, manifest_magic, sizeof(magic)) != 0 || r.read_ubyte() != backup_version)
+        throw nbt_exception("not a backup manifest");
+
+    regions.clear();
+    time = (uint32_t) r.read_int();
+    int32_t count = r.read_int();
+    if (count < 0)
+        throw nbt_exception("invalid backup manifest");
+    for (int32_t i = 0; i < count; i++) {
+        region_state s;
+        r.read_string(s.name);
+        r.read_array(s.locations, 1024);
+        r.read_array(s.timestamps, 1024);
+        regions.push_back(std::move(s));
+    }
+    std::sort(regions.begin(), regions.end(), [](const region_state& a, const region_state& b) {
+        return a.name < b.name;
+    });
+}
+
+/**
+ * Names of the .mca files of a directory, sorted.
+ */
+static std::vector<std::string> list_regions(const std::string& directory) {
+    std::vector<std::string> names;
+    auto add = [&names](const std::string& name) {
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".mca") == 0)
+            names.push_back(name);
+    };
+#ifdef _WIN32
+    struct _stat st;
+    if (_stat(directory.c_str(), &st) != 0 || (st.st_mode & _S_IFDIR) == 0)
+        throw nbt_exception("can't list " + directory);
+    _finddata_t e;
+    intptr_t dir = _findfirst((directory + "/*.mca").c_str(), &e);
+    if (dir != -1) {
+        do {
+            add(e.name);
+        } while (_findnext(dir, &e) == 0);
+        _findclose(dir);
+    }
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+        throw nbt_exception("can't list " + directory);
+    while (struct dirent* e = readdir(dir)) {
+        add(e->d_name);
+    }
+    closedir(dir);
+#endif
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+/**
+ * Write a region's delta record: its name, timestamps, chunk states, then the stored chunks in index order, each as
+ * its record in the region file followed, for external chunks, by the size and bytes of its .mcc file. The record is
+ * preceded by its size so restores can skip it.
+ */
+static void write_record(codec::stream_writer& out, const std::vector<uint8_t>& record) {
+    out.write_long((int64_t) record.size());
+    out.write_raw(record.data(), record.size());
+}
+
+snapshot_stats backup::snapshot(const std::string& directory, const manifest& previous, std::ostream& delta, manifest& current) {
+    snapshot_stats stats;
+    current.regions.clear();
+    current.time = (uint32_t) std::time(nullptr);
+
+    codec::stream_writer out(delta.rdbuf());
+    out.write_raw(delta_magic, sizeof(delta_magic));
+    out.write_ubyte(backup_version);
+
+    std::vector<uint8_t> record;
+    std::vector<uint8_t> chunk;
+    std::vector<uint8_t> external;
+    for (const std::string& name : list_regions(directory)) {
+        std::string path = directory + "/" + name;
+        region_state state;
+        state.name = name;
+        std::memset(state.locations, 0, sizeof(state.locations));
+        std::memset(state.timestamps, 0, sizeof(state.timestamps));
+
+        // The game leaves empty region files around, they have no chunk.
+        std::unique_ptr<region_file> region;
+        std::ifstream probe(path, std::ios::binary | std::ios::ate);
+        if (probe && probe.tellg() > 0) {
+            region.reset(new region_file(path));
+            for (int32_t i = 0; i < 1024; i++) {
+                state.locations[i] = region->location(i % 32, i / 32);
+                state.timestamps[i] = region->timestamp(i % 32, i / 32);
+            }
+        }
+        stats.regions++;
+
+        const region_state* before = previous.find(name);
+        uint8_t changes[1024];
+        bool changed = false;
+        for (size_t i = 0; i < 1024; i++) {
+            bool was = before != nullptr && before->locations[i] != 0;
+            if (state.locations[i] == 0) {
+                changes[i] = absent;
+                if (was)
+                    stats.removed++;
+                changed |= was;
+                continue;
+            }
+            stats.chunks++;
+            if (was && before->locations[i] == state.locations[i] && before->timestamps[i] == state.timestamps[i] &&
+                state.timestamps[i] < previous.time) {
+                changes[i] = unchanged;
+            } else {
+                changes[i] = stored;
+                changed = true;
+            }
+        }
+
+        if (changed) {
+            record.clear();
+            codec::buffer_writer w(record);
+            w.write_string(name);
+            w.write_array(state.timestamps, 1024);
+            w.write_raw(changes, sizeof(changes));
+            for (int32_t i = 0; i < 1024; i++) {
+                if (changes[i] != stored)
+                    continue;
+                if (!region->read_record(i % 32, i / 32, chunk))
+                    throw nbt_exception("chunk " + std::to_string(i % 32) + "," + std::to_string(i / 32) + " of " + path + " vanished");
+                w.write_raw(chunk.data(), chunk.size());
+                stats.copied++;
+                stats.bytes += chunk.size();
+                if (chunk[4] & region_file::external_flag) {
+                    region_file::read_external(path, i % 32, i / 32, external);
+                    w.write_int((int32_t) external.size());
+                    w.write_raw(external.data(), external.size());
+                    stats.bytes += external.size();
+                }
+            }
+            write_record(out, record);
+        }
+        current.regions.push_back(std::move(state));
+    }
+
+    // Regions gone since the previous snapshot get a record without chunks.
+    for (const region_state& r : previous.regions) {
+        if (current.find(r.name) != nullptr)
+            continue;
+        size_t count = 1024 - std::count(r.locations, r.locations + 1024, 0u);
+        if (count == 0)
+            continue;
+        stats.removed += count;
+        record.clear();
+        codec::buffer_writer w(record);
+        w.write_string(r.name);
+        uint32_t timestamps[1024] = { 0 };
+        uint8_t changes[1024] = { absent };
+        w.write_array(timestamps, 1024);
+        w.write_raw(changes, sizeof(changes));
+        write_record(out, record);
+    }
+
+    out.flush();
+    if (!delta)
+        throw nbt_exception("can't write backup delta");
+    return stats;
+}
+
+/**
+ * A delta file with the offset of the record of each region it holds.
+ */
+class delta_file {
+public:
+    explicit delta_file(const std::string& path) : m_path(path), m_in(path, std::ios::binary) {
+        if (!m_in)
+            throw nbt_exception("can't open backup delta " + path);
+        codec::stream_reader r(m_in.rdbuf());
+        char magic[sizeof(delta_magic)];
+        try {
+            r.read_raw(magic, sizeof(magic));
+            if (std::memcmp(magic, delta_magic, sizeof(magic)) != 0 || r.read_ubyte() != backup_version)
+                throw nbt_exception("not a backup delta: " + path);
+
+            uint64_t offset = sizeof(delta_magic) + 1;
+            while (m_in.rdbuf()->sgetc() != std::char_traits<char>::eof()) {
+                int64_t size = r.read_long();
+                if (size < 2)
+                    throw nbt_exception("invalid record in backup delta " + path);
+                std::string name;
+                r.read_string(name);
+                m_records[name] = offset + 8;
+                offset += 8 + (uint64_t) size;
+                m_in.rdbuf()->pubseekpos(offset);
+            }
+        } catch (codec::eof_exception&) {
+            throw nbt_exception("truncated backup delta " + path);
+        }
+    }
+
+    inline const std::map<std::string, uint64_t>& records() const {
+        return m_records;
+    }
+
+    /**
+     * Apply the record of a region, if any, to the chunks restored so far.
+     *
+     * @param chunks    Record of each chunk, empty when absent
+     * @param externals .mcc file of each external chunk
+     */
+    void apply(const std::string& name, std::vector<std::vector<uint8_t>>& chunks, std::vector<std::vector<uint8_t>>& externals,
+        uint32_t timestamps[1024]) {
+        auto found = m_records.find(name);
+        if (found == m_records.end())
+            return;
+
+        m_in.clear();
+        m_in.rdbuf()->pubseekpos(found->second);
+        codec::stream_reader r(m_in.rdbuf());
+        try {
+            std::string stored_name;
+            r.read_string(stored_name);
+            r.read_array(timestamps, 1024);
+            uint8_t changes[1024];
+            r.read_raw(changes, sizeof(changes));
+            for (size_t i = 0; i < 1024; i++) {
+                switch (changes[i]) {
+                    case absent:
+                        chunks[i].clear();
+                        externals[i].clear();
+                        break;
+                    case unchanged:
+                        if (chunks[i].empty())
+                            throw nbt_exception("chunk " + std::to_string(i % 32) + "," + std::to_string(i / 32) + " of " + name +
+                                " is unchanged in " + m_path + " but missing from the deltas before it");
+                        break;
+                    case stored: {
+                        uint8_t header[5];
+                        r.read_raw(header, sizeof(header));
+                        uint32_t length = codec::load_be<uint32_t>(header);
+                        if (length == 0 || length > max_chunk_length)
+                            throw nbt_exception("invalid chunk length in backup delta " + m_path);
+                        chunks[i].resize(4 + length);
+                        std::memcpy(chunks[i].data(), header, sizeof(header));
+                        r.read_raw(chunks[i].data() + sizeof(header), length - 1);
+                        externals[i].clear();
+                        if (header[4] & region_file::external_flag) {
+                            int32_t size = r.read_int();
+                            if (size < 0)
+                                throw nbt_exception("invalid external chunk size in backup delta " + m_path);
+                            r.read_vector(externals[i], size);
+                        }
+                        break;
+                    }
+                    default:
+                        throw nbt_exception("invalid chunk state in backup delta " + m_path);
+                }
+            }
+        } catch (codec::eof_exception&) {
+            throw nbt_exception("truncated backup delta " + m_path);
+        }
+    }
+private:
+    std::string m_path;
+    std::ifstream m_in;
+    std::map<std::string, uint64_t> m_records;
+};
+
+/**
+ * Write a file through a temporary file renamed over path.
+ */
+static void write_file(const std::string& path, const std::vector<uint8_t>& data) {
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.write(reinterpret_cast<const char*>(data.data()), data.size()) || !out.flush()) {
+            std::remove(temp.c_str());
+            throw nbt_exception("can't write " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw nbt_exception("can't replace " + path);
+    }
+}
+
+/**
+ * Write the chunks of a region in index order after the header, through a temporary file renamed over path, then the
+ * .mcc files of its external chunks next to it.
+ */
+static void write_region(const std::string& path, const std::vector<std::vector<uint8_t>>& chunks,
+    const std::vector<std::vector<uint8_t>>& externals, const uint32_t timestamps[1024]) {
+    for (size_t i = 0; i < 1024; i++) {
+        if (!chunks[i].empty() && (chunks[i][4] & region_file::external_flag))
+            write_file(region_file::external_path(path, i % 32, i / 32), externals[i]);
+    }
+
+    std::string temp = path + ".tmp";
+    try {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        std::vector<uint8_t> header(2 * sector_size);
+        if (!out.write(reinterpret_cast<const char*>(header.data()), header.size()))
+            throw nbt_exception("can't write " + temp);
+
+        uint32_t sector = 2;
+        std::vector<char> padding(sector_size);
+        for (size_t i = 0; i < 1024; i++) {
+            if (chunks[i].empty())
+                continue;
+            size_t sectors = (chunks[i].size() + sector_size - 1) / sector_size;
+            if (!out.write(reinterpret_cast<const char*>(chunks[i].data()), chunks[i].size()) ||
+                !out.write(padding.data(), sectors * sector_size - chunks[i].size()))
+                throw nbt_exception("can't write " + temp);
+            codec::store_be<uint32_t>(header.data() + i * 4, (sector << 8) | (uint32_t) sectors);
+            codec::store_be<uint32_t>(header.data() + sector_size + i * 4, timestamps[i]);
+            sector += (uint32_t) sectors;
+        }
+
+        out.seekp(0);
+        if (!out.write(reinterpret_cast<const char*>(header.data()), header.size()) || !out.flush())
+            throw nbt_exception("can't write " + temp);
+        out.close();
+        if (std::rename(temp.c_str(), path.c_str()) != 0)
+            throw nbt_exception("can't replace " + path);
+    } catch (...) {
+        std::remove(temp.c_str());
+        throw;
+    }
+}
+
+static bool restore_region(std::vector<std::unique_ptr<delta_file>>& deltas, const std::string& name, const std::string& path) {
+    std::vector<std::vector<uint8_t>> chunks(1024);
+    std::vector<std::vector<uint8_t>> externals(1024);
+    uint32_t timestamps[1024] = { 0 };
+    for (std::unique_ptr<delta_file>& d : deltas) {
+        d->apply(name, chunks, externals, timestamps);
+    }
+    if (std::all_of(chunks.begin(), chunks.end(), [](const std::vector<uint8_t>& c) { return c.empty(); }))
+        return false;
+    write_region(path, chunks, externals, timestamps);
+    return true;
+}
+
+static std::vector<std::unique_ptr<delta_file>> open_deltas(const std::vector<std::string>& paths) {
+    std::vector<std::unique_ptr<delta_file>> deltas;
+    for (const std::string& p : paths) {
+        deltas.push_back(std::unique_ptr<delta_file>(new delta_file(p)));
+    }
+    return deltas;
+}
+
+bool backup::restore_region(const std::vector<std::string>& deltas, const std::string& name, const std::string& path) {
+    std::vector<std::unique_ptr<delta_file>> files = open_deltas(deltas);
+    return ::restore_region(files, name, path);
+}
+
+size_t backup::restore(const std::vector<std::string>& deltas, const std::string& directory) {
+    std::vector<std::unique_ptr<delta_file>> files = open_deltas(deltas);
+    std::vector<std::string> names;
+    for (std::unique_ptr<delta_file>& d : files) {
+        for (const auto& r : d->records()) {
+            names.push_back(r.first);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    size_t written = 0;
+    for (const std::string& name : names) {
+        if (::restore_region(files, name, directory + "/" + name))
+            written++;
+    }
+    return written;
+}
@@ -0,0 +1,365 @@
+#include "blockdata.hpp"
+#include "nbt.hpp"
+
+#include <cstring>
+
+using namespace nbtpp;
+using namespace nbtpp::blockdata;
+
+size_t varint_decoder::decode(const uint8_t* data, size_t size, uint32_t* out, size_t capacity, size_t& consumed) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    size_t n = 0;
+
+    while (p < end && n < capacity) {
+        if (m_shift == 0) {
+            // Eight single-byte varints at once while no continuation bit is set.
+            while (end - p >= 8 && capacity - n >= 8) {
+                uint64_t w;
+                std::memcpy(&w, p, sizeof(w));
+                if (w & 0x8080808080808080ULL)
+                    break;
+                for (size_t i = 0; i < 8; i++) {
+                    out[n + i] = p[i];
+                }
+                p += 8;
+                n += 8;
+            }
+            if (p == end || n == capacity)
+                break;
+        }
+
+        uint8_t b = *p++;
+        m_value |= (uint32_t) (b & 0x7f) << m_shift;
+        if (b & 0x80) {
+            m_shift += 7;
+            if (m_shift >= 35)
+                throw nbt_exception("varint longer than 5 bytes at byte " + std::to_string(p - data - 1));
+        } else {
+            out[n++] = m_value;
+            m_value = 0;
+            m_shift = 0;
+        }
+    }
+
+    consumed = p - data;
+    return n;
+}
+
+void blockdata::decode_varints(const uint8_t* data, size_t size, std::vector<uint32_t>& out) {
+    // Every value takes at least a byte, so size values is always enough room.
+    size_t offset = out.size();
+    out.resize(offset + size);
+    varint_decoder d;
+    size_t consumed;
+    size_t count = d.decode(data, size, out.data() + offset, size, consumed);
+    d.finish();
+    out.resize(offset + count);
+}
+
+static inline size_t varint_length(uint32_t v) {
+    return v < (1u << 7) ? 1 : v < (1u << 14) ? 2 : v < (1u << 21) ? 3 : v < (1u << 28) ? 4 : 5;
+}
+
+size_t blockdata::varint_size(const uint32_t* values, size_t count) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size += varint_length(values[i]);
+    }
+    return size;
+}
+
+void blockdata::encode_varints(const uint32_t* values, size_t count, std::vector<int8_t>& out) {
+    size_t offset = out.size();
+    out.resize(offset + varint_size(values, count));
+    uint8_t* p = reinterpret_cast<uint8_t*>(out.data() + offset);
+    size_t i = 0;
+
+    while (i < count) {
+        // Eight single-byte varints at once.
+        if (count - i >= 8) {
+            uint32_t all = 0;
+            for (size_t j = 0; j < 8; j++) {
+                all |= values[i + j];
+            }
+            if (all < 0x80) {
+                for (size_t j = 0; j < 8; j++) {
+                    p[j] = (uint8_t) values[i + j];
+                }
+                p += 8;
+                i += 8;
+                continue;
+            }
+        }
+
+        uint32_t v = values[i++];
+        while (v >= 0x80) {
+            *p++ = (uint8_t) (v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t) v;
+    }
+}
+
+template<class T>
+static T* require(const tags::tag_compound* c, const std::string& name, const char* what) {
+    T* t = c->get<T>(name);
+    if (t == nullptr)
+        throw nbt_exception(std::string(what) + " has no " + name_for_type(tag_traits<T>::type) + " '" + name + "'");
+    return t;
+}
+
+/**
+ * Fill out from a compound mapping block states to indices, which must be 0 to its size - 1, each used once.
+ */
+static void read_palette(const tags::tag_compound* palette, std::vector<std::string>& out) {
+    size_t size = palette->value().size();
+    out.assign(size, std::string());
+    std::vector<bool> seen(size, false);
+    for (const tag *t : palette->value()) {
+        const tags::tag_int* i = tag_cast<tags::tag_int>(t);
+        if (i == nullptr || i->value() < 0 || (size_t) i->value() >= size)
+            throw nbt_exception("invalid palette entry '" + t->name() + "'");
+        if (seen[i->value()])
+            throw nbt_exception("palette index " + std::to_string(i->value()) + " used twice");
+        seen[i->value()] = true;
+        out[i->value()] = t->name();
+    }
+}
+
+static void check_indices(const block_volume& v) {
+    uint32_t max = 0;
+    for (uint32_t b : v.blocks) {
+        max = b > max ? b : max;
+    }
+    if (!v.blocks.empty() && max >= v.palette.size())
+        throw nbt_exception("block index " + std::to_string(max) + " outside of palette of " + std::to_string(v.palette.size()));
+}
+
+void blockdata::decode_schematic(const tags::tag_compound* root, block_volume& out) {
+    // Version 3 nests everything in a Schematic compound.
+    const tags::tag_compound* schematic = root->get<tags::tag_compound>("Schematic");
+    if (schematic == nullptr)
+        schematic = root;
+
+    out.width = (uint16_t) require<tags::tag_short>(schematic, "Width", "schematic")->value();
+    out.height = (uint16_t) require<tags::tag_short>(schematic, "Height", "schematic")->value();
+    out.length = (uint16_t) require<tags::tag_short>(schematic, "Length", "schematic")->value();
+
+    const tags::tag_compound* palette;
+    const tags::tag_bytearray* data;
+    const tags::tag_compound* blocks = schematic->get<tags::tag_compound>("Blocks");
+    if (blocks != nullptr) {
+        palette = require<tags::tag_compound>(blocks, "Palette", "schematic blocks");
+        data = require<tags::tag_bytearray>(blocks, "Data", "schematic blocks");
+    } else {
+        palette = require<tags::tag_compound>(schematic, "Palette", "schematic");
+        data = require<tags::tag_bytearray>(schematic, "BlockData", "schematic");
+    }
+
+    // Every block takes at least a byte, a volume larger than the data can't be right and isn't allocated.
+    if (out.volume() > data->value().size())
+        throw nbt_exception("schematic of " + std::to_string(out.volume()) + " blocks has only " + std::to_string(data->value().size()) + " bytes of block data");
+
+    read_palette(palette, out.palette);
+    out.blocks.clear();
+    out.blocks.reserve(out.volume());
+    decode_varints(data->value(), out.blocks);
+    if (out.blocks.size() != out.volume())
+        throw nbt_exception("schematic has " + std::to_string(out.blocks.size()) + " blocks instead of " + std::to_string(out.volume()));
+    check_indices(out);
+}
+
+void blockdata::encode_schematic(const block_volume& in, tags::tag_compound* root) {
+    if (in.width > 0xffff || in.height > 0xffff || in.length > 0xffff)
+        throw nbt_exception("schematic dimensions exceed 65535");
+    if (in.blocks.size() != in.volume())
+        throw nbt_exception("volume has " + std::to_string(in.blocks.size()) + " blocks instead of " + std::to_string(in.volume()));
+    check_indices(in);
+
+    root->insert(new tags::tag_int("Version", 2));
+    root->insert(new tags::tag_short("Width", (int16_t) in.width));
+    root->insert(new tags::tag_short("Height", (int16_t) in.height));
+    root->insert(new tags::tag_short("Length", (int16_t) in.length));
+
+    tags::tag_compound* palette = new tags::tag_compound("Palette");
+    for (size_t i = 0; i < in.palette.size(); i++) {
+        palette->insert(new tags::tag_int(in.palette[i], (int32_t) i));
+    }
+    root->insert(palette);
+    root->insert(new tags::tag_int("PaletteMax", (int32_t) in.palette.size()));
+
+    tags::tag_bytearray* data = new tags::tag_bytearray("BlockData");
+    encode_varints(in.blocks.data(), in.blocks.size(), data->value());
+    root->insert(data);
+}
+
+std::string blockdata::state_string(const tags::tag_compound* entry) {
+    std::string state = require<tags::tag_string>(entry, "Name", "palette entry")->value();
+    const tags::tag_compound* properties = entry->get<tags::tag_compound>("Properties");
+    if (properties != nullptr && !properties->value().empty()) {
+        state += '[';
+        for (size_t i = 0; i < properties->value().size(); i++) {
+            const tags::tag_string* p = tag_cast<tags::tag_string>(properties->value()[i]);
+            if (p == nullptr)
+                throw nbt_exception("invalid block property '" + properties->value()[i]->name() + "'");
+            if (i > 0)
+                state += ',';
+            state += p->name();
+            state += '=';
+            state += p->value();
+        }
+        state += ']';
+    }
+    return state;
+}
+
+/**
+ * Reads the three ints of a size or pos list.
+ */
+static void read_vector(const tags::tag_list* l, int32_t out[3]) {
+    if (l == nullptr || l->content_type() != tag_type::TAG_Int || l->value().size() != 3)
+        throw nbt_exception("expected a list of 3 ints");
+    for (size_t i = 0; i < 3; i++) {
+        out[i] = static_cast<const tags::tag_int*>(l->value()[i])->value();
+    }
+}
+
+/**
+ * Volume of the largest structure a structure block saves, 48 blocks a side.
+ */
+static const uint64_t structure_base_volume = 48 * 48 * 48;
+
+/**
+ * Positions of a structure allowed per block beyond structure_base_volume.
+ */
+static const uint64_t structure_void_ratio = 64;
+
+void blockdata::decode_structure(const tags::tag_compound* root, block_volume& out, uint32_t empty) {
+    int32_t size[3];
+    read_vector(root->get<tags::tag_list>("size"), size);
+    if (size[0] < 0 || size[1] < 0 || size[2] < 0)
+        throw nbt_exception("negative structure size");
+    out.width = size[0];
+    out.height = size[1];
+    out.length = size[2];
+
+    const tags::tag_list* blocks = require<tags::tag_list>(root, "blocks", "structure");
+    if (!blocks->value().empty() && blocks->content_type() != tag_type::TAG_Compound)
+        throw nbt_exception("structure blocks are not a list of compounds");
+
+    // Positions without a block are structure voids, a few are expected but not a size out of proportion with the
+    // blocks, which would be allocated for nothing.
+    uint64_t area = (uint64_t) out.width * out.height;
+    uint64_t limit = structure_base_volume + structure_void_ratio * (uint64_t) blocks->value().size();
+    if (area != 0 && out.length > limit / area)
+        throw nbt_exception("structure of " + std::to_string(size[0]) + "x" + std::to_string(size[1]) + "x" + std::to_string(size[2]) +
+            " has only " + std::to_string(blocks->value().size()) + " blocks");
+
+    // Structures with random variants store several palettes, use the first one.
+    const tags::tag_list* palette = root->get<tags::tag_list>("palette");
+    if (palette == nullptr) {
+        const tags::tag_list* palettes = require<tags::tag_list>(root, "palettes", "structure");
+        if (palettes->value().empty())
+            throw nbt_exception("structure has no palette");
+        palette = tag_cast<tags::tag_list>(palettes->value()[0]);
+    }
+    if (palette == nullptr || (!palette->value().empty() && palette->content_type() != tag_type::TAG_Compound))
+        throw nbt_exception("structure palette is not a list of compounds");
+
+    out.palette.clear();
+    out.palette.reserve(palette->value().size());
+    for (const tag *entry : palette->value()) {
+        out.palette.push_back(state_string(static_cast<const tags::tag_compound*>(entry)));
+    }
+
+    out.blocks.assign(out.volume(), empty);
+    for (const tag *t : blocks->value()) {
+        const tags::tag_compound* block = static_cast<const tags::tag_compound*>(t);
+        const tags::tag_int* state = nullptr;
+        const tags::tag_list* pos = nullptr;
+        // A single pass over the entries instead of a lookup per name.
+        for (const tag *e : block->value()) {
+            if (e->type() == tag_type::TAG_Int && e->name() == "state")
+                state = static_cast<const tags::tag_int*>(e);
+            else if (e->type() == tag_type::TAG_List && e->name() == "pos")
+                pos = static_cast<const tags::tag_list*>(e);
+        }
+        if (state == nullptr || state->value() < 0 || (size_t) state->value() >= out.palette.size())
+            throw nbt_exception("structure block with an invalid state");
+
+        int32_t p[3];
+        read_vector(pos, p);
+        if (p[0] < 0 || p[1] < 0 || p[2] < 0 || (uint32_t) p[0] >= out.width || (uint32_t) p[1] >= out.height || (uint32_t) p[2] >= out.length)
+            throw nbt_exception("structure block outside of its size");
+        out.blocks[out.index(p[0], p[1], p[2])] = state->value();
+    }
+}
+
+static tags::tag_list* make_vector(std::string name, int32_t x, int32_t y, int32_t z) {
+    tags::tag_list* l = new tags::tag_list(std::move(name), tag_type::TAG_Int);
+    l->append(new tags::tag_int("", x));
+    l->append(new tags::tag_int("", y));
+    l->append(new tags::tag_int("", z));
+    return l;
+}
+
+/**
+ * Palette entry of a structure from a block state string.
+ */
+static tags::tag_compound* make_state(const std::string& state) {
+    tags::tag_compound* entry = new tags::tag_compound("");
+    size_t open = state.find('[');
+    entry->insert(new tags::tag_string("Name", state.substr(0, open)));
+    if (open != std::string::npos) {
+        size_t close = state.rfind(']');
+        if (close == std::string::npos || close < open)
+            throw nbt_exception("invalid block state '" + state + "'");
+        tags::tag_compound* properties = new tags::tag_compound("Properties");
+        entry->insert(properties);
+        size_t start = open + 1;
+        while (start < close) {
+            size_t comma = state.find(',', start);
+            if (comma == std::string::npos || comma > close)
+                comma = close;
+            size_t equal = state.find('=', start);
+            if (equal == std::string::npos || equal > comma)
+                throw nbt_exception("invalid block state '" + state + "'");
+            properties->insert(new tags::tag_string(state.substr(start, equal - start), state.substr(equal + 1, comma - equal - 1)));
+            start = comma + 1;
+        }
+    }
+    return entry;
+}
+
+void blockdata::encode_structure(const block_volume& in, tags::tag_compound* root, uint32_t empty) {
+    if (in.blocks.size() != in.volume())
+        throw nbt_exception("volume has " + std::to_string(in.blocks.size()) + " blocks instead of " + std::to_string(in.volume()));
+
+    root->insert(make_vector("size", in.width, in.height, in.length));
+
+    tags::tag_list* palette = new tags::tag_list("palette", tag_type::TAG_Compound);
+    root->insert(palette);
+    for (const std::string& state : in.palette) {
+        palette->append(make_state(state));
+    }
+
+    tags::tag_list* blocks = new tags::tag_list("blocks", tag_type::TAG_Compound);
+    root->insert(blocks);
+    size_t i = 0;
+    for (uint32_t y = 0; y < in.height; y++) {
+        for (uint32_t z = 0; z < in.length; z++) {
+            for (uint32_t x = 0; x < in.width; x++, i++) {
+                uint32_t b = in.blocks[i];
+                if (b == empty)
+                    continue;
+                if (b >= in.palette.size())
+                    throw nbt_exception("block index " + std::to_string(b) + " outside of palette of " + std::to_string(in.palette.size()));
+                tags::tag_compound* block = new tags::tag_compound("");
+                blocks->append(block);
+                block->insert(make_vector("pos", x, y, z));
+                block->insert(new tags::tag_int("state", (int32_t) b));
+            }
+        }
+    }
+}
@@ -0,0 +1,308 @@
+#include "canonical.hpp"
+#include "nbt.hpp"
+
+#include <algorithm>
+
+using namespace nbtpp;
+using namespace nbtpp::canonical::detail;
+
+/**
+ * Hash the big-endian encoding of count values, as hash_raw() does on encoded bytes.
+ */
+template<class T>
+static uint64_t hash_array(tag_type type, const std::vector<T>& values) {
+    canonical::byte_hasher h;
+    uint8_t chunk[4096];
+    const size_t per_chunk = sizeof(chunk) / sizeof(T);
+    for (size_t i = 0; i < values.size(); i += per_chunk) {
+        size_t n = std::min(per_chunk, values.size() - i);
+        codec::to_be(chunk, values.data() + i, n);
+        h.update(chunk, n * sizeof(T));
+    }
+    return combine(type, h.digest());
+}
+
+/**
+ * Computes the same hash as hash_payload() does over encoded bytes.
+ */
+struct hash_visitor {
+    uint64_t operator()(const tags::tag_end& t) const {
+        return combine(t.type(), 0);
+    }
+
+    uint64_t operator()(const tags::tag_byte& t) const {
+        return combine(t.type(), (uint64_t) (int64_t) t.value());
+    }
+
+    uint64_t operator()(const tags::tag_short& t) const {
+        return combine(t.type(), (uint64_t) (int64_t) t.value());
+    }
+
+    uint64_t operator()(const tags::tag_int& t) const {
+        return combine(t.type(), (uint64_t) (int64_t) t.value());
+    }
+
+    uint64_t operator()(const tags::tag_long& t) const {
+        return combine(t.type(), (uint64_t) t.value());
+    }
+
+    uint64_t operator()(const tags::tag_float& t) const {
+        return combine(t.type(), float_bits(t.value()));
+    }
+
+    uint64_t operator()(const tags::tag_double& t) const {
+        return combine(t.type(), double_bits(t.value()));
+    }
+
+    uint64_t operator()(const tags::tag_string& t) const {
+        canonical::byte_hasher h;
+        h.update(reinterpret_cast<const uint8_t*>(t.value().data()), t.value().size());
+        return combine(t.type(), h.digest());
+    }
+
+    uint64_t operator()(const tags::tag_bytearray& t) const {
+        return hash_array(t.type(), t.value());
+    }
+
+    uint64_t operator()(const tags::tag_intarray& t) const {
+        return hash_array(t.type(), t.value());
+    }
+
+    uint64_t operator()(const tags::tag_longarray& t) const {
+        return hash_array(t.type(), t.value());
+    }
+
+    uint64_t operator()(const tags::tag_list& t) const {
+        uint64_t h = combine(t.type(), t.value().size());
+        if (!t.value().empty())
+            h = combine(h, t.content_type());
+        for (const tag *e : t.value()) {
+            h = combine(h, visit(*e, *this));
+        }
+        return h;
+    }
+
+    uint64_t operator()(const tags::tag_compound& t) const {
+        uint64_t sum = 0;
+        for (const tag *e : t.value()) {
+            const std::string& name = e->name();
+            sum += fmix(combine(canonical::hash_name(name.data(), name.size()), visit(*e, *this)));
+        }
+        return combine(combine(t.type(), t.value().size()), sum);
+    }
+};
+
+uint64_t canonical::hash_value(const tag* t) {
+    return visit(*t, hash_visitor());
+}
+
+uint64_t canonical::hash(const tag* t) {
+    const std::string& name = t->name();
+    return combine(hash_name(name.data(), name.size()), hash_value(t));
+}
+
+static bool equal_value(const tag* a, const tag* b);
+
+/**
+ * Compares the payload of b, known to be of the same type, with the visited tag.
+ */
+struct equal_visitor {
+    const tag* other;
+
+    bool operator()(const tags::tag_end&) const {
+        return true;
+    }
+
+    bool operator()(const tags::tag_byte& t) const {
+        return t.value() == static_cast<const tags::tag_byte*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_short& t) const {
+        return t.value() == static_cast<const tags::tag_short*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_int& t) const {
+        return t.value() == static_cast<const tags::tag_int*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_long& t) const {
+        return t.value() == static_cast<const tags::tag_long*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_float& t) const {
+        return float_bits(t.value()) == float_bits(static_cast<const tags::tag_float*>(other)->value());
+    }
+
+    bool operator()(const tags::tag_double& t) const {
+        return double_bits(t.value()) == double_bits(static_cast<const tags::tag_double*>(other)->value());
+    }
+
+    bool operator()(const tags::tag_string& t) const {
+        return t.value() == static_cast<const tags::tag_string*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_bytearray& t) const {
+        return t.value() == static_cast<const tags::tag_bytearray*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_intarray& t) const {
+        return t.value() == static_cast<const tags::tag_intarray*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_longarray& t) const {
+        return t.value() == static_cast<const tags::tag_longarray*>(other)->value();
+    }
+
+    bool operator()(const tags::tag_list& t) const {
+        const tags::tag_list* l = static_cast<const tags::tag_list*>(other);
+        if (t.value().size() != l->value().size())
+            return false;
+        if (t.value().empty())
+            return true;
+        if (t.content_type() != l->content_type())
+            return false;
+        for (size_t i = 0; i < t.value().size(); i++) {
+            if (!equal_value(t.value()[i], l->value()[i]))
+                return false;
+        }
+        return true;
+    }
+
+    bool operator()(const tags::tag_compound& t) const {
+        const tags::tag_compound* c = static_cast<const tags::tag_compound*>(other);
+        if (t.value().size() != c->value().size())
+            return false;
+        for (size_t i = 0; i < t.value().size(); i++) {
+            const tag* a = t.value()[i];
+            // Entries are usually in the same order, only search when they are not.
+            const tag* b = c->value()[i];
+            if (b->name() != a->name()) {
+                b = c->get(a->name());
+                if (b == nullptr)
+                    return false;
+            }
+            if (!equal_value(a, b))
+                return false;
+        }
+        return true;
+    }
+};
+
+static bool equal_value(const tag* a, const tag* b) {
+    if (a == b)
+        return true;
+    if (a->type() != b->type())
+        return false;
+    return visit(*a, equal_visitor { b });
+}
+
+bool canonical::equal(const tag* a, const tag* b) {
+    if (a == nullptr || b == nullptr)
+        return a == b;
+    return a->name() == b->name() && equal_value(a, b);
+}
+
+static bool name_less(const tag* a, const tag* b) {
+    return a->name() < b->name();
+}
+
+template<class Writer>
+static void encode_payload(Writer& out, const tag* t);
+
+/**
+ * Writes the canonical payload of a tag.
+ */
+template<class Writer>
+struct encode_visitor {
+    Writer& out;
+
+    void operator()(const tags::tag_end&) const {
+    }
+
+    void operator()(const tags::tag_byte& t) const {
+        out.write_byte(t.value());
+    }
+
+    void operator()(const tags::tag_short& t) const {
+        out.write_short(t.value());
+    }
+
+    void operator()(const tags::tag_int& t) const {
+        out.write_int(t.value());
+    }
+
+    void operator()(const tags::tag_long& t) const {
+        out.write_long(t.value());
+    }
+
+    void operator()(const tags::tag_float& t) const {
+        out.write_int((int32_t) float_bits(t.value()));
+    }
+
+    void operator()(const tags::tag_double& t) const {
+        out.write_long((int64_t) double_bits(t.value()));
+    }
+
+    void operator()(const tags::tag_string& t) const {
+        out.write_string(t.value());
+    }
+
+    void operator()(const tags::tag_bytearray& t) const {
+        out.write_int(t.value().size());
+        out.write_array(t.value().data(), t.value().size());
+    }
+
+    void operator()(const tags::tag_intarray& t) const {
+        out.write_int(t.value().size());
+        out.write_array(t.value().data(), t.value().size());
+    }
+
+    void operator()(const tags::tag_longarray& t) const {
+        out.write_int(t.value().size());
+        out.write_array(t.value().data(), t.value().size());
+    }
+
+    void operator()(const tags::tag_list& t) const {
+        out.write_ubyte(t.value().empty() ? tag_type::TAG_End : t.content_type());
+        out.write_int(t.value().size());
+        for (const tag *e : t.value()) {
+            encode_payload(out, e);
+        }
+    }
+
+    void operator()(const tags::tag_compound& t) const {
+        std::vector<const tag*> sorted(t.value().begin(), t.value().end());
+        std::sort(sorted.begin(), sorted.end(), name_less);
+        for (const tag *e : sorted) {
+            out.write_ubyte(e->type());
+            out.write_string(e->name());
+            encode_payload(out, e);
+        }
+        out.write_ubyte(tag_type::TAG_End);
+    }
+};
+
+template<class Writer>
+static void encode_payload(Writer& out, const tag* t) {
+    visit(*t, encode_visitor<Writer> { out });
+}
+
+template<class Writer>
+static void encode_root(Writer& out, const tag* t) {
+    out.write_ubyte(t->type());
+    if (t->type() == tag_type::TAG_End)
+        return;
+    out.write_string(t->name());
+    encode_payload(out, t);
+}
+
+void canonical::encode(const tag* t, std::vector<uint8_t>& out) {
+    codec::buffer_writer w(out);
+    encode_root(w, t);
+}
+
+void canonical::encode(const tag* t, std::ostream& out) {
+    codec::stream_writer w(out.rdbuf());
+    encode_root(w, t);
+    w.flush();
+}
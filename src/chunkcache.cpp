@@ -0,0 +1,279 @@
+#include "chunkcache.hpp"
+#include "region.hpp"
+
+#include <sys/stat.h>
+
+using namespace nbtpp;
+
+/**
+ * Region files kept open by a region fetcher, the most recently used first.
+ */
+class region_pool {
+public:
+    /**
+     * An open region, read by one thread at a time.
+     */
+    struct region {
+        std::mutex mutex;
+        region_file file;
+
+        region(const std::string& path) : file(path) {
+        }
+    };
+
+    region_pool(size_t capacity) : m_capacity(capacity > 0 ? capacity : 1) {
+    }
+
+    /**
+     * Open region at path, or nullptr if there is no file.
+     *
+     * @throws nbt_exception if the file can't be read
+     */
+    std::shared_ptr<region> get(const std::string& path) {
+        struct stat now;
+        if (stat(path.c_str(), &now) != 0)
+            return nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto it = m_open.begin(); it != m_open.end(); ++it) {
+                if (it->path != path)
+                    continue;
+                if (same_file(it->status, now)) {
+                    m_open.splice(m_open.begin(), m_open, it);
+                    return it->open;
+                }
+                // Replaced or written since, its header is stale.
+                m_open.erase(it);
+                break;
+            }
+        }
+
+        // Opened without the lock, other regions stay available meanwhile.
+        std::shared_ptr<region> r(new region(path));
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_open.begin(); it != m_open.end(); ++it) {
+            if (it->path == path) {
+                m_open.erase(it);
+                break;
+            }
+        }
+        m_open.push_front(entry { path, now, r });
+        if (m_open.size() > m_capacity)
+            m_open.pop_back();
+        return r;
+    }
+private:
+    struct entry {
+        std::string path;
+        struct stat status;
+        std::shared_ptr<region> open;
+    };
+
+    static bool same_file(const struct stat& a, const struct stat& b) {
+        return a.st_ino == b.st_ino && a.st_size == b.st_size && a.st_mtime == b.st_mtime;
+    }
+
+    size_t m_capacity;
+    std::mutex m_mutex;
+    std::list<entry> m_open;
+};
+
+chunk_cache::chunk_cache(size_t budget, size_t compressed_budget, size_t shards, fetcher fetch) : m_budget(budget), m_compressed_budget(compressed_budget),
+        m_fetch(std::move(fetch)), m_next_load(0), m_hits(0), m_compressed_hits(0), m_misses(0), m_evictions(0), m_discards(0) {
+    if (shards > budget / min_shard_budget)
+        shards = budget / min_shard_budget;
+    if (shards == 0)
+        shards = 1;
+    for (size_t i = 0; i < shards; i++) {
+        m_shards.push_back(std::unique_ptr<shard>(new shard()));
+    }
+}
+
+chunk_cache::fetcher chunk_cache::region_fetcher(size_t open_regions) {
+    std::shared_ptr<region_pool> pool(new region_pool(open_regions));
+    return [pool](const key& k, std::vector<uint8_t>& data, nbt::compression& compression) {
+        // A missing region file means the chunk was never generated.
+        std::shared_ptr<region_pool::region> region = pool->get(k.region);
+        if (region == nullptr)
+            return false;
+        std::lock_guard<std::mutex> lock(region->mutex);
+        return region->file.read(k.x, k.z, data, compression);
+    };
+}
+
+chunk_cache::handle chunk_cache::get(const std::string& region, int32_t x, int32_t z) {
+    key k = { region, x, z };
+    shard& s = shard_for(k);
+    std::vector<uint8_t> data;
+    nbt::compression compression = nbt::uncompressed;
+    bool stored = false;
+    std::promise<handle> promise;
+    uint64_t load = m_next_load++;
+
+    {
+        std::unique_lock<std::mutex> lock(s.mutex);
+        auto hot = s.hot.find(k);
+        if (hot != s.hot.end()) {
+            s.hot_order.splice(s.hot_order.begin(), s.hot_order, hot->second.position);
+            m_hits++;
+            return hot->second.tree;
+        }
+
+        auto loading = s.loading.find(k);
+        if (loading != s.loading.end()) {
+            std::shared_future<handle> result = loading->second.second;
+            lock.unlock();
+            return result.get();
+        }
+
+        auto cold = s.cold.find(k);
+        if (cold != s.cold.end()) {
+            data = std::move(cold->second.data);
+            compression = cold->second.compression;
+            s.cold_bytes -= cold->second.cost;
+            s.cold_order.erase(cold->second.position);
+            s.cold.erase(cold);
+            stored = true;
+            m_compressed_hits++;
+        } else {
+            m_misses++;
+        }
+        s.loading.emplace(k, std::make_pair(load, promise.get_future().share()));
+    }
+
+    // Load without holding the lock, other callers of this key wait on the future.
+    entry e;
+    try {
+        if (stored || m_fetch(k, data, compression)) {
+            std::shared_ptr<nbt> tree(new nbt());
+            region_file::decode(data.data(), data.size(), compression, *tree);
+            data.shrink_to_fit();
+            e.cost = tree->memory_usage() + data.capacity() + sizeof(entry) + k.region.capacity();
+            e.tree = tree;
+            e.data = std::move(data);
+            e.compression = compression;
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto loading = s.loading.find(k);
+            if (loading != s.loading.end() && loading->second.first == load)
+                s.loading.erase(loading);
+        }
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    handle result = e.tree;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto loading = s.loading.find(k);
+        // Not cached if the key was invalidated meanwhile.
+        if (loading != s.loading.end() && loading->second.first == load) {
+            s.loading.erase(loading);
+            if (result != nullptr)
+                insert(s, k, std::move(e));
+        }
+    }
+    promise.set_value(result);
+    return result;
+}
+
+void chunk_cache::insert(shard& s, const key& k, entry e) {
+    s.hot_order.push_front(k);
+    e.position = s.hot_order.begin();
+    s.hot_bytes += e.cost;
+    s.hot.emplace(k, std::move(e));
+    demote(s);
+}
+
+void chunk_cache::demote(shard& s) {
+    size_t budget = m_budget / m_shards.size();
+    size_t compressed_budget = m_compressed_budget / m_shards.size();
+
+    while (s.hot_bytes > budget && !s.hot_order.empty()) {
+        key k = s.hot_order.back();
+        s.hot_order.pop_back();
+        auto hot = s.hot.find(k);
+        entry e = std::move(hot->second);
+        s.hot.erase(hot);
+        s.hot_bytes -= e.cost;
+        m_evictions++;
+
+        e.tree.reset();
+        e.cost = e.data.capacity() + sizeof(entry) + k.region.capacity();
+        if (e.cost > compressed_budget) {
+            m_discards++;
+            continue;
+        }
+        s.cold_order.push_front(k);
+        e.position = s.cold_order.begin();
+        s.cold_bytes += e.cost;
+        s.cold.emplace(k, std::move(e));
+
+        while (s.cold_bytes > compressed_budget) {
+            auto cold = s.cold.find(s.cold_order.back());
+            s.cold_bytes -= cold->second.cost;
+            s.cold.erase(cold);
+            s.cold_order.pop_back();
+            m_discards++;
+        }
+    }
+}
+
+void chunk_cache::invalidate(const std::string& region, int32_t x, int32_t z) {
+    key k = { region, x, z };
+    shard& s = shard_for(k);
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto hot = s.hot.find(k);
+    if (hot != s.hot.end()) {
+        s.hot_bytes -= hot->second.cost;
+        s.hot_order.erase(hot->second.position);
+        s.hot.erase(hot);
+    }
+    auto cold = s.cold.find(k);
+    if (cold != s.cold.end()) {
+        s.cold_bytes -= cold->second.cost;
+        s.cold_order.erase(cold->second.position);
+        s.cold.erase(cold);
+    }
+    s.loading.erase(k);
+}
+
+void chunk_cache::clear() {
+    for (std::unique_ptr<shard>& s : m_shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->hot.clear();
+        s->cold.clear();
+        s->hot_order.clear();
+        s->cold_order.clear();
+        s->loading.clear();
+        s->hot_bytes = 0;
+        s->cold_bytes = 0;
+    }
+}
+
+size_t chunk_cache::size() const {
+    size_t total = 0;
+    for (const std::unique_ptr<shard>& s : m_shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        total += s->hot_bytes;
+    }
+    return total;
+}
+
+size_t chunk_cache::compressed_size() const {
+    size_t total = 0;
+    for (const std::unique_ptr<shard>& s : m_shards) {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        total += s->cold_bytes;
+    }
+    return total;
+}
+
+chunk_cache::statistics chunk_cache::stats() const {
+    statistics s = { m_hits, m_compressed_hits, m_misses, m_evictions, m_discards };
+    return s;
+}
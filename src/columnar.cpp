@@ -0,0 +1,505 @@
+#include "columnar.hpp"
+#include "nbt.hpp"
+#include "codec.hpp"
+#include "deflate.hpp"
+#include "nbtexception.hpp"
+#include "visit.hpp"
+#include "stde/streams/gzip.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <thread>
+
+using namespace nbtpp;
+using namespace nbtpp::columnar;
+using namespace stde;
+
+column::column(std::string name, column_type type, compression method) : m_name(std::move(name)), m_type(type), m_method(method), m_size(0) {
+}
+
+void column::next_row(bool valid) {
+    if ((m_size & 7) == 0)
+        m_valid.push_back(0);
+    if (valid)
+        m_valid.back() |= (uint8_t) (1 << (m_size & 7));
+    m_size++;
+}
+
+void column::append_null() {
+    switch (m_type) {
+        case column_type::int64:
+            m_ints.push_back(0);
+            break;
+        case column_type::real:
+            m_reals.push_back(0);
+            break;
+        case column_type::string:
+            m_codes.push_back(0);
+            break;
+    }
+    next_row(false);
+}
+
+void column::append(int64_t v) {
+    if (m_type == column_type::int64) {
+        m_ints.push_back(v);
+        next_row(true);
+    } else if (m_type == column_type::real) {
+        m_reals.push_back((double) v);
+        next_row(true);
+    } else {
+        append_null();
+    }
+}
+
+void column::append(double v) {
+    if (m_type == column_type::real) {
+        m_reals.push_back(v);
+        next_row(true);
+    } else {
+        append_null();
+    }
+}
+
+void column::append(const std::string& v) {
+    if (m_type != column_type::string) {
+        append_null();
+        return;
+    }
+    auto it = m_lookup.find(v);
+    uint32_t code;
+    if (it == m_lookup.end()) {
+        code = (uint32_t) m_dictionary.size();
+        m_dictionary.push_back(v);
+        m_lookup.emplace(v, code);
+    } else {
+        code = it->second;
+    }
+    m_codes.push_back(code);
+    next_row(true);
+}
+
+void column::append(const column& other) {
+    if (other.m_type != m_type)
+        throw nbt_exception("can't append column '" + other.m_name + "' to column '" + m_name + "' of another type");
+
+    if (m_type == column_type::string) {
+        std::vector<uint32_t> remap(other.m_dictionary.size());
+        for (size_t i = 0; i < other.m_dictionary.size(); i++) {
+            const std::string& s = other.m_dictionary[i];
+            auto it = m_lookup.find(s);
+            if (it == m_lookup.end()) {
+                remap[i] = (uint32_t) m_dictionary.size();
+                m_dictionary.push_back(s);
+                m_lookup.emplace(s, remap[i]);
+            } else {
+                remap[i] = it->second;
+            }
+        }
+        m_codes.reserve(m_codes.size() + other.m_size);
+        for (uint32_t c : other.m_codes) {
+            m_codes.push_back(remap[c]);
+        }
+    } else {
+        m_ints.insert(m_ints.end(), other.m_ints.begin(), other.m_ints.end());
+        m_reals.insert(m_reals.end(), other.m_reals.begin(), other.m_reals.end());
+    }
+
+    if ((m_size & 7) == 0) {
+        m_valid.insert(m_valid.end(), other.m_valid.begin(), other.m_valid.end());
+        m_size += other.m_size;
+    } else {
+        for (size_t i = 0; i < other.m_size; i++) {
+            next_row(!other.null(i));
+        }
+    }
+}
+
+void column::assign(size_t size, std::vector<uint8_t> valid, std::vector<int64_t> ints, std::vector<double> reals,
+    std::vector<uint32_t> codes, std::vector<std::string> dictionary) {
+    m_size = size;
+    m_valid = std::move(valid);
+    m_ints = std::move(ints);
+    m_reals = std::move(reals);
+    m_codes = std::move(codes);
+    m_dictionary = std::move(dictionary);
+    m_lookup.clear();
+    for (size_t i = 0; i < m_dictionary.size(); i++) {
+        m_lookup.emplace(m_dictionary[i], (uint32_t) i);
+    }
+}
+
+void table::append(const table& other) {
+    if (other.columns.size() != columns.size())
+        throw nbt_exception("can't append a table with other columns");
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (columns[i].name() != other.columns[i].name())
+            throw nbt_exception("can't append column '" + other.columns[i].name() + "' to column '" + columns[i].name() + "'");
+        columns[i].append(other.columns[i]);
+    }
+}
+
+const column* table::find(const std::string& name) const {
+    for (const column& c : columns) {
+        if (c.name() == name)
+            return &c;
+    }
+    return nullptr;
+}
+
+static extractor::path parse_path(const std::string& s) {
+    extractor::path p;
+    p.absolute = !s.empty() && s[0] == '/';
+    size_t i = p.absolute ? 1 : 0;
+
+    while (i < s.size()) {
+        if (s[i] == '[') {
+            size_t close = s.find(']', i);
+            if (close == std::string::npos || close == i + 1)
+                throw nbt_exception("invalid path '" + s + "'");
+            int32_t index = 0;
+            for (size_t j = i + 1; j < close; j++) {
+                if (s[j] < '0' || s[j] > '9')
+                    throw nbt_exception("invalid index in path '" + s + "'");
+                index = index * 10 + (s[j] - '0');
+            }
+            p.steps.push_back(extractor::step { std::string(), index });
+            i = close + 1;
+        } else {
+            size_t end = s.find_first_of(".[", i);
+            if (end == std::string::npos)
+                end = s.size();
+            p.steps.push_back(extractor::step { s.substr(i, end - i), -1 });
+            i = end;
+        }
+        if (i < s.size() && s[i] == '.')
+            i++;
+    }
+    return p;
+}
+
+extractor::extractor(const std::string& rows, std::vector<field> fields) : m_rows(parse_path(rows)), m_fields(std::move(fields)) {
+    for (const field& f : m_fields) {
+        m_paths.push_back(parse_path(f.path));
+    }
+}
+
+table extractor::make_table() const {
+    table t;
+    for (const field& f : m_fields) {
+        t.columns.push_back(column(f.name, f.type, f.method));
+    }
+    return t;
+}
+
+template<class T>
+static void append_element(const std::vector<T>& values, int32_t index, column& c) {
+    if ((size_t) index < values.size())
+        c.append((int64_t) values[index]);
+    else
+        c.append_null();
+}
+
+/**
+ * Appends the value of a tag to a column, null for tags that are not a number or a string.
+ */
+struct append_visitor {
+    column& c;
+
+    void operator()(const tag&) const {
+        c.append_null();
+    }
+
+    void operator()(const tags::tag_byte& t) const {
+        c.append((int64_t) t.value());
+    }
+
+    void operator()(const tags::tag_short& t) const {
+        c.append((int64_t) t.value());
+    }
+
+    void operator()(const tags::tag_int& t) const {
+        c.append((int64_t) t.value());
+    }
+
+    void operator()(const tags::tag_long& t) const {
+        c.append((int64_t) t.value());
+    }
+
+    void operator()(const tags::tag_float& t) const {
+        c.append((double) t.value());
+    }
+
+    void operator()(const tags::tag_double& t) const {
+        c.append(t.value());
+    }
+
+    void operator()(const tags::tag_string& t) const {
+        c.append(t.value());
+    }
+};
+
+/**
+ * Appends an element of an array to a column, returning false for tags that are not arrays.
+ */
+struct element_visitor {
+    int32_t index;
+    column& c;
+
+    bool operator()(const tag&) const {
+        return false;
+    }
+
+    bool operator()(const tags::tag_bytearray& t) const {
+        append_element(t.value(), index, c);
+        return true;
+    }
+
+    bool operator()(const tags::tag_intarray& t) const {
+        append_element(t.value(), index, c);
+        return true;
+    }
+
+    bool operator()(const tags::tag_longarray& t) const {
+        append_element(t.value(), index, c);
+        return true;
+    }
+};
+
+static void append_tag(const tag* t, column& c) {
+    if (t == nullptr)
+        c.append_null();
+    else
+        visit(*t, append_visitor { c });
+}
+
+/**
+ * Follow steps from t, returning nullptr when the path does not exist.
+ */
+static const tag* resolve(const tag* t, const std::vector<extractor::step>& steps, size_t count) {
+    for (size_t i = 0; i < count && t != nullptr; i++) {
+        const extractor::step& s = steps[i];
+        if (s.index < 0) {
+            const tags::tag_compound* c = tag_cast<tags::tag_compound>(t);
+            t = c != nullptr ? c->get(s.name) : nullptr;
+        } else if (const tags::tag_list* l = tag_cast<tags::tag_list>(t)) {
+            t = (size_t) s.index < l->value().size() ? l->value()[s.index] : nullptr;
+        } else {
+            t = nullptr;
+        }
+    }
+    return t;
+}
+
+static void extract_value(const tag* t, const std::vector<extractor::step>& steps, column& c) {
+    // An index into an array can only be the last step, it yields a value and not a tag.
+    if (!steps.empty() && steps.back().index >= 0) {
+        const tag* parent = resolve(t, steps, steps.size() - 1);
+        if (parent != nullptr && visit(*parent, element_visitor { steps.back().index, c }))
+            return;
+    }
+    append_tag(resolve(t, steps, steps.size()), c);
+}
+
+void extractor::extract(const tag* document, table& out) const {
+    const tag* rows = resolve(document, m_rows.steps, m_rows.steps.size());
+    if (rows == nullptr)
+        return;
+
+    const tag* const * first = &rows;
+    size_t count = 1;
+    const tags::tag_list* list = tag_cast<tags::tag_list>(rows);
+    if (!m_rows.steps.empty() && list != nullptr) {
+        const std::vector<tag*>& elements = list->value();
+        first = elements.data();
+        count = elements.size();
+    }
+
+    for (size_t r = 0; r < count; r++) {
+        for (size_t i = 0; i < m_paths.size(); i++) {
+            extract_value(m_paths[i].absolute ? document : first[r], m_paths[i].steps, out.columns[i]);
+        }
+    }
+}
+
+void extractor::extract(const std::vector<const tag*>& documents, table& out, unsigned threads) const {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads > documents.size())
+        threads = (unsigned) documents.size();
+    if (threads <= 1) {
+        for (const tag *d : documents) {
+            extract(d, out);
+        }
+        return;
+    }
+
+    // Each thread fills its own table over a contiguous range, appended in order afterwards.
+    std::vector<table> parts(threads, make_table());
+    std::vector<std::exception_ptr> errors(threads);
+    std::vector<std::thread> workers;
+    size_t per_thread = (documents.size() + threads - 1) / threads;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.push_back(std::thread([&, i]() {
+            try {
+                size_t end = std::min(documents.size(), (i + 1) * per_thread);
+                for (size_t d = i * per_thread; d < end; d++) {
+                    extract(documents[d], parts[i]);
+                }
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }));
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        if (errors[i])
+            std::rethrow_exception(errors[i]);
+    }
+    for (const table& part : parts) {
+        out.append(part);
+    }
+}
+
+static const char magic[4] = { 'N', 'B', 'T', 'C' };
+static const uint8_t version = 1;
+
+static void column_payload(const column& c, std::vector<uint8_t>& out) {
+    codec::buffer_writer w(out);
+    w.write_raw(c.validity().data(), c.validity().size());
+    switch (c.type()) {
+        case column_type::int64:
+            w.write_array(c.ints().data(), c.ints().size());
+            break;
+        case column_type::real:
+            w.write_array(c.reals().data(), c.reals().size());
+            break;
+        case column_type::string:
+            w.write_int((int32_t) c.dictionary().size());
+            for (const std::string& s : c.dictionary()) {
+                w.write_int((int32_t) s.size());
+                w.write_raw(s.data(), s.size());
+            }
+            w.write_array(c.codes().data(), c.codes().size());
+            break;
+    }
+}
+
+void columnar::write_table(std::ostream& out, const table& t) {
+    codec::stream_writer w(out.rdbuf());
+    w.write_raw(magic, sizeof(magic));
+    w.write_ubyte(version);
+    w.write_long((int64_t) t.rows());
+    w.write_int((int32_t) t.columns.size());
+
+    std::vector<uint8_t> payload;
+    for (const column& c : t.columns) {
+        payload.clear();
+        column_payload(c, payload);
+
+        w.write_string(c.name());
+        w.write_ubyte((uint8_t) c.type());
+        w.write_ubyte((uint8_t) c.method());
+        w.write_long((int64_t) payload.size());
+        if (c.method() == compression::zlib) {
+            std::ostringstream compressed;
+            {
+                streams::gzip_ostream g(compressed, streams::gzip_streambuf::zlib);
+                g.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+            }
+            const std::string& s = compressed.str();
+            w.write_long((int64_t) s.size());
+            w.write_raw(s.data(), s.size());
+        } else {
+            w.write_long((int64_t) payload.size());
+            w.write_raw(payload.data(), payload.size());
+        }
+    }
+    w.flush();
+}
+
+void columnar::read_table(std::istream& in, table& t) {
+    codec::stream_reader r(in.rdbuf());
+    char m[sizeof(magic)];
+    r.read_raw(m, sizeof(m));
+    if (std::memcmp(m, magic, sizeof(magic)) != 0)
+        throw nbt_exception("not a columnar file");
+    if (r.read_ubyte() != version)
+        throw nbt_exception("unsupported columnar file version");
+    size_t rows = (size_t) r.read_long();
+    int32_t count = r.read_int();
+
+    t.columns.clear();
+    for (int32_t i = 0; i < count; i++) {
+        std::string name = r.read_string();
+        column_type type = (column_type) r.read_ubyte();
+        compression method = (compression) r.read_ubyte();
+        size_t size = (size_t) r.read_long();
+        size_t stored = (size_t) r.read_long();
+
+        // Sizes are not trusted for allocations: the stored bytes grow as they are read, so the file bounds them, and
+        // the payload is only as large as they decompress to.
+        std::vector<uint8_t> payload;
+        if (method == compression::zlib) {
+            std::vector<uint8_t> compressed;
+            r.read_vector(compressed, stored);
+            try {
+                decompress(compressed.data(), compressed.size(), nbt::zlib, payload);
+            } catch (nbt_exception&) {
+                throw nbt_exception("invalid compressed column '" + name + "'");
+            }
+            if (payload.size() != size)
+                throw nbt_exception("truncated column '" + name + "'");
+        } else if (method == compression::none && stored == size) {
+            r.read_vector(payload, stored);
+        } else {
+            throw nbt_exception("invalid column '" + name + "'");
+        }
+
+        // Every row has a validity bit, which bounds the row count by the payload.
+        if (rows / 8 >= payload.size() + 1)
+            throw nbt_exception("truncated column '" + name + "'");
+        codec::buffer_reader p(payload.data(), payload.size());
+        std::vector<uint8_t> valid((rows + 7) / 8);
+        std::vector<int64_t> ints;
+        std::vector<double> reals;
+        std::vector<uint32_t> codes;
+        std::vector<std::string> dictionary;
+        p.read_raw(valid.data(), valid.size());
+        switch (type) {
+            case column_type::int64:
+                p.read_vector(ints, rows);
+                break;
+            case column_type::real:
+                p.read_vector(reals, rows);
+                break;
+            case column_type::string: {
+                int32_t entries = p.read_int();
+                for (int32_t e = 0; e < entries; e++) {
+                    int32_t length = p.read_int();
+                    p.expect(length);
+                    dictionary.push_back(std::string(reinterpret_cast<const char*>(p.current()), length));
+                    p.skip(length);
+                }
+                p.read_vector(codes, rows);
+                for (size_t row = 0; row < rows; row++) {
+                    // Null rows hold code 0 even with an empty dictionary.
+                    bool present = (valid[row >> 3] >> (row & 7)) & 1;
+                    if (codes[row] >= dictionary.size() && (present || codes[row] != 0))
+                        throw nbt_exception("invalid dictionary index in column '" + name + "'");
+                }
+                break;
+            }
+            default:
+                throw nbt_exception("invalid type of column '" + name + "'");
+        }
+
+        column c(name, type, method);
+        c.assign(rows, std::move(valid), std::move(ints), std::move(reals), std::move(codes), std::move(dictionary));
+        t.columns.push_back(std::move(c));
+    }
+}
@@ -0,0 +1,446 @@
+#include "compact.hpp"
+#include "nbtexception.hpp"
+#include "visit.hpp"
+
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+using namespace nbtpp;
+
+static_assert(sizeof(compact_node) == 16, "compact_node should stay 16 bytes");
+
+static uint32_t checked_index(size_t v) {
+    if (v >= UINT32_MAX)
+        throw nbt_exception("tree too large for a compact_tree");
+    return (uint32_t) v;
+}
+
+/**
+ * Fills the arrays of a tree, interning names as it goes.
+ */
+class compact_tree::builder {
+public:
+    builder(compact_tree& tree) : m_tree(tree) {
+    }
+
+    uint32_t intern(const std::string& name) {
+        auto it = m_interned.find(name);
+        if (it != m_interned.end())
+            return it->second;
+        uint32_t i = checked_index(m_tree.m_names.size());
+        compact_node::range r = { checked_index(m_tree.m_name_pool.size()), (uint32_t) name.size() };
+        m_tree.m_name_pool.insert(m_tree.m_name_pool.end(), name.begin(), name.end());
+        m_tree.m_names.push_back(r);
+        m_interned.emplace(name, i);
+        return i;
+    }
+
+    /**
+     * Node of a tag and its children. The children of a container are reserved as one block before they are filled.
+     */
+    void convert(const tag* t, compact_node& n, bool named) {
+        n.type = t->type();
+        n.element = tag_type::TAG_End;
+        n.reserved = 0;
+        n.name = named ? intern(t->name()) : no_name;
+        n.value.integer = 0;
+
+        visit(*t, node_visitor { *this, n });
+    }
+
+    /**
+     * Decode the payload of a tag of a known type into n. Children are decoded into a staging vector of their depth,
+     * then appended as one block.
+     */
+    template<class Reader>
+    void decode(Reader& in, compact_node& n, size_t depth) {
+        n.element = tag_type::TAG_End;
+        n.reserved = 0;
+        n.value.integer = 0;
+
+        switch (n.type) {
+            case tag_type::TAG_End:
+                break;
+            case tag_type::TAG_Byte:
+                n.value.integer = in.read_byte();
+                break;
+            case tag_type::TAG_Short:
+                n.value.integer = in.read_short();
+                break;
+            case tag_type::TAG_Int:
+                n.value.integer = in.read_int();
+                break;
+            case tag_type::TAG_Long:
+                n.value.integer = in.read_long();
+                break;
+            case tag_type::TAG_Float:
+                n.value.float_value = in.read_float();
+                break;
+            case tag_type::TAG_Double:
+                n.value.double_value = in.read_double();
+                break;
+            case tag_type::TAG_String: {
+                size_t length;
+                const char* s = in.read_string_data(length);
+                n.value.children = { checked_index(m_tree.m_strings.size()), (uint32_t) length };
+                m_tree.m_strings.insert(m_tree.m_strings.end(), s, s + length);
+                break;
+            }
+            case tag_type::TAG_Byte_Array:
+                n.value.children = read_pooled(in, m_tree.m_bytes);
+                break;
+            case tag_type::TAG_Int_Array:
+                n.value.children = read_pooled(in, m_tree.m_ints);
+                break;
+            case tag_type::TAG_Long_Array:
+                n.value.children = read_pooled(in, m_tree.m_longs);
+                break;
+            case tag_type::TAG_List:
+            case tag_type::TAG_Compound: {
+                if (m_stages.size() <= depth)
+                    m_stages.resize(depth + 1);
+                std::vector<compact_node>& stage = m_stages[depth];
+                stage.clear();
+
+                if (n.type == tag_type::TAG_Compound) {
+                    while (1) {
+                        compact_node c;
+                        c.type = (tag_type) in.read_ubyte();
+                        if (c.type == tag_type::TAG_End)
+                            break;
+                        in.read_string(m_name);
+                        c.name = intern(m_name);
+                        decode(in, c, depth + 1);
+                        stage.push_back(c);
+                    }
+                } else {
+                    n.element = (tag_type) in.read_ubyte();
+                    int32_t length = in.read_int();
+                    for (int32_t k = 0; k < length; k++) {
+                        compact_node c;
+                        c.type = n.element;
+                        c.name = no_name;
+                        decode(in, c, depth + 1);
+                        stage.push_back(c);
+                    }
+                }
+
+                uint32_t first = checked_index(m_tree.m_nodes.size());
+                m_tree.m_nodes.insert(m_tree.m_nodes.end(), stage.begin(), stage.end());
+                n.value.children = { first, (uint32_t) stage.size() };
+                break;
+            }
+            default:
+                throw nbt_exception("invalid tag type " + std::to_string((int) n.type));
+        }
+    }
+private:
+    /**
+     * Fills the value of a node from its tag.
+     */
+    struct node_visitor {
+        builder& b;
+        compact_node& n;
+
+        void operator()(const tags::tag_end&) const {
+        }
+
+        void operator()(const tags::tag_byte& t) const {
+            n.value.integer = t.value();
+        }
+
+        void operator()(const tags::tag_short& t) const {
+            n.value.integer = t.value();
+        }
+
+        void operator()(const tags::tag_int& t) const {
+            n.value.integer = t.value();
+        }
+
+        void operator()(const tags::tag_long& t) const {
+            n.value.integer = t.value();
+        }
+
+        void operator()(const tags::tag_float& t) const {
+            n.value.float_value = t.value();
+        }
+
+        void operator()(const tags::tag_double& t) const {
+            n.value.double_value = t.value();
+        }
+
+        void operator()(const tags::tag_string& t) const {
+            const std::string& s = t.value();
+            n.value.children = { checked_index(b.m_tree.m_strings.size()), (uint32_t) s.size() };
+            b.m_tree.m_strings.insert(b.m_tree.m_strings.end(), s.begin(), s.end());
+        }
+
+        void operator()(const tags::tag_bytearray& t) const {
+            n.value.children = b.pooled(b.m_tree.m_bytes, t.value());
+        }
+
+        void operator()(const tags::tag_intarray& t) const {
+            n.value.children = b.pooled(b.m_tree.m_ints, t.value());
+        }
+
+        void operator()(const tags::tag_longarray& t) const {
+            n.value.children = b.pooled(b.m_tree.m_longs, t.value());
+        }
+
+        void operator()(const tags::tag_list& t) const {
+            n.element = t.content_type();
+            n.value.children = b.children(t.value(), false);
+        }
+
+        void operator()(const tags::tag_compound& t) const {
+            n.value.children = b.children(t.value(), true);
+        }
+    };
+
+    /**
+     * Convert the children of a container into one block of nodes.
+     */
+    compact_node::range children(const std::vector<tag*>& children, bool named) {
+        uint32_t first = checked_index(m_tree.m_nodes.size());
+        m_tree.m_nodes.resize(first + children.size());
+        for (size_t k = 0; k < children.size(); k++) {
+            compact_node c;
+            convert(children[k], c, named);
+            m_tree.m_nodes[first + k] = c;
+        }
+        return compact_node::range { first, (uint32_t) children.size() };
+    }
+
+    template<class T>
+    compact_node::range pooled(std::vector<T>& pool, const std::vector<T>& values) {
+        compact_node::range r = { checked_index(pool.size()), checked_index(values.size()) };
+        pool.insert(pool.end(), values.begin(), values.end());
+        return r;
+    }
+
+    template<class Reader, class T>
+    compact_node::range read_pooled(Reader& in, std::vector<T>& pool) {
+        int32_t length = in.read_int();
+        compact_node::range r = { checked_index(pool.size()), 0 };
+        if (length > 0) {
+            in.read_vector(pool, length);
+            r.count = (uint32_t) length;
+        }
+        return r;
+    }
+
+    compact_tree& m_tree;
+    std::unordered_map<std::string, uint32_t> m_interned;
+
+    /**
+     * Children being decoded, one vector per depth so they are reused. A deque keeps the outer ones in place while
+     * deeper levels are added.
+     */
+    std::deque<std::vector<compact_node>> m_stages;
+    std::string m_name;
+};
+
+compact_tree::compact_tree(const tag* t) : m_root(npos) {
+    if (t == nullptr)
+        return;
+    builder b(*this);
+    compact_node root;
+    b.convert(t, root, true);
+    m_root = checked_index(m_nodes.size());
+    m_nodes.push_back(root);
+    shrink_to_fit();
+}
+
+template<class Reader>
+void compact_tree::load_from(Reader& in) {
+    clear();
+    try {
+        builder b(*this);
+        compact_node root;
+        root.type = (tag_type) in.read_ubyte();
+        root.name = no_name;
+        if (root.type != tag_type::TAG_End) {
+            std::string name;
+            in.read_string(name);
+            root.name = b.intern(name);
+        }
+        b.decode(in, root, 0);
+        m_root = checked_index(m_nodes.size());
+        m_nodes.push_back(root);
+        shrink_to_fit();
+    } catch (...) {
+        clear();
+        throw;
+    }
+}
+
+void compact_tree::load(const uint8_t* data, size_t size) {
+    codec::buffer_reader in(data, size);
+    load_from(in);
+}
+
+void compact_tree::load(std::istream& stream) {
+    codec::stream_reader in(stream.rdbuf());
+    load_from(in);
+}
+
+void compact_tree::clear() {
+    m_nodes.clear();
+    m_names.clear();
+    m_name_pool.clear();
+    m_strings.clear();
+    m_bytes.clear();
+    m_ints.clear();
+    m_longs.clear();
+    m_root = npos;
+}
+
+void compact_tree::shrink_to_fit() {
+    m_nodes.shrink_to_fit();
+    m_names.shrink_to_fit();
+    m_name_pool.shrink_to_fit();
+    m_strings.shrink_to_fit();
+    m_bytes.shrink_to_fit();
+    m_ints.shrink_to_fit();
+    m_longs.shrink_to_fit();
+}
+
+/**
+ * Writes the payload of a node.
+ */
+template<class Writer>
+static void save_payload(Writer& out, const compact_tree& tree, uint32_t i) {
+    switch (tree.type(i)) {
+        case tag_type::TAG_End:
+            break;
+        case tag_type::TAG_Byte:
+            out.write_byte((int8_t) tree.integer(i));
+            break;
+        case tag_type::TAG_Short:
+            out.write_short((int16_t) tree.integer(i));
+            break;
+        case tag_type::TAG_Int:
+            out.write_int((int32_t) tree.integer(i));
+            break;
+        case tag_type::TAG_Long:
+            out.write_long(tree.integer(i));
+            break;
+        case tag_type::TAG_Float:
+            out.write_float(tree.node(i).value.float_value);
+            break;
+        case tag_type::TAG_Double:
+            out.write_double(tree.node(i).value.double_value);
+            break;
+        case tag_type::TAG_String: {
+            codec::string_ref s = tree.string(i);
+            out.write_string(s.data, s.size);
+            break;
+        }
+        case tag_type::TAG_Byte_Array:
+            out.write_int((int32_t) tree.size(i));
+            out.write_array(tree.bytes(i), tree.size(i));
+            break;
+        case tag_type::TAG_Int_Array:
+            out.write_int((int32_t) tree.size(i));
+            out.write_array(tree.ints(i), tree.size(i));
+            break;
+        case tag_type::TAG_Long_Array:
+            out.write_int((int32_t) tree.size(i));
+            out.write_array(tree.longs(i), tree.size(i));
+            break;
+        case tag_type::TAG_List:
+            out.write_ubyte(tree.node(i).element);
+            out.write_int((int32_t) tree.size(i));
+            for (uint32_t k = 0; k < tree.size(i); k++) {
+                save_payload(out, tree, tree.child(i, k));
+            }
+            break;
+        case tag_type::TAG_Compound:
+            for (uint32_t k = 0; k < tree.size(i); k++) {
+                uint32_t c = tree.child(i, k);
+                codec::string_ref name = tree.name(c);
+                out.write_ubyte(tree.type(c));
+                out.write_string(name.data, name.size);
+                save_payload(out, tree, c);
+            }
+            out.write_ubyte(tag_type::TAG_End);
+            break;
+        default:
+            throw nbt_exception("invalid tag type " + std::to_string((int) tree.type(i)));
+    }
+}
+
+void compact_tree::save(std::vector<uint8_t>& out) const {
+    if (empty())
+        return;
+    codec::buffer_writer w(out);
+    w.write_ubyte(type(m_root));
+    if (type(m_root) != tag_type::TAG_End) {
+        codec::string_ref n = name(m_root);
+        w.write_string(n.data, n.size);
+    }
+    save_payload(w, *this, m_root);
+}
+
+tag* compact_tree::to_tag(uint32_t i) const {
+    std::string n = name(i).str();
+    const compact_node& node = m_nodes[i];
+    switch (node.type) {
+        case tag_type::TAG_End:
+            return new tags::tag_end();
+        case tag_type::TAG_Byte:
+            return new tags::tag_byte(std::move(n), (int8_t) node.value.integer);
+        case tag_type::TAG_Short:
+            return new tags::tag_short(std::move(n), (int16_t) node.value.integer);
+        case tag_type::TAG_Int:
+            return new tags::tag_int(std::move(n), (int32_t) node.value.integer);
+        case tag_type::TAG_Long:
+            return new tags::tag_long(std::move(n), node.value.integer);
+        case tag_type::TAG_Float:
+            return new tags::tag_float(std::move(n), node.value.float_value);
+        case tag_type::TAG_Double:
+            return new tags::tag_double(std::move(n), node.value.double_value);
+        case tag_type::TAG_String:
+            return new tags::tag_string(std::move(n), string(i).str());
+        case tag_type::TAG_Byte_Array:
+            return new tags::tag_bytearray(std::move(n), std::vector<int8_t>(bytes(i), bytes(i) + size(i)));
+        case tag_type::TAG_Int_Array:
+            return new tags::tag_intarray(std::move(n), std::vector<int32_t>(ints(i), ints(i) + size(i)));
+        case tag_type::TAG_Long_Array:
+            return new tags::tag_longarray(std::move(n), std::vector<int64_t>(longs(i), longs(i) + size(i)));
+        case tag_type::TAG_List: {
+            std::unique_ptr<tags::tag_list> l(new tags::tag_list(std::move(n), node.element));
+            for (uint32_t k = 0; k < size(i); k++) {
+                l->append(std::unique_ptr<tag>(to_tag(child(i, k))));
+            }
+            return l.release();
+        }
+        case tag_type::TAG_Compound: {
+            std::unique_ptr<tags::tag_compound> c(new tags::tag_compound(std::move(n)));
+            for (uint32_t k = 0; k < size(i); k++) {
+                c->insert(std::unique_ptr<tag>(to_tag(child(i, k))));
+            }
+            return c.release();
+        }
+        default:
+            throw nbt_exception("invalid tag type " + std::to_string((int) node.type));
+    }
+}
+
+uint32_t compact_tree::find(uint32_t i, codec::string_ref key) const {
+    for (uint32_t k = 0; k < size(i); k++) {
+        uint32_t c = child(i, k);
+        codec::string_ref n = name(c);
+        if (n.size == key.size && std::memcmp(n.data, key.data, n.size) == 0)
+            return c;
+    }
+    return npos;
+}
+
+size_t compact_tree::memory_usage() const {
+    return sizeof(compact_tree) + m_nodes.capacity() * sizeof(compact_node) + m_names.capacity() * sizeof(compact_node::range) +
+        m_name_pool.capacity() + m_strings.capacity() + m_bytes.capacity() + m_ints.capacity() * sizeof(int32_t) +
+        m_longs.capacity() * sizeof(int64_t);
+}
@@ -0,0 +1,362 @@
+#include "deflate.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+#include <cstring>
+#include <zlib.h>
+
+using namespace nbtpp;
+
+static const size_t dictionary_size = 32768;
+
+void nbtpp::compress(const uint8_t* data, size_t size, nbt::compression compression, std::vector<uint8_t>& out, int level) {
+    if (compression == nbt::uncompressed) {
+        out.assign(data, data + size);
+        return;
+    }
+
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    // 16 more window bits ask zlib for a gzip header and trailer.
+    if (deflateInit2(&strm, level, Z_DEFLATED, compression == nbt::gzip ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw nbt_exception("can't initialize deflate");
+
+    out.resize(deflateBound(&strm, size));
+    strm.next_in = const_cast<Bytef*>(data);
+    strm.avail_in = (uInt) size;
+    strm.next_out = out.data();
+    strm.avail_out = (uInt) out.size();
+    int ret = deflate(&strm, Z_FINISH);
+    out.resize(strm.total_out);
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END)
+        throw nbt_exception("compression failed");
+}
+
+void nbtpp::decompress(const uint8_t* data, size_t size, nbt::compression compression, std::vector<uint8_t>& out) {
+    if (compression == nbt::uncompressed) {
+        out.assign(data, data + size);
+        return;
+    }
+
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    // 32 more window bits let zlib detect a gzip or zlib header.
+    if (inflateInit2(&strm, 15 + 32) != Z_OK)
+        throw nbt_exception("can't initialize inflate");
+
+    out.resize(size * 4 > 65536 ? size * 4 : 65536);
+    strm.next_in = const_cast<Bytef*>(data);
+    strm.avail_in = (uInt) size;
+    int ret;
+    while (1) {
+        strm.next_out = out.data() + strm.total_out;
+        strm.avail_out = (uInt) (out.size() - strm.total_out);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK || strm.avail_out > 0)
+            break;
+        out.resize(out.size() * 2);
+    }
+    out.resize(strm.total_out);
+    inflateEnd(&strm);
+    if (ret != Z_STREAM_END)
+        throw nbt_exception("invalid compressed data");
+}
+
+struct parallel_deflate_streambuf::block {
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> dictionary;
+    std::vector<uint8_t> output;
+    uint32_t check = 0;
+    bool last = false;
+    bool done = false;
+    std::exception_ptr error;
+};
+
+parallel_deflate_streambuf::parallel_deflate_streambuf(std::streambuf* sink, nbt::compression compression, unsigned threads,
+    size_t block_size, int level) : m_sink(sink), m_compression(compression), m_block_size(block_size), m_level(level),
+    m_finished(false), m_failed(false), m_check(0), m_total(0), m_stop(false) {
+    if (compression != nbt::gzip && compression != nbt::zlib)
+        throw nbt_exception("parallel compression needs gzip or zlib");
+    if (m_block_size < dictionary_size)
+        m_block_size = dictionary_size;
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    // Enough blocks in flight to keep every worker busy while the oldest is written.
+    m_max_pending = 2 * threads;
+
+    if (compression == nbt::gzip) {
+        // No name, no modification time, unknown OS.
+        static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+        put(header, sizeof(header));
+        m_check = crc32(0, Z_NULL, 0);
+    } else {
+        int flevel = level == Z_DEFAULT_COMPRESSION ? 2 : level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        uint16_t header = 0x7800 | (flevel << 6);
+        header += 31 - header % 31;
+        uint8_t bytes[2];
+        codec::store_be(bytes, header);
+        put(bytes, sizeof(bytes));
+        m_check = adler32(0, Z_NULL, 0);
+    }
+
+    m_current.reset(new block());
+    m_current->input.resize(m_block_size);
+    setp(reinterpret_cast<char*>(m_current->input.data()), reinterpret_cast<char*>(m_current->input.data()) + m_block_size);
+
+    for (unsigned i = 0; i < threads; i++) {
+        m_workers.push_back(std::thread(&parallel_deflate_streambuf::work, this));
+    }
+}
+
+parallel_deflate_streambuf::~parallel_deflate_streambuf() {
+    // Unwinding means the data is incomplete, a trailer would make it look whole.
+    if (std::uncaught_exception()) {
+        abort();
+        return;
+    }
+    try {
+        finish();
+    } catch (...) {
+    }
+}
+
+void parallel_deflate_streambuf::finish() {
+    if (m_finished)
+        return;
+    if (m_failed) {
+        abort();
+        throw nbt_exception("compressed stream failed, not finishing it");
+    }
+    m_finished = true;
+
+    std::exception_ptr error;
+    try {
+        submit(true);
+        setp(nullptr, nullptr);
+        while (!m_pending.empty()) {
+            write_oldest();
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    stop_workers(false);
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void parallel_deflate_streambuf::abort() {
+    if (m_finished)
+        return;
+    m_finished = true;
+    setp(nullptr, nullptr);
+    stop_workers(true);
+    m_pending.clear();
+}
+
+/**
+ * Stop and join the workers, after they compressed the queued blocks unless discard is set.
+ */
+void parallel_deflate_streambuf::stop_workers(bool discard) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (discard)
+            m_queue.clear();
+        m_stop = true;
+    }
+    m_work.notify_all();
+    for (std::thread& w : m_workers) {
+        w.join();
+    }
+    m_workers.clear();
+}
+
+parallel_deflate_streambuf::int_type parallel_deflate_streambuf::overflow(int_type c) {
+    if (m_finished)
+        return traits_type::eof();
+    submit(false);
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize parallel_deflate_streambuf::xsputn(const char* s, std::streamsize n) {
+    if (m_finished)
+        return 0;
+    std::streamsize written = 0;
+    while (written < n) {
+        if (pptr() == epptr())
+            submit(false);
+        std::streamsize room = epptr() - pptr();
+        std::streamsize chunk = n - written < room ? n - written : room;
+        std::memcpy(pptr(), s + written, chunk);
+        pbump((int) chunk);
+        written += chunk;
+    }
+    return written;
+}
+
+int parallel_deflate_streambuf::sync() {
+    if (m_finished)
+        return 0;
+    try {
+        submit(false);
+        while (!m_pending.empty()) {
+            write_oldest();
+        }
+    } catch (nbt_exception&) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Hand the current block to the workers and start a new one.
+ */
+void parallel_deflate_streambuf::submit(bool last) {
+    size_t size = pptr() - pbase();
+    if (size == 0 && !last)
+        return;
+
+    std::shared_ptr<block> b(m_current.release());
+    b->input.resize(size);
+    b->last = last;
+    b->dictionary = m_dictionary;
+    if (size >= dictionary_size) {
+        m_dictionary.assign(b->input.end() - dictionary_size, b->input.end());
+    } else {
+        m_dictionary.insert(m_dictionary.end(), b->input.begin(), b->input.end());
+        if (m_dictionary.size() > dictionary_size)
+            m_dictionary.erase(m_dictionary.begin(), m_dictionary.end() - dictionary_size);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(b);
+    }
+    m_pending.push_back(b);
+    m_work.notify_one();
+
+    if (!last) {
+        m_current.reset(new block());
+        m_current->input.resize(m_block_size);
+        setp(reinterpret_cast<char*>(m_current->input.data()), reinterpret_cast<char*>(m_current->input.data()) + m_block_size);
+    }
+
+    while (m_pending.size() > m_max_pending) {
+        write_oldest();
+    }
+}
+
+/**
+ * Wait for the oldest block and write it, with the trailer after the last one.
+ */
+void parallel_deflate_streambuf::write_oldest() {
+    std::shared_ptr<block> b = m_pending.front();
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [&b]() { return b->done; });
+    }
+    m_pending.pop_front();
+    if (b->error) {
+        m_failed = true;
+        std::rethrow_exception(b->error);
+    }
+
+    put(b->output.data(), b->output.size());
+    if (m_compression == nbt::gzip)
+        m_check = crc32_combine(m_check, b->check, (z_off_t) b->input.size());
+    else
+        m_check = adler32_combine(m_check, b->check, (z_off_t) b->input.size());
+    m_total += b->input.size();
+
+    if (b->last) {
+        if (m_compression == nbt::gzip) {
+            // gzip stores the CRC and the size modulo 2^32 little-endian.
+            uint8_t trailer[8];
+            uint32_t size = (uint32_t) m_total;
+            for (int i = 0; i < 4; i++) {
+                trailer[i] = (uint8_t) (m_check >> (8 * i));
+                trailer[4 + i] = (uint8_t) (size >> (8 * i));
+            }
+            put(trailer, sizeof(trailer));
+        } else {
+            uint8_t trailer[4];
+            codec::store_be(trailer, m_check);
+            put(trailer, sizeof(trailer));
+        }
+    }
+}
+
+void parallel_deflate_streambuf::work() {
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    bool ready = deflateInit2(&strm, m_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+    while (1) {
+        std::shared_ptr<block> b;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_work.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+                break;
+            b = m_queue.front();
+            m_queue.pop_front();
+        }
+
+        try {
+            if (!ready)
+                throw nbt_exception("can't initialize deflate");
+            deflateReset(&strm);
+            if (!b->dictionary.empty())
+                deflateSetDictionary(&strm, b->dictionary.data(), (uInt) b->dictionary.size());
+
+            // Raw deflate data of the block, ended on a byte boundary unless it is the last one.
+            int flush = b->last ? Z_FINISH : Z_SYNC_FLUSH;
+            b->output.resize(deflateBound(&strm, b->input.size()) + 16);
+            strm.next_in = b->input.data();
+            strm.avail_in = (uInt) b->input.size();
+            strm.next_out = b->output.data();
+            strm.avail_out = (uInt) b->output.size();
+            while (1) {
+                int ret = deflate(&strm, flush);
+                if (ret == Z_STREAM_ERROR)
+                    throw nbt_exception("compression failed");
+                if (ret == Z_STREAM_END || (flush == Z_SYNC_FLUSH && strm.avail_in == 0 && strm.avail_out > 0))
+                    break;
+                size_t used = b->output.size() - strm.avail_out;
+                b->output.resize(b->output.size() * 2);
+                strm.next_out = b->output.data() + used;
+                strm.avail_out = (uInt) (b->output.size() - used);
+            }
+            b->output.resize(b->output.size() - strm.avail_out);
+
+            if (m_compression == nbt::gzip)
+                b->check = crc32(crc32(0, Z_NULL, 0), b->input.data(), (uInt) b->input.size());
+            else
+                b->check = adler32(adler32(0, Z_NULL, 0), b->input.data(), (uInt) b->input.size());
+        } catch (...) {
+            b->error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            b->done = true;
+        }
+        m_done.notify_all();
+    }
+
+    deflateEnd(&strm);
+}
+
+void parallel_deflate_streambuf::put(const void* data, size_t size) {
+    if (size > 0 && (size_t) m_sink->sputn(static_cast<const char*>(data), size) != size) {
+        m_failed = true;
+        throw nbt_exception("write error");
+    }
+}
@@ -0,0 +1,494 @@
+#include "filter.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+using namespace nbtpp;
+
+/**
+ * Nesting of the expression beyond which parsing stops, so a hostile expression can't exhaust the stack.
+ */
+static const int max_depth = 256;
+
+static inline bool name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '+';
+}
+
+class filter::parser {
+public:
+    parser(const std::string& s, std::vector<node>& nodes) : m_s(s), m_pos(0), m_nodes(nodes), m_depth(0) {
+    }
+
+    uint32_t parse() {
+        uint32_t root = expression();
+        skip_space();
+        if (m_pos != m_s.size())
+            fail("unexpected '" + m_s.substr(m_pos, 1) + "'");
+        return root;
+    }
+private:
+    uint32_t expression() {
+        if (++m_depth > max_depth)
+            fail("expression nested too deep");
+        uint32_t first = conjunction();
+        std::vector<uint32_t> operands(1, first);
+        while (accept("||")) {
+            operands.push_back(conjunction());
+        }
+        m_depth--;
+        return operands.size() == 1 ? first : add(kind::any_of, std::move(operands));
+    }
+
+    uint32_t conjunction() {
+        uint32_t first = unary();
+        std::vector<uint32_t> operands(1, first);
+        while (accept("&&")) {
+            operands.push_back(unary());
+        }
+        return operands.size() == 1 ? first : add(kind::all_of, std::move(operands));
+    }
+
+    uint32_t unary() {
+        skip_space();
+        if (accept("!")) {
+            if (++m_depth > max_depth)
+                fail("expression nested too deep");
+            uint32_t operand = unary();
+            m_depth--;
+            return add(kind::negate, std::vector<uint32_t>(1, operand));
+        }
+        if (accept("(")) {
+            uint32_t inner = expression();
+            expect(")");
+            return inner;
+        }
+
+        size_t start = m_pos;
+        if (keyword("any") || keyword("all")) {
+            kind k = m_s.compare(start, 3, "any") == 0 ? kind::any : kind::all;
+            expect("(");
+            std::vector<step> p = path();
+            expect(",");
+            uint32_t condition = expression();
+            expect(")");
+            uint32_t n = add(k, std::vector<uint32_t>(1, condition));
+            m_nodes[n].path = std::move(p);
+            return n;
+        }
+
+        std::vector<step> p = path();
+        comparison op;
+        if (accept("=="))
+            op = comparison::eq;
+        else if (accept("!="))
+            op = comparison::ne;
+        else if (accept("<="))
+            op = comparison::le;
+        else if (accept(">="))
+            op = comparison::ge;
+        else if (accept("<"))
+            op = comparison::lt;
+        else if (accept(">"))
+            op = comparison::gt;
+        else {
+            uint32_t n = add(kind::exists, std::vector<uint32_t>());
+            m_nodes[n].path = std::move(p);
+            return n;
+        }
+
+        uint32_t n = add(kind::compare, std::vector<uint32_t>());
+        m_nodes[n].op = op;
+        m_nodes[n].path = std::move(p);
+        literal(m_nodes[n]);
+        return n;
+    }
+
+    std::vector<step> path() {
+        skip_space();
+        std::vector<step> steps;
+        if (m_pos < m_s.size() && m_s[m_pos] == '.' && (m_pos + 1 == m_s.size() || !name_char(m_s[m_pos + 1]))) {
+            m_pos++;
+            return steps;
+        }
+
+        steps.push_back(step { name(), -1 });
+        while (m_pos < m_s.size()) {
+            if (m_s[m_pos] == '.') {
+                m_pos++;
+                steps.push_back(step { name(), -1 });
+            } else if (m_s[m_pos] == '[') {
+                m_pos++;
+                size_t start = m_pos;
+                int64_t index = 0;
+                while (m_pos < m_s.size() && m_s[m_pos] >= '0' && m_s[m_pos] <= '9' && index <= INT32_MAX) {
+                    index = index * 10 + (m_s[m_pos++] - '0');
+                }
+                if (m_pos == start || index > INT32_MAX)
+                    fail("invalid index");
+                if (m_pos >= m_s.size() || m_s[m_pos] != ']')
+                    fail("expected ']'");
+                m_pos++;
+                steps.push_back(step { std::string(), (int32_t) index });
+            } else {
+                break;
+            }
+        }
+        return steps;
+    }
+
+    std::string name() {
+        if (m_pos < m_s.size() && m_s[m_pos] == '"')
+            return quoted();
+        size_t start = m_pos;
+        while (m_pos < m_s.size() && name_char(m_s[m_pos])) {
+            m_pos++;
+        }
+        if (m_pos == start)
+            fail("expected a name");
+        return m_s.substr(start, m_pos - start);
+    }
+
+    std::string quoted() {
+        m_pos++;
+        std::string out;
+        while (1) {
+            if (m_pos >= m_s.size())
+                fail("unterminated string");
+            char c = m_s[m_pos++];
+            if (c == '"')
+                return out;
+            if (c == '\\') {
+                if (m_pos >= m_s.size())
+                    fail("unterminated string");
+                c = m_s[m_pos++];
+            }
+            out += c;
+        }
+    }
+
+    void literal(node& n) {
+        skip_space();
+        n.is_string = false;
+        n.is_integer = false;
+        n.integer = 0;
+        n.real = 0;
+        if (m_pos < m_s.size() && m_s[m_pos] == '"') {
+            n.is_string = true;
+            n.string = quoted();
+            return;
+        }
+        bool is_true = keyword("true");
+        if (is_true || keyword("false")) {
+            n.is_integer = true;
+            n.integer = is_true ? 1 : 0;
+            n.real = (double) n.integer;
+            return;
+        }
+
+        size_t start = m_pos;
+        while (m_pos < m_s.size() && (name_char(m_s[m_pos]) || m_s[m_pos] == '.')) {
+            m_pos++;
+        }
+        std::string token = m_s.substr(start, m_pos - start);
+        if (token.empty())
+            fail("expected a value");
+        // SNBT type suffixes only matter for the tag, any numeric tag compares with any number.
+        char suffix = token.back();
+        bool real_suffix = suffix == 'f' || suffix == 'F' || suffix == 'd' || suffix == 'D';
+        if (real_suffix || suffix == 'b' || suffix == 'B' || suffix == 's' || suffix == 'S' || suffix == 'l' || suffix == 'L')
+            token.pop_back();
+
+        char* end;
+        if (!real_suffix && token.find_first_of(".eE") == std::string::npos) {
+            errno = 0;
+            n.integer = std::strtoll(token.c_str(), &end, 10);
+            if (*end == '\0' && errno == 0 && !token.empty()) {
+                n.is_integer = true;
+                n.real = (double) n.integer;
+                return;
+            }
+        }
+        n.real = std::strtod(token.c_str(), &end);
+        if (*end != '\0' || token.empty())
+            fail("invalid number '" + m_s.substr(start, m_pos - start) + "'");
+    }
+
+    uint32_t add(kind k, std::vector<uint32_t> children) {
+        node n;
+        n.type = k;
+        n.op = comparison::eq;
+        n.is_string = false;
+        n.is_integer = false;
+        n.integer = 0;
+        n.real = 0;
+        n.children = std::move(children);
+        m_nodes.push_back(std::move(n));
+        return (uint32_t) m_nodes.size() - 1;
+    }
+
+    void skip_space() {
+        while (m_pos < m_s.size() && (m_s[m_pos] == ' ' || m_s[m_pos] == '\t' || m_s[m_pos] == '\n' || m_s[m_pos] == '\r')) {
+            m_pos++;
+        }
+    }
+
+    bool accept(const char* token) {
+        skip_space();
+        size_t n = std::strlen(token);
+        if (m_s.compare(m_pos, n, token) != 0)
+            return false;
+        m_pos += n;
+        return true;
+    }
+
+    /**
+     * Accept a word only if it is not the start of a longer name.
+     */
+    bool keyword(const char* word) {
+        size_t n = std::strlen(word);
+        if (m_s.compare(m_pos, n, word) != 0 || (m_pos + n < m_s.size() && (name_char(m_s[m_pos + n]) || m_s[m_pos + n] == '.' || m_s[m_pos + n] == '[')))
+            return false;
+        size_t after = m_pos + n;
+        while (after < m_s.size() && m_s[after] == ' ') {
+            after++;
+        }
+        // any and all are names unless followed by a parenthesis.
+        if ((std::strcmp(word, "any") == 0 || std::strcmp(word, "all") == 0) && (after >= m_s.size() || m_s[after] != '('))
+            return false;
+        m_pos += n;
+        return true;
+    }
+
+    void expect(const char* token) {
+        if (!accept(token))
+            fail(std::string("expected '") + token + "'");
+    }
+
+    [[noreturn]] void fail(const std::string& what) {
+        throw nbt_exception("invalid filter at " + std::to_string(m_pos) + ": " + what);
+    }
+
+    const std::string& m_s;
+    size_t m_pos;
+    std::vector<node>& m_nodes;
+    int m_depth;
+};
+
+filter::filter(const std::string& expression) : m_expression(expression) {
+    parser p(m_expression, m_nodes);
+    m_root = p.parse();
+}
+
+bool filter::matches(const uint8_t* data, size_t size) const {
+    codec::buffer_reader in(data, size);
+    tag_type type = (tag_type) in.read_ubyte();
+    if (type == tag_type::TAG_End)
+        return false;
+    in.skip(in.read_ushort());
+    return eval(m_root, data, size, value { type, in.position() });
+}
+
+/**
+ * Size of the elements of an array type, or 0.
+ */
+static inline size_t array_element_size(tag_type type) {
+    switch (type) {
+        case tag_type::TAG_Byte_Array:
+            return 1;
+        case tag_type::TAG_Int_Array:
+            return 4;
+        case tag_type::TAG_Long_Array:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static inline tag_type array_element_type(tag_type type) {
+    switch (type) {
+        case tag_type::TAG_Byte_Array:
+            return tag_type::TAG_Byte;
+        case tag_type::TAG_Int_Array:
+            return tag_type::TAG_Int;
+        default:
+            return tag_type::TAG_Long;
+    }
+}
+
+bool filter::eval(uint32_t i, const uint8_t* data, size_t size, value v) const {
+    const node& n = m_nodes[i];
+    switch (n.type) {
+        case kind::all_of:
+            for (uint32_t c : n.children) {
+                if (!eval(c, data, size, v))
+                    return false;
+            }
+            return true;
+        case kind::any_of:
+            for (uint32_t c : n.children) {
+                if (eval(c, data, size, v))
+                    return true;
+            }
+            return false;
+        case kind::negate:
+            return !eval(n.children[0], data, size, v);
+        case kind::exists:
+            return resolve(n.path, data, size, v);
+        case kind::compare:
+            return resolve(n.path, data, size, v) && compare(n, data, size, v);
+        case kind::any:
+        case kind::all: {
+            if (!resolve(n.path, data, size, v))
+                return false;
+            bool any = n.type == kind::any;
+            codec::buffer_reader in(data, size);
+            in.skip(v.offset);
+
+            size_t element_size = array_element_size(v.type);
+            if (element_size != 0) {
+                int32_t length = in.read_int();
+                tag_type element_type = array_element_type(v.type);
+                size_t offset = in.position();
+                in.expect(length > 0 ? (size_t) length * element_size : 0);
+                for (int32_t k = 0; k < length; k++, offset += element_size) {
+                    if (eval(n.children[0], data, size, value { element_type, offset }) == any)
+                        return any;
+                }
+                return !any;
+            }
+            if (v.type != tag_type::TAG_List)
+                return false;
+
+            tag_type element_type = (tag_type) in.read_ubyte();
+            int32_t length = in.read_int();
+            // Lists of TAG_End have no elements whatever their length says.
+            if (element_type == tag_type::TAG_End)
+                length = 0;
+            for (int32_t k = 0; k < length; k++) {
+                size_t offset = in.position();
+                if (eval(n.children[0], data, size, value { element_type, offset }) == any)
+                    return any;
+                codec::skip_payload(in, element_type);
+            }
+            return !any;
+        }
+    }
+    return false;
+}
+
+bool filter::resolve(const std::vector<step>& path, const uint8_t* data, size_t size, value& v) const {
+    for (const step& s : path) {
+        codec::buffer_reader in(data, size);
+        in.skip(v.offset);
+
+        if (s.index < 0) {
+            if (v.type != tag_type::TAG_Compound)
+                return false;
+            while (1) {
+                tag_type type = (tag_type) in.read_ubyte();
+                if (type == tag_type::TAG_End)
+                    return false;
+                size_t length;
+                const char* name = in.read_string_data(length);
+                if (length == s.name.size() && std::memcmp(name, s.name.data(), length) == 0) {
+                    v = value { type, in.position() };
+                    break;
+                }
+                codec::skip_payload(in, type);
+            }
+            continue;
+        }
+
+        size_t element_size = array_element_size(v.type);
+        if (element_size != 0) {
+            int32_t length = in.read_int();
+            if (s.index >= length)
+                return false;
+            in.skip((size_t) s.index * element_size);
+            v = value { array_element_type(v.type), in.position() };
+            continue;
+        }
+        if (v.type != tag_type::TAG_List)
+            return false;
+
+        tag_type element_type = (tag_type) in.read_ubyte();
+        int32_t length = in.read_int();
+        if (s.index >= length)
+            return false;
+        size_t fixed = codec::fixed_payload_size(element_type);
+        if (fixed != 0) {
+            in.skip((size_t) s.index * fixed);
+        } else {
+            for (int32_t k = 0; k < s.index; k++) {
+                codec::skip_payload(in, element_type);
+            }
+        }
+        v = value { element_type, in.position() };
+    }
+    return true;
+}
+
+template<class T>
+static inline bool apply(filter::comparison op, const T& a, const T& b) {
+    switch (op) {
+        case filter::comparison::eq:
+            return a == b;
+        case filter::comparison::ne:
+            return a != b;
+        case filter::comparison::lt:
+            return a < b;
+        case filter::comparison::le:
+            return a <= b;
+        case filter::comparison::gt:
+            return a > b;
+        case filter::comparison::ge:
+            return a >= b;
+    }
+    return false;
+}
+
+bool filter::compare(const node& n, const uint8_t* data, size_t size, value v) const {
+    codec::buffer_reader in(data, size);
+    in.skip(v.offset);
+
+    if (v.type == tag_type::TAG_String) {
+        if (!n.is_string)
+            return false;
+        size_t length;
+        const char* s = in.read_string_data(length);
+        int c = std::memcmp(s, n.string.data(), length < n.string.size() ? length : n.string.size());
+        if (c == 0)
+            c = length < n.string.size() ? -1 : length > n.string.size() ? 1 : 0;
+        return apply(n.op, c, 0);
+    }
+    if (n.is_string)
+        return false;
+
+    int64_t integer;
+    switch (v.type) {
+        case tag_type::TAG_Byte:
+            integer = in.read_byte();
+            break;
+        case tag_type::TAG_Short:
+            integer = in.read_short();
+            break;
+        case tag_type::TAG_Int:
+            integer = in.read_int();
+            break;
+        case tag_type::TAG_Long:
+            integer = in.read_long();
+            break;
+        case tag_type::TAG_Float:
+            return apply(n.op, (double) in.read_float(), n.real);
+        case tag_type::TAG_Double:
+            return apply(n.op, in.read_double(), n.real);
+        default:
+            return false;
+    }
+    if (n.is_integer)
+        return apply(n.op, integer, n.integer);
+    return apply(n.op, (double) integer, n.real);
+}
@@ -0,0 +1,358 @@
+#include "gzipindex.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <zlib.h>
+
+using namespace nbtpp;
+
+static const char index_magic[4] = { 'N', 'B', 'T', 'I' };
+static const uint8_t index_version = 2;
+
+/**
+ * Stream buffer inflating a compressed file, either from its start while taking checkpoints, or from a checkpoint.
+ */
+class inflate_buf: public std::streambuf {
+public:
+    /**
+     * Inflate from the start of the file, a gzip or zlib stream, adding a checkpoint to checkpoints every span bytes.
+     */
+    inflate_buf(std::istream& in, std::vector<gzip_index::checkpoint>* checkpoints, uint64_t span) : m_in(in),
+        m_checkpoints(checkpoints), m_span(span), m_base(0), m_done(false), m_window(gzip_index::window_size), m_window_pos(0) {
+        init(15 + 32);
+    }
+
+    /**
+     * Inflate raw deflate data from a checkpoint.
+     */
+    explicit inflate_buf(std::istream& in, const gzip_index::checkpoint& from) : m_in(in), m_checkpoints(nullptr),
+        m_span(0), m_base(from.out), m_done(false), m_window_pos(0) {
+        init(-15);
+        m_in.clear();
+        m_in.seekg(from.in - (from.bits != 0 ? 1 : 0));
+        if (from.bits != 0) {
+            int c = m_in.get();
+            if (c == EOF || inflatePrime(&m_strm, from.bits, c >> (8 - from.bits)) != Z_OK)
+                throw nbt_exception("can't resume inflating at checkpoint " + std::to_string(from.out));
+        } else if (!m_in) {
+            throw nbt_exception("can't resume inflating at checkpoint " + std::to_string(from.out));
+        }
+        if (!from.window.empty() && inflateSetDictionary(&m_strm, from.window.data(), from.window.size()) != Z_OK)
+            throw nbt_exception("can't resume inflating at checkpoint " + std::to_string(from.out));
+    }
+
+    inflate_buf(const inflate_buf&) = delete;
+    inflate_buf& operator=(const inflate_buf&) = delete;
+
+    ~inflate_buf() {
+        inflateEnd(&m_strm);
+    }
+
+    /**
+     * Offset in the uncompressed data of the next byte read.
+     */
+    uint64_t position() const {
+        return m_base + m_strm.total_out - (egptr() - gptr());
+    }
+protected:
+    int_type underflow() override {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (m_done)
+            return traits_type::eof();
+
+        m_strm.next_out = m_out;
+        m_strm.avail_out = sizeof(m_out);
+        while (m_strm.avail_out > 0 && !m_done) {
+            if (m_strm.avail_in == 0) {
+                m_in.read(reinterpret_cast<char*>(m_input), sizeof(m_input));
+                if (m_in.gcount() == 0)
+                    throw nbt_exception("truncated compressed data");
+                m_strm.next_in = m_input;
+                m_strm.avail_in = (uInt) m_in.gcount();
+            }
+
+            Bytef* start = m_strm.next_out;
+            // Z_BLOCK stops at every deflate block boundary, where a checkpoint may be taken.
+            int ret = inflate(&m_strm, m_checkpoints != nullptr ? Z_BLOCK : Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR)
+                throw nbt_exception("invalid compressed data");
+            if (ret == Z_STREAM_END)
+                m_done = true;
+
+            if (m_checkpoints != nullptr) {
+                remember(start, m_strm.next_out - start);
+                // Bit 7 is set at the end of a block, bit 6 if it was the last one.
+                if ((m_strm.data_type & 128) != 0 && (m_strm.data_type & 64) == 0 &&
+                    (m_checkpoints->empty() || m_strm.total_out - m_checkpoints->back().out >= m_span))
+                    checkpoint();
+            }
+        }
+
+        setg(reinterpret_cast<char*>(m_out), reinterpret_cast<char*>(m_out),
+            reinterpret_cast<char*>(m_strm.next_out));
+        if (gptr() == egptr())
+            return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
+    }
+private:
+    void init(int window_bits) {
+        std::memset(&m_strm, 0, sizeof(m_strm));
+        if (inflateInit2(&m_strm, window_bits) != Z_OK)
+            throw nbt_exception("can't initialize inflate");
+    }
+
+    /**
+     * Keep the last 32 KB of output in the ring for the next checkpoint.
+     */
+    void remember(const uint8_t* data, size_t size) {
+        if (size > gzip_index::window_size) {
+            data += size - gzip_index::window_size;
+            size = gzip_index::window_size;
+        }
+        while (size > 0) {
+            size_t n = std::min(size, gzip_index::window_size - m_window_pos);
+            std::memcpy(m_window.data() + m_window_pos, data, n);
+            m_window_pos = (m_window_pos + n) % gzip_index::window_size;
+            data += n;
+            size -= n;
+        }
+    }
+
+    void checkpoint() {
+        gzip_index::checkpoint c;
+        c.out = m_strm.total_out;
+        c.in = m_strm.total_in;
+        c.bits = m_strm.data_type & 7;
+        if (c.out < gzip_index::window_size) {
+            c.window.assign(m_window.begin(), m_window.begin() + c.out);
+        } else {
+            c.window.reserve(gzip_index::window_size);
+            c.window.assign(m_window.begin() + m_window_pos, m_window.end());
+            c.window.insert(c.window.end(), m_window.begin(), m_window.begin() + m_window_pos);
+        }
+        m_checkpoints->push_back(std::move(c));
+    }
+
+    std::istream& m_in;
+    std::vector<gzip_index::checkpoint>* m_checkpoints;
+    uint64_t m_span;
+    uint64_t m_base;
+    bool m_done;
+    z_stream m_strm;
+    std::vector<uint8_t> m_window;
+    size_t m_window_pos;
+    uint8_t m_input[65536];
+    uint8_t m_out[65536];
+};
+
+/**
+ * Last 8 bytes of a file of the given size, the CRC32 and size of a gzip trailer, 0 if it is shorter.
+ */
+static uint64_t read_trailer(std::istream& in, uint64_t size) {
+    if (size < 8)
+        return 0;
+    uint8_t b[8];
+    in.clear();
+    in.seekg(size - 8);
+    if (!in.read(reinterpret_cast<char*>(b), sizeof(b)))
+        throw nbt_exception("can't read the end of the compressed file");
+    return codec::load_be<uint64_t>(b);
+}
+
+gzip_index gzip_index::build(std::istream& in, uint64_t span) {
+    gzip_index index;
+    index.m_span = span;
+
+    inflate_buf buf(in, &index.m_checkpoints, span);
+    codec::stream_reader r(&buf);
+    index.m_root_type = (tag_type) r.read_ubyte();
+    if (index.m_root_type != tag_type::TAG_End)
+        r.read_string(index.m_root_name);
+
+    if (index.m_root_type == tag_type::TAG_Compound) {
+        while (1) {
+            child c;
+            c.offset = buf.position();
+            c.type = (tag_type) r.read_ubyte();
+            if (c.type == tag_type::TAG_End)
+                break;
+            r.read_string(c.name);
+            codec::skip_payload(r, c.type);
+            c.size = buf.position() - c.offset;
+            index.m_children.push_back(std::move(c));
+        }
+    } else if (index.m_root_type == tag_type::TAG_List) {
+        index.m_element_type = (tag_type) r.read_ubyte();
+        int32_t length = r.read_int();
+        for (int32_t i = 0; i < length; i++) {
+            child c;
+            c.type = index.m_element_type;
+            c.offset = buf.position();
+            codec::skip_payload(r, c.type);
+            c.size = buf.position() - c.offset;
+            index.m_children.push_back(std::move(c));
+        }
+    } else if (index.m_root_type != tag_type::TAG_End) {
+        codec::skip_payload(r, index.m_root_type);
+    }
+
+    index.m_uncompressed_size = buf.position();
+    in.clear();
+    in.seekg(0, std::ios::end);
+    index.m_compressed_size = (uint64_t) in.tellg();
+    index.m_trailer = read_trailer(in, index.m_compressed_size);
+    return index;
+}
+
+gzip_index gzip_index::open(const std::string& path, uint64_t span) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw nbt_exception("can't open " + path);
+    file.seekg(0, std::ios::end);
+    uint64_t size = (uint64_t) file.tellg();
+    uint64_t trailer = read_trailer(file, size);
+    file.seekg(0);
+
+    // A file rewritten with the same size is told apart by its trailer.
+    std::string sidecar = path + ".idx";
+    std::ifstream existing(sidecar, std::ios::binary);
+    if (existing) {
+        try {
+            gzip_index index = load(existing);
+            if (index.m_compressed_size == size && index.m_trailer == trailer && index.m_span == span)
+                return index;
+        } catch (nbt_exception&) {
+            // Stale or damaged, build it again.
+        }
+    }
+
+    gzip_index index = build(file, span);
+    std::ofstream out(sidecar, std::ios::binary | std::ios::trunc);
+    if (out)
+        index.save(out);
+    return index;
+}
+
+void gzip_index::save(std::ostream& out) const {
+    codec::stream_writer w(out.rdbuf());
+    w.write_raw(index_magic, sizeof(index_magic));
+    w.write_ubyte(index_version);
+    w.write_long((int64_t) m_compressed_size);
+    w.write_long((int64_t) m_trailer);
+    w.write_long((int64_t) m_uncompressed_size);
+    w.write_long((int64_t) m_span);
+    w.write_ubyte(m_root_type);
+    w.write_string(m_root_name);
+    w.write_ubyte(m_element_type);
+
+    w.write_int((int32_t) m_checkpoints.size());
+    for (const checkpoint& c : m_checkpoints) {
+        w.write_long((int64_t) c.out);
+        w.write_long((int64_t) c.in);
+        w.write_ubyte(c.bits);
+        w.write_int((int32_t) c.window.size());
+        if (!c.window.empty())
+            w.write_raw(c.window.data(), c.window.size());
+    }
+
+    w.write_int((int32_t) m_children.size());
+    for (const child& c : m_children) {
+        w.write_ubyte(c.type);
+        w.write_string(c.name);
+        w.write_long((int64_t) c.offset);
+        w.write_long((int64_t) c.size);
+    }
+    w.flush();
+}
+
+gzip_index gzip_index::load(std::istream& in) {
+    codec::stream_reader r(in.rdbuf());
+    char magic[sizeof(index_magic)];
+    r.read_raw(magic, sizeof(magic));
+    if (std::memcmp(magic, index_magic, sizeof(magic)) != 0 || r.read_ubyte() != index_version)
+        throw nbt_exception("not a gzip index");
+
+    gzip_index index;
+    index.m_compressed_size = (uint64_t) r.read_long();
+    index.m_trailer = (uint64_t) r.read_long();
+    index.m_uncompressed_size = (uint64_t) r.read_long();
+    index.m_span = (uint64_t) r.read_long();
+    index.m_root_type = (tag_type) r.read_ubyte();
+    r.read_string(index.m_root_name);
+    index.m_element_type = (tag_type) r.read_ubyte();
+
+    int32_t count = r.read_int();
+    for (int32_t i = 0; i < count; i++) {
+        checkpoint c;
+        c.out = (uint64_t) r.read_long();
+        c.in = (uint64_t) r.read_long();
+        c.bits = r.read_ubyte();
+        int32_t size = r.read_int();
+        if (size < 0 || (size_t) size > window_size || c.bits > 7)
+            throw nbt_exception("invalid checkpoint in gzip index");
+        c.window.resize(size);
+        if (size > 0)
+            r.read_raw(c.window.data(), size);
+        index.m_checkpoints.push_back(std::move(c));
+    }
+
+    count = r.read_int();
+    for (int32_t i = 0; i < count; i++) {
+        child c;
+        c.type = (tag_type) r.read_ubyte();
+        r.read_string(c.name);
+        c.offset = (uint64_t) r.read_long();
+        c.size = (uint64_t) r.read_long();
+        index.m_children.push_back(std::move(c));
+    }
+    return index;
+}
+
+void gzip_index::extract(std::istream& in, uint64_t offset, uint64_t size, std::vector<uint8_t>& out) const {
+    if (offset > m_uncompressed_size || size > m_uncompressed_size - offset)
+        throw nbt_exception("range out of the indexed data");
+
+    // Last checkpoint at or before offset.
+    auto it = std::upper_bound(m_checkpoints.begin(), m_checkpoints.end(), offset,
+        [](uint64_t value, const checkpoint& c) { return value < c.out; });
+    if (it == m_checkpoints.begin())
+        throw nbt_exception("no checkpoint before offset " + std::to_string(offset));
+    --it;
+
+    inflate_buf buf(in, *it);
+    codec::stream_reader r(&buf);
+    r.skip(offset - it->out);
+    out.resize(size);
+    r.read_raw(out.data(), size);
+}
+
+const gzip_index::child* gzip_index::find(const std::string& name) const {
+    for (const child& c : m_children) {
+        if (c.name == name)
+            return &c;
+    }
+    return nullptr;
+}
+
+void gzip_index::load(std::istream& in, const child& c, nbt& out) const {
+    std::vector<uint8_t> data;
+    extract(in, c.offset, c.size, data);
+    if (m_root_type == tag_type::TAG_List) {
+        // List elements are bare payloads, give them a type and an empty name.
+        uint8_t header[3] = { (uint8_t) c.type, 0, 0 };
+        data.insert(data.begin(), header, header + sizeof(header));
+    }
+    out.load(data.data(), data.size());
+}
+
+bool gzip_index::load(std::istream& in, const std::string& name, nbt& out) const {
+    const child* c = find(name);
+    if (c == nullptr)
+        return false;
+    load(in, *c, out);
+    return true;
+}
@@ -0,0 +1,54 @@
+#include "instrumentation.hpp"
+#include "nbt.hpp"
+
+#include <algorithm>
+
+using namespace nbtpp;
+
+instrumentation::counters& instrumentation::counters::operator+=(const counters& other) {
+    for (int i = 0; i <= TAG_Long_Array; i++) {
+        tags[i] += other.tags[i];
+    }
+    bytes_decoded += other.bytes_decoded;
+    bytes_encoded += other.bytes_encoded;
+    decompression_ns += other.decompression_ns;
+    load_ns += other.load_ns;
+    allocation_ns += other.allocation_ns;
+    save_ns += other.save_ns;
+    largest_byte_array = std::max(largest_byte_array, other.largest_byte_array);
+    largest_int_array = std::max(largest_int_array, other.largest_int_array);
+    largest_long_array = std::max(largest_long_array, other.largest_long_array);
+    largest_list = std::max(largest_list, other.largest_list);
+    return *this;
+}
+
+instrumentation::counters& instrumentation::thread_counters() {
+    static thread_local counters c;
+    return c;
+}
+
+void instrumentation::reset() {
+    thread_counters() = counters();
+}
+
+void instrumentation::export_counters(const counters& c, const std::function<void(const std::string&, uint64_t)>& sink) {
+    for (int i = 0; i <= TAG_Long_Array; i++) {
+        sink("tags." + name_for_type((tag_type) i), c.tags[i]);
+    }
+    sink("bytes_decoded", c.bytes_decoded);
+    sink("bytes_encoded", c.bytes_encoded);
+    sink("decompression_ns", c.decompression_ns);
+    sink("load_ns", c.load_ns);
+    sink("allocation_ns", c.allocation_ns);
+    sink("save_ns", c.save_ns);
+    sink("largest_byte_array", c.largest_byte_array);
+    sink("largest_int_array", c.largest_int_array);
+    sink("largest_long_array", c.largest_long_array);
+    sink("largest_list", c.largest_list);
+}
+
+void instrumentation::write_counters(std::ostream& out, const counters& c) {
+    export_counters(c, [&out](const std::string& name, uint64_t value) {
+        out << name << " " << value << "\n";
+    });
+}
@@ -0,0 +1,490 @@
+#include "json.hpp"
+#include "nbt.hpp"
+#include "codec.hpp"
+#include "format.hpp"
+#include "nbtexception.hpp"
+
+#include <cmath>
+
+using namespace nbtpp;
+using namespace nbtpp::json;
+
+/**
+ * Output buffer, handed to a stream buffer whenever it grows past 64 KB if there is one.
+ */
+class json_output {
+public:
+    json_output(std::string& buffer, std::streambuf* sink = nullptr) : buf(buffer), m_sink(sink) {
+    }
+
+    void spill() {
+        if (m_sink != nullptr && buf.size() >= 65536)
+            flush();
+    }
+
+    void flush() {
+        if (m_sink != nullptr && !buf.empty()) {
+            if ((size_t) m_sink->sputn(buf.data(), buf.size()) != buf.size())
+                throw nbt_exception("can't write JSON output");
+            buf.clear();
+        }
+    }
+
+    std::string& buf;
+private:
+    std::streambuf* m_sink;
+};
+
+static const char* type_name(tag_type type) {
+    switch (type) {
+        case tag_type::TAG_End:
+            return "end";
+        case tag_type::TAG_Byte:
+            return "byte";
+        case tag_type::TAG_Short:
+            return "short";
+        case tag_type::TAG_Int:
+            return "int";
+        case tag_type::TAG_Long:
+            return "long";
+        case tag_type::TAG_Float:
+            return "float";
+        case tag_type::TAG_Double:
+            return "double";
+        case tag_type::TAG_Byte_Array:
+            return "byte_array";
+        case tag_type::TAG_String:
+            return "string";
+        case tag_type::TAG_List:
+            return "list";
+        case tag_type::TAG_Compound:
+            return "compound";
+        case tag_type::TAG_Int_Array:
+            return "int_array";
+        case tag_type::TAG_Long_Array:
+            return "long_array";
+        default:
+            throw nbt_exception("invalid tag type " + std::to_string((int) type));
+    }
+}
+
+static inline bool continuation(unsigned char c) {
+    return (c & 0xc0) == 0x80;
+}
+
+/**
+ * Length of the standard UTF-8 sequence at s, 0 if it is not one. Surrogates and overlong forms are not.
+ */
+static size_t utf8_length(const unsigned char* s, size_t n) {
+    unsigned char c = s[0];
+    if (c >= 0xc2 && c <= 0xdf)
+        return n >= 2 && continuation(s[1]) ? 2 : 0;
+    if (c >= 0xe0 && c <= 0xef) {
+        if (n < 3 || !continuation(s[1]) || !continuation(s[2]) || (c == 0xe0 && s[1] < 0xa0) || (c == 0xed && s[1] >= 0xa0))
+            return 0;
+        return 3;
+    }
+    if (c >= 0xf0 && c <= 0xf4) {
+        if (n < 4 || !continuation(s[1]) || !continuation(s[2]) || !continuation(s[3]) || (c == 0xf0 && s[1] < 0x90) ||
+            (c == 0xf4 && s[1] >= 0x90))
+            return 0;
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * Surrogate encoded on 3 bytes at s as Java does, 0 if there is none.
+ */
+static uint32_t surrogate(const unsigned char* s, size_t n) {
+    if (n < 3 || s[0] != 0xed || s[1] < 0xa0 || s[1] > 0xbf || !continuation(s[2]))
+        return 0;
+    return 0xd000 | (uint32_t) (s[1] & 0x3f) << 6 | (s[2] & 0x3f);
+}
+
+/**
+ * Append a quoted string, from the modified UTF-8 of NBT to standard UTF-8: NUL, stored as C0 80, is escaped, and
+ * supplementary characters, stored as two 3-byte surrogates, are written as one 4-byte sequence. Lone surrogates are
+ * escaped and bytes that are not UTF-8 at all replaced by U+FFFD, so the output is always valid.
+ */
+static void append_string(std::string& out, const char* s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(s);
+    out += '"';
+    size_t start = 0;
+    size_t i = 0;
+    while (i < n) {
+        unsigned char c = u[i];
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            i++;
+            continue;
+        }
+        if (c >= 0x80) {
+            size_t length = utf8_length(u + i, n - i);
+            if (length != 0) {
+                i += length;
+                continue;
+            }
+        }
+        out.append(s + start, i - start);
+
+        if (c < 0x80) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\r':
+                    out += "\\r";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default: {
+                    char e[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+                    out.append(e, sizeof(e));
+                    break;
+                }
+            }
+            i++;
+        } else if (c == 0xc0 && i + 1 < n && u[i + 1] == 0x80) {
+            out += "\\u0000";
+            i += 2;
+        } else if (uint32_t high = surrogate(u + i, n - i)) {
+            uint32_t low = high < 0xdc00 ? surrogate(u + i + 3, n - i - 3) : 0;
+            if (low >= 0xdc00) {
+                uint32_t v = 0x10000 + ((high - 0xd800) << 10) + (low - 0xdc00);
+                char e[] = { (char) (0xf0 | (v >> 18)), (char) (0x80 | ((v >> 12) & 0x3f)), (char) (0x80 | ((v >> 6) & 0x3f)),
+                    (char) (0x80 | (v & 0x3f)) };
+                out.append(e, sizeof(e));
+                i += 6;
+            } else {
+                char e[] = { '\\', 'u', 'd', hex[(high >> 8) & 15], hex[(high >> 4) & 15], hex[high & 15] };
+                out.append(e, sizeof(e));
+                i += 3;
+            }
+        } else {
+            out += "\xef\xbf\xbd";
+            i++;
+        }
+        start = i;
+    }
+    out.append(s + start, n - start);
+    out += '"';
+}
+
+static inline void append_string(std::string& out, const std::string& s) {
+    append_string(out, s.data(), s.size());
+}
+
+static void append_long(std::string& out, int64_t v, mode m) {
+    // Doubles can't hold every long, typed mode keeps them exact as strings.
+    if (m == mode::typed) {
+        out += '"';
+        format::append_integer(out, v);
+        out += '"';
+    } else {
+        format::append_integer(out, v);
+    }
+}
+
+template<class T>
+static void append_real(std::string& out, T v, mode m) {
+    if (v != v || std::isinf(v)) {
+        if (m == mode::plain)
+            out += "null";
+        else
+            out += v != v ? "\"NaN\"" : v < 0 ? "\"-Infinity\"" : "\"Infinity\"";
+    } else if (sizeof(T) == sizeof(float)) {
+        format::append_float(out, (float) v);
+    } else {
+        format::append_double(out, (double) v);
+    }
+}
+
+/**
+ * Opens the typed form of a tag, up to its value.
+ */
+static void open_typed(std::string& out, tag_type type, tag_type element, const char* name, size_t name_length) {
+    out += '{';
+    if (name != nullptr) {
+        out += "\"name\":";
+        append_string(out, name, name_length);
+        out += ',';
+    }
+    out += "\"type\":\"";
+    out += type_name(type);
+    out += '"';
+    if (type == tag_type::TAG_List) {
+        out += ",\"element\":\"";
+        out += type_name(element);
+        out += '"';
+    }
+    out += ",\"value\":";
+}
+
+static void write_node(json_output& o, const tag* t, mode m, bool root);
+
+/**
+ * Writes the value of the visited tag.
+ */
+struct json_visitor {
+    json_output& o;
+    mode m;
+
+    void operator()(const tags::tag_end&) const {
+        o.buf += "null";
+    }
+
+    void operator()(const tags::tag_byte& t) const {
+        format::append_integer(o.buf, t.value());
+    }
+
+    void operator()(const tags::tag_short& t) const {
+        format::append_integer(o.buf, t.value());
+    }
+
+    void operator()(const tags::tag_int& t) const {
+        format::append_integer(o.buf, t.value());
+    }
+
+    void operator()(const tags::tag_long& t) const {
+        append_long(o.buf, t.value(), m);
+    }
+
+    void operator()(const tags::tag_float& t) const {
+        append_real(o.buf, t.value(), m);
+    }
+
+    void operator()(const tags::tag_double& t) const {
+        append_real(o.buf, t.value(), m);
+    }
+
+    void operator()(const tags::tag_string& t) const {
+        append_string(o.buf, t.value());
+    }
+
+    void operator()(const tags::tag_bytearray& t) const {
+        o.buf += '[';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            if (i > 0)
+                o.buf += ',';
+            format::append_integer(o.buf, t.value()[i]);
+            if ((i & 4095) == 4095)
+                o.spill();
+        }
+        o.buf += ']';
+    }
+
+    void operator()(const tags::tag_intarray& t) const {
+        o.buf += '[';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            if (i > 0)
+                o.buf += ',';
+            format::append_integer(o.buf, t.value()[i]);
+            if ((i & 4095) == 4095)
+                o.spill();
+        }
+        o.buf += ']';
+    }
+
+    void operator()(const tags::tag_longarray& t) const {
+        o.buf += '[';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            if (i > 0)
+                o.buf += ',';
+            append_long(o.buf, t.value()[i], m);
+            if ((i & 4095) == 4095)
+                o.spill();
+        }
+        o.buf += ']';
+    }
+
+    void operator()(const tags::tag_list& t) const {
+        o.buf += '[';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            if (i > 0)
+                o.buf += ',';
+            write_node(o, t.value()[i], m, false);
+        }
+        o.buf += ']';
+    }
+
+    void operator()(const tags::tag_compound& t) const {
+        o.buf += '{';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            const tag* e = t.value()[i];
+            if (i > 0)
+                o.buf += ',';
+            append_string(o.buf, e->name());
+            o.buf += ':';
+            write_node(o, e, m, false);
+        }
+        o.buf += '}';
+    }
+};
+
+static void write_node(json_output& o, const tag* t, mode m, bool root) {
+    if (m == mode::typed) {
+        tag_type element = t->type() == tag_type::TAG_List ? static_cast<const tags::tag_list*>(t)->content_type() : tag_type::TAG_End;
+        open_typed(o.buf, t->type(), element, root ? t->name().data() : nullptr, t->name().size());
+        visit(*t, json_visitor { o, m });
+        o.buf += '}';
+    } else {
+        visit(*t, json_visitor { o, m });
+    }
+    o.spill();
+}
+
+void json::write(const tag* t, std::string& out, mode m) {
+    json_output o(out);
+    write_node(o, t, m, true);
+}
+
+void json::write(const tag* t, std::ostream& out, mode m) {
+    std::string buffer;
+    json_output o(buffer, out.rdbuf());
+    write_node(o, t, m, true);
+    o.flush();
+}
+
+template<class Reader>
+static void encoded_node(Reader& in, json_output& o, tag_type type, mode m, const char* name, size_t name_length);
+
+/**
+ * Writes the value of an encoded payload of a known type, other than a list.
+ */
+template<class Reader>
+static void encoded_value(Reader& in, json_output& o, tag_type type, mode m) {
+    std::string& out = o.buf;
+    switch (type) {
+        case tag_type::TAG_Byte:
+            format::append_integer(out, in.read_byte());
+            break;
+        case tag_type::TAG_Short:
+            format::append_integer(out, in.read_short());
+            break;
+        case tag_type::TAG_Int:
+            format::append_integer(out, in.read_int());
+            break;
+        case tag_type::TAG_Long:
+            append_long(out, in.read_long(), m);
+            break;
+        case tag_type::TAG_Float:
+            append_real(out, in.read_float(), m);
+            break;
+        case tag_type::TAG_Double:
+            append_real(out, in.read_double(), m);
+            break;
+        case tag_type::TAG_String: {
+            size_t length;
+            const char* s = in.read_string_data(length);
+            append_string(out, s, length);
+            break;
+        }
+        case tag_type::TAG_Byte_Array:
+        case tag_type::TAG_Int_Array:
+        case tag_type::TAG_Long_Array: {
+            int32_t length = in.read_int();
+            out += '[';
+            for (int32_t i = 0; i < length; i++) {
+                if (i > 0)
+                    out += ',';
+                if (type == tag_type::TAG_Byte_Array)
+                    format::append_integer(out, in.read_byte());
+                else if (type == tag_type::TAG_Int_Array)
+                    format::append_integer(out, in.read_int());
+                else
+                    append_long(out, in.read_long(), m);
+                if ((i & 4095) == 4095)
+                    o.spill();
+            }
+            out += ']';
+            break;
+        }
+        case tag_type::TAG_Compound: {
+            out += '{';
+            bool first = true;
+            while (1) {
+                tag_type t = (tag_type) in.read_ubyte();
+                if (t == tag_type::TAG_End)
+                    break;
+                if (!first)
+                    out += ',';
+                first = false;
+                size_t length;
+                const char* name = in.read_string_data(length);
+                append_string(out, name, length);
+                out += ':';
+                encoded_node(in, o, t, m, nullptr, 0);
+            }
+            out += '}';
+            break;
+        }
+        default:
+            throw nbt_exception("invalid tag type " + std::to_string((int) type));
+    }
+}
+
+/**
+ * Writes a whole encoded tag whose type and name have been read. name is only given for the root.
+ */
+template<class Reader>
+static void encoded_node(Reader& in, json_output& o, tag_type type, mode m, const char* name, size_t name_length) {
+    if (type == tag_type::TAG_List) {
+        tag_type element = (tag_type) in.read_ubyte();
+        int32_t length = in.read_int();
+        if (m == mode::typed)
+            open_typed(o.buf, type, element, name, name_length);
+        o.buf += '[';
+        for (int32_t i = 0; i < length; i++) {
+            if (i > 0)
+                o.buf += ',';
+            encoded_node(in, o, element, m, nullptr, 0);
+        }
+        o.buf += ']';
+    } else {
+        if (m == mode::typed)
+            open_typed(o.buf, type, tag_type::TAG_End, name, name_length);
+        encoded_value(in, o, type, m);
+    }
+    if (m == mode::typed)
+        o.buf += '}';
+    o.spill();
+}
+
+template<class Reader>
+static void encoded_root(Reader& in, json_output& o, mode m) {
+    tag_type type = (tag_type) in.read_ubyte();
+    if (type == tag_type::TAG_End) {
+        if (m == mode::typed)
+            o.buf += "{\"name\":\"\",\"type\":\"end\",\"value\":null}";
+        else
+            o.buf += "null";
+        return;
+    }
+    size_t length;
+    const char* s = in.read_string_data(length);
+    // The name is only valid until the next read, keep a copy.
+    std::string name(s, length);
+    encoded_node(in, o, type, m, name.data(), name.size());
+}
+
+void json::write_encoded(const uint8_t* data, size_t size, std::string& out, mode m) {
+    codec::buffer_reader in(data, size);
+    json_output o(out);
+    encoded_root(in, o, m);
+}
+
+void json::write_encoded(std::istream& in, std::ostream& out, mode m) {
+    codec::stream_reader r(in.rdbuf());
+    std::string buffer;
+    json_output o(buffer, out.rdbuf());
+    encoded_root(r, o, m);
+    o.flush();
+}
@@ -1,15 +1,78 @@
 #include "nbt.hpp"
 #include "tag.hpp"
-#include "stde/streams/data.hpp"
 #include "stde/streams/gzip.hpp"
 #include "nbtexception.hpp"
+#include "instrumentation.hpp"
+#include "codec.hpp"
+#include "recycler.hpp"
+#include "deflate.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <thread>
+#include <utility>
 #include <assert.h>
 
+#ifdef NBTPP_INSTRUMENTATION
+#include <chrono>
+#endif
+
 using namespace nbtpp;
 using namespace stde;
 
+#ifdef NBTPP_INSTRUMENTATION
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Input buffer that times every refill from an underlying buffer, used to measure decompression.
+ */
+class timed_streambuf: public std::streambuf {
+public:
+    timed_streambuf(std::streambuf* source, uint64_t& elapsed_ns) : m_source(source), m_elapsed_ns(elapsed_ns) {
+    }
+protected:
+    virtual int_type underflow() {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        uint64_t start = now_ns();
+        std::streamsize n = m_source->sgetn(m_buffer, sizeof(m_buffer));
+        m_elapsed_ns += now_ns() - start;
+
+        if (n <= 0)
+            return traits_type::eof();
+        setg(m_buffer, m_buffer, m_buffer + n);
+        return traits_type::to_int_type(*gptr());
+    }
+private:
+    std::streambuf* m_source;
+    uint64_t& m_elapsed_ns;
+    char m_buffer[4096];
+};
+#endif
+
+/**
+ * Allocate a tag, accounting for it when instrumented.
+ */
+template<class T, class ... Args>
+static inline T* make_tag(Args&&... args) {
+#ifdef NBTPP_INSTRUMENTATION
+    uint64_t start = now_ns();
+    T* t = new T(std::forward<Args>(args)...);
+    instrumentation::counters& c = instrumentation::thread_counters();
+    c.allocation_ns += now_ns() - start;
+    c.tags[t->type()]++;
+    return t;
+#else
+    return new T(std::forward<Args>(args)...);
+#endif
+}
+
 nbt::nbt(std::istream& in) : nbt() {
     load(in);
 }
@@ -28,9 +91,19 @@ nbt::~nbt() {
 void nbt::load_file(std::ifstream& in) {
     int pos = in.tellg();
     try {
+#ifdef NBTPP_INSTRUMENTATION
+        uint64_t start = now_ns();
+        streams::gzip_istream g(in);
+        instrumentation::thread_counters().decompression_ns += now_ns() - start;
+
+        timed_streambuf timed_buf(g.rdbuf(), instrumentation::thread_counters().decompression_ns);
+        std::istream timed(&timed_buf);
+        load(timed);
+#else
         streams::gzip_istream g(in);
 
         load((std::istream&) g);
+#endif
 
         m_compression = g.type() == streams::gzip_streambuf::zlib ? zlib : gzip;
 
@@ -42,60 +115,74 @@ void nbt::load_file(std::ifstream& in) {
     }
 }
 
-static tag* load_internal(streams::data_istream& di, tag_type force_type = tag_type::TAG_Undef) {
+template<class Reader>
+static tag* load_internal(Reader& di, tag_type force_type = tag_type::TAG_Undef) {
     tag_type type = force_type;
     std::string tag_name = "";
 
     if (type == tag_type::TAG_Undef) {
         type = (tag_type) di.read_ubyte();
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 1);
 
         if (type == tag_type::TAG_End)
-            return new tags::tag_end();
+            return make_tag<tags::tag_end>();
         tag_name = di.read_string();
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 2 + tag_name.size());
     }
 
     switch (type) {
         case tag_type::TAG_Byte: {
             int8_t value = di.read_byte();
-            return new tags::tag_byte(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 1);
+            return make_tag<tags::tag_byte>(std::move(tag_name), value);
         }
         case tag_type::TAG_Short: {
             int16_t value = di.read_short();
-            return new tags::tag_short(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 2);
+            return make_tag<tags::tag_short>(std::move(tag_name), value);
         }
         case tag_type::TAG_Int: {
             int32_t value = di.read_int();
-            return new tags::tag_int(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 4);
+            return make_tag<tags::tag_int>(std::move(tag_name), value);
         }
         case tag_type::TAG_Long: {
             int64_t value = di.read_long();
-            return new tags::tag_long(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 8);
+            return make_tag<tags::tag_long>(std::move(tag_name), value);
         }
         case tag_type::TAG_Float: {
             float value = di.read_float();
-            return new tags::tag_float(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 4);
+            return make_tag<tags::tag_float>(std::move(tag_name), value);
         }
         case tag_type::TAG_Double: {
             double value = di.read_double();
-            return new tags::tag_double(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 8);
+            return make_tag<tags::tag_double>(std::move(tag_name), value);
         }
         case tag_type::TAG_Byte_Array: {
-            tags::tag_bytearray *list = new tags::tag_bytearray(tag_name);
+            tags::tag_bytearray *list = make_tag<tags::tag_bytearray>(std::move(tag_name));
             int32_t list_length = di.read_int();
-            for (int i = 0; i < list_length; i++) {
-                int8_t val = di.read_byte();
-                list->append(val);
-            }
+            if (list_length > 0)
+                di.read_vector(list->value(), list_length);
+            NBTPP_INSTRUMENT(instrumentation::counters& c = instrumentation::thread_counters();
+                c.bytes_decoded += 4 + list->value().size();
+                c.largest_byte_array = std::max<uint64_t>(c.largest_byte_array, list->value().size()));
             return list;
         }
         case tag_type::TAG_String: {
             std::string value = di.read_string();
-            return new tags::tag_string(tag_name, value);
+            NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_decoded += 2 + value.size());
+            return make_tag<tags::tag_string>(std::move(tag_name), std::move(value));
         }
         case tag_type::TAG_List: {
             tag_type list_type = (tag_type) di.read_ubyte();
             int32_t list_length = di.read_int();
-            tags::tag_list *list = new tags::tag_list(tag_name, list_type);
+            tags::tag_list *list = make_tag<tags::tag_list>(std::move(tag_name), list_type);
+            NBTPP_INSTRUMENT(instrumentation::counters& c = instrumentation::thread_counters();
+                c.bytes_decoded += 5;
+                c.largest_list = std::max<uint64_t>(c.largest_list, list_length > 0 ? list_length : 0));
 
             for (int i = 0; i < list_length; i++) {
                 list->append(load_internal(di, list_type));
@@ -104,7 +191,7 @@ static tag* load_internal(streams::data_istream& di, tag_type force_type = tag_t
         }
         case tag_type::TAG_Compound: {
             tag *t;
-            tags::tag_compound *comp = new tags::tag_compound(tag_name);
+            tags::tag_compound *comp = make_tag<tags::tag_compound>(std::move(tag_name));
             while (1) {
                 t = load_internal(di);
                 if (t->type() == tag_type::TAG_End) {
@@ -116,21 +203,23 @@ static tag* load_internal(streams::data_istream& di, tag_type force_type = tag_t
             return comp;
         }
         case tag_type::TAG_Int_Array: {
-            tags::tag_intarray *list = new tags::tag_intarray(tag_name);
+            tags::tag_intarray *list = make_tag<tags::tag_intarray>(std::move(tag_name));
             int32_t list_length = di.read_int();
-            for (int i = 0; i < list_length; i++) {
-                int32_t val = di.read_int();
-                list->append(val);
-            }
+            if (list_length > 0)
+                di.read_vector(list->value(), list_length);
+            NBTPP_INSTRUMENT(instrumentation::counters& c = instrumentation::thread_counters();
+                c.bytes_decoded += 4 + 4 * list->value().size();
+                c.largest_int_array = std::max<uint64_t>(c.largest_int_array, list->value().size()));
             return list;
         }
         case tag_type::TAG_Long_Array: {
-            tags::tag_longarray *list = new tags::tag_longarray(tag_name);
-            int64_t list_length = di.read_int();
-            for (int i = 0; i < list_length; i++) {
-                int64_t val = di.read_long();
-                list->append(val);
-            }
+            tags::tag_longarray *list = make_tag<tags::tag_longarray>(std::move(tag_name));
+            int32_t list_length = di.read_int();
+            if (list_length > 0)
+                di.read_vector(list->value(), list_length);
+            NBTPP_INSTRUMENT(instrumentation::counters& c = instrumentation::thread_counters();
+                c.bytes_decoded += 4 + 8 * list->value().size();
+                c.largest_long_array = std::max<uint64_t>(c.largest_long_array, list->value().size()));
             return list;
         }
         default: {
@@ -142,16 +231,518 @@ static tag* load_internal(streams::data_istream& di, tag_type force_type = tag_t
     return nullptr;
 }
 
+void tree_recycler::release(tag* t) {
+    if (t == nullptr)
+        return;
+
+    std::vector<tag*>* children = nullptr;
+    if (t->type() == tag_type::TAG_List)
+        children = &static_cast<tags::tag_list*>(t)->m_content;
+    else if (t->type() == tag_type::TAG_Compound)
+        children = &static_cast<tags::tag_compound*>(t)->m_content;
+    if (children != nullptr) {
+        for (tag *c : *children) {
+            release(c);
+        }
+        children->clear();
+    }
+
+    if (m_free_count < m_max_free && t->type() <= tag_type::TAG_Long_Array) {
+        m_free[t->type()].push_back(t);
+        m_free_count++;
+    } else {
+        delete t;
+    }
+}
+
+void tree_recycler::clear() {
+    for (std::vector<tag*>& list : m_free) {
+        for (tag *t : list) {
+            delete t;
+        }
+        list.clear();
+    }
+    m_free_count = 0;
+}
+
+/**
+ * Node to decode a tag of the given type into: old if it has this type, else a free node, else nullptr.
+ */
+template<class T>
+T* tree_recycler::acquire(tag* old, tag_type type) {
+    if (old != nullptr && old->type() == type)
+        return static_cast<T*>(old);
+    release(old);
+
+    std::vector<tag*>& list = m_free[type];
+    if (list.empty())
+        return nullptr;
+    tag* t = list.back();
+    list.pop_back();
+    m_free_count--;
+    return static_cast<T*>(t);
+}
+
+template<class Reader>
+tag* tree_recycler::reload(Reader& di, tag* old) {
+    return reload(di, old, tag_type::TAG_Undef);
+}
+
+template<class Reader, class T>
+static void reload_array(Reader& di, std::vector<T>& values) {
+    int32_t length = di.read_int();
+    values.clear();
+    if (length > 0)
+        di.read_vector(values, length);
+}
+
+template<class Reader>
+tag* tree_recycler::reload(Reader& di, tag* old, tag_type type) {
+    bool named = type == tag_type::TAG_Undef;
+    if (named) {
+        try {
+            type = (tag_type) di.read_ubyte();
+            if (type != tag_type::TAG_End)
+                di.read_string(m_name);
+        } catch (...) {
+            release(old);
+            throw;
+        }
+    }
+
+    tag* node;
+    switch (type) {
+        case tag_type::TAG_End:
+            node = acquire<tags::tag_end>(old, type);
+            return node != nullptr ? node : make_tag<tags::tag_end>();
+        case tag_type::TAG_Byte:
+            node = acquire<tags::tag_byte>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_byte>(std::string(), 0);
+            break;
+        case tag_type::TAG_Short:
+            node = acquire<tags::tag_short>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_short>(std::string(), 0);
+            break;
+        case tag_type::TAG_Int:
+            node = acquire<tags::tag_int>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_int>(std::string(), 0);
+            break;
+        case tag_type::TAG_Long:
+            node = acquire<tags::tag_long>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_long>(std::string(), 0);
+            break;
+        case tag_type::TAG_Float:
+            node = acquire<tags::tag_float>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_float>(std::string(), 0);
+            break;
+        case tag_type::TAG_Double:
+            node = acquire<tags::tag_double>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_double>(std::string(), 0);
+            break;
+        case tag_type::TAG_Byte_Array:
+            node = acquire<tags::tag_bytearray>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_bytearray>(std::string());
+            break;
+        case tag_type::TAG_String:
+            node = acquire<tags::tag_string>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_string>(std::string(), std::string());
+            break;
+        case tag_type::TAG_List:
+            node = acquire<tags::tag_list>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_list>(std::string(), tag_type::TAG_End);
+            break;
+        case tag_type::TAG_Compound:
+            node = acquire<tags::tag_compound>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_compound>(std::string());
+            break;
+        case tag_type::TAG_Int_Array:
+            node = acquire<tags::tag_intarray>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_intarray>(std::string());
+            break;
+        case tag_type::TAG_Long_Array:
+            node = acquire<tags::tag_longarray>(old, type);
+            node = node != nullptr ? node : make_tag<tags::tag_longarray>(std::string());
+            break;
+        default:
+            release(old);
+            throw nbtpp::nbt_exception("invalid tag type " + std::to_string((int) type));
+    }
+
+    // The old name buffer is kept for the next name.
+    if (named)
+        node->m_name.swap(m_name);
+    else
+        node->m_name.clear();
+
+    try {
+        switch (type) {
+            case tag_type::TAG_Byte:
+                static_cast<tags::tag_byte*>(node)->value(di.read_byte());
+                break;
+            case tag_type::TAG_Short:
+                static_cast<tags::tag_short*>(node)->value(di.read_short());
+                break;
+            case tag_type::TAG_Int:
+                static_cast<tags::tag_int*>(node)->value(di.read_int());
+                break;
+            case tag_type::TAG_Long:
+                static_cast<tags::tag_long*>(node)->value(di.read_long());
+                break;
+            case tag_type::TAG_Float:
+                static_cast<tags::tag_float*>(node)->value(di.read_float());
+                break;
+            case tag_type::TAG_Double:
+                static_cast<tags::tag_double*>(node)->value(di.read_double());
+                break;
+            case tag_type::TAG_Byte_Array:
+                reload_array(di, static_cast<tags::tag_bytearray*>(node)->value());
+                break;
+            case tag_type::TAG_String:
+                di.read_string(static_cast<tags::tag_string*>(node)->m_value);
+                break;
+            case tag_type::TAG_Int_Array:
+                reload_array(di, static_cast<tags::tag_intarray*>(node)->value());
+                break;
+            case tag_type::TAG_Long_Array:
+                reload_array(di, static_cast<tags::tag_longarray*>(node)->value());
+                break;
+            case tag_type::TAG_List: {
+                // Element i reuses the old element i, the slot is cleared while it is decoded so a failure does not
+                // release it twice.
+                tags::tag_list* l = static_cast<tags::tag_list*>(node);
+                std::vector<tag*>& content = l->m_content;
+                l->m_content_type = (tag_type) di.read_ubyte();
+                int32_t length = di.read_int();
+                size_t i = 0;
+                for (; i < (size_t) (length > 0 ? length : 0); i++) {
+                    if (i < content.size()) {
+                        tag* previous = content[i];
+                        content[i] = nullptr;
+                        content[i] = reload(di, previous, l->m_content_type);
+                    } else {
+                        content.push_back(nullptr);
+                        content[i] = reload(di, nullptr, l->m_content_type);
+                    }
+                }
+                for (size_t j = i; j < content.size(); j++) {
+                    release(content[j]);
+                }
+                content.resize(i);
+                break;
+            }
+            case tag_type::TAG_Compound: {
+                std::vector<tag*>& content = static_cast<tags::tag_compound*>(node)->m_content;
+                size_t i = 0;
+                while (1) {
+                    tag* previous = nullptr;
+                    if (i < content.size()) {
+                        previous = content[i];
+                        content[i] = nullptr;
+                    } else {
+                        content.push_back(nullptr);
+                    }
+                    tag* t = reload(di, previous);
+                    if (t->type() == tag_type::TAG_End) {
+                        release(t);
+                        break;
+                    }
+                    // Same as tag_compound::insert(), a later entry replaces an earlier one of the same name.
+                    for (size_t j = 0; j < i; j++) {
+                        if (content[j]->name() == t->name()) {
+                            release(content[j]);
+                            content.erase(content.begin() + j);
+                            i--;
+                            break;
+                        }
+                    }
+                    content[i++] = t;
+                }
+                for (size_t j = i + 1; j < content.size(); j++) {
+                    release(content[j]);
+                }
+                content.resize(i);
+                break;
+            }
+            default:
+                break;
+        }
+    } catch (...) {
+        release(node);
+        throw;
+    }
+    return node;
+}
+
+template<class Reader>
+static tag* load_root(Reader& di) {
+#ifdef NBTPP_INSTRUMENTATION
+    instrumentation::counters& c = instrumentation::thread_counters();
+    uint64_t start = now_ns();
+    uint64_t decompression_start = c.decompression_ns;
+    uint64_t allocation_start = c.allocation_ns;
+
+    tag* t = load_internal(di);
+
+    uint64_t elapsed = now_ns() - start;
+    uint64_t excluded = (c.decompression_ns - decompression_start) + (c.allocation_ns - allocation_start);
+    c.load_ns += elapsed > excluded ? elapsed - excluded : 0;
+    return t;
+#else
+    return load_internal(di);
+#endif
+}
+
 void nbt::load(std::istream& in) {
     if (m_tag != nullptr) {
         delete m_tag;
         m_tag = nullptr;
     }
 
-    streams::data_istream di(in, streams::endianconv::big);
-    di.exceptions(std::ios_base::badbit);
+    codec::stream_reader di(in.rdbuf());
+    m_tag = load_root(di);
+    m_compression = uncompressed;
+}
+
+void nbt::load(const uint8_t* data, size_t size) {
+    if (m_tag != nullptr) {
+        delete m_tag;
+        m_tag = nullptr;
+    }
+
+    codec::buffer_reader di(data, size);
+    m_tag = load_root(di);
+    m_compression = uncompressed;
+}
+
+/**
+ * Documents smaller than this are not worth the boundary scan and the threads.
+ */
+static const size_t parallel_min_size = 1 << 20;
+
+/**
+ * Consecutive elements of a container, parsed by one thread into slots of the container's children.
+ */
+struct parse_task {
+    size_t begin;
+    size_t end;
+
+    /**
+     * Element type for list elements, TAG_Undef for named tags of a compound
+     */
+    tag_type list_type;
+    std::vector<tag*>* out;
+    size_t first;
+    size_t count;
+};
+
+/**
+ * Container whose children are parsed in parallel, filled once every task is done.
+ */
+struct split_container {
+    tag* container;
+    std::vector<tag*> children;
+};
+
+/**
+ * Find the element boundaries of a container payload by skipping over them, and cut them into tasks of about chunk
+ * bytes. A list or compound child holding most of the payload is split in turn rather than parsed by a single task.
+ */
+static void plan_container(const uint8_t* data, size_t size, size_t begin, tag_type type, split_container& target,
+    std::deque<split_container>& containers, std::vector<parse_task>& tasks, size_t chunk, int depth) {
+    codec::buffer_reader di(data, size);
+    di.skip(begin);
+
+    // Start of each element, then the end of the last one.
+    std::vector<size_t> bounds;
+    tag_type list_type = tag_type::TAG_Undef;
+    if (type == tag_type::TAG_Compound) {
+        while (1) {
+            size_t start = di.position();
+            tag_type t = (tag_type) di.read_ubyte();
+            if (t == tag_type::TAG_End) {
+                bounds.push_back(start);
+                break;
+            }
+            di.skip(di.read_ushort());
+            codec::skip_payload(di, t);
+            bounds.push_back(start);
+        }
+    } else {
+        list_type = (tag_type) di.read_ubyte();
+        int32_t length = di.read_int();
+        for (int32_t i = 0; i < length; i++) {
+            bounds.push_back(di.position());
+            codec::skip_payload(di, list_type);
+        }
+        bounds.push_back(di.position());
+    }
+
+    size_t count = bounds.size() - 1;
+    size_t payload = di.position() - begin;
+    target.children.assign(count, nullptr);
+
+    size_t run = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t element_size = bounds[i + 1] - bounds[i];
+        codec::buffer_reader header(data, size);
+        header.skip(bounds[i]);
+        tag_type element_type = list_type;
+        std::string name;
+        if (list_type == tag_type::TAG_Undef) {
+            element_type = (tag_type) header.read_ubyte();
+            header.read_string(name);
+        }
+
+        bool big = depth < 4 && element_size >= parallel_min_size && element_size > payload / 2 &&
+            (element_type == tag_type::TAG_List || element_type == tag_type::TAG_Compound);
+        if (big) {
+            if (run < i)
+                tasks.push_back(parse_task { bounds[run], bounds[i], list_type, &target.children, run, i - run });
+            run = i + 1;
+
+            size_t payload_begin = header.position();
+            tag* shell;
+            if (element_type == tag_type::TAG_Compound)
+                shell = make_tag<tags::tag_compound>(std::move(name));
+            else
+                shell = make_tag<tags::tag_list>(std::move(name), (tag_type) header.read_ubyte());
+            target.children[i] = shell;
+            containers.push_back(split_container { shell, std::vector<tag*>() });
+            plan_container(data, size, payload_begin, element_type, containers.back(), containers, tasks, chunk, depth + 1);
+        } else if (bounds[i + 1] - bounds[run] >= chunk) {
+            tasks.push_back(parse_task { bounds[run], bounds[i + 1], list_type, &target.children, run, i + 1 - run });
+            run = i + 1;
+        }
+    }
+    if (run < count)
+        tasks.push_back(parse_task { bounds[run], bounds[count], list_type, &target.children, run, count - run });
+}
+
+static void run_task(const uint8_t* data, const parse_task& task) {
+    codec::buffer_reader di(data + task.begin, task.end - task.begin);
+    for (size_t i = 0; i < task.count; i++) {
+        (*task.out)[task.first + i] = load_internal(di, task.list_type);
+    }
+}
+
+/**
+ * Move the parsed children into their containers, skipping those of failed tasks.
+ */
+static void stitch(std::deque<split_container>& containers) {
+    for (split_container& c : containers) {
+        c.children.erase(std::remove(c.children.begin(), c.children.end(), nullptr), c.children.end());
+        if (c.container->type() == tag_type::TAG_Compound) {
+            static_cast<tags::tag_compound*>(c.container)->insert_all(c.children);
+        } else {
+            tags::tag_list* list = static_cast<tags::tag_list*>(c.container);
+            for (tag *t : c.children) {
+                list->append(t);
+            }
+            c.children.clear();
+        }
+    }
+}
+
+void nbt::load_parallel(const uint8_t* data, size_t size, unsigned threads) {
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    codec::buffer_reader di(data, size);
+    tag_type type = size > 0 ? (tag_type) data[0] : tag_type::TAG_End;
+    if (threads <= 1 || size < parallel_min_size || (type != tag_type::TAG_Compound && type != tag_type::TAG_List)) {
+        load(data, size);
+        return;
+    }
+
+    if (m_tag != nullptr) {
+        delete m_tag;
+        m_tag = nullptr;
+    }
+
+    di.skip(1);
+    std::string name = di.read_string();
+    size_t payload_begin = di.position();
+    tag* root = type == tag_type::TAG_Compound ? (tag*) make_tag<tags::tag_compound>(std::move(name)) :
+        (tag*) make_tag<tags::tag_list>(std::move(name), (tag_type) di.read_ubyte());
+
+    std::deque<split_container> containers;
+    containers.push_back(split_container { root, std::vector<tag*>() });
+    try {
+        std::vector<parse_task> tasks;
+        // Several tasks per thread so uneven elements still spread evenly.
+        size_t chunk = std::max<size_t>(size / (threads * 8), 65536);
+        plan_container(data, size, payload_begin, type, containers.front(), containers, tasks, chunk, 0);
+
+        std::atomic<size_t> next(0);
+        std::vector<std::exception_ptr> errors(threads);
+        auto parse = [&](unsigned worker) {
+            try {
+                for (size_t i = next++; i < tasks.size(); i = next++) {
+                    run_task(data, tasks[i]);
+                }
+            } catch (...) {
+                errors[worker] = std::current_exception();
+                next = tasks.size();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned i = 1; i < threads; i++) {
+            workers.push_back(std::thread(parse, i));
+        }
+        parse(0);
+        for (std::thread& w : workers) {
+            w.join();
+        }
+        for (std::exception_ptr& e : errors) {
+            if (e)
+                std::rethrow_exception(e);
+        }
+        stitch(containers);
+    } catch (...) {
+        stitch(containers);
+        delete root;
+        throw;
+    }
+
+    m_tag = root;
+    m_compression = uncompressed;
+}
+
+void nbt::load_parallel(std::istream& in, unsigned threads) {
+    std::vector<uint8_t> data;
+    size_t size = 0;
+    while (1) {
+        data.resize(std::max<size_t>(size * 2, 1 << 20));
+        std::streamsize n = in.rdbuf()->sgetn(reinterpret_cast<char*>(data.data() + size), data.size() - size);
+        size += (size_t) n;
+        if (size < data.size())
+            break;
+    }
+    data.resize(size);
+    load_parallel(data.data(), data.size(), threads);
+}
+
+template tag* tree_recycler::reload(codec::buffer_reader&, tag*);
+template tag* tree_recycler::reload(codec::stream_reader&, tag*);
+
+tree_recycler& nbt::recycler() {
+    if (m_recycler == nullptr)
+        m_recycler.reset(new tree_recycler());
+    return *m_recycler;
+}
+
+void nbt::reload(std::istream& in) {
+    codec::stream_reader di(in.rdbuf());
+    tag* old = m_tag;
+    m_tag = nullptr;
+    m_tag = recycler().reload(di, old);
+    m_compression = uncompressed;
+}
 
-    m_tag = load_internal(di);
+void nbt::reload(const uint8_t* data, size_t size) {
+    codec::buffer_reader di(data, size);
+    tag* old = m_tag;
+    m_tag = nullptr;
+    m_tag = recycler().reload(di, old);
     m_compression = uncompressed;
 }
 
@@ -188,12 +779,84 @@ std::string nbtpp::name_for_type(tag_type t) {
     }
 }
 
+static void debug_internal(std::ostream& out, const tag* data, int indent, bool unnamed);
+
+/**
+ * Prints the value part of a tag, used by debug_internal.
+ */
+struct debug_visitor {
+    std::ostream& out;
+    const std::string& ind;
+    int indent;
+
+    void operator()(const tags::tag_end&) const {
+    }
+
+    void operator()(const tags::tag_byte& s) const {
+        out << +s.value() << "\n";
+    }
+
+    void operator()(const tags::tag_short& s) const {
+        out << +s.value() << "\n";
+    }
+
+    void operator()(const tags::tag_int& s) const {
+        out << s.value() << "\n";
+    }
+
+    void operator()(const tags::tag_long& s) const {
+        out << s.value() << "\n";
+    }
+
+    void operator()(const tags::tag_float& s) const {
+        out << s.value() << "\n";
+    }
+
+    void operator()(const tags::tag_double& s) const {
+        out << s.value() << "\n";
+    }
+
+    void operator()(const tags::tag_bytearray& s) const {
+        out << "[" << s.value().size() << " bytes]" << "\n";
+    }
+
+    void operator()(const tags::tag_string& s) const {
+        out << "'" << s.value() << "'" << "\n";
+    }
+
+    void operator()(const tags::tag_list& l) const {
+        out << l.value().size() << " entry" << "\n";
+        out << ind << "{" << "\n";
+        for (const tag *i : l.value()) {
+            debug_internal(out, i, indent + 1, true);
+        }
+        out << ind << "}" << "\n";
+    }
+
+    void operator()(const tags::tag_compound& c) const {
+        out << c.value().size() << " entry" << "\n";
+        out << ind << "{" << "\n";
+        for (const tag *i : c.value()) {
+            debug_internal(out, i, indent + 1, false);
+        }
+        out << ind << "}" << "\n";
+    }
+
+    void operator()(const tags::tag_intarray& s) const {
+        out << "[" << s.value().size() << " ints]" << "\n";
+    }
+
+    void operator()(const tags::tag_longarray& s) const {
+        out << "[" << s.value().size() << " longs]" << "\n";
+    }
+};
+
 static void debug_internal(std::ostream& out, const tag* data, int indent, bool unnamed) {
 
     std::string ind(indent * 2, ' ');
 
     if (data == nullptr) {
-        std::cout << ind << "<nullptr>\n";
+        out << ind << "<nullptr>\n";
         return;
     }
 
@@ -203,82 +866,7 @@ static void debug_internal(std::ostream& out, const tag* data, int indent, bool
     else
         out << "('" << data->name() << "'): ";
 
-    switch (data->type()) {
-        case tag_type::TAG_Byte: {
-            const tags::tag_byte *s = static_cast<const tags::tag_byte*>(data);
-            out << +s->value() << "\n";
-            break;
-        }
-        case tag_type::TAG_Short: {
-            const tags::tag_short *s = static_cast<const tags::tag_short*>(data);
-            out << +s->value() << "\n";
-            break;
-        }
-        case tag_type::TAG_Int: {
-            const tags::tag_int *s = static_cast<const tags::tag_int*>(data);
-            out << s->value() << "\n";
-            break;
-        }
-        case tag_type::TAG_Long: {
-            const tags::tag_long *s = static_cast<const tags::tag_long*>(data);
-            out << s->value() << "\n";
-            break;
-        }
-        case tag_type::TAG_Float: {
-            const tags::tag_float *s = static_cast<const tags::tag_float*>(data);
-            out << s->value() << "\n";
-            break;
-        }
-        case tag_type::TAG_Double: {
-            const tags::tag_double *s = static_cast<const tags::tag_double*>(data);
-            out << s->value() << "\n";
-            break;
-        }
-        case tag_type::TAG_Byte_Array: {
-            const tags::tag_bytearray *s = static_cast<const tags::tag_bytearray*>(data);
-            out << "[" << s->value().size() << " bytes]" << "\n";
-            break;
-        }
-        case tag_type::TAG_String: {
-            const tags::tag_string *s = static_cast<const tags::tag_string*>(data);
-            out << "'" << s->value() << "'" << "\n";
-            break;
-        }
-        case tag_type::TAG_List: {
-            const tags::tag_list *l = static_cast<const tags::tag_list*>(data);
-
-            out << l->value().size() << " entry" << "\n";
-            out << ind << "{" << "\n";
-            for (const tag *i : l->value()) {
-                debug_internal(out, i, indent + 1, true);
-            }
-            out << ind << "}" << "\n";
-            break;
-        }
-        case tag_type::TAG_Compound: {
-            const tags::tag_compound *c = static_cast<const tags::tag_compound*>(data);
-
-            out << c->value().size() << " entry" << "\n";
-            out << ind << "{" << "\n";
-            for (const tag *i : c->value()) {
-                debug_internal(out, i, indent + 1, false);
-            }
-            out << ind << "}" << "\n";
-            break;
-        }
-        case tag_type::TAG_Int_Array: {
-            const tags::tag_intarray *s = static_cast<const tags::tag_intarray*>(data);
-            out << "[" << s->value().size() << " ints]" << "\n";
-            break;
-        }
-        case tag_type::TAG_Long_Array: {
-            const tags::tag_longarray *s = static_cast<const tags::tag_longarray*>(data);
-            out << "[" << s->value().size() << " longs]" << "\n";
-            break;
-        }
-        default:
-            break;
-    }
+    visit(*data, debug_visitor { out, ind, indent });
 }
 
 void nbt::debug(std::ostream& out) {
@@ -304,108 +892,146 @@ void nbt::save_file(std::ofstream& out) {
     }
 }
 
-static void save_internal(streams::data_ostream& out, const tag* the_tag, tag_type force_type = tag_type::TAG_Undef) {
+void nbt::save_file(std::ofstream& out, unsigned threads) {
+    if (m_compression != gzip && m_compression != zlib) {
+        save(out);
+        return;
+    }
+    parallel_deflate_ostream p(out, m_compression, threads);
+    save(p);
+    p.finish();
+}
+
+template<class Writer>
+static void save_internal(Writer& out, const tag* the_tag, tag_type force_type = tag_type::TAG_Undef);
+
+/**
+ * Writes the payload of a tag, used by save_internal.
+ */
+template<class Writer>
+struct save_visitor {
+    Writer& out;
+
+    void operator()(const tags::tag_end&) const {
+    }
+
+    void operator()(const tags::tag_byte& s) const {
+        out.write_byte(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 1);
+    }
+
+    void operator()(const tags::tag_short& s) const {
+        out.write_short(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 2);
+    }
+
+    void operator()(const tags::tag_int& s) const {
+        out.write_int(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 4);
+    }
+
+    void operator()(const tags::tag_long& s) const {
+        out.write_long(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 8);
+    }
+
+    void operator()(const tags::tag_float& s) const {
+        out.write_float(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 4);
+    }
+
+    void operator()(const tags::tag_double& s) const {
+        out.write_double(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 8);
+    }
+
+    void operator()(const tags::tag_bytearray& s) const {
+        out.write_int(s.value().size());
+        out.write_array(s.value().data(), s.value().size());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 4 + s.value().size());
+    }
+
+    void operator()(const tags::tag_string& s) const {
+        out.write_string(s.value());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 2 + s.value().size());
+    }
+
+    void operator()(const tags::tag_list& l) const {
+        out.write_ubyte(l.content_type());
+        out.write_int(l.value().size());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 5);
+        for (const tag *t : l.value()) {
+            save_internal(out, t, l.content_type());
+        }
+    }
+
+    void operator()(const tags::tag_compound& c) const {
+        for (const tag *t : c.value()) {
+            save_internal(out, t);
+        }
+        out.write_ubyte(tag_type::TAG_End);
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 1);
+    }
+
+    void operator()(const tags::tag_intarray& s) const {
+        out.write_int(s.value().size());
+        out.write_array(s.value().data(), s.value().size());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 4 + 4 * s.value().size());
+    }
+
+    void operator()(const tags::tag_longarray& s) const {
+        out.write_int(s.value().size());
+        out.write_array(s.value().data(), s.value().size());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 4 + 8 * s.value().size());
+    }
+};
+
+template<class Writer>
+static void save_internal(Writer& out, const tag* the_tag, tag_type force_type) {
     tag_type type = force_type;
 
     if (type == tag_type::TAG_Undef) {
         type = the_tag->type();
         out.write_ubyte(type);
         out.write_string(the_tag->name());
+        NBTPP_INSTRUMENT(instrumentation::thread_counters().bytes_encoded += 3 + the_tag->name().size());
     } else {
         if (type != the_tag->type()) {
             throw nbt_exception("invalid data, trying to put tag of type " + name_for_type(the_tag->type()) + " in list of " + name_for_type(type) + ".");
         }
     }
 
-    switch (type) {
-        case tag_type::TAG_Byte: {
-            const tags::tag_byte *s = static_cast<const tags::tag_byte*>(the_tag);
-            out.write_byte(s->value());
-            break;
-        }
-        case tag_type::TAG_Short: {
-            const tags::tag_short *s = static_cast<const tags::tag_short*>(the_tag);
-            out.write_short(s->value());
-            break;
-        }
-        case tag_type::TAG_Int: {
-            const tags::tag_int *s = static_cast<const tags::tag_int*>(the_tag);
-            out.write_int(s->value());
-            break;
-        }
-        case tag_type::TAG_Long: {
-            const tags::tag_long *s = static_cast<const tags::tag_long*>(the_tag);
-            out.write_long(s->value());
-            break;
-        }
-        case tag_type::TAG_Float: {
-            const tags::tag_float *s = static_cast<const tags::tag_float*>(the_tag);
-            out.write_float(s->value());
-            break;
-        }
-        case tag_type::TAG_Double: {
-            const tags::tag_double *s = static_cast<const tags::tag_double*>(the_tag);
-            out.write_double(s->value());
-            break;
-        }
-        case tag_type::TAG_Byte_Array: {
-            const tags::tag_bytearray *s = static_cast<const tags::tag_bytearray*>(the_tag);
-            out.write_int(s->value().size());
-            for (const int8_t i : s->value()) {
-                out.write_byte(i);
-            }
-            break;
-        }
-        case tag_type::TAG_String: {
-            const tags::tag_string *s = static_cast<const tags::tag_string*>(the_tag);
-            out.write_string(s->value());
-            break;
-        }
-        case tag_type::TAG_List: {
-            const tags::tag_list *l = static_cast<const tags::tag_list*>(the_tag);
-            out.write_ubyte(l->content_type());
-            out.write_int(l->value().size());
-            for (const tag *t : l->value()) {
-                save_internal(out, t, l->content_type());
-            }
-
-            break;
-        }
-        case tag_type::TAG_Compound: {
-            const tags::tag_compound *c = static_cast<const tags::tag_compound*>(the_tag);
-            for (const tag *t : c->value()) {
-                save_internal(out, t);
-            }
-            out.write_ubyte(tag_type::TAG_End);
-            break;
-        }
-        case tag_type::TAG_Int_Array: {
-            const tags::tag_intarray *s = static_cast<const tags::tag_intarray*>(the_tag);
-            out.write_int(s->value().size());
-            for (const int32_t i : s->value()) {
-                out.write_int(i);
-            }
-            break;
-        }
-        case tag_type::TAG_Long_Array: {
-            const tags::tag_longarray *s = static_cast<const tags::tag_longarray*>(the_tag);
-            out.write_int(s->value().size());
-            for (const int64_t i : s->value()) {
-                out.write_long(i);
-            }
-            break;
-        }
-        default:
-            break;
-    }
+    visit(*the_tag, save_visitor<Writer> { out });
 }
 
 void nbt::save(std::ostream& out) {
     if (m_tag == nullptr)
         return;
 
-    streams::data_ostream dout(out, streams::endianconv::big);
-    dout.exceptions(std::ios_base::badbit);
+    codec::stream_writer dout(out.rdbuf());
 
+#ifdef NBTPP_INSTRUMENTATION
+    uint64_t start = now_ns();
+    save_internal(dout, m_tag);
+    dout.flush();
+    instrumentation::thread_counters().save_ns += now_ns() - start;
+#else
+    save_internal(dout, m_tag);
+    dout.flush();
+#endif
+}
+
+void nbt::save(std::vector<uint8_t>& out) {
+    if (m_tag == nullptr)
+        return;
+
+    codec::buffer_writer dout(out);
+
+#ifdef NBTPP_INSTRUMENTATION
+    uint64_t start = now_ns();
+    save_internal(dout, m_tag);
+    instrumentation::thread_counters().save_ns += now_ns() - start;
+#else
     save_internal(dout, m_tag);
+#endif
 }
@@ -0,0 +1,360 @@
+#include "pushparser.hpp"
+#include "nbt.hpp"
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace nbtpp;
+
+/**
+ * Size of the fixed part of a payload, read before the tag can be created.
+ */
+static size_t header_size(tag_type type) {
+    switch (type) {
+        case tag_type::TAG_String:
+            return 2;
+        case tag_type::TAG_Byte_Array:
+        case tag_type::TAG_Int_Array:
+        case tag_type::TAG_Long_Array:
+            return 4;
+        case tag_type::TAG_List:
+            return 5;
+        case tag_type::TAG_Compound:
+            return 0;
+        default:
+            return codec::fixed_payload_size(type);
+    }
+}
+
+static bool valid_type(tag_type type) {
+    return type > tag_type::TAG_End && type <= tag_type::TAG_Long_Array;
+}
+
+push_parser::push_parser(size_t max_size) : m_max_size(max_size), m_status(need_more), m_phase(read_type), m_type(tag_type::TAG_Undef),
+        m_root(nullptr), m_current(nullptr), m_have(0), m_body_size(0), m_body_have(0), m_position(0) {
+}
+
+push_parser::~push_parser() {
+    reset();
+}
+
+void push_parser::reset() {
+    if (m_root != nullptr) {
+        delete m_root;
+        m_root = nullptr;
+    }
+    m_current = nullptr;
+    m_stack.clear();
+    m_status = need_more;
+    m_phase = read_type;
+    m_type = tag_type::TAG_Undef;
+    m_have = 0;
+    m_position = 0;
+    m_error.clear();
+}
+
+tag* push_parser::take() {
+    if (m_status != complete)
+        return nullptr;
+    tag* t = m_root;
+    m_root = nullptr;
+    reset();
+    return t;
+}
+
+void push_parser::fail(const std::string& message) {
+    m_status = error;
+    m_error = message + " at byte " + std::to_string(m_position);
+}
+
+bool push_parser::reserve(size_t size) {
+    if (m_max_size != 0 && (size > m_max_size || m_position > m_max_size - size)) {
+        fail("document exceeds the size limit of " + std::to_string(m_max_size) + " bytes");
+        return false;
+    }
+    return true;
+}
+
+bool push_parser::gather(const uint8_t*& in, const uint8_t* end, size_t size) {
+    while (m_have < size) {
+        if (in == end)
+            return false;
+        m_scratch[m_have++] = *in++;
+    }
+    return true;
+}
+
+void push_parser::attach(tag* t) {
+    if (m_stack.empty()) {
+        m_root = t;
+    } else if (m_stack.back().container->type() == tag_type::TAG_Compound) {
+        static_cast<tags::tag_compound*>(m_stack.back().container)->insert(t);
+    } else {
+        static_cast<tags::tag_list*>(m_stack.back().container)->append(t);
+    }
+}
+
+void push_parser::begin_header(tag_type type) {
+    m_type = type;
+    m_phase = read_header;
+    m_have = 0;
+}
+
+void push_parser::value_done() {
+    while (!m_stack.empty()) {
+        frame& f = m_stack.back();
+        if (f.container->type() == tag_type::TAG_Compound) {
+            m_phase = read_type;
+            return;
+        }
+        if (--f.remaining > 0) {
+            m_name.clear();
+            begin_header(f.content_type);
+            return;
+        }
+        // The list is complete, and is itself a value of its parent.
+        m_stack.pop_back();
+    }
+    m_status = complete;
+}
+
+void push_parser::header_done() {
+    const uint8_t* h = m_scratch;
+    m_have = 0;
+
+    switch (m_type) {
+        case tag_type::TAG_Byte:
+            attach(new tags::tag_byte(m_name, (int8_t) h[0]));
+            value_done();
+            break;
+        case tag_type::TAG_Short:
+            attach(new tags::tag_short(m_name, (int16_t) codec::load_be<uint16_t>(h)));
+            value_done();
+            break;
+        case tag_type::TAG_Int:
+            attach(new tags::tag_int(m_name, (int32_t) codec::load_be<uint32_t>(h)));
+            value_done();
+            break;
+        case tag_type::TAG_Long:
+            attach(new tags::tag_long(m_name, (int64_t) codec::load_be<uint64_t>(h)));
+            value_done();
+            break;
+        case tag_type::TAG_Float: {
+            uint32_t bits = codec::load_be<uint32_t>(h);
+            float v;
+            std::memcpy(&v, &bits, sizeof(v));
+            attach(new tags::tag_float(m_name, v));
+            value_done();
+            break;
+        }
+        case tag_type::TAG_Double: {
+            uint64_t bits = codec::load_be<uint64_t>(h);
+            double v;
+            std::memcpy(&v, &bits, sizeof(v));
+            attach(new tags::tag_double(m_name, v));
+            value_done();
+            break;
+        }
+        case tag_type::TAG_String: {
+            m_body_size = codec::load_be<uint16_t>(h);
+            if (!reserve(m_body_size))
+                return;
+            m_string.resize(m_body_size);
+            m_body_have = 0;
+            m_phase = read_body;
+            break;
+        }
+        case tag_type::TAG_Byte_Array:
+        case tag_type::TAG_Int_Array:
+        case tag_type::TAG_Long_Array: {
+            int32_t length = (int32_t) codec::load_be<uint32_t>(h);
+            size_t count = length > 0 ? length : 0;
+            if (!reserve(count * codec::fixed_payload_size(m_type == tag_type::TAG_Byte_Array ? tag_type::TAG_Byte :
+                m_type == tag_type::TAG_Int_Array ? tag_type::TAG_Int : tag_type::TAG_Long)))
+                return;
+
+            if (m_type == tag_type::TAG_Byte_Array) {
+                m_current = new tags::tag_bytearray(m_name);
+                m_body_size = count;
+            } else if (m_type == tag_type::TAG_Int_Array) {
+                m_current = new tags::tag_intarray(m_name);
+                m_body_size = count * 4;
+            } else {
+                m_current = new tags::tag_longarray(m_name);
+                m_body_size = count * 8;
+            }
+            attach(m_current);
+            m_body_have = 0;
+            if (m_body_size == 0)
+                body_done();
+            else
+                m_phase = read_body;
+            break;
+        }
+        case tag_type::TAG_List: {
+            tag_type content_type = (tag_type) h[0];
+            int32_t length = (int32_t) codec::load_be<uint32_t>(h + 1);
+            if (length > 0 && !valid_type(content_type)) {
+                fail("invalid list type " + std::to_string((int) content_type));
+                return;
+            }
+            tags::tag_list* l = new tags::tag_list(m_name, content_type);
+            attach(l);
+            if (length > 0) {
+                frame f = { l, content_type, length };
+                m_stack.push_back(f);
+                m_name.clear();
+                begin_header(content_type);
+            } else {
+                value_done();
+            }
+            break;
+        }
+        case tag_type::TAG_Compound: {
+            tags::tag_compound* c = new tags::tag_compound(m_name);
+            attach(c);
+            frame f = { c, tag_type::TAG_End, 0 };
+            m_stack.push_back(f);
+            m_phase = read_type;
+            break;
+        }
+        default:
+            fail("invalid tag type " + std::to_string((int) m_type));
+            break;
+    }
+}
+
+/**
+ * Target of the variable-size part of the current payload, an array being grown to hold size bytes of it.
+ *
+ * Arrays grow with the bytes received instead of being sized from their header, so a few bytes declaring a huge array
+ * don't allocate it.
+ */
+static uint8_t* body_target(tag_type type, tag* current, std::string& str, size_t size) {
+    switch (type) {
+        case tag_type::TAG_String:
+            return reinterpret_cast<uint8_t*>(&str[0]);
+        case tag_type::TAG_Byte_Array: {
+            std::vector<int8_t>& v = static_cast<tags::tag_bytearray*>(current)->value();
+            v.resize(size);
+            return reinterpret_cast<uint8_t*>(v.data());
+        }
+        case tag_type::TAG_Int_Array: {
+            std::vector<int32_t>& v = static_cast<tags::tag_intarray*>(current)->value();
+            v.resize((size + 3) / 4);
+            return reinterpret_cast<uint8_t*>(v.data());
+        }
+        default: {
+            std::vector<int64_t>& v = static_cast<tags::tag_longarray*>(current)->value();
+            v.resize((size + 7) / 8);
+            return reinterpret_cast<uint8_t*>(v.data());
+        }
+    }
+}
+
+void push_parser::body_done() {
+    switch (m_type) {
+        case tag_type::TAG_String:
+            attach(new tags::tag_string(m_name, m_string));
+            break;
+        case tag_type::TAG_Int_Array: {
+            std::vector<int32_t>& v = static_cast<tags::tag_intarray*>(m_current)->value();
+            codec::from_be(v.data(), reinterpret_cast<const uint8_t*>(v.data()), v.size());
+            break;
+        }
+        case tag_type::TAG_Long_Array: {
+            std::vector<int64_t>& v = static_cast<tags::tag_longarray*>(m_current)->value();
+            codec::from_be(v.data(), reinterpret_cast<const uint8_t*>(v.data()), v.size());
+            break;
+        }
+        default:
+            break;
+    }
+    m_current = nullptr;
+    value_done();
+}
+
+push_parser::status push_parser::feed(const uint8_t* data, size_t size, size_t& consumed) {
+    const uint8_t* in = data;
+    const uint8_t* end = data + size;
+
+    while (m_status == need_more) {
+        const uint8_t* start = in;
+
+        switch (m_phase) {
+            case read_type: {
+                if (in == end)
+                    goto out;
+                tag_type type = (tag_type) *in++;
+                m_position++;
+                if (type == tag_type::TAG_End) {
+                    if (m_stack.empty()) {
+                        m_root = new tags::tag_end();
+                        m_status = complete;
+                    } else {
+                        m_stack.pop_back();
+                        value_done();
+                    }
+                    break;
+                }
+                if (!valid_type(type)) {
+                    fail("invalid tag type " + std::to_string((int) type));
+                    break;
+                }
+                m_type = type;
+                m_phase = read_name_length;
+                m_have = 0;
+                break;
+            }
+            case read_name_length: {
+                bool done = gather(in, end, 2);
+                m_position += in - start;
+                if (!done)
+                    goto out;
+                m_have = 0;
+                m_body_size = codec::load_be<uint16_t>(m_scratch);
+                m_name.clear();
+                m_phase = read_name;
+                break;
+            }
+            case read_name: {
+                size_t n = std::min<size_t>(end - in, m_body_size - m_name.size());
+                m_name.append(reinterpret_cast<const char*>(in), n);
+                in += n;
+                m_position += n;
+                if (m_name.size() < m_body_size)
+                    goto out;
+                begin_header(m_type);
+                break;
+            }
+            case read_header: {
+                bool done = gather(in, end, header_size(m_type));
+                m_position += in - start;
+                if (!done)
+                    goto out;
+                header_done();
+                break;
+            }
+            case read_body: {
+                if (in == end)
+                    goto out;
+                size_t n = std::min<size_t>(end - in, m_body_size - m_body_have);
+                std::memcpy(body_target(m_type, m_current, m_string, m_body_have + n) + m_body_have, in, n);
+                in += n;
+                m_body_have += n;
+                m_position += n;
+                if (m_body_have < m_body_size)
+                    goto out;
+                body_done();
+                break;
+            }
+        }
+
+        if (m_status == need_more && !reserve(0))
+            break;
+    }
+
+    out: consumed = in - data;
+    return m_status;
+}
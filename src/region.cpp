@@ -0,0 +1,261 @@
+#include "region.hpp"
+#include "codec.hpp"
+#include "deflate.hpp"
+#include "nbtexception.hpp"
+#include "stde/streams/gzip.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <thread>
+
+using namespace nbtpp;
+using namespace stde;
+
+region_file::region_file(const std::string& path) : m_path(path), m_file(path, std::ios::binary) {
+    read_header();
+}
+
+void region_file::create(const std::string& path) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::vector<char> header(2 * sector_size);
+    if (!out.write(header.data(), header.size()))
+        throw nbt_exception("can't create region file " + path);
+}
+
+std::string region_file::external_path(const std::string& region_path, int32_t x, int32_t z) {
+    size_t slash = region_path.find_last_of("/\\");
+    size_t start = slash == std::string::npos ? 0 : slash + 1;
+    int32_t region_x, region_z;
+    char end;
+    if (std::sscanf(region_path.c_str() + start, "r.%d.%d.mc%c", &region_x, &region_z, &end) != 3)
+        throw nbt_exception("can't tell the coordinates of region " + region_path);
+    return region_path.substr(0, start) + "c." + std::to_string(region_x * 32 + (x & 31)) + "." +
+        std::to_string(region_z * 32 + (z & 31)) + ".mcc";
+}
+
+void region_file::read_external(const std::string& region_path, int32_t x, int32_t z, std::vector<uint8_t>& data) {
+    std::string path = external_path(region_path, x, z);
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+        throw nbt_exception("can't open external chunk " + path);
+    data.resize((size_t) in.tellg());
+    in.seekg(0);
+    if (!data.empty() && !in.read(reinterpret_cast<char*>(data.data()), data.size()))
+        throw nbt_exception("can't read external chunk " + path);
+}
+
+void region_file::read_header() {
+    uint8_t header[2 * sector_size];
+    if (!m_file.read(reinterpret_cast<char*>(header), sizeof(header)))
+        throw nbt_exception("can't read region header of " + m_path);
+    for (size_t i = 0; i < 1024; i++) {
+        m_locations[i] = codec::load_be<uint32_t>(header + i * 4);
+        m_timestamps[i] = codec::load_be<uint32_t>(header + sector_size + i * 4);
+    }
+}
+
+bool region_file::read(int32_t x, int32_t z, std::vector<uint8_t>& data, nbt::compression& compression) {
+    uint32_t location = m_locations[index(x, z)];
+    if (location == 0)
+        return false;
+
+    uint64_t offset = (uint64_t) (location >> 8) * sector_size;
+    uint64_t sectors = location & 0xff;
+    uint8_t header[5];
+    m_file.clear();
+    m_file.seekg(offset);
+    if (!m_file.read(reinterpret_cast<char*>(header), sizeof(header)))
+        throw nbt_exception("can't read chunk " + std::to_string(x) + "," + std::to_string(z) + " of " + m_path);
+
+    uint32_t length = codec::load_be<uint32_t>(header);
+    if (length == 0 || (uint64_t) length + 4 > sectors * sector_size)
+        throw nbt_exception("invalid length of chunk " + std::to_string(x) + "," + std::to_string(z) + " in " + m_path);
+    uint8_t stored = header[4] & ~external_flag;
+    if (stored < nbt::gzip || stored > nbt::uncompressed)
+        throw nbt_exception("unsupported compression " + std::to_string(header[4]) + " of chunk " + std::to_string(x) + "," +
+            std::to_string(z) + " in " + m_path);
+    compression = (nbt::compression) stored;
+
+    if (header[4] & external_flag) {
+        read_external(m_path, x, z, data);
+        return true;
+    }
+    data.resize(length - 1);
+    if (!m_file.read(reinterpret_cast<char*>(data.data()), data.size()))
+        throw nbt_exception("truncated chunk " + std::to_string(x) + "," + std::to_string(z) + " in " + m_path);
+    return true;
+}
+
+bool region_file::read_record(int32_t x, int32_t z, std::vector<uint8_t>& record) {
+    uint32_t location = m_locations[index(x, z)];
+    if (location == 0)
+        return false;
+
+    uint64_t offset = (uint64_t) (location >> 8) * sector_size;
+    uint64_t sectors = location & 0xff;
+    uint8_t header[4];
+    m_file.clear();
+    m_file.seekg(offset);
+    if (!m_file.read(reinterpret_cast<char*>(header), sizeof(header)))
+        throw nbt_exception("can't read chunk " + std::to_string(x) + "," + std::to_string(z) + " of " + m_path);
+
+    uint32_t length = codec::load_be<uint32_t>(header);
+    if (length == 0 || (uint64_t) length + 4 > sectors * sector_size)
+        throw nbt_exception("invalid length of chunk " + std::to_string(x) + "," + std::to_string(z) + " in " + m_path);
+
+    record.resize((size_t) length + 4);
+    std::memcpy(record.data(), header, sizeof(header));
+    if (!m_file.read(reinterpret_cast<char*>(record.data() + 4), length))
+        throw nbt_exception("truncated chunk " + std::to_string(x) + "," + std::to_string(z) + " in " + m_path);
+    return true;
+}
+
+bool region_file::load(int32_t x, int32_t z, nbt& out) {
+    std::vector<uint8_t> data;
+    nbt::compression compression;
+    if (!read(x, z, data, compression))
+        return false;
+    decode(data.data(), data.size(), compression, out);
+    return true;
+}
+
+void region_file::decode(const uint8_t* data, size_t size, nbt::compression compression, nbt& out) {
+    if (compression == nbt::uncompressed) {
+        out.reload(data, size);
+    } else {
+        try {
+            std::istringstream in(std::string(reinterpret_cast<const char*>(data), size));
+            streams::gzip_istream g(in);
+            out.reload((std::istream&) g);
+        } catch (streams::gzip_exception&) {
+            throw nbt_exception("invalid compressed chunk");
+        }
+    }
+    out.compression_method(compression);
+}
+
+void region_file::store(int32_t x, int32_t z, nbt chunk, nbt::compression compression) {
+    size_t i = index(x, z);
+    for (dirty_chunk& d : m_dirty) {
+        if (d.index == i) {
+            d.chunk = std::move(chunk);
+            d.compression = compression;
+            return;
+        }
+    }
+    m_dirty.push_back(dirty_chunk { i, std::move(chunk), compression });
+}
+
+void region_file::save(unsigned threads) {
+    if (m_dirty.empty())
+        return;
+
+    // Serialize and compress the dirty chunks, each thread taking the next chunk left.
+    std::vector<std::vector<uint8_t>> compressed(m_dirty.size());
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads > m_dirty.size())
+        threads = (unsigned) m_dirty.size();
+    if (threads < 1)
+        threads = 1;
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(threads);
+    auto encode = [&](unsigned worker) {
+        try {
+            std::vector<uint8_t> raw;
+            for (size_t i = next++; i < m_dirty.size(); i = next++) {
+                raw.clear();
+                m_dirty[i].chunk.save(raw);
+                compress(raw.data(), raw.size(), m_dirty[i].compression, compressed[i]);
+            }
+        } catch (...) {
+            errors[worker] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.push_back(std::thread(encode, i));
+    }
+    encode(0);
+    for (std::thread& w : workers) {
+        w.join();
+    }
+    for (std::exception_ptr& e : errors) {
+        if (e)
+            std::rethrow_exception(e);
+    }
+
+    std::vector<int> dirty(1024, -1);
+    for (size_t i = 0; i < m_dirty.size(); i++) {
+        dirty[m_dirty[i].index] = (int) i;
+    }
+
+    // Chunks are laid out again in index order, after the two header sectors.
+    std::string temp = m_path + ".tmp";
+    try {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        std::vector<uint8_t> header(2 * sector_size);
+        if (!out.write(reinterpret_cast<const char*>(header.data()), header.size()))
+            throw nbt_exception("can't write " + temp);
+
+        uint32_t sector = 2;
+        uint32_t now = (uint32_t) std::time(nullptr);
+        std::vector<uint8_t> record;
+        for (size_t i = 0; i < 1024; i++) {
+            int32_t x = (int32_t) (i % 32);
+            int32_t z = (int32_t) (i / 32);
+            uint32_t timestamp;
+            if (dirty[i] >= 0) {
+                const std::vector<uint8_t>& data = compressed[dirty[i]];
+                record.resize(5 + data.size());
+                codec::store_be<uint32_t>(record.data(), (uint32_t) (data.size() + 1));
+                record[4] = m_dirty[dirty[i]].compression;
+                std::memcpy(record.data() + 5, data.data(), data.size());
+                timestamp = now;
+            } else if (read_record(x, z, record)) {
+                // Copied as stored, external chunks keep their flag and .mcc file.
+                timestamp = m_timestamps[i];
+            } else {
+                continue;
+            }
+
+            size_t sectors = (record.size() + sector_size - 1) / sector_size;
+            if (sectors > 255)
+                throw nbt_exception("chunk " + std::to_string(x) + "," + std::to_string(z) + " of " + m_path +
+                    " is too large to store");
+
+            std::vector<char> padding(sectors * sector_size - record.size());
+            if (!out.write(reinterpret_cast<const char*>(record.data()), record.size()) ||
+                !out.write(padding.data(), padding.size()))
+                throw nbt_exception("can't write " + temp);
+
+            codec::store_be<uint32_t>(header.data() + i * 4, (sector << 8) | (uint32_t) sectors);
+            codec::store_be<uint32_t>(header.data() + sector_size + i * 4, timestamp);
+            sector += (uint32_t) sectors;
+        }
+
+        out.seekp(0);
+        if (!out.write(reinterpret_cast<const char*>(header.data()), header.size()) || !out.flush())
+            throw nbt_exception("can't write " + temp);
+        out.close();
+
+        m_file.close();
+        if (std::rename(temp.c_str(), m_path.c_str()) != 0)
+            throw nbt_exception("can't replace " + m_path);
+    } catch (...) {
+        std::remove(temp.c_str());
+        m_file.close();
+        m_file.clear();
+        m_file.open(m_path, std::ios::binary);
+        throw;
+    }
+
+    m_file.clear();
+    m_file.open(m_path, std::ios::binary);
+    read_header();
+    m_dirty.clear();
+}
@@ -0,0 +1,753 @@
+#include "regionscan.hpp"
+#include "region.hpp"
+#include "filter.hpp"
+#include "deflate.hpp"
+#include "codec.hpp"
+#include "nbtexception.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#ifdef NBTPP_POSIX
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <memory>
+#endif
+
+#ifdef NBTPP_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace nbtpp;
+
+/**
+ * Read of the sectors of one chunk.
+ */
+struct chunk_read {
+    size_t file;
+    int32_t x;
+    int32_t z;
+    uint64_t offset;
+    std::vector<uint8_t> data;
+#ifdef NBTPP_IO_URING
+    struct iovec iov;
+#endif
+};
+
+/**
+ * Region file being read, closed once its last read completes.
+ *
+ * Threads read it at once with pread() on POSIX systems. Elsewhere they read through a stream, one thread at a time.
+ */
+struct scanned_file {
+    /**
+     * Reads not completed yet, plus one while its chunks are being queued
+     */
+    size_t users = 0;
+
+    ~scanned_file() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+#ifdef NBTPP_POSIX
+        fd = ::open(path.c_str(), O_RDONLY);
+        return fd >= 0;
+#else
+        in.reset(new std::ifstream(path, std::ios::binary));
+        if (!*in)
+            in.reset();
+        return in != nullptr;
+#endif
+    }
+
+    void close() {
+#ifdef NBTPP_POSIX
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#else
+        in.reset();
+#endif
+    }
+
+    /**
+     * Read size bytes at offset, fewer at the end of the file.
+     *
+     * @return  Number of bytes read, or -errno
+     */
+    int64_t read(void* data, size_t size, uint64_t offset) {
+#ifdef NBTPP_POSIX
+        int64_t result = 0;
+        while (result < (int64_t) size) {
+            ssize_t n = ::pread(fd, static_cast<char*>(data) + result, size - result, offset + result);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return -errno;
+            if (n == 0)
+                break;
+            result += n;
+        }
+        return result;
+#else
+        std::lock_guard<std::mutex> hold(lock);
+        in->clear();
+        if (!in->seekg((std::streamoff) offset))
+            return -EIO;
+        in->read(static_cast<char*>(data), size);
+        return in->gcount();
+#endif
+    }
+
+#ifdef NBTPP_POSIX
+    int fd = -1;
+#else
+    std::unique_ptr<std::ifstream> in;
+    std::mutex lock;
+#endif
+};
+
+/**
+ * State shared by the reading side, which queues chunk reads in file order, and the decoding threads.
+ */
+class scan_state {
+public:
+    scan_state(const std::vector<std::string>& paths, const region_scanner::visitor& visit, const filter* where,
+        const region_scanner::error_handler& errors, unsigned depth) :
+        m_paths(paths), m_visit(visit), m_filter(where), m_errors(errors), m_depth(depth), m_files(paths.size()), m_next_file(0),
+        m_next_slot(0), m_in_flight(0), m_io_done(false), m_failed(false), m_chunks(0), m_filtered(0), m_error_count(0), m_bytes(0) {
+    }
+
+    scan_state(const scan_state&) = delete;
+    scan_state& operator=(const scan_state&) = delete;
+
+    /**
+     * Next chunk to read, or nullptr once every file is done or the scan failed.
+     */
+    chunk_read* next() {
+        std::lock_guard<std::mutex> lock(m_source);
+        try {
+            while (!failed()) {
+                if (m_next_slot < m_slots.size()) {
+                    size_t file = m_next_file - 1;
+                    uint32_t location = m_locations[m_slots[m_next_slot]];
+                    uint32_t slot = m_slots[m_next_slot++];
+                    chunk_read* op = new chunk_read();
+                    op->file = file;
+                    op->x = (int32_t) (slot % 32);
+                    op->z = (int32_t) (slot / 32);
+                    op->offset = (uint64_t) (location >> 8) * region_file::sector_size;
+                    op->data.resize((size_t) (location & 0xff) * region_file::sector_size);
+#ifdef NBTPP_IO_URING
+                    op->iov.iov_base = op->data.data();
+                    op->iov.iov_len = op->data.size();
+#endif
+                    m_files[file].users++;
+                    return op;
+                }
+
+                if (m_next_file > 0)
+                    release_file(m_next_file - 1);
+                if (m_next_file == m_paths.size())
+                    return nullptr;
+                size_t file = m_next_file++;
+                try {
+                    open_file(file);
+                } catch (nbt_exception& e) {
+                    // The file is skipped, with no chunk left to read.
+                    m_slots.clear();
+                    chunk_failed(file, -1, -1, e);
+                }
+            }
+        } catch (...) {
+            fail(std::current_exception());
+        }
+        return nullptr;
+    }
+
+    inline scanned_file& file(const chunk_read* op) {
+        return m_files[op->file];
+    }
+
+    /**
+     * Take a place in the queue, waiting for one to be free.
+     *
+     * @return  false if the scan failed
+     */
+    bool acquire() {
+        std::unique_lock<std::mutex> lock(m_flight);
+        m_slot_free.wait(lock, [this]() { return m_in_flight < m_depth || failed(); });
+        if (failed())
+            return false;
+        m_in_flight++;
+        return true;
+    }
+
+    /**
+     * Take a place in the queue if one is free.
+     */
+    bool try_acquire() {
+        std::lock_guard<std::mutex> lock(m_flight);
+        if (m_in_flight >= m_depth || failed())
+            return false;
+        m_in_flight++;
+        return true;
+    }
+
+    /**
+     * Wait until a place is free, without taking it.
+     */
+    void wait_slot() {
+        std::unique_lock<std::mutex> lock(m_flight);
+        m_slot_free.wait(lock, [this]() { return m_in_flight < m_depth || failed(); });
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(m_flight);
+            m_in_flight--;
+        }
+        m_slot_free.notify_all();
+    }
+
+    /**
+     * A read finished with result bytes, or -errno. Hands the chunk to the decoding threads.
+     */
+    void completed(chunk_read* op, int64_t result) {
+        // The last sector of a file may be cut short after the chunk, which is fine once its length is covered.
+        if (result >= 4 && result < (int64_t) op->data.size() &&
+            (uint64_t) codec::load_be<uint32_t>(op->data.data()) + 4 <= (uint64_t) result)
+            op->data.resize((size_t) result);
+        bool read = result == (int64_t) op->data.size();
+        if (!read && !failed()) {
+            std::string where = "chunk " + std::to_string(op->x) + "," + std::to_string(op->z) + " of " + m_paths[op->file];
+            if (result < 0)
+                chunk_failed(op->file, op->x, op->z, nbt_exception("can't read " + where + ": " + std::strerror((int) -result)));
+            else
+                chunk_failed(op->file, op->x, op->z, nbt_exception("truncated " + where));
+        }
+        m_bytes += result > 0 ? (uint64_t) result : 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_source);
+            release_file(op->file);
+        }
+        if (!read || failed()) {
+            delete op;
+            release();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_queue.push_back(op);
+        }
+        m_queue_ready.notify_one();
+    }
+
+    /**
+     * No more reads will complete.
+     */
+    void finish_io() {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_io_done = true;
+        }
+        m_queue_ready.notify_all();
+    }
+
+    /**
+     * Body of a decoding thread, with one tree and one buffer reused for its chunks.
+     */
+    void decode_loop() {
+        nbt tree;
+        std::vector<uint8_t> buffer;
+        std::vector<uint8_t> external;
+        while (1) {
+            chunk_read* op;
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                m_queue_ready.wait(lock, [this]() { return m_io_done || !m_queue.empty(); });
+                if (m_queue.empty())
+                    break;
+                op = m_queue.front();
+                m_queue.pop_front();
+            }
+
+            if (!failed()) {
+                bool decoded = false;
+                try {
+                    decoded = decode(*op, tree, buffer, external);
+                    if (!decoded)
+                        m_filtered++;
+                } catch (nbt_exception& e) {
+                    chunk_failed(op->file, op->x, op->z, e);
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+                if (decoded) {
+                    try {
+                        m_visit(m_paths[op->file], op->x, op->z, tree);
+                        m_chunks++;
+                    } catch (...) {
+                        fail(std::current_exception());
+                    }
+                }
+            }
+            delete op;
+            release();
+        }
+    }
+
+    inline bool failed() const {
+        return m_failed.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Keep the first error and stop queueing reads.
+     */
+    void fail(std::exception_ptr error) {
+        {
+            std::lock_guard<std::mutex> lock(m_error_mutex);
+            if (!m_error)
+                m_error = error;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_flight);
+            m_failed.store(true, std::memory_order_release);
+        }
+        m_slot_free.notify_all();
+    }
+
+    /**
+     * A chunk, or a whole file with x and z -1, can't be read or decoded. Goes to the error handler, or fails the
+     * scan without one.
+     */
+    void chunk_failed(size_t file, int32_t x, int32_t z, const nbt_exception& error) {
+        if (!m_errors) {
+            fail(std::make_exception_ptr(error));
+            return;
+        }
+        m_error_count++;
+        try {
+            m_errors(m_paths[file], x, z, error);
+        } catch (...) {
+            fail(std::current_exception());
+        }
+    }
+
+    void rethrow() {
+        if (m_error)
+            std::rethrow_exception(m_error);
+    }
+
+    inline uint64_t chunks() const {
+        return m_chunks;
+    }
+
+    inline uint64_t filtered() const {
+        return m_filtered;
+    }
+
+    inline uint64_t errors() const {
+        return m_error_count;
+    }
+
+    inline uint64_t bytes() const {
+        return m_bytes;
+    }
+private:
+    /**
+     * Open a file and list its chunks in sector order, so reads go forward through the file.
+     */
+    void open_file(size_t i) {
+        const std::string& path = m_paths[i];
+        m_slots.clear();
+        m_next_slot = 0;
+
+        // Set first so the file is released the same way when it can't be read.
+        m_files[i].users = 1;
+        if (!m_files[i].open(path))
+            throw nbt_exception("can't open region file " + path + ": " + std::strerror(errno));
+
+        uint8_t header[region_file::sector_size];
+        int64_t n = m_files[i].read(header, sizeof(header), 0);
+        // Empty region files are left behind by the game, they have no chunks.
+        if (n == 0)
+            return;
+        if (n != (int64_t) sizeof(header))
+            throw nbt_exception("can't read region header of " + path);
+
+        for (uint32_t slot = 0; slot < 1024; slot++) {
+            m_locations[slot] = codec::load_be<uint32_t>(header + slot * 4);
+            if (m_locations[slot] != 0)
+                m_slots.push_back(slot);
+        }
+        std::sort(m_slots.begin(), m_slots.end(), [this](uint32_t a, uint32_t b) {
+            return m_locations[a] < m_locations[b];
+        });
+    }
+
+    /**
+     * Drop a user of a file, closing it after the last. m_source must be held.
+     */
+    void release_file(size_t i) {
+        if (--m_files[i].users == 0)
+            m_files[i].close();
+    }
+
+    /**
+     * Decode a chunk into tree, unless it doesn't match the filter. External chunks are read from their .mcc file
+     * into external.
+     *
+     * @return  Whether the chunk was decoded
+     */
+    bool decode(const chunk_read& op, nbt& tree, std::vector<uint8_t>& buffer, std::vector<uint8_t>& external) {
+        // Only built for errors, this runs for every chunk.
+        auto where = [&op, this]() {
+            return "chunk " + std::to_string(op.x) + "," + std::to_string(op.z) + " in " + m_paths[op.file];
+        };
+        if (op.data.size() < 5)
+            throw nbt_exception("invalid length of " + where());
+        uint32_t length = codec::load_be<uint32_t>(op.data.data());
+        if (length == 0 || (uint64_t) length + 4 > op.data.size())
+            throw nbt_exception("invalid length of " + where());
+        uint8_t compression = op.data[4] & ~region_file::external_flag;
+        if (compression < nbt::gzip || compression > nbt::uncompressed)
+            throw nbt_exception("unsupported compression " + std::to_string(op.data[4]) + " of " + where());
+        const uint8_t* data = op.data.data() + 5;
+        size_t size = length - 1;
+        try {
+            if (op.data[4] & region_file::external_flag) {
+                region_file::read_external(m_paths[op.file], op.x, op.z, external);
+                data = external.data();
+                size = external.size();
+            }
+            if (m_filter == nullptr) {
+                region_file::decode(data, size, (nbt::compression) compression, tree);
+                return true;
+            }
+            // Test the filter on the decompressed bytes, only building the tree of matching chunks.
+            decompress(data, size, (nbt::compression) compression, buffer);
+            if (!m_filter->matches(buffer))
+                return false;
+            tree.reload(buffer.data(), buffer.size());
+            tree.compression_method((nbt::compression) compression);
+            return true;
+        } catch (nbt_exception& e) {
+            throw nbt_exception(std::string(e.what()) + " in " + where());
+        }
+    }
+
+    const std::vector<std::string>& m_paths;
+    const region_scanner::visitor& m_visit;
+    const filter* m_filter;
+    const region_scanner::error_handler& m_errors;
+    unsigned m_depth;
+
+    std::mutex m_source;
+    std::vector<scanned_file> m_files;
+    size_t m_next_file;
+    uint32_t m_locations[1024];
+    std::vector<uint32_t> m_slots;
+    size_t m_next_slot;
+
+    std::mutex m_flight;
+    std::condition_variable m_slot_free;
+    unsigned m_in_flight;
+
+    std::mutex m_queue_mutex;
+    std::condition_variable m_queue_ready;
+    std::deque<chunk_read*> m_queue;
+    bool m_io_done;
+
+    std::atomic<bool> m_failed;
+    std::mutex m_error_mutex;
+    std::exception_ptr m_error;
+
+    std::atomic<uint64_t> m_chunks;
+    std::atomic<uint64_t> m_filtered;
+    std::atomic<uint64_t> m_error_count;
+    std::atomic<uint64_t> m_bytes;
+};
+
+/**
+ * Body of a reading thread of the pool: one blocking read at a time.
+ */
+static void pread_loop(scan_state& st) {
+    while (st.acquire()) {
+        chunk_read* op = st.next();
+        if (op == nullptr) {
+            st.release();
+            break;
+        }
+
+        st.completed(op, st.file(op).read(op->data.data(), op->data.size(), op->offset));
+    }
+}
+
+#ifdef NBTPP_IO_URING
+
+/**
+ * Minimal io_uring over the raw system calls, submitting readv requests.
+ */
+class uring {
+public:
+    uring() : m_fd(-1), m_sq(nullptr), m_cq(nullptr), m_sqes(nullptr), m_sq_size(0), m_cq_size(0), m_sqes_size(0) {
+    }
+
+    uring(const uring&) = delete;
+    uring& operator=(const uring&) = delete;
+
+    ~uring() {
+        if (m_sqes != nullptr)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq != nullptr && m_cq != m_sq)
+            munmap(m_cq, m_cq_size);
+        if (m_sq != nullptr)
+            munmap(m_sq, m_sq_size);
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    /**
+     * Set the ring up.
+     *
+     * @return  false if the kernel does not support io_uring or refuses it
+     */
+    bool open(unsigned entries) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        m_fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+        if (m_fd < 0)
+            return false;
+
+        m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+
+        m_sq = map(m_sq_size, IORING_OFF_SQ_RING);
+        if (m_sq == nullptr)
+            return false;
+        m_cq = single ? m_sq : map(m_cq_size, IORING_OFF_CQ_RING);
+        if (m_cq == nullptr)
+            return false;
+        m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(map(m_sqes_size, IORING_OFF_SQES));
+        if (m_sqes == nullptr)
+            return false;
+
+        char* sq = static_cast<char*>(m_sq);
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        char* cq = static_cast<char*>(m_cq);
+        m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        m_entries = p.sq_entries;
+        return true;
+    }
+
+    inline unsigned entries() const {
+        return m_entries;
+    }
+
+    /**
+     * Queue the read of a chunk, submitted by the next enter().
+     */
+    void prepare(chunk_read* op, int fd) {
+        unsigned tail = *m_sq_tail;
+        unsigned index = tail & m_sq_mask;
+        io_uring_sqe* sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t) (uintptr_t) &op->iov;
+        sqe->len = 1;
+        sqe->off = op->offset;
+        sqe->user_data = (uint64_t) (uintptr_t) op;
+        m_sq_array[index] = index;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * Submit queued reads and wait for some to complete.
+     *
+     * @return  Number of reads submitted, or -errno
+     */
+    int enter(unsigned submit, unsigned wait) {
+        int n = (int) syscall(__NR_io_uring_enter, m_fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        return n < 0 ? -errno : n;
+    }
+
+    /**
+     * Call f(op, result) for each completed read.
+     */
+    template<class F>
+    unsigned reap(F f) {
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; head++, count++) {
+            const io_uring_cqe& c = m_cqes[head & m_cq_mask];
+            f(reinterpret_cast<chunk_read*>((uintptr_t) c.user_data), (int64_t) c.res);
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+private:
+    void* map(size_t size, off_t offset) {
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int m_fd;
+    void* m_sq;
+    void* m_cq;
+    io_uring_sqe* m_sqes;
+    size_t m_sq_size;
+    size_t m_cq_size;
+    size_t m_sqes_size;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned* m_sq_array;
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe* m_cqes;
+    unsigned m_entries;
+};
+
+/**
+ * Read every chunk through one ring on the calling thread.
+ *
+ * @return  false if io_uring is not available, before anything was read
+ */
+static bool uring_loop(scan_state& st, unsigned depth) {
+    uring ring;
+    if (!ring.open(depth))
+        return false;
+
+    // Reads prepared but not submitted yet, in submission order.
+    std::deque<chunk_read*> queued;
+    unsigned submitted = 0;
+    bool exhausted = false;
+    while (1) {
+        while (!exhausted && queued.size() + submitted < ring.entries() && st.try_acquire()) {
+            chunk_read* op = st.next();
+            if (op == nullptr) {
+                st.release();
+                exhausted = true;
+                break;
+            }
+            ring.prepare(op, st.file(op).fd);
+            queued.push_back(op);
+        }
+        if (st.failed())
+            exhausted = true;
+
+        if (queued.size() + submitted == 0) {
+            if (exhausted)
+                break;
+            // Every place is taken by chunks being decoded.
+            st.wait_slot();
+            continue;
+        }
+
+        int n = ring.enter((unsigned) queued.size(), 1);
+        if (n == -EINTR || n == -EAGAIN || n == -EBUSY) {
+            n = 0;
+        } else if (n < 0) {
+            st.fail(std::make_exception_ptr(nbt_exception(std::string("io_uring failed: ") + std::strerror(-n))));
+            break;
+        }
+        queued.erase(queued.begin(), queued.begin() + n);
+        submitted += (unsigned) n;
+        submitted -= ring.reap([&st](chunk_read* op, int64_t result) {
+            st.completed(op, result);
+        });
+    }
+
+    // The kernel may still write the buffers of submitted reads, wait for them before freeing anything. Reads the
+    // kernel never took are only dropped.
+    for (chunk_read* op : queued) {
+        st.completed(op, -ECANCELED);
+    }
+    while (submitted > 0) {
+        int n = ring.enter(0, 1);
+        if (n < 0 && n != -EINTR)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        submitted -= ring.reap([&st](chunk_read* op, int64_t result) {
+            st.completed(op, result);
+        });
+    }
+    return true;
+}
+
+#endif
+
+region_scanner::region_scanner(unsigned queue_depth, unsigned threads, backend use) : m_queue_depth(queue_depth > 0 ? queue_depth : 1),
+    m_threads(threads), m_backend(use), m_used(use), m_chunks(0), m_filtered(0), m_errors(0), m_bytes_read(0) {
+}
+
+void region_scanner::scan(const std::vector<std::string>& paths, const visitor& visit, const filter* where,
+    const error_handler& errors) {
+    scan_state st(paths, visit, where, errors, m_queue_depth);
+
+    unsigned threads = m_threads != 0 ? m_threads : std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    std::vector<std::thread> decoders;
+    for (unsigned i = 0; i < threads; i++) {
+        decoders.push_back(std::thread(&scan_state::decode_loop, &st));
+    }
+
+    bool done = false;
+#ifdef NBTPP_IO_URING
+    if (m_backend != backend::thread_pool) {
+        done = uring_loop(st, m_queue_depth);
+        m_used = backend::io_uring;
+    }
+#endif
+    if (!done) {
+        // Each reading thread has one pread in flight, the queue depth is the number of threads.
+        m_used = backend::thread_pool;
+        unsigned readers = std::min(m_queue_depth, 64u);
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < readers; i++) {
+            pool.push_back(std::thread(pread_loop, std::ref(st)));
+        }
+        pread_loop(st);
+        for (std::thread& t : pool) {
+            t.join();
+        }
+    }
+
+    st.finish_io();
+    for (std::thread& t : decoders) {
+        t.join();
+    }
+    m_chunks = st.chunks();
+    m_filtered = st.filtered();
+    m_errors = st.errors();
+    m_bytes_read = st.bytes();
+    st.rethrow();
+}
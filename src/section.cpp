@@ -0,0 +1,362 @@
+#include "section.hpp"
+#include "blockdata.hpp"
+#include "nbt.hpp"
+#include "nbtexception.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace nbtpp;
+
+uint32_t palette_registry::intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_ids.find(name);
+    if (found != m_ids.end())
+        return found->second;
+    uint32_t id = (uint32_t) m_names.size();
+    m_names.push_back(name);
+    m_ids.emplace(name, id);
+    return id;
+}
+
+uint32_t palette_registry::intern(const tags::tag_compound* entry) {
+    return intern(blockdata::state_string(entry));
+}
+
+uint32_t palette_registry::find(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_ids.find(name);
+    return found != m_ids.end() ? found->second : npos;
+}
+
+const std::string& palette_registry::name(uint32_t id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (id >= m_names.size())
+        throw nbt_exception("unknown palette id " + std::to_string(id));
+    return m_names[id];
+}
+
+size_t palette_registry::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_names.size();
+}
+
+static const size_t nibble_bytes = section_view::volume / 2;
+static const size_t biome_volume = 64;
+
+static uint32_t bits_for(size_t palette_size) {
+    uint32_t bits = 0;
+    while (((size_t) 1 << bits) < palette_size) {
+        bits++;
+    }
+    return bits;
+}
+
+/**
+ * Check the number of longs holding count indices of the given bits.
+ *
+ * @return  Whether indices span two longs, as before 1.16, rather than leaving the top bits of each long unused
+ */
+static bool check_packing(const tags::tag_longarray* data, uint32_t bits, size_t count, const char* what) {
+    size_t per_long = 64 / bits;
+    size_t padded = (count + per_long - 1) / per_long;
+    size_t spanning = (count * bits + 63) / 64;
+    size_t size = data->value().size();
+    if (size == padded)
+        return false;
+    if (size == spanning)
+        return true;
+    throw nbt_exception(std::string(what) + " has " + std::to_string(size) + " longs instead of " + std::to_string(padded) +
+        " for " + std::to_string(bits) + " bits per entry");
+}
+
+/**
+ * Unpack indices of a constant width, letting the compiler unroll the inner loop.
+ */
+template<uint32_t Bits>
+static void unpack_padded(const int64_t* data, uint16_t* out, size_t count) {
+    const uint32_t per_long = 64 / Bits;
+    const uint64_t mask = (1u << Bits) - 1;
+    size_t full = count / per_long;
+    for (size_t l = 0; l < full; l++) {
+        uint64_t v = (uint64_t) data[l];
+        for (uint32_t k = 0; k < per_long; k++) {
+            out[k] = (uint16_t) ((v >> (k * Bits)) & mask);
+        }
+        out += per_long;
+    }
+    size_t rest = count - full * per_long;
+    if (rest > 0) {
+        uint64_t v = (uint64_t) data[full];
+        for (size_t k = 0; k < rest; k++) {
+            out[k] = (uint16_t) ((v >> (k * Bits)) & mask);
+        }
+    }
+}
+
+static void unpack_padded(const int64_t* data, uint16_t* out, size_t count, uint32_t bits) {
+    switch (bits) {
+        case 1: return unpack_padded<1>(data, out, count);
+        case 2: return unpack_padded<2>(data, out, count);
+        case 3: return unpack_padded<3>(data, out, count);
+        case 4: return unpack_padded<4>(data, out, count);
+        case 5: return unpack_padded<5>(data, out, count);
+        case 6: return unpack_padded<6>(data, out, count);
+        case 7: return unpack_padded<7>(data, out, count);
+        case 8: return unpack_padded<8>(data, out, count);
+        default:
+            break;
+    }
+    const uint32_t per_long = 64 / bits;
+    const uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (uint16_t) (((uint64_t) data[i / per_long] >> ((i % per_long) * bits)) & mask);
+    }
+}
+
+static void unpack_spanning(const int64_t* data, uint16_t* out, size_t count, uint32_t bits) {
+    const uint64_t mask = ((uint64_t) 1 << bits) - 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t bit = i * bits;
+        size_t l = bit >> 6;
+        uint32_t offset = bit & 63;
+        uint64_t v = (uint64_t) data[l] >> offset;
+        if (offset + bits > 64)
+            v |= (uint64_t) data[l + 1] << (64 - offset);
+        out[i] = (uint16_t) (v & mask);
+    }
+}
+
+static const int8_t* nibble_array(const tags::tag_compound* section, const std::string& name) {
+    const tags::tag_bytearray* a = section->get<tags::tag_bytearray>(name);
+    if (a == nullptr || a->value().empty())
+        return nullptr;
+    if (a->value().size() != nibble_bytes)
+        throw nbt_exception("section " + name + " has " + std::to_string(a->value().size()) + " bytes instead of 2048");
+    return a->value().data();
+}
+
+section_view::section_view(const tags::tag_compound* section, palette_registry& states, palette_registry* biomes) :
+    m_y(0), m_data(nullptr), m_bits(0), m_spanning(false), m_biome_data(nullptr), m_biome_bits(0), m_block_light(nullptr),
+    m_sky_light(nullptr), m_unpacked(false) {
+    const tags::tag_byte* y = section->get<tags::tag_byte>("Y");
+    if (y != nullptr)
+        m_y = y->value();
+
+    const tags::tag_list* palette;
+    const tags::tag_compound* block_states = section->get<tags::tag_compound>("block_states");
+    if (block_states != nullptr) {
+        palette = block_states->get<tags::tag_list>("palette");
+        m_data = block_states->get<tags::tag_longarray>("data");
+    } else {
+        palette = section->get<tags::tag_list>("Palette");
+        m_data = section->get<tags::tag_longarray>("BlockStates");
+    }
+
+    if (palette != nullptr) {
+        m_palette.reserve(palette->value().size());
+        for (const tag *t : palette->value()) {
+            const tags::tag_compound* entry = tag_cast<tags::tag_compound>(t);
+            if (entry == nullptr)
+                throw nbt_exception("section palette entry is a " + name_for_type(t->type()) + " instead of a compound");
+            m_palette.push_back(states.intern(entry));
+        }
+    }
+    if (m_palette.size() > 1) {
+        if (m_data == nullptr)
+            throw nbt_exception("section has a palette of " + std::to_string(m_palette.size()) + " but no block data");
+        // Block indices take at least 4 bits.
+        m_bits = std::max<uint32_t>(bits_for(m_palette.size()), 4);
+        m_spanning = check_packing(m_data, m_bits, volume, "section block data");
+    }
+
+    const tags::tag_compound* biome_states = section->get<tags::tag_compound>("biomes");
+    if (biomes != nullptr && biome_states != nullptr) {
+        const tags::tag_list* biome_palette = biome_states->get<tags::tag_list>("palette");
+        if (biome_palette != nullptr) {
+            m_biome_palette.reserve(biome_palette->value().size());
+            for (const tag *t : biome_palette->value()) {
+                const tags::tag_string* name = tag_cast<tags::tag_string>(t);
+                if (name == nullptr)
+                    throw nbt_exception("biome palette entry is a " + name_for_type(t->type()) + " instead of a string");
+                m_biome_palette.push_back(biomes->intern(name->value()));
+            }
+        }
+        if (m_biome_palette.size() > 1) {
+            m_biome_data = biome_states->get<tags::tag_longarray>("data");
+            if (m_biome_data == nullptr)
+                throw nbt_exception("section has a biome palette of " + std::to_string(m_biome_palette.size()) + " but no biome data");
+            m_biome_bits = bits_for(m_biome_palette.size());
+            if (check_packing(m_biome_data, m_biome_bits, biome_volume, "section biome data"))
+                throw nbt_exception("section biome data spans longs");
+        }
+    }
+
+    m_block_light = nibble_array(section, "BlockLight");
+    m_sky_light = nibble_array(section, "SkyLight");
+}
+
+const uint16_t* section_view::indices() const {
+    if (m_unpacked)
+        return m_indices;
+
+    if (m_palette.size() <= 1) {
+        std::memset(m_indices, 0, sizeof(m_indices));
+    } else {
+        const int64_t* data = m_data->value().data();
+        if (m_spanning)
+            unpack_spanning(data, m_indices, volume, m_bits);
+        else
+            unpack_padded(data, m_indices, volume, m_bits);
+
+        uint16_t max = 0;
+        for (size_t i = 0; i < volume; i++) {
+            max = m_indices[i] > max ? m_indices[i] : max;
+        }
+        if (max >= m_palette.size())
+            throw nbt_exception("block index " + std::to_string(max) + " outside of palette of " + std::to_string(m_palette.size()));
+    }
+    m_unpacked = true;
+    return m_indices;
+}
+
+void section_view::blocks(uint32_t* out) const {
+    if (m_palette.size() <= 1) {
+        uint32_t state = m_palette.empty() ? palette_registry::npos : m_palette[0];
+        std::fill(out, out + volume, state);
+        return;
+    }
+    const uint16_t* ix = indices();
+    const uint32_t* p = m_palette.data();
+    for (size_t i = 0; i < volume; i++) {
+        out[i] = p[ix[i]];
+    }
+}
+
+size_t section_view::count(uint32_t state) const {
+    if (m_palette.size() <= 1)
+        return !m_palette.empty() && m_palette[0] == state ? volume : 0;
+
+    const uint16_t* ix = indices();
+    size_t n = 0;
+    // A state is usually in the palette once, so count each matching index with a plain comparison loop.
+    for (size_t p = 0; p < m_palette.size(); p++) {
+        if (m_palette[p] != state)
+            continue;
+        uint16_t index = (uint16_t) p;
+        uint32_t matches = 0;
+        for (size_t i = 0; i < volume; i++) {
+            matches += ix[i] == index;
+        }
+        n += matches;
+    }
+    return n;
+}
+
+void section_view::histogram(std::vector<uint32_t>& counts) const {
+    if (m_palette.empty())
+        return;
+
+    std::vector<uint32_t> local(m_palette.size(), 0);
+    if (m_palette.size() == 1) {
+        local[0] = volume;
+    } else {
+        const uint16_t* ix = indices();
+        for (size_t i = 0; i < volume; i++) {
+            local[ix[i]]++;
+        }
+    }
+
+    for (size_t p = 0; p < m_palette.size(); p++) {
+        uint32_t state = m_palette[p];
+        if (state >= counts.size())
+            counts.resize(state + 1, 0);
+        counts[state] += local[p];
+    }
+}
+
+uint32_t section_view::biome(uint32_t x, uint32_t y, uint32_t z) const {
+    if (m_biome_palette.empty())
+        return palette_registry::npos;
+    if (m_biome_palette.size() == 1)
+        return m_biome_palette[0];
+
+    // Biomes are stored for 4x4x4 cells.
+    size_t i = ((y >> 2) << 4) | ((z >> 2) << 2) | (x >> 2);
+    uint32_t per_long = 64 / m_biome_bits;
+    uint64_t v = (uint64_t) m_biome_data->value()[i / per_long] >> ((i % per_long) * m_biome_bits);
+    size_t index = (size_t) (v & (((uint64_t) 1 << m_biome_bits) - 1));
+    if (index >= m_biome_palette.size())
+        throw nbt_exception("biome index " + std::to_string(index) + " outside of palette of " + std::to_string(m_biome_palette.size()));
+    return m_biome_palette[index];
+}
+
+/**
+ * Unpack 4096 nibbles, low nibble first. The loop has no dependency between bytes so compilers vectorize it.
+ */
+static void unpack_nibbles(const int8_t* in, uint8_t* out) {
+    if (in == nullptr) {
+        std::memset(out, 0, section_view::volume);
+        return;
+    }
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(in);
+    for (size_t i = 0; i < nibble_bytes; i++) {
+        out[2 * i] = b[i] & 0x0f;
+        out[2 * i + 1] = b[i] >> 4;
+    }
+}
+
+/**
+ * Highest of 4096 nibbles, by blocks of 64 bytes reduced without branches and stopping at the maximum level.
+ */
+static uint8_t max_nibble(const int8_t* in) {
+    if (in == nullptr)
+        return 0;
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(in);
+    uint8_t max = 0;
+    for (size_t base = 0; base < nibble_bytes && max < 15; base += 64) {
+        uint8_t lo = 0;
+        uint8_t hi = 0;
+        for (size_t i = base; i < base + 64; i++) {
+            uint8_t l = b[i] & 0x0f;
+            uint8_t h = b[i] >> 4;
+            lo = l > lo ? l : lo;
+            hi = h > hi ? h : hi;
+        }
+        max = lo > max ? lo : max;
+        max = hi > max ? hi : max;
+    }
+    return max;
+}
+
+static inline uint8_t nibble(const int8_t* in, uint32_t x, uint32_t y, uint32_t z) {
+    if (in == nullptr)
+        return 0;
+    uint32_t i = (y << 8) | (z << 4) | x;
+    uint8_t b = (uint8_t) in[i >> 1];
+    return (i & 1) ? b >> 4 : b & 0x0f;
+}
+
+void section_view::block_light(uint8_t* out) const {
+    unpack_nibbles(m_block_light, out);
+}
+
+void section_view::sky_light(uint8_t* out) const {
+    unpack_nibbles(m_sky_light, out);
+}
+
+uint8_t section_view::block_light(uint32_t x, uint32_t y, uint32_t z) const {
+    return nibble(m_block_light, x, y, z);
+}
+
+uint8_t section_view::sky_light(uint32_t x, uint32_t y, uint32_t z) const {
+    return nibble(m_sky_light, x, y, z);
+}
+
+uint8_t section_view::max_block_light() const {
+    return max_nibble(m_block_light);
+}
+
+uint8_t section_view::max_sky_light() const {
+    return max_nibble(m_sky_light);
+}
@@ -0,0 +1,634 @@
+#include "snbt.hpp"
+#include "nbt.hpp"
+#include "nbtexception.hpp"
+#include "format.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+using namespace nbtpp;
+
+/**
+ * Maximum nesting of compounds and lists, as in the game.
+ */
+static const int max_depth = 512;
+
+static const double pow10_double[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+    1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static const float pow10_float[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+static inline bool unquoted_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.' || c == '+';
+}
+
+/**
+ * Decomposed decimal number, as read from an unquoted token.
+ */
+struct decimal {
+    bool negative;
+    uint64_t mantissa;
+    int digits;
+    int exponent;
+    bool has_point;
+    bool has_exponent;
+};
+
+/**
+ * Scan a decimal number spanning exactly [s, end).
+ */
+static bool scan_decimal(const char* s, const char* end, decimal& d) {
+    d.negative = false;
+    d.mantissa = 0;
+    d.digits = 0;
+    d.exponent = 0;
+    d.has_point = false;
+    d.has_exponent = false;
+
+    if (s < end && (*s == '-' || *s == '+'))
+        d.negative = *s++ == '-';
+
+    int seen = 0;
+    for (; s < end && *s >= '0' && *s <= '9'; s++, seen++) {
+        if (d.mantissa == 0 && *s == '0')
+            continue;
+        if (d.digits < 19) {
+            d.mantissa = d.mantissa * 10 + (*s - '0');
+            d.digits++;
+        } else {
+            d.exponent++;
+            d.digits++;
+        }
+    }
+    if (s < end && *s == '.') {
+        d.has_point = true;
+        for (s++; s < end && *s >= '0' && *s <= '9'; s++, seen++) {
+            if (d.mantissa == 0 && *s == '0') {
+                d.exponent--;
+                continue;
+            }
+            if (d.digits < 19) {
+                d.mantissa = d.mantissa * 10 + (*s - '0');
+                d.digits++;
+                d.exponent--;
+            } else {
+                d.digits++;
+            }
+        }
+    }
+    if (seen == 0)
+        return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        d.has_exponent = true;
+        s++;
+        bool negative = false;
+        if (s < end && (*s == '-' || *s == '+'))
+            negative = *s++ == '-';
+        if (s == end)
+            return false;
+        int e = 0;
+        for (; s < end && *s >= '0' && *s <= '9'; s++) {
+            if (e < 100000)
+                e = e * 10 + (*s - '0');
+        }
+        d.exponent += negative ? -e : e;
+    }
+    return s == end;
+}
+
+/**
+ * Parse the integer part of a token, false if it is not an integer or does not fit in [min, max].
+ */
+static bool integer_value(const char* s, const char* end, int64_t min, int64_t max, int64_t& out) {
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+    if (s == end)
+        return false;
+    uint64_t limit = negative ? (uint64_t) -(min + 1) + 1 : (uint64_t) max;
+    uint64_t v = 0;
+    for (; s < end; s++) {
+        if (*s < '0' || *s > '9')
+            return false;
+        uint64_t digit = *s - '0';
+        if (v > (limit - digit) / 10)
+            return false;
+        v = v * 10 + digit;
+    }
+    out = negative ? (int64_t) (0 - v) : (int64_t) v;
+    return true;
+}
+
+/**
+ * Parse a token as a double, exact without going through strtod when the value fits the fast path.
+ */
+static double double_value(const char* s, const char* end, const decimal& d) {
+    if (d.digits <= 15 && d.exponent >= -22 && d.exponent <= 22) {
+        double v = (double) d.mantissa;
+        v = d.exponent < 0 ? v / pow10_double[-d.exponent] : v * pow10_double[d.exponent];
+        return d.negative ? -v : v;
+    }
+    std::string copy(s, end);
+    return std::strtod(copy.c_str(), nullptr);
+}
+
+static float float_value(const char* s, const char* end, const decimal& d) {
+    if (d.digits <= 7 && d.exponent >= -10 && d.exponent <= 10) {
+        float v = (float) d.mantissa;
+        v = d.exponent < 0 ? v / pow10_float[-d.exponent] : v * pow10_float[d.exponent];
+        return d.negative ? -v : v;
+    }
+    std::string copy(s, end);
+    return std::strtof(copy.c_str(), nullptr);
+}
+
+/**
+ * Value of NaN and infinity tokens, which have no digits.
+ */
+static bool special_value(const char* s, const char* end, double& out) {
+    size_t n = end - s;
+    if (n == 3 && std::memcmp(s, "NaN", 3) == 0) {
+        out = std::numeric_limits<double>::quiet_NaN();
+        return true;
+    }
+    bool negative = n > 0 && *s == '-';
+    if (n > 0 && (*s == '-' || *s == '+')) {
+        s++;
+        n--;
+    }
+    if (n == 8 && std::memcmp(s, "Infinity", 8) == 0) {
+        out = negative ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+        return true;
+    }
+    return false;
+}
+
+class snbt_parser {
+public:
+    snbt_parser(const char* data, size_t size) : m_begin(data), m_p(data), m_end(data + size), m_depth(0) {
+    }
+
+    tag* parse_root(std::string name) {
+        tag* t = parse_value(std::move(name));
+        skip_space();
+        if (m_p != m_end) {
+            delete t;
+            fail("trailing data");
+        }
+        return t;
+    }
+private:
+    [[noreturn]] void fail(const std::string& message) {
+        throw nbt_exception("invalid SNBT: " + message + " at position " + std::to_string(m_p - m_begin));
+    }
+
+    void skip_space() {
+        while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' || *m_p == '\n' || *m_p == '\r'))
+            m_p++;
+    }
+
+    void expect(char c) {
+        skip_space();
+        if (m_p == m_end || *m_p != c)
+            fail(std::string("expected '") + c + "'");
+        m_p++;
+    }
+
+    /**
+     * Consume c if it is the next character.
+     */
+    bool accept(char c) {
+        skip_space();
+        if (m_p < m_end && *m_p == c) {
+            m_p++;
+            return true;
+        }
+        return false;
+    }
+
+    void enter() {
+        if (++m_depth > max_depth)
+            fail("nested too deep");
+    }
+
+    static void append_utf8(std::string& out, uint32_t c) {
+        if (c < 0x80) {
+            out += (char) c;
+        } else if (c < 0x800) {
+            out += (char) (0xc0 | (c >> 6));
+            out += (char) (0x80 | (c & 0x3f));
+        } else {
+            out += (char) (0xe0 | (c >> 12));
+            out += (char) (0x80 | ((c >> 6) & 0x3f));
+            out += (char) (0x80 | (c & 0x3f));
+        }
+    }
+
+    std::string parse_quoted() {
+        char quote = *m_p++;
+        std::string out;
+        const char* start = m_p;
+        while (1) {
+            // Copy runs without escapes at once.
+            while (m_p < m_end && *m_p != quote && *m_p != '\\')
+                m_p++;
+            out.append(start, m_p);
+            if (m_p == m_end)
+                fail("unterminated string");
+            if (*m_p == quote) {
+                m_p++;
+                return out;
+            }
+            m_p++;
+            if (m_p == m_end)
+                fail("unterminated string");
+            char c = *m_p++;
+            switch (c) {
+                case '\\':
+                case '"':
+                case '\'':
+                    out += c;
+                    break;
+                case 'n':
+                    out += '\n';
+                    break;
+                case 't':
+                    out += '\t';
+                    break;
+                case 'r':
+                    out += '\r';
+                    break;
+                case 'b':
+                    out += '\b';
+                    break;
+                case 'f':
+                    out += '\f';
+                    break;
+                case 's':
+                    out += ' ';
+                    break;
+                case 'u': {
+                    if (m_end - m_p < 4)
+                        fail("invalid unicode escape");
+                    uint32_t v = 0;
+                    for (int i = 0; i < 4; i++) {
+                        char h = *m_p++;
+                        v <<= 4;
+                        if (h >= '0' && h <= '9')
+                            v |= h - '0';
+                        else if (h >= 'a' && h <= 'f')
+                            v |= h - 'a' + 10;
+                        else if (h >= 'A' && h <= 'F')
+                            v |= h - 'A' + 10;
+                        else
+                            fail("invalid unicode escape");
+                    }
+                    append_utf8(out, v);
+                    break;
+                }
+                default:
+                    m_p--;
+                    fail(std::string("invalid escape '\\") + c + "'");
+            }
+            start = m_p;
+        }
+    }
+
+    /**
+     * Read an unquoted token, returning its end.
+     */
+    const char* token() {
+        skip_space();
+        const char* start = m_p;
+        while (m_p < m_end && unquoted_char(*m_p))
+            m_p++;
+        if (m_p == start)
+            fail(m_p == m_end ? "unexpected end" : std::string("unexpected '") + *m_p + "'");
+        return start;
+    }
+
+    std::string parse_key() {
+        skip_space();
+        if (m_p < m_end && (*m_p == '"' || *m_p == '\''))
+            return parse_quoted();
+        const char* start = token();
+        return std::string(start, m_p);
+    }
+
+    tag* parse_value(std::string name) {
+        skip_space();
+        if (m_p == m_end)
+            fail("expected a value");
+        switch (*m_p) {
+            case '{':
+                return parse_compound(std::move(name));
+            case '[':
+                return parse_list(std::move(name));
+            case '"':
+            case '\'':
+                return new tags::tag_string(std::move(name), parse_quoted());
+            default: {
+                const char* start = token();
+                return scalar(std::move(name), start, m_p);
+            }
+        }
+    }
+
+    /**
+     * Tag of an unquoted token: a number according to its suffix, a boolean or else a string.
+     */
+    static tag* scalar(std::string name, const char* s, const char* end) {
+        size_t n = end - s;
+        char last = end[-1];
+        int64_t i;
+        decimal d;
+
+        switch (last) {
+            case 'b':
+            case 'B':
+                if (integer_value(s, end - 1, INT8_MIN, INT8_MAX, i))
+                    return new tags::tag_byte(std::move(name), (int8_t) i);
+                break;
+            case 's':
+            case 'S':
+                if (integer_value(s, end - 1, INT16_MIN, INT16_MAX, i))
+                    return new tags::tag_short(std::move(name), (int16_t) i);
+                break;
+            case 'l':
+            case 'L':
+                if (integer_value(s, end - 1, INT64_MIN, INT64_MAX, i))
+                    return new tags::tag_long(std::move(name), i);
+                break;
+            case 'f':
+            case 'F': {
+                double special;
+                if (scan_decimal(s, end - 1, d))
+                    return new tags::tag_float(std::move(name), float_value(s, end - 1, d));
+                if (special_value(s, end - 1, special))
+                    return new tags::tag_float(std::move(name), (float) special);
+                break;
+            }
+            case 'd':
+            case 'D': {
+                double special;
+                if (scan_decimal(s, end - 1, d))
+                    return new tags::tag_double(std::move(name), double_value(s, end - 1, d));
+                if (special_value(s, end - 1, special))
+                    return new tags::tag_double(std::move(name), special);
+                break;
+            }
+            default:
+                if (integer_value(s, end, INT32_MIN, INT32_MAX, i))
+                    return new tags::tag_int(std::move(name), (int32_t) i);
+                if (scan_decimal(s, end, d) && (d.has_point || d.has_exponent))
+                    return new tags::tag_double(std::move(name), double_value(s, end, d));
+                if (n == 4 && std::memcmp(s, "true", 4) == 0)
+                    return new tags::tag_byte(std::move(name), 1);
+                if (n == 5 && std::memcmp(s, "false", 5) == 0)
+                    return new tags::tag_byte(std::move(name), 0);
+                break;
+        }
+        return new tags::tag_string(std::move(name), std::string(s, end));
+    }
+
+    tag* parse_compound(std::string name) {
+        enter();
+        m_p++;
+        std::unique_ptr<tags::tag_compound> c(new tags::tag_compound(std::move(name)));
+        if (!accept('}')) {
+            do {
+                std::string key = parse_key();
+                expect(':');
+                c->insert(parse_value(std::move(key)));
+            } while (accept(','));
+            expect('}');
+        }
+        m_depth--;
+        return c.release();
+    }
+
+    /**
+     * Elements of a typed array, the "[X;" prefix already consumed.
+     */
+    template<class Array, class T>
+    tag* parse_array(std::string name, char suffix, int64_t min, int64_t max) {
+        std::unique_ptr<Array> a(new Array(std::move(name)));
+        std::vector<T>& values = a->value();
+        if (!accept(']')) {
+            do {
+                const char* start = token();
+                const char* end = m_p;
+                if (end[-1] == suffix || end[-1] == (suffix & ~0x20))
+                    end--;
+                int64_t v;
+                if (suffix == 0 || !integer_value(start, end, min, max, v)) {
+                    if (!integer_value(start, m_p, min, max, v)) {
+                        m_p = start;
+                        fail("invalid array element");
+                    }
+                }
+                values.push_back((T) v);
+            } while (accept(','));
+            expect(']');
+        }
+        return a.release();
+    }
+
+    tag* parse_list(std::string name) {
+        enter();
+        m_p++;
+
+        // Typed arrays: [B;...], [I;...], [L;...]
+        if (m_end - m_p >= 2 && m_p[1] == ';' && (m_p[0] == 'B' || m_p[0] == 'I' || m_p[0] == 'L')) {
+            char kind = m_p[0];
+            m_p += 2;
+            tag* t;
+            if (kind == 'B')
+                t = parse_array<tags::tag_bytearray, int8_t>(std::move(name), 'b', INT8_MIN, INT8_MAX);
+            else if (kind == 'I')
+                t = parse_array<tags::tag_intarray, int32_t>(std::move(name), 0, INT32_MIN, INT32_MAX);
+            else
+                t = parse_array<tags::tag_longarray, int64_t>(std::move(name), 'l', INT64_MIN, INT64_MAX);
+            m_depth--;
+            return t;
+        }
+
+        if (accept(']')) {
+            m_depth--;
+            return new tags::tag_list(std::move(name), tag_type::TAG_End);
+        }
+
+        std::unique_ptr<tag> first(parse_value(""));
+        std::unique_ptr<tags::tag_list> l(new tags::tag_list(std::move(name), first->type()));
+        l->append(std::move(first));
+        while (accept(',')) {
+            const char* start = m_p;
+            std::unique_ptr<tag> e(parse_value(""));
+            if (e->type() != l->content_type()) {
+                m_p = start;
+                fail("can't put type " + name_for_type(e->type()) + " in list of " + name_for_type(l->content_type()));
+            }
+            l->append(std::move(e));
+        }
+        expect(']');
+        m_depth--;
+        return l.release();
+    }
+
+    const char* m_begin;
+    const char* m_p;
+    const char* m_end;
+    int m_depth;
+};
+
+tag* snbt::parse(const char* data, size_t size, std::string name) {
+    snbt_parser p(data, size);
+    return p.parse_root(std::move(name));
+}
+
+/**
+ * Append a float or double, with the SNBT names of NaN and infinities.
+ */
+template<class T>
+static void append_real(std::string& out, T v) {
+    if (v != v)
+        out += "NaN";
+    else if (std::isinf(v))
+        out += v < 0 ? "-Infinity" : "Infinity";
+    else if (sizeof(T) == sizeof(float))
+        format::append_float(out, (float) v);
+    else
+        format::append_double(out, (double) v);
+}
+
+static bool needs_quotes(const std::string& s) {
+    if (s.empty())
+        return true;
+    for (char c : s) {
+        if (!unquoted_char(c))
+            return true;
+    }
+    return false;
+}
+
+static void append_quoted(std::string& out, const std::string& s) {
+    // Use single quotes when it avoids escaping double quotes.
+    char quote = s.find('"') != std::string::npos && s.find('\'') == std::string::npos ? '\'' : '"';
+    out += quote;
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == quote || s[i] == '\\') {
+            out.append(s, start, i - start);
+            out += '\\';
+            start = i;
+        }
+    }
+    out.append(s, start, std::string::npos);
+    out += quote;
+}
+
+/**
+ * Appends the SNBT form of the visited tag.
+ */
+struct snbt_visitor {
+    std::string& out;
+
+    void operator()(const tags::tag_end&) const {
+    }
+
+    void operator()(const tags::tag_byte& t) const {
+        format::append_integer(out, t.value());
+        out += 'b';
+    }
+
+    void operator()(const tags::tag_short& t) const {
+        format::append_integer(out, t.value());
+        out += 's';
+    }
+
+    void operator()(const tags::tag_int& t) const {
+        format::append_integer(out, t.value());
+    }
+
+    void operator()(const tags::tag_long& t) const {
+        format::append_integer(out, t.value());
+        out += 'L';
+    }
+
+    void operator()(const tags::tag_float& t) const {
+        append_real(out, t.value());
+        out += 'f';
+    }
+
+    void operator()(const tags::tag_double& t) const {
+        append_real(out, t.value());
+        out += 'd';
+    }
+
+    void operator()(const tags::tag_string& t) const {
+        append_quoted(out, t.value());
+    }
+
+    template<class T>
+    void array(const char* prefix, const std::vector<T>& values, const char* suffix) const {
+        out += prefix;
+        for (size_t i = 0; i < values.size(); i++) {
+            if (i > 0)
+                out += ',';
+            format::append_integer(out, values[i]);
+            out += suffix;
+        }
+        out += ']';
+    }
+
+    void operator()(const tags::tag_bytearray& t) const {
+        array("[B;", t.value(), "b");
+    }
+
+    void operator()(const tags::tag_intarray& t) const {
+        array("[I;", t.value(), "");
+    }
+
+    void operator()(const tags::tag_longarray& t) const {
+        array("[L;", t.value(), "L");
+    }
+
+    void operator()(const tags::tag_list& t) const {
+        out += '[';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            if (i > 0)
+                out += ',';
+            visit(*t.value()[i], *this);
+        }
+        out += ']';
+    }
+
+    void operator()(const tags::tag_compound& t) const {
+        out += '{';
+        for (size_t i = 0; i < t.value().size(); i++) {
+            const tag* e = t.value()[i];
+            if (i > 0)
+                out += ',';
+            if (needs_quotes(e->name()))
+                append_quoted(out, e->name());
+            else
+                out += e->name();
+            out += ':';
+            visit(*e, *this);
+        }
+        out += '}';
+    }
+};
+
+void snbt::write(const tag* t, std::string& out) {
+    visit(*t, snbt_visitor { out });
+}
+
+void snbt::write(const tag* t, std::ostream& out) {
+    std::string s;
+    write(t, s);
+    out.write(s.data(), s.size());
+}
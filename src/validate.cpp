@@ -0,0 +1,401 @@
+#include "validate.hpp"
+#include "tag.hpp"
+#include "codec.hpp"
+#include "deflate.hpp"
+#include "region.hpp"
+#include "nbtexception.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+using namespace nbtpp;
+
+/**
+ * Maximum nesting of compounds and lists, as in the game.
+ */
+static const int max_depth = 512;
+
+std::string validation_result::what() const {
+    if (valid)
+        return "valid";
+    std::string s = message + " at byte " + std::to_string(offset);
+    if (!path.empty())
+        s += " in " + path;
+    return s;
+}
+
+/**
+ * Walks encoded NBT with a bare pointer, keeping the names and indices of the tags it is in so the path of an error
+ * can be given without building strings while the data is valid.
+ */
+class validator {
+public:
+    validator(const uint8_t* data, size_t size) : m_begin(data), m_p(data), m_end(data + size), m_depth(0),
+        m_error_at(nullptr), m_error_depth(0), m_message(nullptr) {
+    }
+
+    validation_result run() {
+        if (root() && m_p != m_end)
+            fail(m_p, "data after the root tag");
+
+        validation_result r;
+        if (m_message != nullptr) {
+            r.valid = false;
+            r.offset = m_error_at - m_begin;
+            r.message = m_message;
+            r.path = path();
+        }
+        return r;
+    }
+private:
+    /**
+     * Name of a compound entry or index of a list element.
+     */
+    struct frame {
+        const uint8_t* name;
+        uint16_t length;
+        int32_t index;
+    };
+
+    bool root() {
+        if (!need(1, "empty data"))
+            return false;
+        tag_type type = (tag_type) *m_p;
+        if (type == tag_type::TAG_End || (uint8_t) type > (uint8_t) tag_type::TAG_Long_Array)
+            return fail(m_p, "invalid root tag type");
+        m_p++;
+        const uint8_t* name;
+        uint16_t length;
+        if (!string(name, length, "invalid modified UTF-8 in root name"))
+            return false;
+        return payload(type);
+    }
+
+    bool payload(tag_type type) {
+        switch (type) {
+            case tag_type::TAG_Byte:
+                return skip(1);
+            case tag_type::TAG_Short:
+                return skip(2);
+            case tag_type::TAG_Int:
+            case tag_type::TAG_Float:
+                return skip(4);
+            case tag_type::TAG_Long:
+            case tag_type::TAG_Double:
+                return skip(8);
+            case tag_type::TAG_Byte_Array:
+                return array(1);
+            case tag_type::TAG_Int_Array:
+                return array(4);
+            case tag_type::TAG_Long_Array:
+                return array(8);
+            case tag_type::TAG_String: {
+                const uint8_t* s;
+                uint16_t length;
+                return string(s, length, "invalid modified UTF-8 in string");
+            }
+            case tag_type::TAG_List:
+                return list();
+            case tag_type::TAG_Compound:
+                return compound();
+            default:
+                return fail(m_p, "invalid tag type");
+        }
+    }
+
+    bool array(size_t element_size) {
+        const uint8_t* at = m_p;
+        if (!need(4, "truncated array length"))
+            return false;
+        int32_t length = codec::load_be<int32_t>(m_p);
+        if (length < 0)
+            return fail(at, "negative array length");
+        m_p += 4;
+        return skip((size_t) length * element_size);
+    }
+
+    bool list() {
+        const uint8_t* at = m_p;
+        if (!need(5, "truncated list header"))
+            return false;
+        tag_type type = (tag_type) m_p[0];
+        int32_t length = codec::load_be<int32_t>(m_p + 1);
+        if ((uint8_t) type > (uint8_t) tag_type::TAG_Long_Array)
+            return fail(at, "invalid list element type");
+        if (length < 0)
+            return fail(at + 1, "negative list length");
+        if (length > 0 && type == tag_type::TAG_End)
+            return fail(at, "list of TAG_End with elements");
+        m_p += 5;
+
+        size_t element_size = codec::fixed_payload_size(type);
+        if (element_size != 0)
+            return skip((size_t) length * element_size);
+
+        if (!enter(at))
+            return false;
+        frame& f = m_path[m_depth - 1];
+        f.name = nullptr;
+        f.length = 0;
+        for (int32_t i = 0; i < length; i++) {
+            f.index = i;
+            if (!payload(type))
+                return false;
+        }
+        m_depth--;
+        return true;
+    }
+
+    bool compound() {
+        if (!enter(m_p))
+            return false;
+        frame& f = m_path[m_depth - 1];
+        f.index = -1;
+        while (1) {
+            f.name = nullptr;
+            f.length = 0;
+            if (!need(1, "truncated compound"))
+                return false;
+            const uint8_t* at = m_p;
+            tag_type type = (tag_type) *m_p++;
+            if (type == tag_type::TAG_End)
+                break;
+            if ((uint8_t) type > (uint8_t) tag_type::TAG_Long_Array)
+                return fail(at, "invalid tag type");
+            if (!string(f.name, f.length, "invalid modified UTF-8 in name"))
+                return false;
+            if (!payload(type))
+                return false;
+        }
+        m_depth--;
+        return true;
+    }
+
+    /**
+     * Check a length-prefixed string as Java's DataInput.readUTF() would read it.
+     */
+    bool string(const uint8_t*& s, uint16_t& length, const char* message) {
+        if (!need(2, "truncated string length"))
+            return false;
+        length = codec::load_be<uint16_t>(m_p);
+        m_p += 2;
+        if (!need(length, "truncated string"))
+            return false;
+        s = m_p;
+        const uint8_t* p = m_p;
+        const uint8_t* end = m_p + length;
+        m_p = end;
+
+        while (p < end) {
+            // Eight ASCII bytes at once.
+            while (end - p >= 8) {
+                uint64_t w;
+                std::memcpy(&w, p, sizeof(w));
+                if (w & 0x8080808080808080ULL)
+                    break;
+                p += 8;
+            }
+            if (p == end)
+                break;
+
+            uint8_t c = *p;
+            if (c < 0x80) {
+                p++;
+            } else if ((c & 0xe0) == 0xc0) {
+                if (end - p < 2 || (p[1] & 0xc0) != 0x80)
+                    return fail(p, message);
+                p += 2;
+            } else if ((c & 0xf0) == 0xe0) {
+                if (end - p < 3 || (p[1] & 0xc0) != 0x80 || (p[2] & 0xc0) != 0x80)
+                    return fail(p, message);
+                p += 3;
+            } else {
+                return fail(p, message);
+            }
+        }
+        return true;
+    }
+
+    bool enter(const uint8_t* at) {
+        if (m_depth >= max_depth)
+            return fail(at, "nesting deeper than 512");
+        m_depth++;
+        return true;
+    }
+
+    inline bool need(size_t n, const char* message) {
+        if ((size_t) (m_end - m_p) < n)
+            return fail(m_end, message);
+        return true;
+    }
+
+    inline bool skip(size_t n) {
+        if (!need(n, "truncated data"))
+            return false;
+        m_p += n;
+        return true;
+    }
+
+    bool fail(const uint8_t* at, const char* message) {
+        m_error_at = at;
+        m_message = message;
+        m_error_depth = m_depth;
+        return false;
+    }
+
+    std::string path() const {
+        std::string s;
+        for (int i = 0; i < m_error_depth; i++) {
+            const frame& f = m_path[i];
+            if (f.index >= 0) {
+                s += "[" + std::to_string(f.index) + "]";
+                continue;
+            }
+            // The name of a compound frame is only set once an entry has been read.
+            if (f.name == nullptr)
+                break;
+            std::string name(reinterpret_cast<const char*>(f.name), f.length);
+            bool plain = !name.empty() && name.find_first_of(".[]\" ") == std::string::npos;
+            if (!s.empty())
+                s += '.';
+            s += plain ? name : "\"" + name + "\"";
+        }
+        return s;
+    }
+
+    const uint8_t* m_begin;
+    const uint8_t* m_p;
+    const uint8_t* m_end;
+    int m_depth;
+    frame m_path[max_depth];
+
+    const uint8_t* m_error_at;
+    int m_error_depth;
+    const char* m_message;
+};
+
+validation_result nbtpp::validate(const uint8_t* data, size_t size) {
+    validator v(data, size);
+    return v.run();
+}
+
+static void problem(region_validation& out, int32_t x, int32_t z, size_t offset, std::string message) {
+    region_problem p;
+    p.x = x;
+    p.z = z;
+    p.error.valid = false;
+    p.error.offset = offset;
+    p.error.message = std::move(message);
+    out.problems.push_back(std::move(p));
+}
+
+region_validation nbtpp::validate_region(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw nbt_exception("can't open region file " + path);
+    std::vector<uint8_t> file;
+    in.seekg(0, std::ios::end);
+    file.resize((size_t) in.tellg());
+    in.seekg(0);
+    if (!file.empty() && !in.read(reinterpret_cast<char*>(file.data()), file.size()))
+        throw nbt_exception("can't read region file " + path);
+
+    region_validation out;
+    const size_t sector_size = region_file::sector_size;
+    if (file.empty())
+        return out;
+    if (file.size() < 2 * sector_size) {
+        problem(out, -1, -1, file.size(), "truncated region header");
+        return out;
+    }
+
+    // Chunk index owning each sector, to find chunks sharing sectors.
+    size_t file_sectors = (file.size() + sector_size - 1) / sector_size;
+    std::vector<int16_t> owner(file_sectors, -1);
+    std::vector<uint8_t> buffer;
+    std::vector<uint8_t> external_data;
+
+    for (int16_t i = 0; i < 1024; i++) {
+        uint32_t location = codec::load_be<uint32_t>(file.data() + i * 4);
+        if (location == 0)
+            continue;
+        out.chunks++;
+        int32_t x = i % 32;
+        int32_t z = i / 32;
+        size_t sector = location >> 8;
+        size_t sectors = location & 0xff;
+
+        if (sector < 2) {
+            problem(out, x, z, i * 4, "chunk location inside the header");
+            continue;
+        }
+        if (sectors == 0) {
+            problem(out, x, z, i * 4, "chunk location without sectors");
+            continue;
+        }
+        if (sector + sectors > file_sectors) {
+            problem(out, x, z, i * 4, "chunk sectors past the end of the file");
+            continue;
+        }
+        bool shared = false;
+        for (size_t s = sector; s < sector + sectors; s++) {
+            if (owner[s] >= 0 && !shared) {
+                problem(out, x, z, i * 4, "chunk sectors shared with chunk " + std::to_string(owner[s] % 32) + "," +
+                    std::to_string(owner[s] / 32));
+                shared = true;
+            }
+            owner[s] = i;
+        }
+        if (shared)
+            continue;
+
+        size_t offset = sector * sector_size;
+        size_t available = std::min(sectors * sector_size, file.size() - offset);
+        if (available < 5) {
+            problem(out, x, z, offset, "truncated chunk header");
+            continue;
+        }
+        uint32_t length = codec::load_be<uint32_t>(file.data() + offset);
+        if (length == 0 || (size_t) length + 4 > available) {
+            problem(out, x, z, offset, "invalid chunk length " + std::to_string(length));
+            continue;
+        }
+        bool external = (file[offset + 4] & region_file::external_flag) != 0;
+        uint8_t compression = file[offset + 4] & ~region_file::external_flag;
+        if (compression < nbt::gzip || compression > nbt::uncompressed) {
+            problem(out, x, z, offset + 4, "unsupported compression " + std::to_string(file[offset + 4]));
+            continue;
+        }
+
+        const uint8_t* data = file.data() + offset + 5;
+        size_t size = length - 1;
+        if (external) {
+            // The data of the chunk is its whole .mcc file, problems of the file are reported at the flag.
+            try {
+                region_file::read_external(path, x, z, external_data);
+            } catch (nbt_exception& e) {
+                problem(out, x, z, offset + 4, e.what());
+                continue;
+            }
+            data = external_data.data();
+            size = external_data.size();
+        }
+        if (compression != nbt::uncompressed) {
+            try {
+                decompress(data, size, (nbt::compression) compression, buffer);
+            } catch (nbt_exception& e) {
+                problem(out, x, z, external ? offset + 4 : offset + 5,
+                    external ? std::string(e.what()) + " in external chunk" : std::string(e.what()));
+                continue;
+            }
+            data = buffer.data();
+            size = buffer.size();
+        }
+
+        validation_result r = validate(data, size);
+        if (!r.valid)
+            out.problems.push_back(region_problem { x, z, std::move(r) });
+    }
+    return out;
+}